@@ -0,0 +1,20 @@
+#!/bin/sh
+# compiles and runs each corpus file, comparing what it prints
+# against the "# output:" line at its top, lines joined by spaces
+furn=${FURN:-furn}
+dir=$(cd "$(dirname "$0")" && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+status=0
+for file in "$dir"/*.fn; do
+    name=$(basename "$file" .fn)
+    expected=$(head -n 1 "$file" | tr -d '\r' | sed 's/^# output: //')
+    actual=$(cd "$work" && "$furn" "$file" -q >/dev/null 2>&1 && "./$name" | paste -sd' ' -)
+    if [ "$expected" = "$actual" ]; then
+        echo "ok   $file"
+    else
+        echo "FAIL $file: expected $expected, got $actual"
+        status=1
+    fi
+done
+exit $status
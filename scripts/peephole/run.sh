@@ -0,0 +1,21 @@
+#!/bin/sh
+# compiles each corpus file at -O1 and compares the peephole
+# instruction counts against the "# peephole:" line at its top
+furn=${FURN:-furn}
+dir=$(cd "$(dirname "$0")" && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+status=0
+for file in "$dir"/*.fn; do
+    expected=$(head -n 1 "$file" | tr -d '\r' | sed 's/^# peephole: //')
+    actual=$(cd "$work" && "$furn" "$file" -q -S -O1 -print-after=peephole 2>&1 >/dev/null |
+        sed -n 's/^; after peephole, \(.*\) instructions.*/\1/p' | tr -d '\r' |
+        paste -sd, - | sed 's/,/, /g')
+    if [ "$expected" = "$actual" ]; then
+        echo "ok   $file"
+    else
+        echo "FAIL $file: expected $expected, got $actual"
+        status=1
+    fi
+done
+exit $status
@@ -0,0 +1,208 @@
+#pragma once
+
+#include "Common.hpp"
+
+// one line of a generated function, instructions are split into their parts
+struct AsmLine
+{
+    std::string Label;                 // `name:` lines
+    std::string Mnemonic;              // empty for labels, comments and raw lines
+    std::vector<std::string> Operands; // as written, memory operands keep their brackets
+    std::string Comment;               // without the ;
+    std::string Raw;                   // the line as generated, printed again unless Modified
+    bool Modified = false;
+    bool Barrier = false; // directives and inline assembly, nothing moves across them
+
+    bool IsInstruction() const
+    {
+        return !Mnemonic.empty();
+    }
+};
+
+/*
+ * the instructions of generated functions as a list of lines instead of
+ * text so passes over the assembly can look at and rewrite them
+ */
+class AsmBuffer
+{
+public:
+    std::vector<AsmLine> Lines;
+
+    // splits one line of text, without its newline, into the next AsmLine
+    void Append(const std::string &Line)
+    {
+        AsmLine Parsed{.Raw = Line};
+
+        if (Line.rfind("; inline assembly begin", 0) == 0)
+            InlineAssembly = true;
+        else if (Line.rfind("; inline assembly end", 0) == 0)
+            InlineAssembly = false;
+
+        std::string Code = Line;
+        const size_t CommentStart = Line.find(';');
+        if (CommentStart != std::string::npos)
+        {
+            Parsed.Comment = Line.substr(CommentStart + 1);
+            Code = Line.substr(0, CommentStart);
+        }
+        Code = Trim(Code);
+
+        if (InlineAssembly)
+        {
+            Parsed.Barrier = !Code.empty();
+        }
+        else if (!Code.empty() && !std::isspace((unsigned char)Line.front()))
+        {
+            // labels and directives start at the first column
+            if (Code.back() == ':' && Code.find(' ') == std::string::npos)
+                Parsed.Label = Code.substr(0, Code.size() - 1);
+            else
+                Parsed.Barrier = true;
+        }
+        else if (!Code.empty())
+        {
+            const size_t Space = Code.find_first_of(" \t");
+            Parsed.Mnemonic = Code.substr(0, Space);
+            if (Space != std::string::npos)
+                Parsed.Operands = SplitOperands(Code.substr(Space + 1));
+        }
+
+        Lines.push_back(Parsed);
+    }
+
+    void Append(const AsmBuffer &Other)
+    {
+        Lines.insert(Lines.end(), Other.Lines.begin(), Other.Lines.end());
+    }
+
+    // true if a line as generated names Symbol, like a call to a function
+    bool Mentions(const std::string &Symbol) const
+    {
+        return std::any_of(Lines.begin(), Lines.end(), [&](const AsmLine &Line)
+                           { return Line.Raw.find(Symbol) != std::string::npos; });
+    }
+
+    std::string ToString() const
+    {
+        std::stringstream Out;
+        for (const AsmLine &Line : Lines)
+        {
+            if (!Line.Modified)
+            {
+                Out << Line.Raw << "\n";
+                continue;
+            }
+
+            Out << "    " << Line.Mnemonic;
+            for (size_t i = 0; i < Line.Operands.size(); i++)
+                Out << (i ? ", " : " ") << Line.Operands.at(i);
+            if (!Line.Comment.empty())
+                Out << " ;" << Line.Comment;
+            Out << "\n";
+        }
+        return Out.str();
+    }
+
+    size_t InstructionCount() const
+    {
+        return std::count_if(Lines.begin(), Lines.end(), [](const AsmLine &Line)
+                             { return Line.IsInstruction() || Line.Barrier; });
+    }
+
+private:
+    bool InlineAssembly = false; // between the markers the generators put around it
+
+    static std::string Trim(const std::string &Text)
+    {
+        const size_t Begin = Text.find_first_not_of(" \t\r");
+        if (Begin == std::string::npos)
+            return "";
+        return Text.substr(Begin, Text.find_last_not_of(" \t\r") - Begin + 1);
+    }
+
+    static std::vector<std::string> SplitOperands(const std::string &Text)
+    {
+        std::vector<std::string> Operands;
+        std::string Current;
+        int Depth = 0;
+        for (char c : Text)
+        {
+            if (c == '[')
+                Depth++;
+            else if (c == ']')
+                Depth--;
+
+            if (c == ',' && !Depth)
+            {
+                Operands.push_back(Trim(Current));
+                Current.clear();
+                continue;
+            }
+            Current += c;
+        }
+        if (!Trim(Current).empty())
+            Operands.push_back(Trim(Current));
+        return Operands;
+    }
+};
+
+/*
+ * what the code generators write their assembly into with <<, every line
+ * goes into the buffer as an AsmLine once its newline is written so the
+ * passes over a function get it already split instead of as text
+ */
+class AsmStream : private std::streambuf, public std::ostream
+{
+public:
+    AsmStream() : std::ostream(static_cast<std::streambuf *>(this)) {}
+
+    // everything written since the last Take(), the stream starts over empty
+    AsmBuffer Take()
+    {
+        if (!Partial.empty())
+            EndLine();
+        AsmBuffer Taken = std::move(Buffer);
+        Buffer = AsmBuffer();
+        return Taken;
+    }
+
+    void Append(const AsmBuffer &Lines)
+    {
+        if (!Partial.empty())
+            EndLine();
+        Buffer.Append(Lines);
+    }
+
+private:
+    AsmBuffer Buffer;
+    std::string Partial; // the line being written
+
+    void EndLine()
+    {
+        Buffer.Append(Partial);
+        Partial.clear();
+    }
+
+    std::streambuf::int_type overflow(std::streambuf::int_type Character) override
+    {
+        if (std::streambuf::traits_type::eq_int_type(Character, std::streambuf::traits_type::eof()))
+            return std::streambuf::traits_type::not_eof(Character);
+        if (std::streambuf::traits_type::to_char_type(Character) == '\n')
+            EndLine();
+        else
+            Partial += std::streambuf::traits_type::to_char_type(Character);
+        return Character;
+    }
+
+    std::streamsize xsputn(const char *Text, std::streamsize Count) override
+    {
+        for (std::streamsize i = 0; i < Count; i++)
+        {
+            if (Text[i] == '\n')
+                EndLine();
+            else
+                Partial += Text[i];
+        }
+        return Count;
+    }
+};
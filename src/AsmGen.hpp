@@ -2,81 +2,88 @@
 #include "Common.hpp"
 #include "Ast.hpp"
 #include "CompileFlags.hpp"
-
-#define INC_REF_COUNT(Type)                     \
-    if (Type.PointerDepth && CmplFlags::GarbageCollect)       \
-    {                                           \
-        Output << "    inc QWORD [rax - 16]\n"; \
-    }
-#define DEC_REF_COUNT(Type)                     \
-    if (Type.PointerDepth && CmplFlags::GarbageCollect)       \
-    {                                           \
-        Output << "    dec QWORD [rax - 16]\n"; \
-    }
-
-uint64_t CurrentScope = 0;
-
-class AsmGenerator
+#include "SymbolResolver.hpp"
+#include "RegisterAllocator.hpp"
+#include "IRLowering.hpp"
+#include "ISel.hpp"
+#include "PassManager.hpp"
+#include "AsmBuffer.hpp"
+#include "Peephole.hpp"
+#include "Runtime.hpp"
+#include "Scalars.hpp"
+#include "CountedLoops.hpp"
+
+#define INC_REF_COUNT(Type) AdjustRefCount(Type, "inc")
+#define DEC_REF_COUNT(Type) AdjustRefCount(Type, "dec")
+
+class AsmGenerator : public SymbolResolver
 {
 public:
-    std::vector<CompileError> Errors;
     std::vector<std::string> AvailableIdentifiers;
+    std::string IRListing; // every function that was lowered, for -emit-ir
+    std::string PassDumps; // -print-after listings
+    std::map<std::string, size_t> Statistics; // what the optimizations did, summed over every function
 
 private:
-    inline void Throw(CompileError e)
-    {
-        e.Location = CurrentEval->Location;
-        if (auto ExprStmt = std::dynamic_pointer_cast<ExpressionStatement>(CurrentEval))
-            e.Location = ExprStmt->Expr->Location;
-        Errors.push_back(e);
-    }
-
-    std::vector<StatementPtr> Ast;
-    std::stringstream Output;
-    std::unordered_map<MapId, std::string> PendingFunctionDefinitions;
+    AsmStream Output;
+    std::vector<AsmBuffer> PendingFunctionDefinitions; // in the order they were generated
+    std::vector<std::pair<size_t, std::shared_ptr<IRFunction>>> LoweredFunctions; // index into PendingFunctionDefinitions
+    std::vector<std::pair<std::shared_ptr<VarDeclaration>, std::shared_ptr<FunctionDefinition>>> FunctionWorklist; // called but not generated yet
+    std::vector<std::pair<std::shared_ptr<VarDeclaration>, std::shared_ptr<FunctionDefinition>>> ParsedFunctions;  // deferred with their body already parsed
+    bool Discarding = false; // checking bodies nothing reached, their code is thrown away
 
-    StatementPtr CurrentEval = nullptr;
+    static constexpr int64_t SlotSize = 8; // locals, parameters and pushed values each take a whole register
+    static constexpr uint64_t LargestFrameObject = 128; // bytes of a `new` object that can live in the frame
 
-    struct MemberInfo
-    {
-        TypeDescriptor Type;
-        uint64_t Offset; // byte offset in the instance
-    };
+    int64_t StackSize = 0;
+    int64_t FrameSize = 0;         // StackSize right after the prologue
+    RegisterAllocation Allocation; // of the function being generated
 
-    struct Variable
-    {
-        int64_t StackLoc = 0;
-        TypeDescriptor TypeDesc;
-        std::shared_ptr<std::vector<std::shared_ptr<FunctionDefinition>>> Funcs = nullptr;
-        std::shared_ptr<std::unordered_map<std::string, MapId>> Namespace = nullptr;
-        std::shared_ptr<std::unordered_map<std::string, MemberInfo>> Class = nullptr;
-        MapId Address = 0;
-        uint64_t ScopeI = CurrentScope;
-        std::string Name;
-    };
-
-    struct CmplSymbol
-    {
-        TypeDescriptor TypeDesc;
-        std::shared_ptr<Variable> Var = nullptr;
-        std::shared_ptr<std::vector<std::shared_ptr<FunctionDefinition>>> Funcs = nullptr;
-        std::shared_ptr<std::unordered_map<std::string, MapId>> Namespace = nullptr;
-        std::shared_ptr<std::unordered_map<std::string, MemberInfo>> Class = nullptr;
-    };
+    std::vector<CountedLoop> CountedLoops;             // enclosing loops whose counter indexes its array without a check
+    std::map<std::string, size_t> FunctionStatistics; // of the function being generated, kept if it is not lowered
+    const FunctionDefinition *CurrentFunction = nullptr; // being generated, null in main
 
-    int64_t StackSize = 0;
-    std::vector<Variable> Variables;
-    
     size_t LabelCount = 0;
+    size_t DataCount = 0;
     std::vector<std::string> DataList;
+    std::vector<std::string> ReadOnlyDataList;
+    std::unordered_map<std::string, std::string> StringLiterals; // text to the label of its one copy
+
+    std::shared_ptr<ExpressionStatement> EvalExpr = std::make_shared<ExpressionStatement>(nullptr); // CurrentEval of expressions
+    std::string OutOfBoundsErrorMessageData1;
+    std::string OutOfBoundsErrorMessageData2;
+    std::vector<std::string> ColdList; // only runs when the program fails, placed after all other code
+    std::set<std::string> ExternalFunctions; // the C functions something calls
+
+    // furn --repl, every entry is linked into one session after the entries before it
+    bool Resident = false;
+    size_t GlobalCount = 0;
+    std::vector<std::string> GlobalList; // .bss slots of the top level variables the entry declares
+
+    // what a failed entry has to leave as it found it
+    struct SessionState
+    {
+        std::vector<Variable> Variables;
+        std::vector<std::vector<std::shared_ptr<FunctionDefinition>>> Overloads; // of each function in Variables
+        std::unordered_map<MapId, std::shared_ptr<VarDeclaration>> DeferredFunctions;
+        std::unordered_map<std::string, std::string> StringLiterals;
+    } EntryStart;
+
+    static constexpr const char *OutOfBoundsStub = "_furn_out_of_bounds";
+    static constexpr const char *EntrySaved[] = {"rbx", "rbp", "r12", "r13", "r14", "r15"}; // the caller of an entry is C
 
 public:
-    explicit AsmGenerator(std::vector<StatementPtr> ast)
-        : Ast(std::move(ast))
+    AsmGenerator(std::vector<StatementPtr> ast, const CompileFlags &flags)
+        : SymbolResolver(std::move(ast), flags)
     {
     }
 
 private:
+    void DeclareNamespaceMember(const StatementPtr &Stmt) override
+    {
+        GenerateStatement(Stmt);
+    }
+
     void OpenScope()
     {
         Output << "    ; scope begin\n";
@@ -97,8 +104,8 @@ private:
 
             if (Var.Funcs)
                 continue;
-            if (Var.Class)
-                continue;
+            if (Var.Class && Var.StackLoc == -1)
+                continue; // the class, a local of its type still goes
             if (Var.Namespace)
                 continue;
 
@@ -107,34 +114,76 @@ private:
             if (Var.ScopeI < ScopeLoc)
                 continue;
 
+            if (Var.Object)
+            {
+                if (Var.ObjectSize)
+                {
+                    Output << "    add rsp, " << Var.ObjectSize << " ; object in the frame\n";
+                    Pop(Var.ObjectSize);
+                }
+                DiscardVariable(i);
+                continue;
+            }
+
             const CmplSymbol &LocalSymbol = ResolveSymbol(std::make_shared<VariableExpression>("*Local", Address));
 
+            if (!Var.Register.empty())
+            {
+                if (LocalSymbol.TypeDesc.PointerDepth && CmplFlags.GarbageCollect)
+                {
+                    Output << "    mov rax, " << Var.Register << "\n";
+                    DestroyObject(LocalSymbol);
+                }
+                DiscardVariable(i);
+                continue;
+            }
+
             GenerateExpression(std::make_shared<VariableExpression>("*Local", Address));
 
             DestroyObject(LocalSymbol);
 
-            Variables.erase(Variables.begin() + i);
+            DiscardVariable(i);
             // stays aligned since we are iterating backwards
 
-            Pop("r9", SizeOfType(LocalSymbol.TypeDesc));
+            Pop("r9", SlotSize);
         }
         
         Output << "    ; scope closed and locals destroyed\n";
     }
 
+    // the object in rax, string literals are immortal and never counted
+    void AdjustRefCount(const TypeDescriptor &Type, const std::string &Mnemonic)
+    {
+        if (!Type.PointerDepth || !CmplFlags.GarbageCollect)
+            return;
+
+        const std::string Immortal = CreateLabel();
+        Output << "    cmp QWORD [rax - 16], " << HeapRuntime::ImmortalRefCount << " ; immortal literal\n";
+        Output << "    je " << Immortal << "\n";
+        Output << "    " << Mnemonic << " QWORD [rax - 16]\n";
+        Output << Immortal << ":\n";
+    }
+
+    // literals are read only, one in rax bound where the program may write through it gets a copy of its own
+    void CopyLiteral(const ExpressionPtr &Expr, const TypeDescriptor &Type)
+    {
+        auto Literal = std::dynamic_pointer_cast<ValueExpression>(Expr);
+        if (!Literal || Literal->Val.type() != typeid(std::string) || Type.Constant)
+            return;
+
+        Output << "    mov rdi, rax\n";
+        Output << "    call " << HeapRuntime::Copy << " ; written through, not the read only literal\n";
+    }
+
     void GarbageCollectObject(const CmplSymbol &Symbol)
     {
-        if (!CmplFlags::GarbageCollect)
+        if (!CmplFlags.GarbageCollect)
             return;
             
         if (Symbol.TypeDesc.PointerDepth)
         {
             TypeDescriptor Subtype = Symbol.TypeDesc;
             Subtype.PointerDepth--;
-            // mov rdi, rax ; addr
-            // mov rsi, rcx ; length
-            // mov rax, 11 ; munmap syscall number
-            // syscall
             std::string SkipLabel = CreateLabel();
             Output << "    mov rbx, rax\n";
             Output << "    mov rax, [rbx - 16] ; refcount\n";
@@ -146,8 +195,7 @@ private:
             Output << "    mov rsi, [rax + 8] ; length\n";
             Output << "    imul rsi, " << SizeOfType(Subtype) << "\n";
             Output << "    add rsi, 16\n";
-            Output << "    mov rax, 11 ; munmap syscall number\n";
-            Output << "    syscall\n";
+            Output << "    call " << HeapRuntime::Free << "\n";
             Output << SkipLabel << ":\n";
         }
     }
@@ -158,456 +206,322 @@ private:
         GarbageCollectObject(Symbol);
     }
 
-    bool CompileTypeMatch(const TypeDescriptor &ObjectType, const TypeDescriptor &ExpectedType, const unsigned short Looseness = 1000)
+    // the members of a `new` object that never escapes are zeroed in the registers
+    // the allocator gave them, the rest in the object's memory in the frame
+    void DeclareFrameObject(const VarDeclaration &Decl, const std::shared_ptr<std::unordered_map<std::string, MemberInfo>> &Members)
     {
-#define _CompileTypeMatch_NumbersCheck                                                                                         \
-    if (ExpectedType.Type == ValueType::Long)                                                                                  \
-    {                                                                                                                          \
-        return ObjectType.Type == ValueType::Short || ObjectType.Type == ValueType::Int || ObjectType.Type == ValueType::Long; \
-    }                                                                                                                          \
-    else if (ExpectedType.Type == ValueType::Int)                                                                              \
-    {                                                                                                                          \
-        return ObjectType.Type == ValueType::Short || ObjectType.Type == ValueType::Int;                                       \
-    }                                                                                                                          \
-    else if (ExpectedType.Type == ValueType::Short)                                                                            \
-    {                                                                                                                          \
-        return ObjectType.Type == ValueType::Short || ObjectType.Type == ValueType::Int;                                       \
-    }
-
-        if (ObjectType.PointerDepth != ExpectedType.PointerDepth)
-            return false;
-
-        if (ObjectType.PointerDepth)
+        int64_t Size = 0;
+        for (auto It = Allocation.Members.lower_bound({Decl.Address, ""}); It != Allocation.Members.end() && It->first.first == Decl.Address; It++)
         {
-            if (ObjectType.Constant && !ExpectedType.Constant)
-                return false;
-        }
-
-        if (ObjectType.Type == ValueType::Custom || ExpectedType.Type == ValueType::Custom)
-        {
-            if (ObjectType.Type != ExpectedType.Type)
-                return false;
-
-            if (ObjectType.Constant && !ExpectedType.Constant)
-                return false;
-
-            return (*ResolveSymbol(ObjectType.CustomTypeName).Class).at("*ClassId").Offset == (*ResolveSymbol(ExpectedType.CustomTypeName).Class).at("*ClassId").Offset;
-        }
-
-        if (Looseness <= 0)
-        {
-            if (ObjectType.Type != ExpectedType.Type)
-                return false;
-
-            if (ObjectType.Nullable != ExpectedType.Nullable)
-                return false;
-
-            if (ObjectType.Constant != ExpectedType.Constant)
-                return false;
-
-            return true;
-        }
-        else if (Looseness <= 1)
-        {
-            if (ObjectType.Type != ExpectedType.Type)
-                return false;
-
-            if (ObjectType.Nullable && !ExpectedType.Nullable)
-                return false;
-
-            return true;
+            if (It->second.empty())
+            {
+                Size = (int64_t(Members->at("*ClassSize").Offset) + SlotSize - 1) / SlotSize * SlotSize;
+                continue;
+            }
+            Output << "    mov " << It->second << ", 0 ; member " << It->first.second << " kept in register\n";
+            FunctionStatistics["members kept in registers"]++;
         }
-        else if (Looseness <= 2)
-        {
-            if (ObjectType.Type != ExpectedType.Type)
-                return false;
 
-            if (ObjectType.Nullable && !ExpectedType.Nullable)
-                return false;
-
-            _CompileTypeMatch_NumbersCheck;
-
-            return true;
-        }
-        else if (Looseness <= 3)
+        if (Size)
         {
-            if (ObjectType.Type != ExpectedType.Type)
-                return false;
-
-            if (ObjectType.Nullable && !ExpectedType.Nullable)
-                return false;
-
-            if (ExpectedType.Type == ValueType::Dynamic)
-                return true;
-
-            _CompileTypeMatch_NumbersCheck;
-
-            return true;
+            Output << "    sub rsp, " << Size << " ; object in the frame\n";
+            for (int64_t Offset = 0; Offset < Size; Offset += SlotSize)
+                Output << "    mov QWORD [rsp + " << Offset << "], 0\n";
         }
-        else
-        {
-            if (ObjectType.Type == ValueType::Null && ExpectedType.Nullable)
-                return true;
-
-            if (ObjectType.Nullable && !ExpectedType.Nullable)
-                return false;
 
-            if (ExpectedType.Type == ValueType::Dynamic)
-                return true;
-
-            _CompileTypeMatch_NumbersCheck;
+        DeclareVariable(Variable{.StackLoc = StackSize, .TypeDesc = Decl.Type, .Class = Members, .Address = Decl.Address, .Name = Decl.Name, .Object = true, .ObjectSize = Size});
+        Push(Size);
+        FunctionStatistics["objects placed on the stack"]++;
+    }
 
-            return ObjectType.Type == ExpectedType.Type;
-        }
+    // empty when the member is in the object's memory
+    const std::string &MemberRegister(const Variable &Object, const std::string &Member)
+    {
+        static const std::string InFrame;
+        auto It = Allocation.Members.find({Object.Address, Member});
+        return It == Allocation.Members.end() ? InFrame : It->second;
     }
 
-    int64_t SizeOfType(const TypeDescriptor &Type)
+    std::string FrameMember(const Variable &Object, const MemberInfo &Member)
     {
-        if (Type.PointerDepth)
-        {
-            return 8;
-        }
+        return "[rsp + " + std::to_string(StackSize - Object.StackLoc - Object.ObjectSize + int64_t(Member.Offset)) + "]";
+    }
 
-        if (Type.Type == ValueType::Custom && Type.CustomTypeName)
+    // cold code that jumps to the shared failure with the index in r9 and the length in r10, the label to jump to when Index is not below the length of Array
+    std::string OutOfBoundsPath(const std::string &Index, const std::string &Array)
+    {
+        if (OutOfBoundsErrorMessageData1.empty())
         {
-            // return the size of the REFERENCE address
-            return 8;
-            // NOT the following
-            // const CmplSymbol &TypeSymbol = ResolveSymbol(Type.CustomTypeName);
-            // if (TypeSymbol.Class)
-            // {
-            //     return TypeSymbol.Class->at("*ClassSize").Offset;
-            // }
+            OutOfBoundsErrorMessageData1 = CreateData("db 0x1B, \"[1;101mERROR: index [\"");
+            OutOfBoundsErrorMessageData2 = CreateData("db \"] is out of bounds size\", 0x1B, \"[0m\", 10");
+            ColdList.push_back(OutOfBoundsFailure());
         }
 
-        // right now we only use rax
-        // which is 64 bit, to avoid
-        // overcomplicating the compiler
-        // so we will just return 8
-        return 8;
-
-        // switch (Type.Type)
-        // {
-        // case ValueType::Bool:
-        //     return 1;
-
-        // case ValueType::Character:
-        //     return 1;
-
-        // case ValueType::Int:
-        //     return 4;
-
-        // case ValueType::Short:
-        //     return 2;
-
-        // case ValueType::Long:
-        //     return 8;
-
-        // case ValueType::Float:
-        //     return 4;
-
-        // case ValueType::Double:
-        //     return 8;
-
-        // default:
-        //     break;
-        // }
-
-        return 8;
+        const std::string Label = CreateLabel();
+        std::stringstream Path;
+        Path << Label << ":\n";
+        Path << "    push " << Index << " ; either register may be r9 or r10\n";
+        Path << "    mov r10, [" << Array << " - 8]\n";
+        Path << "    pop r9\n";
+        Path << "    jmp " << OutOfBoundsStub << "\n";
+        ColdList.push_back(Path.str());
+        return Label;
     }
 
-    CmplSymbol GarbageCmplSymbol = CmplSymbol{.TypeDesc = ValueType::Unknown};
-
-    CmplSymbol ResolveSymbol(const ExpressionPtr &Expr)
+    // prints the index in r9 as out of bounds and exits with 1, emitted once and reached from OutOfBoundsPath()
+    std::string OutOfBoundsFailure()
     {
-        if (auto VarExpr = std::dynamic_pointer_cast<VariableExpression>(Expr))
-        {
-            if (VarExpr->Name.empty())
-            {
-                return GarbageCmplSymbol;
-            }
-
-            bool Found = false;
-            for (auto &&Var : Variables)
-            {
-                if (Var.Address != VarExpr->Address)
-                    continue;
-
-                Found = true;
-                break;
-            }
-
-            if (!Found)
-            {
-                // look for identifier in namespaces
-                for (auto &&Var : Variables)
-                {
-                    if (!Var.Namespace)
-                        continue;
-                    if (!Var.Namespace->count(VarExpr->Name))
-                        continue;
-
-                    for (auto &&MemberVar : Variables)
-                    {
-                        if (MemberVar.Address != Var.Namespace->at(VarExpr->Name))
-                            continue;
-
-                        // only look for a function
-                        if (MemberVar.Funcs)
-                            return CmplSymbol{.TypeDesc = MemberVar.TypeDesc, .Funcs = MemberVar.Funcs};
-
-                        break;
-                    }
-                }
+        std::stringstream Failure;
+        Failure << OutOfBoundsStub << ":\n";
+        // ; write(1, msg, len)
+        // mov     rax, 1        ; syscall: write
+        // mov     rdi, 1        ; fd = stdout
+        // mov     rsi, msg      ; buf
+        // mov     rdx, len      ; count
+        // syscall
+        std::string DgLabel = CreateLabel();
+        std::string WrLabel = CreateLabel();
+        Failure << "    mov rax, 1\n";
+        Failure << "    mov rdi, 1\n";
+        Failure << "    mov rsi, " << OutOfBoundsErrorMessageData1 << "\n";
+        Failure << "    mov rdx, 22\n";
+        Failure << "    syscall\n";
+        Failure << "    mov rbx, r9\n";
+        Failure << "    mov rdi, _numbuf + 20\n";
+        Failure << "    mov byte [rdi], 0\n";
+        Failure << "    mov rcx, 0\n";
+        Failure << "    cmp rbx, 0\n";
+        Failure << "    jge " << DgLabel << "\n";
+        Failure << "    neg rbx\n";
+        Failure << "    mov rcx, 1\n";
+        Failure << DgLabel << ":\n";
+        Failure << "    xor rdx, rdx\n";
+        Failure << "    mov rax, rbx\n";
+        Failure << "    mov rsi, 10\n";
+        Failure << "    div rsi\n";
+        Failure << "    add rdx, 48\n";
+        Failure << "    dec rdi\n";
+        Failure << "    mov byte [rdi], dl\n";
+        Failure << "    mov rbx, rax\n";
+        Failure << "    test rbx, rbx\n";
+        Failure << "    jnz " << DgLabel << "\n";
+        Failure << "    cmp rcx, 0\n";
+        Failure << "    je " << WrLabel << "\n";
+        Failure << "    dec rdi\n";
+        Failure << "    mov byte [rdi], 45\n";
+        Failure << WrLabel << ":\n";
+        Failure << "    mov rax, 1\n";
+        Failure << "    mov rsi, rdi\n";
+        Failure << "    mov rdx, _numbuf + 20\n";
+        Failure << "    sub rdx, rdi\n";
+        Failure << "    mov rdi, 1\n";
+        Failure << "    syscall\n";
+        Failure << "    mov rax, 1\n";
+        Failure << "    mov rdi, 1\n";
+        Failure << "    mov rsi, " << OutOfBoundsErrorMessageData2 << "\n";
+        Failure << "    mov rdx, 29\n";
+        Failure << "    syscall\n";
+        Failure << "    mov rax, 60\n";
+        Failure << "    mov rdi, 1\n";
+        Failure << "    syscall\n";
+        //     f33460_print_NullInt: ; begin function
+        //     ; scope begin
+        //     mov rax, [rsp + 8] ; load from stack
+        //     ; discard result
+        // ; inline assembly begin
+        //     mov rbx , rax
+        //     mov rdi , _numbuf + 20
+        //     mov byte [ rdi ] , 0
+        // ; inline assembly end
+        // ; inline assembly begin
+        //     mov rcx , 0
+        //     cmp rbx , 0
+        //     jge .Dg
+        //     neg rbx
+        //     mov rcx , 1
+        // ; inline assembly end
+        // ; inline assembly begin
+        // .Dg:
+        //     xor rdx , rdx
+        //     mov rax , rbx
+        //     mov rsi , 10
+        //     div rsi
+        //     add rdx , 48
+        //     dec rdi
+        //     mov byte [ rdi ] , dl
+        //     mov rbx , rax
+        //     test rbx , rbx
+        //     jnz .Dg
+        // ; inline assembly end
+        // ; inline assembly begin
+        //     cmp rcx , 0
+        //     je .Wr
+        //     dec rdi
+        //     mov byte [ rdi ] , 45
+        // ; inline assembly end
+        // ; inline assembly begin
+        // .Wr:
+        //     mov rax , 1
+        //     mov rsi , rdi
+        //     mov rdx , _numbuf + 20
+        //     sub rdx , rdi
+        //     mov rdi , 1
+        //     syscall
+        // ; inline assembly end
+        //     ; scope closed and locals destroyed
+        //     mov rax, 0 ; null
+        //     ret
+        // ; end function f33460_print_NullInt
+        return Failure.str();
+    }
 
-                return GarbageCmplSymbol;
-            }
+    void GenerateFunctionDefinition(const std::shared_ptr<VarDeclaration> &Decl, const std::shared_ptr<FunctionDefinition> &Func)
+    {
+        const bool IsMain = Decl->Address == 1;
+        std::string FuncLabel = MangleFunctionSignature(*Func, Decl->Name);
 
-            for (auto &&Var : Variables)
-            {
-                if (Var.Address != VarExpr->Address)
-                    continue;
-
-                if (Var.Funcs)
-                    return CmplSymbol{.TypeDesc = Var.TypeDesc, .Funcs = Var.Funcs};
-                else if (Var.Namespace)
-                    return CmplSymbol{.TypeDesc = Var.TypeDesc, .Namespace = Var.Namespace};
-                else if (Var.Class && Var.StackLoc == -1)
-                    return CmplSymbol{.TypeDesc = Var.TypeDesc, .Class = Var.Class};
-                else
-                    return CmplSymbol{.TypeDesc = Var.TypeDesc, .Var = std::make_shared<Variable>(Var), .Class = Var.Class};
-            }
-        }
-        else if (auto Assign = std::dynamic_pointer_cast<AssignmentExpression>(Expr))
+        if (IsMain)
         {
-            return ResolveSymbol(Assign->Value);
-        }
-        else if (auto Literal = std::dynamic_pointer_cast<ValueExpression>(Expr))
-        {
-            if (Literal->Val.type() == typeid(rt_Int))
-                return CmplSymbol{.TypeDesc = TypeDescriptor(ValueType::Int).AsConstant()};
-            else if (Literal->Val.type() == typeid(rt_Float))
-                return CmplSymbol{.TypeDesc = TypeDescriptor(ValueType::Float).AsConstant()};
-            else if (Literal->Val.type() == typeid(bool))
-                return CmplSymbol{.TypeDesc = TypeDescriptor(ValueType::Bool).AsConstant()};
-            else if (Literal->Val.type() == typeid(std::nullptr_t))
-                return CmplSymbol{.TypeDesc = TypeDescriptor(ValueType::Null, {}, nullptr, 2).AsConstant()};
-            else if (Literal->Val.type() == typeid(char))
-                return CmplSymbol{.TypeDesc = TypeDescriptor(ValueType::Character).AsConstant()};
-            else if (Literal->Val.type() == typeid(std::string))
+            FuncLabel = "_start";
+            if (CmplFlags.StrictMode && !Func->Global)
             {
-                if (ToString(Literal->Val).length() == 1)
-                    return CmplSymbol{.TypeDesc = TypeDescriptor(ValueType::Character).AsConstant()};
-                else
-                    return CmplSymbol{.TypeDesc = TypeDescriptor(ValueType::Character).AsPointer()};
+                Throw(CompileError("the main function was not exported (add `export` keyword)", Warning));
             }
-
-            return GarbageCmplSymbol;
         }
-        else if (auto Func = std::dynamic_pointer_cast<FunctionDefinition>(Expr))
-        {
-            std::vector<TypeDescriptor> FuncSubtypes;
-            FuncSubtypes.push_back(Func->ReturnType);
-            for (auto &&Param : Func->Arguments)
-            {
-                FuncSubtypes.push_back(Param.Type);
-            }
 
-            auto Funcs = std::make_shared<std::vector<std::shared_ptr<FunctionDefinition>>>();
-            Funcs->push_back(Func);
-
-            return CmplSymbol{.TypeDesc = TypeDescriptor(ValueType::Function, FuncSubtypes), .Funcs = Funcs};
-        }
-        else if (auto Namespace = std::dynamic_pointer_cast<NamespaceDefinition>(Expr))
+        const AsmBuffer SavedOutput = Output.Take();
+
+        // the direct path below still runs for its diagnostics and the functions it queues
+        std::shared_ptr<IRFunction> Lowered = CmplFlags.OptimizationLevel && !Discarding ? IRLowering(*this).LowerFunction(Func, FuncLabel, IsMain) : nullptr;
+        const size_t PreviousErrors = Errors.size();
+
+        if (Func->Global || IsMain)
+            Output << "global " << FuncLabel << "\n";
+        Output << FuncLabel << ": ; begin function\n";
+
+        int64_t PreviousStackSize = StackSize;
+        int64_t PreviousFrameSize = FrameSize;
+        RegisterAllocation PreviousAllocation = std::move(Allocation);
+        std::vector<CountedLoop> PreviousCountedLoops = std::move(CountedLoops);
+        std::map<std::string, size_t> PreviousFunctionStatistics = std::move(FunctionStatistics);
+        const FunctionDefinition *PreviousFunction = CurrentFunction;
+        CountedLoops.clear();
+        FunctionStatistics.clear();
+        CurrentFunction = IsMain ? nullptr : Func.get();
+        StackSize = 0;
+
+        const PassManager Passes(CmplFlags);
+        auto FitsInFrame = [&](const UseExpression &New)
         {
-            auto Members = std::make_shared<std::unordered_map<std::string, MapId>>();
-            for (auto &&[Name, Address] : Namespace->Definition)
-            {
-                (*Members)[Name] = Address;
-            }
-
-            for (auto &&Member : Namespace->Statements)
-            {
-                if (auto &&Decl = std::dynamic_pointer_cast<VarDeclaration>(Member))
-                {
-                    if (Decl->Address == 1) // is main()
-                        continue;
-                }
-                GenerateStatement(Member);
-            }
-
-            return CmplSymbol{.TypeDesc = ValueType::Namespace, .Namespace = Members};
-        }
-        else if (auto Access = std::dynamic_pointer_cast<MemberExpression>(Expr))
+            const CmplSymbol Type = ResolveSymbol(New.Type.CustomTypeName);
+            return Type.Class && Type.Class->count("*ClassSize") && Type.Class->at("*ClassSize").Offset <= LargestFrameObject;
+        };
+        Allocation = RegisterAllocator(CmplFlags, Passes.Enabled("stackalloc") ? FitsInFrame : std::function<bool(const UseExpression &)>(), Passes.Enabled("scalarrepl")).Allocate(*Func);
+        if (Func->CLinkage)
+            Allocation.CalleeSaved.push_back("rbx"); // C keeps it, the stdlib's assembly does not
+        if (IsMain)
+            Allocation.CalleeSaved.clear(); // nothing to return to
+
+        auto DeclareParameter = [&](const VarDeclaration &ParamDecl)
         {
-            CmplSymbol ObjectSymbol = ResolveSymbol(Access->Object);
-
-            if (ObjectSymbol.Namespace)
+            if (ParamDecl.Type.CustomTypeName)
             {
-                if (!ObjectSymbol.Namespace->count(Access->Member))
-                {
-                    return GarbageCmplSymbol;
-                }
-                for (auto &&Var : Variables)
-                {
-                    if (Var.Address != ObjectSymbol.Namespace->at(Access->Member))
-                        continue;
-
-                    if (Var.Funcs)
-                        return CmplSymbol{.TypeDesc = Var.TypeDesc, .Funcs = Var.Funcs};
-                    else if (Var.Namespace)
-                        return CmplSymbol{.TypeDesc = Var.TypeDesc, .Namespace = Var.Namespace};
-                    else
-                        return CmplSymbol{.TypeDesc = Var.TypeDesc, .Var = std::make_shared<Variable>(Var)};
-                }
-
-                return GarbageCmplSymbol;
+                const CmplSymbol &ParamTypeSymbol = ResolveSymbol(ParamDecl.Type.CustomTypeName);
+                DeclareVariable(Variable{.StackLoc = StackSize, .TypeDesc = ParamDecl.Type, .Class = ParamTypeSymbol.Class, .Address = ParamDecl.Address, .Name = ParamDecl.Name});
             }
-            else if (ObjectSymbol.Class)
+            else
             {
-                if (!ObjectSymbol.Class->count(Access->Member))
-                {
-                    return GarbageCmplSymbol;
-                }
-                TypeDescriptor MemberType = ObjectSymbol.Class->at(Access->Member).Type;
-                if (ObjectSymbol.TypeDesc.Constant)
-                {
-                    // if the object is constant, all of its members should be too
-                    MemberType.Constant = true;
-                }
-
-                std::shared_ptr<std::unordered_map<std::string, AsmGenerator::MemberInfo>> MemberClass = nullptr;
-                if (MemberType.CustomTypeName)
-                {
-                    MemberClass = ResolveSymbol(MemberType.CustomTypeName).Class;
-                }
-
-                return CmplSymbol{.TypeDesc = MemberType, .Class = MemberClass};
+                DeclareVariable(Variable{.StackLoc = StackSize, .TypeDesc = ParamDecl.Type, .Address = ParamDecl.Address, .Name = ParamDecl.Name});
             }
-
-            return GarbageCmplSymbol;
-        }
-        else if (auto Index = std::dynamic_pointer_cast<IndexExpression>(Expr))
+        };
+
+        // System V, the first six arguments come in registers and the rest
+        // above the return address with the seventh closest to it, C has
+        // float and double ones in the xmm registers
+        const bool FloatsFromC = PassesFloatsToC(*Func);
+        const std::vector<std::string> ArgumentRegisters = FloatsFromC ? CArgumentRegisters(*Func) : InstructionSelector::ArgumentRegisters;
+        if (FloatsFromC && std::count(ArgumentRegisters.begin(), ArgumentRegisters.end(), ""))
+            Throw(CompileError("a function C calls with float or double parameters can take at most 6 integer and 8 floating arguments", Error));
+        for (size_t j = Func->Arguments.size(); j > ArgumentRegisters.size(); j--)
         {
-            CmplSymbol ObjectSymbol = ResolveSymbol(Index->Object);
-            ObjectSymbol.TypeDesc.PointerDepth -= 1;
-            return ObjectSymbol;
+            DeclareParameter(Func->Arguments.at(j - 1));
+            Push(SlotSize);
         }
-        else if (auto Class = std::dynamic_pointer_cast<ClassBlueprint>(Expr))
-        {
-            auto Members = std::make_shared<std::unordered_map<std::string, MemberInfo>>();
-            (*Members)["*ClassId"] = MemberInfo{.Type = ValueType::Unknown, .Offset = Class->UniqueId};
-
-            uint64_t Size = 0;
-            for (auto &&MemberDecl : Class->Members)
-            {
-                (*Members)[MemberDecl.Name] = MemberInfo{.Type = MemberDecl.Type, .Offset = Size};
-                Size += SizeOfType(MemberDecl.Type);
-            }
+        if (!IsMain)
+            Push(8); // return address
 
-            (*Members)["*ClassSize"] = MemberInfo{.Type = ValueType::Unknown, .Offset = Size};
-
-            return CmplSymbol{.TypeDesc = TypeDescriptor(ValueType::Custom, {}, nullptr), .Class = Members};
-        }
-        else if (auto NewExpr = std::dynamic_pointer_cast<UseExpression>(Expr))
+        for (const std::string &Register : Allocation.CalleeSaved)
         {
-            CmplSymbol Type = ResolveSymbol(NewExpr->Type.CustomTypeName);
-            auto Members = Type.Class;
-
-            return CmplSymbol{.TypeDesc = NewExpr->Type, .Class = Members};
+            Push(Register, 8);
         }
-        else if (auto Cast = std::dynamic_pointer_cast<ClassCastExpression>(Expr))
-        {
-            std::shared_ptr<std::unordered_map<std::string, AsmGenerator::MemberInfo>> Members = nullptr;
+        FrameSize = StackSize;
 
-            if (Cast->Type.CustomTypeName)
+        // the register arguments get slots in the frame, ret drops them with the locals
+        for (size_t j = 0; j < std::min(Func->Arguments.size(), ArgumentRegisters.size()); j++)
+        {
+            const std::string &Register = ArgumentRegisters.at(j);
+            DeclareParameter(Func->Arguments.at(j));
+            if (Register.rfind("xmm", 0) != 0)
             {
-                CmplSymbol Type = ResolveSymbol(Cast->Type.CustomTypeName);
-                Members = Type.Class;
+                Push(Register, SlotSize);
+                continue;
             }
-
-            return CmplSymbol{.TypeDesc = Cast->Type, .Class = Members};
+            if (Func->Arguments.at(j).Type.Type == ValueType::Float)
+                Output << "    cvtss2sd " << Register << ", " << Register << " ; C passes a float\n";
+            Output << "    movq rax, " << Register << "\n";
+            Push("rax", SlotSize);
         }
-        else if (auto SizeOfType = std::dynamic_pointer_cast<SizeOfTypeExpression>(Expr))
-        {
-            return CmplSymbol{.TypeDesc = ValueType::Int};
-        }
-        else if (auto SizeOf = std::dynamic_pointer_cast<SizeOfExpression>(Expr))
+
+        OpenScope(); // parameters destroyed by the caller
+
+        for (const StatementPtr &Stmt : Func->Body)
         {
-            return CmplSymbol{.TypeDesc = ValueType::Int};
+            GenerateStatement(Stmt);
         }
-        else if (auto Bin = std::dynamic_pointer_cast<BinaryExpression>(Expr))
-        {
-            CmplSymbol SymbolA = ResolveSymbol(Bin->A);
-            CmplSymbol SymbolB = ResolveSymbol(Bin->B);
 
-            switch (Bin->Operator)
-            {
-            case OperationType::Add:
-            case OperationType::Subtract:
-            case OperationType::Multiply:
-            case OperationType::Divide:
-                return CmplSymbol{.TypeDesc = (CompileTypeMatch(SymbolA.TypeDesc, ValueType::Float) || CompileTypeMatch(SymbolB.TypeDesc, ValueType::Float)) ? ValueType::Float : ValueType::Int};
-            case OperationType::LessThan:
-            case OperationType::GreaterThan:
-            case OperationType::LessThanOrEqualTo:
-            case OperationType::GreaterThanOrEqualTo:
-                return CmplSymbol{.TypeDesc = ValueType::Bool};
-            default:
-                break;
-            }
+        CloseScope();
 
-            return GarbageCmplSymbol;
+        for (int i = Func->Arguments.size() - 1; i >= 0; i--)
+        {
+            DiscardVariable(Variables.size() - 1);
         }
 
-        else if (auto Un = std::dynamic_pointer_cast<UnaryExpression>(Expr))
+        if (IsMain)
         {
-            CmplSymbol Symbol = ResolveSymbol(Un->Expr);
-
-            switch (Un->Operator)
-            {
-            case OperationType::Add:
-            case OperationType::Subtract:
-                return CmplSymbol{.TypeDesc = ValueType::Int};
-            case OperationType::ForceUnwrap:
-            {
-                Symbol.TypeDesc.Nullable = false;
-                return Symbol;
-            }
-
-            default:
-                break;
-            }
-
-            return GarbageCmplSymbol;
+            Output << "    ; fallback exit\n";
+            Output << "    mov rax, 60 ; sysexit\n";
+            Output << "    mov rdi, 0 ; exit code\n";
+            Output << "    syscall ; call exit\n";
+            Output << "    ret ; if exit somehow fails its better to segfault here than leak into other functions\n";
+            Output << "; end function " << FuncLabel << "\n";
         }
-        else if (auto Call = std::dynamic_pointer_cast<CallExpression>(Expr))
+        else
         {
-            CmplSymbol Symbol = ResolveSymbol(Call->Callee);
-
-            if (Symbol.Funcs)
-            {
-                auto Func = CalculateBestOverload(Symbol.Funcs, Call, false);
-                if (!Func)
-                    return GarbageCmplSymbol;
-
-                if (Func->ReturnType.CustomTypeName)
-                {
-                    return CmplSymbol{.TypeDesc = Func->ReturnType, .Class = ResolveSymbol(Func->ReturnType.CustomTypeName).Class};
-                }
-                return CmplSymbol{.TypeDesc = Func->ReturnType};
-            }
-
-            return GarbageCmplSymbol;
+            // return null
+            GenerateStatement(std::make_shared<ReturnStatement>(std::make_shared<ValueExpression>(nullptr)));
+            Output << "; end function " << FuncLabel << "\n";
         }
-        else if (auto UnownedReference = std::dynamic_pointer_cast<UnownedReferenceExpression>(Expr))
+
+        if (Lowered && Errors.size() == PreviousErrors)
+            LoweredFunctions.push_back({PendingFunctionDefinitions.size(), Lowered});
+        else
         {
-            return ResolveSymbol(UnownedReference->Expr);
+            IRListing += "; " + FuncLabel + " was generated directly\n\n";
+            for (const auto &[Name, Count] : FunctionStatistics)
+                Statistics[Name] += Count;
         }
-
-        // if (Expr)
-        //     Throw(CompileError("resolve symbol: failed (not implemented)", Error));
-        return GarbageCmplSymbol;
+        CountedLoops = std::move(PreviousCountedLoops);
+        FunctionStatistics = std::move(PreviousFunctionStatistics);
+        CurrentFunction = PreviousFunction;
+
+        AsmBuffer FunctionOutput = Output.Take();
+        Output.Append(SavedOutput);
+        PendingFunctionDefinitions.push_back(std::move(FunctionOutput));
+
+        if (!IsMain)
+            StackSize = PreviousStackSize;
+        FrameSize = PreviousFrameSize;
+        Allocation = std::move(PreviousAllocation);
     }
 
     void GenerateStatement(const StatementPtr &Stmt)
@@ -617,66 +531,7 @@ private:
         if (auto Instruction = std::dynamic_pointer_cast<AssemblyInstructions>(Stmt))
         {
             Output << "; inline assembly begin\n";
-
-            bool Newline = true;
-            for (size_t i = 0; i < Instruction->Instructions.size(); i++)
-            {
-                const Token &Tok = Instruction->Instructions.at(i);
-                if (Tok.Type == TokenType::SemiColon)
-                {
-                    if (!Newline)
-                    {
-                        Output << "\n";
-                        Newline = true;
-                    }
-                }
-                else if (Instruction->Instructions.size() > (i + 1) && Instruction->Instructions.at(i + 1).Type == TokenType::Colon)
-                {
-                    Output << Tok.Text << "\n";
-                    i++;
-                    Newline = true;
-                }
-                else if (Instruction->Instructions.size() > (i + 1) && Instruction->Instructions.at(i).Type == TokenType::Dot)
-                {
-                    if (Instruction->Instructions.size() > (i + 2) && Instruction->Instructions.at(i + 2).Type == TokenType::Colon)
-                    {
-                        Output << "." << Instruction->Instructions.at(i + 1).Text << ":\n";
-                        i++;
-                        i++;
-                        Newline = true;
-                    }
-                    else
-                    {
-                        Output << " ." << Instruction->Instructions.at(i + 1).Text;
-                        i++;
-                        Newline = false;
-                    }
-                }
-                else if (Tok.Text == "section" || Tok.Text == "global" || Tok.Text == "extern" || Tok.Text == "segment")
-                {
-                    if (Tok.Text == "segment")
-                        Output << "section";
-                    else
-                        Output << Tok.Text;
-                    Newline = false;
-                }
-                else
-                {
-                    if (Newline)
-                    {
-                        Newline = false;
-                        Output << "    " << Tok.Text;
-                    }
-                    else
-                    {
-                        Output << " " << Tok.Text;
-                    }
-                }
-            }
-
-            if (!Newline)
-                Output << "\n";
-
+            Output << Instruction->ToString();
             Output << "; inline assembly end\n";
         }
         else if (auto ExprStmt = std::dynamic_pointer_cast<ExpressionStatement>(Stmt))
@@ -686,10 +541,24 @@ private:
         }
         else if (auto Multi = std::dynamic_pointer_cast<MultiStatement>(Stmt))
         {
-            for (auto &&Stmt : Multi->Statements)
+            // a desugared for loop, its counter may index the array it runs over unchecked
+            std::optional<CountedLoop> Counted;
+            if (CmplFlags.BoundsChecking && CmplFlags.OptimizationLevel && !CmplFlags.DisabledPasses.count("bce") && Multi->Statements.size() == 2)
             {
-                GenerateStatement(Stmt);
+                auto Counter = std::dynamic_pointer_cast<VarDeclaration>(Multi->Statements.at(0));
+                auto Loop = std::dynamic_pointer_cast<WhileStatement>(Multi->Statements.at(1));
+                if (Counter && Loop)
+                    Counted = CountedLoop::Match(*Counter, *Loop);
+            }
+
+            for (size_t i = 0; i < Multi->Statements.size(); i++)
+            {
+                if (Counted && i == 1)
+                    CountedLoops.push_back(*Counted);
+                GenerateStatement(Multi->Statements.at(i));
             }
+            if (Counted)
+                CountedLoops.pop_back();
         }
         else if (auto Decl = std::dynamic_pointer_cast<VarDeclaration>(Stmt))
         {
@@ -715,6 +584,19 @@ private:
                         if (Var.Address != Decl->Address)
                             continue;
 
+                        // an entry may define a function again, calls after it get the new body
+                        if (Resident)
+                        {
+                            // the mangled names only differ in the id before the first _
+                            auto Signature = [&](const FunctionDefinition &Overload)
+                            {
+                                const std::string Mangled = MangleFunctionSignature(Overload, Decl->Name);
+                                return Mangled.substr(Mangled.find('_'));
+                            };
+                            Var.Funcs->erase(std::remove_if(Var.Funcs->begin(), Var.Funcs->end(), [&](const std::shared_ptr<FunctionDefinition> &Old)
+                                                            { return Signature(*Old) == Signature(*Func); }),
+                                             Var.Funcs->end());
+                        }
                         Var.Funcs->push_back(Func);
 
                         Found = true;
@@ -724,102 +606,39 @@ private:
                     if (!Found)
                     {
                         Variable Var = Variable{.StackLoc = 0 /* stack location doesnt matter for functions */, .TypeDesc = Decl->Type, .Funcs = Symbol.Funcs, .Address = Decl->Address, .Name = Decl->Name};
-                        Variables.push_back(Var);
-                    }
-
-                    const bool IsMain = Decl->Address == 1;
-                    std::string FuncLabel = MangleFunctionSignature(*Func, Decl->Name);
-                    std::stringstream SavedOutput;
-
-                    if (IsMain)
-                    {
-                        FuncLabel = "_start";
-                        if (CmplFlags::StrictMode && !Func->Global)
-                        {
-                            Throw(CompileError("the main function was not exported (add `export` keyword)", Warning));
-                        }
-                    }
-                    else
-                    {
-                        SavedOutput << Output.str();
-                        Output.str(""); // clear
-                    }
-
-                    if (Func->Global || IsMain)
-                        Output << "global " << FuncLabel << "\n";
-                    Output << FuncLabel << ": ; begin function\n";
-
-                    int64_t PreviousStackSize = StackSize;
-                    StackSize = IsMain ? 0 : 8; // first 8 is return address
-
-                    int64_t i = -1;
-                    if (Func->Arguments.size() <= 1)
-                        i = 0;
-                    for (int j = Func->Arguments.size() - 1; j >= 0; j--)
-                    {
-                        VarDeclaration &ParamDecl = Func->Arguments.at(j);
-
-                        if (ParamDecl.Type.CustomTypeName)
-                        {
-                            const CmplSymbol &ParamTypeSymbol = ResolveSymbol(ParamDecl.Type.CustomTypeName);
-                            Variables.push_back(Variable{.StackLoc = StackSize - 8, .TypeDesc = ParamDecl.Type, .Class = ParamTypeSymbol.Class, .Address = ParamDecl.Address, .Name = ParamDecl.Name});
-                        }
-                        else
-                        {
-                            Variables.push_back(Variable{.StackLoc = StackSize - 8, .TypeDesc = ParamDecl.Type, .Address = ParamDecl.Address, .Name = ParamDecl.Name});
-                        }
-
-                        Push(SizeOfType(ParamDecl.Type));
-                        i++;
-                    }
-
-                    OpenScope(); // parameters destroyed by the caller
-
-                    for (const StatementPtr &Stmt : Func->Body)
-                    {
-                        GenerateStatement(Stmt);
+                        DeclareVariable(Var);
                     }
 
-                    CloseScope();
-
-                    for (int i = Func->Arguments.size() - 1; i >= 0; i--)
+                    // a C library defines it
+                    if (Func->External)
                     {
-                        Variables.pop_back();
+                        MangleFunctionSignature(*Func, Decl->Name);
+                        continue;
                     }
 
-                    if (IsMain)
+                    // main and exported functions seed the worklist, everything
+                    // else is generated once a call selects it
+                    if (Func->ParseBody || (Decl->Address != 1 && !Func->Global))
                     {
-                        Output << "    ; fallback exit\n";
-                        Output << "    mov rax, 60 ; sysexit\n";
-                        Output << "    mov rdi, 0 ; exit code\n";
-                        Output << "    syscall ; call exit\n";
-                        Output << "    ret ; if exit somehow fails its better to segfault here than leak into other functions\n";
-                        Output << "; end function " << FuncLabel << "\n";
-                    }
-                    else
-                    {
-                        // return null
-                        GenerateStatement(std::make_shared<ReturnStatement>(std::make_shared<ValueExpression>(nullptr)));
-                        Output << "; end function " << FuncLabel << "\n";
-                        std::string FunctionOutput = Output.str();
-                        Output.str("");
-                        Output << SavedOutput.str();
-                        PendingFunctionDefinitions[Func->UniqueId] = FunctionOutput;
+                        if (!Func->ParseBody)
+                            ParsedFunctions.push_back({Decl, Func});
+                        MangleFunctionSignature(*Func, Decl->Name);
+                        DeferredFunctions[Func->UniqueId] = Decl;
+                        continue;
                     }
 
-                    if (!IsMain)
-                        StackSize = PreviousStackSize;
+                    GenerateFunctionDefinition(Decl, Func);
                 }
             }
             else if (Symbol.Namespace)
             {
                 Variable Var = Variable{.StackLoc = -1 /* stack location doesnt matter for namespaces */, .TypeDesc = Decl->Type, .Namespace = Symbol.Namespace, .Address = Decl->Address, .Name = Decl->Name};
-                Variables.push_back(Var);
+                DeclareVariable(Var);
             }
             else if (Symbol.Class && !Symbol.TypeDesc.CustomTypeName)
             {
                 Variable Var = Variable{.StackLoc = -1 /* stack location doesnt matter for classes */, .TypeDesc = Decl->Type, .Class = Symbol.Class, .Address = Decl->Address, .Name = Decl->Name};
-                Variables.push_back(Var);
+                DeclareVariable(Var);
             }
             else
             {
@@ -844,26 +663,48 @@ private:
                     ClassMembers = TypeSymbol.Class;
                 }
 
+                if (ClassMembers && Allocation.Objects.count(Decl->Address))
+                {
+                    DeclareFrameObject(*Decl, ClassMembers);
+                    return;
+                }
+
                 Variable NewVariable = Variable{.StackLoc = StackSize, .TypeDesc = Decl->Type, .Class = ClassMembers, .Address = Decl->Address, .Name = Decl->Name};
+                if (Allocation.Locals.count(Decl->Address))
+                    NewVariable.Register = Allocation.Locals.at(Decl->Address);
+
+                // a top level variable of an entry, the entries after it still use it
+                if (Resident && CurrentScope == 0)
+                {
+                    GlobalList.push_back("g" + std::to_string(GlobalCount++));
+                    NewVariable.Register = "QWORD [" + GlobalList.back() + "]";
+                }
 
                 ExpressionPtr InitExpr = Decl->Initializer;
 
-                Variables.push_back(NewVariable);
+                DeclareVariable(NewVariable);
                 GenerateExpression(InitExpr);
+                CopyLiteral(InitExpr, Decl->Type);
 
                 INC_REF_COUNT(Decl->Type);
 
-                Output << "    sub rsp, " << SizeOfType(Decl->Type) << "\n";
+                if (!NewVariable.Register.empty())
+                {
+                    Output << "    mov " << NewVariable.Register << ", rax\n";
+                    return;
+                }
+
+                Output << "    sub rsp, " << SlotSize << "\n";
                 Output << "    mov [rsp], rax\n";
-                Push(SizeOfType(Decl->Type));
+                Push(SlotSize);
             }
         }
         else if (auto Using = std::dynamic_pointer_cast<UseStatement>(Stmt))
         {
             CmplSymbol Object = ResolveSymbol(Using->Expr);
 
-            Variable Var = Variable{.StackLoc = Object.Var ? Object.Var->StackLoc : -1, .TypeDesc = Object.TypeDesc, .Funcs = Object.Funcs, .Namespace = Object.Namespace, .Address = Using->Address};
-            Variables.push_back(Var);
+            Variable Var = Variable{.StackLoc = Object.Var ? Object.Var->StackLoc : -1, .TypeDesc = Object.TypeDesc, .Funcs = Object.Funcs, .Namespace = Object.Namespace, .Address = Using->Address, .Register = Object.Var ? Object.Var->Register : ""};
+            DeclareVariable(Var);
         }
         else if (auto If = std::dynamic_pointer_cast<IfStatement>(Stmt))
         {
@@ -910,17 +751,39 @@ private:
             Output << "    test rax, rax\n";
             Output << "    jz " << EndLabel << "\n";
 
+            OpenScope();
+
             for (const StatementPtr &Stmt : While->Body)
             {
                 GenerateStatement(Stmt);
             }
+
+            CloseScope();
+
             Output << "    jmp " << BeginLabel << "\n";
 
             Output << EndLabel << ": ; end while\n";
         }
         else if (auto Return = std::dynamic_pointer_cast<ReturnStatement>(Stmt))
         {
+            if (auto Call = std::dynamic_pointer_cast<CallExpression>(Return->Expr); Call && GenerateTailCall(Call))
+                return;
+
             GenerateExpression(Return->Expr);
+            if (CurrentFunction && PassesFloatsToC(*CurrentFunction) && IsFloatingType(CurrentFunction->ReturnType))
+            {
+                Output << "    movq xmm0, rax ; C expects it in xmm0\n";
+                if (CurrentFunction->ReturnType.Type == ValueType::Float)
+                    Output << "    cvtsd2ss xmm0, xmm0\n";
+            }
+
+            // locals still on the stack, then the registers the prologue saved
+            if (StackSize > FrameSize)
+                Output << "    add rsp, " << StackSize - FrameSize << "\n";
+            for (auto Register = Allocation.CalleeSaved.rbegin(); Register != Allocation.CalleeSaved.rend(); Register++)
+            {
+                Output << "    pop " << *Register << "\n";
+            }
             Output << "    ret\n";
         }
         else if (Stmt)
@@ -931,9 +794,8 @@ private:
 
     void GenerateExpression(const ExpressionPtr &Expr)
     {
-        static auto ExprStmt = std::make_shared<ExpressionStatement>(nullptr);
-        ExprStmt->Expr = Expr;
-        CurrentEval = ExprStmt;
+        EvalExpr->Expr = Expr;
+        CurrentEval = EvalExpr;
 
         if (auto Literal = std::dynamic_pointer_cast<ValueExpression>(Expr))
         {
@@ -950,31 +812,7 @@ private:
                 if (Literal->Val.type() == typeid(char))
                     Output << "    mov rax, " << StringBytes.at(0) << " ; char\n";
                 else
-                {
-                    // Output << CreateData("db " + EscapedString + ", 0 ; string") << "\n";
-
-                    Output << "    ; allocate string on the heap (char[])\n";
-                    Output << "    ; multiple registers will be clobbered\n";
-                    Output << "    mov rsi, " << StringBytes.size() * 8 + 16 << " ; size\n";
-                    Output << "    mov rax, 9       ; mmap\n";
-                    Output << "    mov rdi, 0       ; addr\n";
-                    Output << "    mov rdx, 3       ; PROT_READ|PROT_WRITE\n";
-                    Output << "    mov r10, 34      ; MAP_PRIVATE|MAP_ANONYMOUS\n";
-                    Output << "    mov r8, -1       ; fd\n";
-                    Output << "    mov r9, 0        ; offset\n";
-                    Output << "    syscall\n";
-                    Output << "    mov QWORD [rax + 0], 0 ; init refcount\n";
-                    Output << "    mov QWORD [rax + 8], " << StringBytes.size() << " ; store string size\n";
-                    Output << "    add rax, 16 ; above string size\n";
-
-                    for (size_t i = 0; i < StringBytes.size(); i++)
-                    {
-                        const int &Byte = StringBytes.at(i);
-                        Output << "    mov QWORD [rax + " << i * 8 << "], " << Byte << "\n";
-                    }
-
-                    Output << "    ; no null terminator needed since string size is always known at runtime\n";
-                }
+                    Output << "    mov rax, " << CreateStringLiteral(ToString(Literal->Val)) << " + 16 ; string literal (char[])\n";
             }
             else
             {
@@ -982,28 +820,25 @@ private:
                     Output<< "    mov rax, " << 0 << " ; null\n";
                 else if (Literal->Val.type() == typeid(bool))
                     Output << "    mov rax, " << int(std::any_cast<bool>(Literal->Val)) << " ; bool\n";
+                else if (Literal->Val.type() == typeid(rt_Float))
+                    Output << "    mov rax, " << DoubleBits(std::any_cast<rt_Float>(Literal->Val)) << " ; double " << ToString(Literal->Val) << "\n";
                 else
                     Output << "    mov rax, " << ToString(Literal->Val) << " ; int\n";
             }
         }
         else if (auto VarExpr = std::dynamic_pointer_cast<VariableExpression>(Expr))
         {
-            if (VarExpr->Name.empty())
+            if (VarExpr->Name.empty() || VarExpr->AtCursor)
             {
-                Throw(CompileError("Awaiting identifier...", SyntaxError));
-                for (Variable &Var : Variables)
-                {
-                    if (Var.Name == "main")
-                        continue; // skip main
+                // the name typed so far is the prefix to complete
+                if (CmplFlags.CompileInfo)
+                    AvailableIdentifiers = Completions.Query(VarExpr->Name, CmplFlags.CompletionLimit);
 
-                    if (Var.Funcs)
-                        AvailableIdentifiers.push_back("(Function): " + Var.Name);
-                    else if (Var.Namespace)
-                        AvailableIdentifiers.push_back("(Namespace): " + Var.Name);
-                    else
-                        AvailableIdentifiers.push_back("(Name): " + Var.Name);
+                if (VarExpr->Name.empty())
+                {
+                    Throw(CompileError("Awaiting identifier...", SyntaxError));
+                    return;
                 }
-                return;
             }
 
             CmplSymbol Symbol = ResolveSymbol(VarExpr);
@@ -1020,10 +855,22 @@ private:
                 return;
             }
 
+            if (Symbol.Var->Object)
+            {
+                Output << "    lea rax, [rsp + " << StackSize - Symbol.Var->StackLoc - Symbol.Var->ObjectSize << "] ; object in the frame\n";
+                return;
+            }
+
+            if (!Symbol.Var->Register.empty())
+            {
+                Output << "    mov rax, " << Symbol.Var->Register << " ; load from register\n";
+                return;
+            }
+
             if (StackSize <= Symbol.Var->StackLoc)
                 Throw(CompileError("invalid stack access (underflow)", Fatal));
 
-            Output << "    mov rax, [rsp + " << int64_t(StackSize) - int64_t(Symbol.Var->StackLoc) - SizeOfType(Symbol.Var->TypeDesc) << "] ; load from stack\n";
+            Output << "    mov rax, [rsp + " << int64_t(StackSize) - int64_t(Symbol.Var->StackLoc) - SlotSize << "] ; load from stack\n";
         }
         else if (auto Access = std::dynamic_pointer_cast<MemberExpression>(Expr))
         {
@@ -1044,18 +891,30 @@ private:
                 }
                 if (Symbol.Var)
                 {
-                    Output << "    mov rax, [rsp + " << int64_t(StackSize) - int64_t(Symbol.Var->StackLoc) - SizeOfType(Symbol.Var->TypeDesc) << "] ; load namespace member statically from stack\n";
+                    Output << "    mov rax, [rsp + " << int64_t(StackSize) - int64_t(Symbol.Var->StackLoc) - SlotSize << "] ; load namespace member statically from stack\n";
                 }
             }
             else if (ObjectSymbol.Class)
             {
                 if (!ObjectSymbol.Class->count(Access->Member))
                 {
-                    Throw(CompileError(Access->Member + " is not a member of the object, is it public?", Error));
-                    return;
+                    Throw(CompileError(Access->Member + " is not a member of the object, is it public?", Error));
+                    return;
+                }
+                const MemberInfo &Member = ObjectSymbol.Class->at(Access->Member);
+                if (ObjectSymbol.Var && ObjectSymbol.Var->Object)
+                {
+                    const std::string &Register = MemberRegister(*ObjectSymbol.Var, Access->Member);
+                    if (!Register.empty())
+                        Output << "    mov rax, " << Register << " ; member kept in register\n";
+                    else
+                        Output << "    " << ScalarAccess::Load("rax", FrameMember(*ObjectSymbol.Var, Member), SizeOfType(Member.Type), IsSignedType(Member.Type), IsFloatingType(Member.Type)) << " ; get member in the frame\n";
+                }
+                else
+                {
+                    GenerateExpression(Access->Object);
+                    Output << "    " << ScalarAccess::Load("rax", "[rax + " + std::to_string(Member.Offset) + "]", SizeOfType(Member.Type), IsSignedType(Member.Type), IsFloatingType(Member.Type)) << " ; get object member\n";
                 }
-                GenerateExpression(Access->Object);
-                Output << "    mov rax, [rax + " << ObjectSymbol.Class->at(Access->Member).Offset << "] ; get object member\n";
             }
             else
             {
@@ -1090,129 +949,23 @@ private:
             }
 
             GenerateExpression(Index->Object);
-            Output << "    mov r8, rax ; save heap pointer\n";
-            GenerateExpression(Index->Index);
-            if (CmplFlags::BoundsChecking)
+            Output << "    ; heap pointer to r8\n";
+            GenerateHeldOperand(Index.get(), Index->Index, "r8");
+            if (CmplFlags.BoundsChecking && std::any_of(CountedLoops.begin(), CountedLoops.end(), [&](const CountedLoop &Loop)
+                                                        { return Loop.Covers(*Index); }))
+            {
+                Output << "    ; in bounds, the loop counter stays below sizeof\n";
+                FunctionStatistics["bounds checks removed"]++;
+            }
+            else if (CmplFlags.BoundsChecking)
             {
-                std::string OutOfBoundsErrorLabel = CreateLabel();
-                static std::string OutOfBoundsErrorMessageData1 = CreateData("db 0x1B, \"[1;101mERROR: index [\"");
-                static std::string OutOfBoundsErrorMessageData2 = CreateData("db \"] is out of bounds size\", 0x1B, \"[0m\", 10");
-
                 Output << "    ; bounds checking\n";
-                Output << "    mov r9, rax\n";
-                Output << "    mov rcx, [r8 - 8]\n";
-                Output << "    dec rcx\n";
-                Output << "    cmp rcx, r9\n";
-                Output << "    mov rax, 0\n";
-                Output << "    mov rcx, 1\n";
-                Output << "    cmovb rax, rcx\n";
-                Output << "    test rax, rax\n";
-                Output << "    jz " << OutOfBoundsErrorLabel << "\n";
-                // ; write(1, msg, len)
-                // mov     rax, 1        ; syscall: write
-                // mov     rdi, 1        ; fd = stdout
-                // mov     rsi, msg      ; buf
-                // mov     rdx, len      ; count
-                // syscall
-                std::string DgLabel = CreateLabel();
-                std::string WrLabel = CreateLabel();
-                Output << "    mov rax, 1\n";
-                Output << "    mov rdi, 1\n";
-                Output << "    mov rsi, " << OutOfBoundsErrorMessageData1 << "\n";
-                Output << "    mov rdx, 22\n";
-                Output << "    syscall\n";
-                Output << "    mov rbx, r9\n";
-                Output << "    mov rdi, _numbuf + 20\n";
-                Output << "    mov byte [rdi], 0\n";
-                Output << "    mov rcx, 0\n";
-                Output << "    cmp rbx, 0\n";
-                Output << "    jge " << DgLabel << "\n";
-                Output << "    neg rbx\n";
-                Output << "    mov rcx, 1\n";
-                Output << DgLabel << ":\n";
-                Output << "    xor rdx, rdx\n";
-                Output << "    mov rax, rbx\n";
-                Output << "    mov rsi, 10\n";
-                Output << "    div rsi\n";
-                Output << "    add rdx, 48\n";
-                Output << "    dec rdi\n";
-                Output << "    mov byte [rdi], dl\n";
-                Output << "    mov rbx, rax\n";
-                Output << "    test rbx, rbx\n";
-                Output << "    jnz " << DgLabel << "\n";
-                Output << "    cmp rcx, 0\n";
-                Output << "    je " << WrLabel << "\n";
-                Output << "    dec rdi\n";
-                Output << "    mov byte [rdi], 45\n";
-                Output << WrLabel << ":\n";
-                Output << "    mov rax, 1\n";
-                Output << "    mov rsi, rdi\n";
-                Output << "    mov rdx, _numbuf + 20\n";
-                Output << "    sub rdx, rdi\n";
-                Output << "    mov rdi, 1\n";
-                Output << "    syscall\n";
-                Output << "    mov rax, 1\n";
-                Output << "    mov rdi, 1\n";
-                Output << "    mov rsi, " << OutOfBoundsErrorMessageData2 << "\n";
-                Output << "    mov rdx, 29\n";
-                Output << "    syscall\n";
-                Output << "    mov rax, 60\n";
-                Output << "    mov rdi, 1\n";
-                Output << "    syscall\n";
-                //     f33460_print_NullInt: ; begin function
-                //     ; scope begin
-                //     mov rax, [rsp + 8] ; load from stack
-                //     ; discard result
-                // ; inline assembly begin
-                //     mov rbx , rax
-                //     mov rdi , _numbuf + 20
-                //     mov byte [ rdi ] , 0
-                // ; inline assembly end
-                // ; inline assembly begin
-                //     mov rcx , 0
-                //     cmp rbx , 0
-                //     jge .Dg
-                //     neg rbx
-                //     mov rcx , 1
-                // ; inline assembly end
-                // ; inline assembly begin
-                // .Dg:
-                //     xor rdx , rdx
-                //     mov rax , rbx
-                //     mov rsi , 10
-                //     div rsi
-                //     add rdx , 48
-                //     dec rdi
-                //     mov byte [ rdi ] , dl
-                //     mov rbx , rax
-                //     test rbx , rbx
-                //     jnz .Dg
-                // ; inline assembly end
-                // ; inline assembly begin
-                //     cmp rcx , 0
-                //     je .Wr
-                //     dec rdi
-                //     mov byte [ rdi ] , 45
-                // ; inline assembly end
-                // ; inline assembly begin
-                // .Wr:
-                //     mov rax , 1
-                //     mov rsi , rdi
-                //     mov rdx , _numbuf + 20
-                //     sub rdx , rdi
-                //     mov rdi , 1
-                //     syscall
-                // ; inline assembly end
-                //     ; scope closed and locals destroyed
-                //     mov rax, 0 ; null
-                //     ret
-                // ; end function f33460_print_NullInt
-                Output << OutOfBoundsErrorLabel << ":\n";
-                Output << "    mov rax, r9\n";
+                Output << "    cmp rax, [r8 - 8]\n";
+                Output << "    jae " << OutOfBoundsPath("rax", "r8") << "\n";
             }
             ObjectSymbol.TypeDesc.PointerDepth = false;
             Output << "    imul rax, " << SizeOfType(ObjectSymbol.TypeDesc) << "\n";
-            Output << "    mov rax, [r8 + rax] ; load index\n";
+            Output << "    " << ScalarAccess::Load("rax", "[r8 + rax]", SizeOfType(ObjectSymbol.TypeDesc), IsSignedType(ObjectSymbol.TypeDesc), IsFloatingType(ObjectSymbol.TypeDesc)) << " ; load index\n";
         }
         else if (auto Assign = std::dynamic_pointer_cast<AssignmentExpression>(Expr))
         {
@@ -1234,22 +987,47 @@ private:
                     return;
                 }
 
-                GenerateExpression(AccessExpr->Object);
-                Output << "    mov r8, rax ; save object pointer\n";
-                GenerateExpression(Assign->Value);
-                Output << "    mov QWORD [r8 + " << ObjectSymbol.Class->at(AccessExpr->Member).Offset << "], rax ; reassign object member\n";
+                const MemberInfo &Member = ObjectSymbol.Class->at(AccessExpr->Member);
+                if (ObjectSymbol.Var && ObjectSymbol.Var->Object)
+                {
+                    GenerateExpression(Assign->Value);
+                    CopyLiteral(Assign->Value, NameSymbol.TypeDesc);
+                    const std::string &Register = MemberRegister(*ObjectSymbol.Var, AccessExpr->Member);
+                    if (!Register.empty())
+                        Output << "    " << ScalarAccess::Narrow(Register, "rax", SizeOfType(Member.Type), IsSignedType(Member.Type), IsFloatingType(Member.Type)) << " ; reassign member kept in register\n";
+                    else
+                        Output << "    " << ScalarAccess::Store(FrameMember(*ObjectSymbol.Var, Member), "rax", SizeOfType(Member.Type), IsFloatingType(Member.Type)) << " ; reassign member in the frame\n";
+                }
+                else
+                {
+                    GenerateExpression(AccessExpr->Object);
+                    Output << "    ; object pointer to r8\n";
+                    GenerateHeldOperand(Assign.get(), Assign->Value, "r8");
+                    CopyLiteral(Assign->Value, NameSymbol.TypeDesc);
+                    Output << "    " << ScalarAccess::Store("[r8 + " + std::to_string(Member.Offset) + "]", "rax", SizeOfType(Member.Type), IsFloatingType(Member.Type)) << " ; reassign object member\n";
+                }
             }
             else if (auto IndexExpr = std::dynamic_pointer_cast<IndexExpression>(Assign->Name))
             {
                 CmplSymbol ObjectSymbol = ResolveSymbol(IndexExpr->Object);
                 GenerateExpression(IndexExpr->Object);
-                Output << "    mov r8, rax ; save heap pointer\n";
-                GenerateExpression(IndexExpr->Index);
+                Output << "    ; heap pointer to r8\n";
+                GenerateHeldOperand(IndexExpr.get(), IndexExpr->Index, "r8");
                 ObjectSymbol.TypeDesc.PointerDepth = false;
-                Output << "    imul rax, " << SizeOfType(ObjectSymbol.TypeDesc) << "\n";
-                Output << "    mov r9, rax ; save offset\n";
-                GenerateExpression(Assign->Value);
-                Output << "    mov QWORD [r8 + r9], rax ; reassign pointer offset\n";
+                const int64_t ElementSize = SizeOfType(ObjectSymbol.TypeDesc);
+                if (ElementSize == 1 || ElementSize == 2 || ElementSize == 4 || ElementSize == 8)
+                {
+                    Output << "    lea rax, [r8 + rax * " << ElementSize << "] ; element address\n";
+                }
+                else
+                {
+                    Output << "    imul rax, " << ElementSize << "\n";
+                    Output << "    add rax, r8 ; element address\n";
+                }
+                Output << "    ; element address to r8\n";
+                GenerateHeldOperand(Assign.get(), Assign->Value, "r8");
+                CopyLiteral(Assign->Value, NameSymbol.TypeDesc);
+                Output << "    " << ScalarAccess::Store("[r8]", "rax", SizeOfType(ObjectSymbol.TypeDesc), IsFloatingType(ObjectSymbol.TypeDesc)) << " ; reassign pointer offset\n";
             }
             else if (auto UnExpr = std::dynamic_pointer_cast<UnaryExpression>(Assign->Name))
             {
@@ -1266,18 +1044,40 @@ private:
                 Throw(CompileError("invalid variable to assign to (if you forced unwrapped change it to `x = x! + 1`)", Fatal));
                 return;
             }
-            else
+            else if (!NameSymbol.Var->Register.empty())
             {
-                Output << "    mov rax, QWORD [rsp + " << StackSize - NameSymbol.Var->StackLoc - SizeOfType(NameSymbol.Var->TypeDesc) << "]; load old value to decrement refcount\n";
-                Output << "    mov r8, rax\n";
-                DEC_REF_COUNT(NameSymbol.Var->TypeDesc);
+                const std::string &Register = NameSymbol.Var->Register;
                 GenerateExpression(Assign->Value);
+                CopyLiteral(Assign->Value, NameSymbol.TypeDesc);
                 Output << "    mov r9, rax\n";
                 INC_REF_COUNT(NameSymbol.Var->TypeDesc);
-                Output << "    mov rax, r8\n";
+                Output << "    mov rax, " << Register << " ; old value to decrement refcount\n";
+                DEC_REF_COUNT(NameSymbol.Var->TypeDesc);
                 GarbageCollectObject(NameSymbol);
                 Output << "    mov rax, r9\n";
-                Output << "    mov QWORD [rsp + " << StackSize - NameSymbol.Var->StackLoc - SizeOfType(NameSymbol.Var->TypeDesc) << "], rax ; reassign stack\n";
+                Output << "    mov " << Register << ", rax ; reassign register\n";
+            }
+            else
+            {
+                // the value can read any scratch register, the old one waits on the stack
+                const bool Counted = NameSymbol.Var->TypeDesc.PointerDepth && CmplFlags.GarbageCollect;
+                if (Counted)
+                {
+                    Output << "    mov rax, QWORD [rsp + " << StackSize - NameSymbol.Var->StackLoc - SlotSize << "]; load old value to decrement refcount\n";
+                    DEC_REF_COUNT(NameSymbol.Var->TypeDesc);
+                    Push("rax", 8);
+                }
+                GenerateExpression(Assign->Value);
+                CopyLiteral(Assign->Value, NameSymbol.TypeDesc);
+                Output << "    mov r9, rax\n";
+                INC_REF_COUNT(NameSymbol.Var->TypeDesc);
+                if (Counted)
+                {
+                    Pop("rax", 8);
+                    GarbageCollectObject(NameSymbol);
+                }
+                Output << "    mov rax, r9\n";
+                Output << "    mov QWORD [rsp + " << StackSize - NameSymbol.Var->StackLoc - SlotSize << "], rax ; reassign stack\n";
                 Output << "    ; result is already in rax\n";
             }
 
@@ -1296,25 +1096,90 @@ private:
                 if (!Func)
                     return;
 
+                if (std::shared_ptr<VarDeclaration> Decl = TakeDeferredFunction(Func))
+                    FunctionWorklist.push_back({Decl, Func});
+
+                // C has float and double arguments in the xmm registers
+                const bool FloatsToC = PassesFloatsToC(*Func);
+                const std::vector<std::string> ArgumentRegisters = FloatsToC ? CArgumentRegisters(*Func) : InstructionSelector::ArgumentRegisters;
+                if (FloatsToC && std::count(ArgumentRegisters.begin(), ArgumentRegisters.end(), ""))
+                    Throw(CompileError("a C function with float or double parameters can take at most 6 integer and 8 floating arguments", Error));
+                if (Func->External)
+                {
+                    if (!CmplFlags.LinkWithGcc)
+                        Throw(CompileError("calling a C function needs -lwgcc to link with the C library", Error));
+                    if (Func->Arguments.size() > ArgumentRegisters.size())
+                        Throw(CompileError("a C function can take at most " + std::to_string(ArgumentRegisters.size()) + " arguments", Error));
+                    ExternalFunctions.insert(MangleFunctionSignature(*Func));
+                }
+
+                // each argument stays on the stack until the call returns, that reference is collected after
+                std::vector<int64_t> ArgumentLocs;
                 for (int i = 0; i < Call->Arguments.size(); i++)
                 {
                     ExpressionPtr Arg = Call->Arguments.at(i);
                     CmplSymbol ArgSymbol = ResolveSymbol(Arg);
 
                     GenerateExpression(Arg);
-                    Push("rax", SizeOfType(ArgSymbol.TypeDesc));
+                    CopyLiteral(Arg, Func->Arguments.at(i).Type);
+                    ArgumentLocs.push_back(StackSize);
+                    Push("rax", SlotSize);
+                }
+
+                const int64_t StackArguments = std::max<int64_t>(ArgumentLocs.size() - ArgumentRegisters.size(), 0);
+                for (size_t i = ArgumentLocs.size(); i > ArgumentRegisters.size(); i--)
+                    Push("QWORD [rsp + " + std::to_string(StackSize - ArgumentLocs.at(i - 1) - SlotSize) + "]", SlotSize);
+                size_t VectorArguments = 0;
+                for (size_t i = 0; i < std::min(ArgumentLocs.size(), ArgumentRegisters.size()); i++)
+                {
+                    const std::string &Register = ArgumentRegisters.at(i);
+                    if (Register.rfind("xmm", 0) != 0)
+                    {
+                        Output << "    mov " << Register << ", [rsp + " << StackSize - ArgumentLocs.at(i) - SlotSize << "]\n";
+                        continue;
+                    }
+                    Output << "    movq " << Register << ", QWORD [rsp + " << StackSize - ArgumentLocs.at(i) - SlotSize << "]\n";
+                    if (Func->Arguments.at(i).Type.Type == ValueType::Float)
+                        Output << "    cvtsd2ss " << Register << ", " << Register << " ; C takes a float\n";
+                    VectorArguments++;
                 }
 
-                Output << "    call " << MangleFunctionSignature(*Func) << "\n";
+                if (Func->External)
+                {
+                    // C expects the stack 16 byte aligned and al to count the vector arguments
+                    Output << "    mov rbx, rsp\n";
+                    Output << "    and rsp, -16\n";
+                    if (VectorArguments)
+                        Output << "    mov eax, " << VectorArguments << "\n";
+                    else
+                        Output << "    xor eax, eax\n";
+                    Output << "    call " << MangleFunctionSignature(*Func) << "\n";
+                    Output << "    mov rsp, rbx\n";
+                }
+                else
+                {
+                    Output << "    call " << MangleFunctionSignature(*Func) << "\n";
+                }
+                if (FloatsToC && IsFloatingType(Func->ReturnType))
+                {
+                    if (Func->ReturnType.Type == ValueType::Float)
+                        Output << "    cvtss2sd xmm0, xmm0\n";
+                    Output << "    movq rax, xmm0 ; C returns it in xmm0\n";
+                }
+                if (StackArguments)
+                {
+                    Output << "    add rsp, " << StackArguments * SlotSize << "\n";
+                    Pop(StackArguments * SlotSize);
+                }
                 Output << "    mov r9, rax ; save return data\n";
 
                 Output << "    ; cleanup arguments\n";
-                for (size_t i = 0; i < Call->Arguments.size(); i++)
+                for (size_t i = Call->Arguments.size(); i > 0; i--)
                 {
-                    ExpressionPtr Arg = Call->Arguments.at(i);
+                    ExpressionPtr Arg = Call->Arguments.at(i - 1);
                     CmplSymbol ArgSymbol = ResolveSymbol(Arg);
                     
-                    Pop("rax", SizeOfType(ArgSymbol.TypeDesc));
+                    Pop("rax", SlotSize);
                     GarbageCollectObject(ArgSymbol);
                 }
 
@@ -1361,28 +1226,21 @@ private:
                 Output << "    imul rax, " << SizeOfType(ElementType) << "\n";
                 Output << "    add rax, 16 ; space for the array size to be stored\n";
                 Output << "    mov rsi, rax ; size\n";
-                Output << "    mov rax, 9       ; mmap\n";
-                Output << "    mov rdi, 0       ; addr\n";
-                Output << "    mov rdx, 3       ; PROT_READ|PROT_WRITE\n";
-                Output << "    mov r10, 34      ; MAP_PRIVATE|MAP_ANONYMOUS\n";
-                Output << "    mov r8, -1       ; fd\n";
-                Output << "    mov r9, 0        ; offset\n";
-                Output << "    syscall\n";
+                Output << "    call " << HeapRuntime::Allocate << "\n";
                 Output << "    mov QWORD [rax + 0], 0 ; store reference count\n";
                 Output << "    mov QWORD [rax + 8], rbx ; store array size\n";
                 Output << "    add rax, 16 ; above array size\n";
             }
+            else if (NewExpr->Type.Type != ValueType::Custom)
+            {
+                GenerateExpression(NewExpr->Arguments.at(0));
+                GenerateConversion(ResolveSymbol(NewExpr->Arguments.at(0)).TypeDesc, NewExpr->Type);
+            }
             else
             {
                 Output << "    ; allocate an object\n";
-                Output << "    mov rax, 9       ; mmap\n";
-                Output << "    mov rdi, 0       ; addr\n";
                 Output << "    mov rsi, " << Symbol.Class->at("*ClassSize").Offset << " ; size in bytes\n";
-                Output << "    mov rdx, 3       ; PROT_READ|PROT_WRITE\n";
-                Output << "    mov r10, 34      ; MAP_PRIVATE|MAP_ANONYMOUS\n";
-                Output << "    mov r8, -1       ; fd\n";
-                Output << "    mov r9, 0        ; offset\n";
-                Output << "    syscall\n";
+                Output << "    call " << HeapRuntime::Allocate << "\n";
             }
         }
         else if (auto _SizeOfType = std::dynamic_pointer_cast<SizeOfTypeExpression>(Expr))
@@ -1417,15 +1275,20 @@ private:
 
             Output << "    ; operand a\n";
             GenerateExpression(Bin->A);
-            Output << "    mov rcx, rax\n";
-            Output << "    ; operand b\n";
-            GenerateExpression(Bin->B);
+            Output << "    ; operand b, a to rcx\n";
+            GenerateHeldOperand(Bin.get(), Bin->B, "rcx");
 
             if (SymbolA.TypeDesc.Nullable || SymbolB.TypeDesc.Nullable)
             {
                 Throw(CompileError("an operand of the binary expression is nullable", Error));
             }
 
+            if (IsFloatingType(SymbolA.TypeDesc) || IsFloatingType(SymbolB.TypeDesc))
+            {
+                GenerateFloatingOperation(Bin->Operator, IsFloatingType(SymbolA.TypeDesc), IsFloatingType(SymbolB.TypeDesc));
+                return;
+            }
+
             switch (Bin->Operator)
             {
             case OperationType::Add:
@@ -1479,6 +1342,13 @@ private:
             switch (Un->Operator)
             {
             case OperationType::Subtract:
+                if (IsFloatingType(Symbol.TypeDesc))
+                {
+                    Output << "    mov rcx, 1\n";
+                    Output << "    shl rcx, 63\n";
+                    Output << "    xor rax, rcx ; flip the sign bit\n";
+                    break;
+                }
                 Output << "    mov rcx, 0\n";
                 Output << "    sub rcx, rax\n";
                 Output << "    mov rax, rcx\n";
@@ -1498,6 +1368,178 @@ private:
         }
     }
 
+    // the registers C has each argument of Func in, for one PassesFloatsToC() is true for
+    std::vector<std::string> CArgumentRegisters(const FunctionDefinition &Func)
+    {
+        std::vector<bool> Floating;
+        for (const VarDeclaration &Argument : Func.Arguments)
+            Floating.push_back(IsFloatingType(Argument.Type));
+        return InstructionSelector::CArgumentRegisters(Floating);
+    }
+
+    // a in rcx and b in rax, an integer side is converted to a double first
+    void GenerateFloatingOperation(OperationType Operator, bool FloatingA, bool FloatingB)
+    {
+        Output << "    " << (FloatingA ? "movq" : "cvtsi2sd") << " xmm0, rcx\n";
+        Output << "    " << (FloatingB ? "movq" : "cvtsi2sd") << " xmm1, rax\n";
+
+        switch (Operator)
+        {
+        case OperationType::Add:
+            Output << "    addsd xmm0, xmm1\n";
+            break;
+        case OperationType::Subtract:
+            Output << "    subsd xmm0, xmm1\n";
+            break;
+        case OperationType::Multiply:
+            Output << "    mulsd xmm0, xmm1\n";
+            break;
+        case OperationType::Divide:
+            Output << "    divsd xmm0, xmm1\n";
+            break;
+
+        // above and above or equal are false when either side is NaN, less than swaps the sides
+        case OperationType::GreaterThan:
+        case OperationType::LessThan:
+        case OperationType::GreaterThanOrEqualTo:
+        case OperationType::LessThanOrEqualTo:
+        {
+            const bool Swapped = Operator == OperationType::LessThan || Operator == OperationType::LessThanOrEqualTo;
+            const bool OrEqual = Operator == OperationType::GreaterThanOrEqualTo || Operator == OperationType::LessThanOrEqualTo;
+            Output << "    ucomisd " << (Swapped ? "xmm1, xmm0" : "xmm0, xmm1") << "\n";
+            Output << "    mov rax, 0\n";
+            Output << "    mov rcx, 1\n";
+            Output << "    cmov" << (OrEqual ? "ae" : "a") << " rax, rcx\n";
+            return;
+        }
+
+        default:
+            Throw(CompileError("TODO: binary op " + std::string(magic_enum::enum_name(Operator)) + " is not implemented", Error));
+            return;
+        }
+
+        Output << "    movq rax, xmm0 ; binary op result in rax\n";
+    }
+
+    // the value of type From in rax to type To, a float keeps the double nearest to it
+    void GenerateConversion(const TypeDescriptor &From, const TypeDescriptor &To)
+    {
+        if (To.Type == ValueType::Bool)
+        {
+            if (IsFloatingType(From))
+                Output << "    shl rax, 1 ; negative zero is false too\n";
+            Output << "    cmp rax, 0\n";
+            Output << "    mov rax, 0\n";
+            Output << "    mov rcx, 1\n";
+            Output << "    cmovne rax, rcx\n";
+        }
+        else if (IsFloatingType(To))
+        {
+            if (IsFloatingType(From) && (To.Type == ValueType::Double || From.Type == ValueType::Float))
+                return;
+            Output << "    " << (IsFloatingType(From) ? "movq" : "cvtsi2sd") << " xmm0, rax\n";
+            if (To.Type == ValueType::Float)
+            {
+                Output << "    cvtsd2ss xmm0, xmm0\n";
+                Output << "    cvtss2sd xmm0, xmm0\n";
+            }
+            Output << "    movq rax, xmm0 ; converted to " << magic_enum::enum_name(To.Type) << "\n";
+        }
+        else if (IsFloatingType(From))
+        {
+            Output << "    movq xmm0, rax\n";
+            Output << "    cvttsd2si rax, xmm0 ; truncated to " << magic_enum::enum_name(To.Type) << "\n";
+        }
+    }
+
+    // `return f(...)` reuses this frame, f gets its arguments where ours came
+    // in and returns straight to our caller, false if it has to be called
+    bool GenerateTailCall(const std::shared_ptr<CallExpression> &Call)
+    {
+        if (!CurrentFunction || CurrentFunction->CLinkage || !CmplFlags.OptimizationLevel || CmplFlags.DisabledPasses.count("tailcall"))
+            return false;
+
+        CmplSymbol Symbol = ResolveSymbol(Call->Callee);
+        if (!Symbol.Funcs)
+            return false;
+        auto Func = CalculateBestOverload(Symbol.Funcs, Call, false);
+        if (!Func || Func->External || PassesFloatsToC(*Func))
+            return false;
+
+        // it can only reuse the stack arguments we got
+        const std::vector<std::string> &ArgumentRegisters = InstructionSelector::ArgumentRegisters;
+        const int64_t Stacked = std::max<int64_t>(Call->Arguments.size() - ArgumentRegisters.size(), 0);
+        const int64_t OurStacked = std::max<int64_t>(CurrentFunction->Arguments.size() - ArgumentRegisters.size(), 0);
+        if (Stacked > OurStacked)
+            return false;
+
+        // nothing is left to collect the arguments after it returns, only a
+        // variable's is fine to skip since the variable still holds it
+        for (const ExpressionPtr &Arg : Call->Arguments)
+        {
+            if (CmplFlags.GarbageCollect && ResolveSymbol(Arg).TypeDesc.PointerDepth && !std::dynamic_pointer_cast<VariableExpression>(Arg))
+                return false;
+        }
+
+        if (std::shared_ptr<VarDeclaration> Decl = TakeDeferredFunction(Func))
+            FunctionWorklist.push_back({Decl, Func});
+
+        std::vector<int64_t> ArgumentLocs;
+        for (const ExpressionPtr &Arg : Call->Arguments)
+        {
+            GenerateExpression(Arg);
+            ArgumentLocs.push_back(StackSize);
+            Push("rax", SlotSize);
+        }
+
+        // over our stack arguments, the return address is right below them
+        const int64_t ReturnAddress = StackSize - OurStacked * SlotSize - SlotSize;
+        for (size_t i = ArgumentRegisters.size(); i < ArgumentLocs.size(); i++)
+        {
+            Output << "    mov rax, [rsp + " << StackSize - ArgumentLocs.at(i) - SlotSize << "]\n";
+            Output << "    mov [rsp + " << ReturnAddress + SlotSize * (i - ArgumentRegisters.size() + 1) << "], rax\n";
+        }
+        for (size_t i = 0; i < std::min(ArgumentLocs.size(), ArgumentRegisters.size()); i++)
+            Output << "    mov " << ArgumentRegisters.at(i) << ", [rsp + " << StackSize - ArgumentLocs.at(i) - SlotSize << "]\n";
+
+        if (StackSize > FrameSize)
+            Output << "    add rsp, " << StackSize - FrameSize << "\n";
+        for (auto Register = Allocation.CalleeSaved.rbegin(); Register != Allocation.CalleeSaved.rend(); Register++)
+        {
+            Output << "    pop " << *Register << "\n";
+        }
+        Output << "    jmp " << MangleFunctionSignature(*Func) << " ; tail call\n";
+
+        Pop(ArgumentLocs.size() * SlotSize);
+        FunctionStatistics["tail calls"]++;
+        return true;
+    }
+
+    // keeps rax where Operand cannot clobber it, evaluates Operand
+    // into rax and then moves the kept value to Register
+    void GenerateHeldOperand(const Expression *Held, const ExpressionPtr &Operand, const std::string &Register)
+    {
+        auto Temp = Allocation.Temporaries.find(Held);
+
+        if (Temp == Allocation.Temporaries.end() && RegisterAllocator::IsLeaf(Operand) && !ResolveSymbol(Operand).Funcs)
+        {
+            Output << "    mov " << Register << ", rax\n";
+            GenerateExpression(Operand);
+        }
+        else if (Temp != Allocation.Temporaries.end() && !Temp->second.empty())
+        {
+            Output << "    mov " << Temp->second << ", rax ; hold in register\n";
+            GenerateExpression(Operand);
+            Output << "    mov " << Register << ", " << Temp->second << "\n";
+        }
+        else
+        {
+            Push("rax", 8); // spilled
+            GenerateExpression(Operand);
+            Pop(Register, 8);
+        }
+    }
+
     void Push(const std::string &Register, const int64_t Size)
     {
         Output << "    push " << Register << "\n";
@@ -1533,63 +1575,183 @@ private:
         return "l" + std::to_string(LabelCount++);
     }
 
-    std::string CreateData(const std::string &Input)
+    std::string CreateData(const std::string &Input, bool ReadOnly = false)
     {
-        std::string DataName = "d" + std::to_string(DataList.size());
-        DataList.push_back(DataName + ' ' + Input);
+        std::string DataName = "d" + std::to_string(DataCount++);
+        (ReadOnly ? ReadOnlyDataList : DataList).push_back(DataName + ' ' + Input);
         return DataName;
     }
 
-public:
-    std::string GenerateProgram()
+    // one read only copy of each literal laid out like a heap char[], point 16 bytes past the label
+    std::string CreateStringLiteral(const std::string &Text)
     {
-        Output << "\nsection .bss\n    _numbuf resb 21\nsection .text\n";
+        if (StringLiterals.count(Text))
+            return StringLiterals.at(Text);
 
-        for (const StatementPtr &Stmt : Ast)
+        std::string Layout = "dq " + std::to_string(HeapRuntime::ImmortalRefCount) + ", " + std::to_string(Text.size()) + " ; " + std::to_string(Text.size()) + " character string";
+        for (size_t i = 0; i < Text.size(); i++)
+            Layout += (i % 16 ? ", " : "\n    db ") + std::to_string(int((unsigned char)Text.at(i)));
+
+        return StringLiterals[Text] = CreateData(Layout, true);
+    }
+
+    void GenerateWorklist()
+    {
+        while (!FunctionWorklist.empty())
         {
-            GenerateStatement(Stmt);
+            auto [Decl, Func] = FunctionWorklist.back();
+            FunctionWorklist.pop_back();
+
+            CurrentEval = Decl;
+            GenerateFunctionDefinition(Decl, Func);
         }
+    }
 
-        for (auto &&[FuncId, FuncBody] : PendingFunctionDefinitions)
+    // functions of the program nothing calls still report their errors, what
+    // they and the functions only they call generate is thrown away
+    void CheckUnreachedFunctions()
+    {
+        const size_t Generated = PendingFunctionDefinitions.size();
+        const size_t ColdCode = ColdList.size();
+        const std::string FailureData1 = OutOfBoundsErrorMessageData1;
+        const std::string FailureData2 = OutOfBoundsErrorMessageData2;
+        const std::set<std::string> Externals = ExternalFunctions;
+        const std::string Listing = IRListing;
+        const std::map<std::string, size_t> Counts = Statistics;
+
+        Discarding = true;
+        for (const auto &[Decl, Func] : ParsedFunctions)
         {
-            if (FunctionSignatureCache.at(FuncId).second > 0)
-                Output << FuncBody;
+            if (TakeDeferredFunction(Func))
+                FunctionWorklist.push_back({Decl, Func});
+            GenerateWorklist();
         }
+        Discarding = false;
+
+        PendingFunctionDefinitions.resize(Generated);
+        ColdList.resize(ColdCode);
+        OutOfBoundsErrorMessageData1 = FailureData1;
+        OutOfBoundsErrorMessageData2 = FailureData2;
+        ExternalFunctions = Externals;
+        IRListing = Listing;
+        Statistics = Counts;
+    }
 
-        Output << "section .data\n";
-        Output << "StringBase:\n";
+    // lowered functions whose every call was inlined, an exported one may still be called from outside
+    void DropUncalledFunctions()
+    {
+        std::unordered_set<std::string> Called;
+        for (auto &[Index, Lowered] : LoweredFunctions)
+        {
+            for (const IRBlock &Block : Lowered->Blocks)
+            {
+                for (const IRInstruction &Instruction : Block.Instructions)
+                {
+                    if (Instruction.Op == IROpcode::Call)
+                        Called.insert(Instruction.Text);
+                }
+            }
+        }
 
-        for (auto &&Data : DataList)
+        std::unordered_set<size_t> Generated; // directly, their calls are only in the text
+        for (size_t i = 0; i < PendingFunctionDefinitions.size(); i++)
+            Generated.insert(i);
+        for (auto &[Index, Lowered] : LoweredFunctions)
+            Generated.erase(Index);
+
+        LoweredFunctions.erase(std::remove_if(LoweredFunctions.begin(), LoweredFunctions.end(),
+                                              [&](const std::pair<size_t, std::shared_ptr<IRFunction>> &Entry)
+                                              {
+                                                  const IRFunction &Function = *Entry.second;
+                                                  if (Function.Global || Called.count(Function.Name))
+                                                      return false;
+                                                  for (size_t Index : Generated)
+                                                  {
+                                                      if (PendingFunctionDefinitions.at(Index).Mentions(Function.Name))
+                                                          return false;
+                                                  }
+                                                  PendingFunctionDefinitions.at(Entry.first) = AsmBuffer();
+                                                  return true; }),
+                               LoweredFunctions.end());
+    }
+
+    // optimizes and selects what was lowered, then appends every function to Output
+    void EmitFunctions(bool DropUncalled)
+    {
+        for (const std::string &Name : ExternalFunctions)
+            Output << "extern " << Name << "\n";
+
+        PassManager Passes(CmplFlags);
         {
-            Output << "    " << Data << "\n";
+            std::vector<IRFunction *> Module;
+            for (auto &[Index, Lowered] : LoweredFunctions)
+                Module.push_back(Lowered.get());
+            Passes.RunModule(Module, PassDumps);
         }
+        if (DropUncalled && Passes.Enabled("inline"))
+            DropUncalledFunctions();
 
-        if (CurrentScope > 0)
+        for (auto &[Index, Lowered] : LoweredFunctions)
         {
-            Throw(CompileError("scope stack could not be closed", Fatal));
+            Passes.Run(*Lowered, PassDumps);
+            for (const auto &[Name, Count] : Lowered->Statistics)
+                Statistics[Name] += Count;
+            IRListing += Lowered->ToString() + "\n";
+            InstructionSelector Selector(CmplFlags, [this]()
+                                         { return CreateLabel(); }, [this](const std::string &Index, const std::string &Array)
+                                         { return OutOfBoundsPath(Index, Array); }, [this](const std::string &Text)
+                                         { return CreateStringLiteral(Text); });
+            PendingFunctionDefinitions.at(Index) = Selector.Select(*Lowered);
+            for (const auto &[Name, Count] : Selector.Statistics)
+                Statistics[Name] += Count;
         }
 
-        if (StackSize > 300)
+        if (Passes.Enabled("peephole"))
         {
-            Throw(CompileError("final stack overflown", Error));
+            for (AsmBuffer &FuncBody : PendingFunctionDefinitions)
+            {
+                const size_t Before = FuncBody.InstructionCount();
+                PeepholeOptimizer().Run(FuncBody);
+
+                if (CmplFlags.PrintAfter.count("peephole"))
+                    PassDumps += "; after peephole, " + std::to_string(Before) + " -> " + std::to_string(FuncBody.InstructionCount()) + " instructions\n" + FuncBody.ToString() + "\n";
+            }
         }
 
-        bool Found = false;
-        for (auto &&Var : Variables)
+        for (const AsmBuffer &FuncBody : PendingFunctionDefinitions)
         {
-            if (Var.Address != 1)
-                continue;
+            Output.Append(FuncBody);
+        }
+    }
 
-            Found = true;
-            break;
+    void EmitColdPathsAndData()
+    {
+        if (!ColdList.empty())
+        {
+            Output << "; cold paths, kept out of the way of the code that runs\n";
+            for (auto &&Cold : ColdList)
+                Output << Cold;
         }
 
-        if (!Found)
+        Output << "section .data\n";
+        Output << "StringBase:\n";
+
+        for (auto &&Data : DataList)
         {
-            Throw(CompileError("main() function could not be found", Warning));
+            Output << "    " << Data << "\n";
+        }
+
+        if (!ReadOnlyDataList.empty())
+        {
+            Output << "section .rodata\n";
+            for (auto &&Data : ReadOnlyDataList)
+                Output << "    " << Data << "\n";
         }
+    }
 
-        std::string Result = Output.str();
+    std::string TakeAssembly()
+    {
+        std::string Result = Output.Take().ToString();
 
         size_t CharPos = 0;
         while ((CharPos = Result.find("    ", CharPos)) != std::string::npos)
@@ -1600,103 +1762,163 @@ public:
         return Result;
     }
 
-    std::unordered_map<MapId, std::pair<std::string, size_t> /* <signature, refcount> */> FunctionSignatureCache;
-
-    /*
-     * function signature generator
-     * with mangled names that are
-     * easier to understand when debugging
-     */
-    std::string MangleFunctionSignature(const FunctionDefinition &Func, std::string OptionalFuncName = "function")
+public:
+    std::string GenerateProgram()
     {
-        if (FunctionSignatureCache.count(Func.UniqueId))
+        Output << "\nsection .bss\n    _numbuf resb 40\n" << HeapRuntime::Bss() << "section .text\n";
+
+        for (const StatementPtr &Stmt : Ast)
         {
-            FunctionSignatureCache.at(Func.UniqueId).second++;
-            return FunctionSignatureCache.at(Func.UniqueId).first;
+            GenerateStatement(Stmt);
         }
 
-        std::replace(OptionalFuncName.begin(), OptionalFuncName.end(), '-', '_');
+        GenerateWorklist();
+        CheckUnreachedFunctions();
+
+        EmitFunctions(true);
+        Output << HeapRuntime::Text();
+        EmitColdPathsAndData();
 
-        std::string Result = "f" + (std::to_string(Func.UniqueId)).substr(0, 5) + "_" + OptionalFuncName + "_" + std::string(magic_enum::enum_name(Func.ReturnType.Type));
+        if (CurrentScope > 0)
+        {
+            Throw(CompileError("scope stack could not be closed", Fatal));
+        }
 
-        if (Func.ReturnType.Nullable && Func.ReturnType.Type != ValueType::Null)
-            Result += "N";
-        if (!Func.ReturnType.Constant)
-            Result += "M";
-        for (size_t i = 0; i < Func.ReturnType.PointerDepth; i++)
-            Result += "P";
+        if (StackSize > 300)
+        {
+            Throw(CompileError("final stack overflown", Error));
+        }
 
-        for (auto &&Param : Func.Arguments)
+        bool Found = false;
+        for (auto &&Var : Variables)
         {
-            Result += std::string(magic_enum::enum_name(Param.Type.Type));
+            if (Var.Address != 1)
+                continue;
+
+            Found = true;
+            break;
+        }
 
-            if (Param.Type.Nullable && Func.ReturnType.Type != ValueType::Null)
-                Result += "N";
-            if (!Param.Type.Constant)
-                Result += "M";
-            for (size_t i = 0; i < Func.ReturnType.PointerDepth; i++)
-                Result += "P";
+        if (!Found)
+        {
+            Throw(CompileError("main() function could not be found", Warning));
         }
 
-        FunctionSignatureCache[Func.UniqueId] = std::make_pair(Result, 0);
+        return TakeAssembly();
+    }
 
-        return Result;
+    // furn --repl, what every entry links against, assembled once per session
+    static std::string SessionRuntime()
+    {
+        return "\nsection .bss\n    _numbuf resb 40\n" + HeapRuntime::Bss() + "section .text\n" + HeapRuntime::Text();
     }
 
-    std::shared_ptr<FunctionDefinition> CalculateBestOverload(std::shared_ptr<std::vector<std::shared_ptr<FunctionDefinition>>> Funcs, std::shared_ptr<CallExpression> Call, const bool Throws = false)
+    // furn --repl, one entry as a function the session calls once, the
+    // variables it declares at the top level are globals in its .bss and
+    // the functions it defines or reaches stay with the session
+    std::string GenerateEntry(const std::vector<StatementPtr> &Statements, const std::string &Label)
     {
-        std::shared_ptr<FunctionDefinition> Best = nullptr;
+        Resident = true;
+        Errors.clear();
 
-        // Try strictest → loosest
-        for (int Looseness = 0; Looseness <= 4; Looseness++)
+        EntryStart = SessionState{.Variables = Variables, .DeferredFunctions = DeferredFunctions, .StringLiterals = StringLiterals};
+        for (const Variable &Var : Variables)
         {
-            std::shared_ptr<FunctionDefinition> Match = nullptr;
+            if (Var.Funcs)
+                EntryStart.Overloads.push_back(*Var.Funcs);
+        }
 
-            for (auto &Func : *Funcs)
+        // only what this entry generates goes into its object
+        Output.Take();
+        PendingFunctionDefinitions.clear();
+        LoweredFunctions.clear();
+        ParsedFunctions.clear();
+        DataList.clear();
+        ReadOnlyDataList.clear();
+        ColdList.clear();
+        ExternalFunctions.clear();
+        GlobalList.clear();
+        OutOfBoundsErrorMessageData1.clear();
+        OutOfBoundsErrorMessageData2.clear();
+        IRListing.clear();
+        PassDumps.clear();
+
+        // the statements run in a function of their own, what they declare at the top level is not its to keep
+        const FunctionDefinition Entry(Statements, {}, TypeDescriptor(ValueType::Null).AsConstant());
+        Allocation = RegisterAllocator(CmplFlags).Allocate(Entry);
+        for (const StatementPtr &Stmt : Statements)
+        {
+            if (auto Decl = std::dynamic_pointer_cast<VarDeclaration>(Stmt))
             {
-                // Arg count mismatch → skip early
-                if (Func->Arguments.size() != Call->Arguments.size())
-                    continue;
-
-                bool AllParamsMatch = true;
+                Allocation.Locals.erase(Decl->Address);
+                Allocation.Objects.erase(Decl->Address);
+            }
+        }
+        CountedLoops.clear();
+        FunctionStatistics.clear();
+        CurrentFunction = nullptr;
+        StackSize = 0;
+
+        Output << Label << ": ; begin function\n";
+        Push(8); // return address
+        for (const char *Register : EntrySaved)
+            Push(Register, 8);
+        FrameSize = StackSize;
+
+        for (const StatementPtr &Stmt : Statements)
+        {
+            CurrentEval = Stmt;
+            auto Decl = std::dynamic_pointer_cast<VarDeclaration>(Stmt);
+            if (Decl && Decl->Address == 1)
+            {
+                Throw(CompileError("there is no main in the repl, statements run as they are entered", Error));
+                continue;
+            }
+            GenerateStatement(Stmt);
+        }
 
-                for (size_t i = 0; i < Func->Arguments.size(); ++i)
-                {
-                    auto CallType = ResolveSymbol(Call->Arguments[i]).TypeDesc;
-                    auto ParamType = Func->Arguments[i].Type;
+        for (size_t i = std::size(EntrySaved); i > 0; i--)
+            Pop(EntrySaved[i - 1], 8);
+        Pop(8);
+        Output << "    ret\n";
+        Output << "; end function " << Label << "\n";
+        PendingFunctionDefinitions.push_back(Output.Take());
 
-                    if (!CompileTypeMatch(CallType, ParamType, Looseness))
-                    {
-                        AllParamsMatch = false;
-                        break;
-                    }
-                }
+        GenerateWorklist();
 
-                if (!AllParamsMatch)
-                    continue;
+        // what nothing has called yet stays deferred for the entries after this one
+        const std::unordered_map<MapId, std::shared_ptr<VarDeclaration>> Deferred = DeferredFunctions;
+        CheckUnreachedFunctions();
+        DeferredFunctions = Deferred;
 
-                // First match at this looseness
-                if (!Match)
-                {
-                    Match = Func;
-                }
-                else
-                {
-                    // Second match → ambiguous
-                    if (Throws)
-                        Throw(CompileError("ambiguous call of overloaded function " + MangleFunctionSignature(*Match), Fatal));
-                    return nullptr;
-                }
-            }
+        Output << "section .bss\n";
+        for (const std::string &Global : GlobalList)
+            Output << "    " << Global << " resq 1\n";
+        Output << "section .text\n";
+        EmitFunctions(false);
+        EmitColdPathsAndData();
 
-            // If we found a valid match at this looseness → return it
-            if (Match)
-                return Match;
+        if (CurrentScope > 0)
+        {
+            Throw(CompileError("scope stack could not be closed", Fatal));
         }
 
-        // No overloads matched at any looseness
-        if (Throws)
-            Throw(CompileError("no overload of the function matches", Error));
-        return nullptr;
+        return TakeAssembly();
+    }
+
+    // furn --repl, forgets what the last GenerateEntry() declared when its code never reached the session
+    void DiscardEntry()
+    {
+        Variables = std::move(EntryStart.Variables);
+        size_t i = 0;
+        for (const Variable &Var : Variables)
+        {
+            if (Var.Funcs)
+                *Var.Funcs = EntryStart.Overloads.at(i++);
+        }
+        DeferredFunctions = std::move(EntryStart.DeferredFunctions);
+        StringLiterals = std::move(EntryStart.StringLiterals);
+        EntryStart = SessionState();
+        CurrentScope = 0;
     }
 };
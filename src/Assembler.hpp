@@ -0,0 +1,1373 @@
+#pragma once
+
+#include "Common.hpp"
+
+enum class AsmSection
+{
+    Text,
+    Data,
+    Bss,
+    ReadOnly, // only while assembling, appended to Text since that is never writable either
+};
+
+enum class RelocationType
+{
+    Absolute32S, // sign extended 32 bit address, the program is linked below 2GB
+    Relative32,  // call or jmp rel32 to a symbol defined somewhere else
+};
+
+struct AsmSymbol
+{
+    std::string Name;
+    AsmSection Section = AsmSection::Text;
+    uint64_t Offset = 0;
+    bool Global = false;
+};
+
+struct AsmRelocation
+{
+    uint64_t Offset = 0; // into Text
+    std::string Symbol;
+    int64_t Addend = 0;
+    RelocationType Type = RelocationType::Absolute32S;
+};
+
+// machine code before it is placed anywhere, references to symbols are left as relocations
+struct ObjectCode
+{
+    std::vector<uint8_t> Text;
+    std::vector<uint8_t> Data;
+    uint64_t BssSize = 0;
+    std::vector<AsmSymbol> Symbols;
+    std::vector<AsmRelocation> Relocations;
+
+    const AsmSymbol *FindSymbol(const std::string &Name) const
+    {
+        for (const AsmSymbol &Symbol : Symbols)
+        {
+            if (Symbol.Name == Name)
+                return &Symbol;
+        }
+        return nullptr;
+    }
+
+    // patches every relocation for the sections placed at these addresses, false if a symbol is missing
+    // Resident has the addresses of symbols linked before, they are used when this object does not define one
+    bool Link(std::vector<uint8_t> &LinkedText, uint64_t TextAddress, uint64_t DataAddress, uint64_t BssAddress, std::string &Missing, const std::unordered_map<std::string, uint64_t> &Resident = {}) const
+    {
+        LinkedText = Text;
+
+        for (const AsmRelocation &Relocation : Relocations)
+        {
+            const AsmSymbol *Symbol = FindSymbol(Relocation.Symbol);
+            if (!Symbol && !Resident.count(Relocation.Symbol))
+            {
+                Missing = Relocation.Symbol;
+                return false;
+            }
+
+            uint64_t Base = 0;
+            if (Symbol)
+                Base = (Symbol->Section == AsmSection::Text ? TextAddress : Symbol->Section == AsmSection::Data ? DataAddress
+                                                                                                                  : BssAddress) +
+                       Symbol->Offset;
+            else
+                Base = Resident.at(Relocation.Symbol);
+            const int64_t Address = Base + Relocation.Addend;
+            const int64_t Value = Relocation.Type == RelocationType::Relative32 ? Address - int64_t(TextAddress + Relocation.Offset) : Address;
+            if (Value < INT32_MIN || Value > INT32_MAX)
+            {
+                Missing = Relocation.Symbol + " (out of range)";
+                return false;
+            }
+
+            for (int i = 0; i < 4; i++)
+                LinkedText.at(Relocation.Offset + i) = uint8_t(uint32_t(Value) >> (8 * i));
+        }
+
+        return true;
+    }
+};
+
+/*
+ * encodes the NASM subset the code generator and the standard library
+ * emit into x86-64 machine code, anything else makes Assemble() fail
+ * with a message so the caller can fall back to an external assembler
+ */
+class X64Assembler
+{
+public:
+    std::string Error; // why Assemble() returned false
+
+    bool Assemble(const std::string &Source, ObjectCode &Object)
+    {
+        try
+        {
+            Parse(Source);
+            Layout();
+            Emit(Object);
+            return true;
+        }
+        catch (const std::runtime_error &Failure)
+        {
+            Error = "line " + std::to_string(LineNumber) + ": " + Failure.what();
+            return false;
+        }
+    }
+
+private:
+    struct Operand
+    {
+        enum
+        {
+            Register,
+            Memory,
+            Immediate,
+        } Kind = Immediate;
+
+        int Size = 0; // bytes, 0 when a memory operand does not say
+        int Reg = -1;
+        bool HighByte = false; // ah, ch, dh, bh
+        bool ForcesRex = false; // spl, bpl, sil, dil and r8b..r15b
+
+        int Base = -1;
+        int Index = -1;
+        int Scale = 1;
+
+        int64_t Value = 0;  // displacement or immediate
+        std::string Symbol; // added to Value once linked
+    };
+
+    struct Instruction
+    {
+        std::string Mnemonic;
+        std::vector<Operand> Operands;
+        size_t Line = 0;
+
+        // filled in by Layout()
+        std::string Target; // jumps and calls to a label
+        bool Short = true;
+        std::vector<uint8_t> Bytes;
+        std::vector<AsmRelocation> Relocations; // offsets into Bytes
+        uint64_t Offset = 0;
+    };
+
+    struct Item
+    {
+        std::string Label; // defines the label instead when not empty
+        size_t Instruction = SIZE_MAX;
+    };
+
+    std::vector<Instruction> Instructions;
+    std::vector<Item> TextItems;
+    std::unordered_map<std::string, uint64_t> TextLabels;
+    std::vector<AsmSymbol> DataSymbols;
+    std::vector<uint8_t> Data;
+    std::vector<uint8_t> ReadOnlyData;
+    uint64_t BssSize = 0;
+    std::set<std::string> Globals;
+    size_t LineNumber = 0;
+
+    [[noreturn]] static void Fail(const std::string &Message)
+    {
+        throw std::runtime_error(Message);
+    }
+
+    static std::string Lower(std::string Text)
+    {
+        std::transform(Text.begin(), Text.end(), Text.begin(), [](unsigned char c)
+                       { return std::tolower(c); });
+        return Text;
+    }
+
+    static std::string Trim(const std::string &Text)
+    {
+        const size_t Begin = Text.find_first_not_of(" \t\r");
+        if (Begin == std::string::npos)
+            return "";
+        return Text.substr(Begin, Text.find_last_not_of(" \t\r") - Begin + 1);
+    }
+
+    // splits on commas outside brackets and quotes
+    static std::vector<std::string> SplitList(const std::string &Text)
+    {
+        std::vector<std::string> Items;
+        std::string Current;
+        int Depth = 0;
+        char Quote = 0;
+        for (char c : Text)
+        {
+            if (Quote)
+            {
+                if (c == Quote)
+                    Quote = 0;
+            }
+            else if (c == '"' || c == '\'' || c == '`')
+                Quote = c;
+            else if (c == '[')
+                Depth++;
+            else if (c == ']')
+                Depth--;
+            else if (c == ',' && !Depth)
+            {
+                Items.push_back(Trim(Current));
+                Current.clear();
+                continue;
+            }
+            Current += c;
+        }
+        if (!Trim(Current).empty())
+            Items.push_back(Trim(Current));
+        return Items;
+    }
+
+    static std::string StripComment(const std::string &Line)
+    {
+        char Quote = 0;
+        for (size_t i = 0; i < Line.size(); i++)
+        {
+            const char c = Line.at(i);
+            if (Quote)
+            {
+                if (c == Quote)
+                    Quote = 0;
+            }
+            else if (c == '"' || c == '\'' || c == '`')
+                Quote = c;
+            else if (c == ';')
+                return Line.substr(0, i);
+        }
+        return Line;
+    }
+
+    static bool ParseNumber(const std::string &Text, int64_t &Value)
+    {
+        if (Text.empty())
+            return false;
+        if (Text.size() == 3 && (Text.front() == '\'' || Text.front() == '"') && Text.back() == Text.front())
+        {
+            Value = (unsigned char)Text.at(1);
+            return true;
+        }
+
+        size_t Used = 0;
+        try
+        {
+            if (Text.rfind("0x", 0) == 0 || Text.rfind("0X", 0) == 0)
+                Value = int64_t(std::stoull(Text.substr(2), &Used, 16)), Used += 2;
+            else if (Text.rfind("-0x", 0) == 0)
+                Value = -int64_t(std::stoull(Text.substr(3), &Used, 16)), Used += 3;
+            else if (std::isdigit((unsigned char)Text.front()) || Text.front() == '-')
+                Value = std::stoll(Text, &Used, 10);
+            else
+                return false;
+        }
+        catch (const std::exception &)
+        {
+            return false;
+        }
+        return Used == Text.size();
+    }
+
+    struct RegisterName
+    {
+        int Reg;
+        int Size;
+        bool HighByte;
+        bool ForcesRex;
+    };
+
+    static std::optional<RegisterName> FindRegister(const std::string &Name)
+    {
+        static const std::vector<std::string> Names64 = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi"};
+        static const std::vector<std::string> Names32 = {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi"};
+        static const std::vector<std::string> Names16 = {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di"};
+        static const std::vector<std::string> Names8 = {"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil"};
+        static const std::vector<std::string> High8 = {"ah", "ch", "dh", "bh"};
+
+        for (int i = 0; i < 8; i++)
+        {
+            if (Name == Names64.at(i))
+                return RegisterName{i, 8, false, false};
+            if (Name == Names32.at(i))
+                return RegisterName{i, 4, false, false};
+            if (Name == Names16.at(i))
+                return RegisterName{i, 2, false, false};
+            if (Name == Names8.at(i))
+                return RegisterName{i, 1, false, i >= 4};
+        }
+        for (int i = 0; i < 4; i++)
+        {
+            if (Name == High8.at(i))
+                return RegisterName{i + 4, 1, true, false};
+        }
+
+        if (Name.size() >= 2 && Name.front() == 'r' && std::isdigit((unsigned char)Name.at(1)))
+        {
+            size_t Used = 0;
+            const int Number = std::stoi(Name.substr(1), &Used);
+            const std::string Suffix = Name.substr(1 + Used);
+            if (Number < 8 || Number > 15)
+                return std::nullopt;
+            if (Suffix.empty())
+                return RegisterName{Number, 8, false, false};
+            if (Suffix == "d")
+                return RegisterName{Number, 4, false, false};
+            if (Suffix == "w")
+                return RegisterName{Number, 2, false, false};
+            if (Suffix == "b")
+                return RegisterName{Number, 1, false, true};
+        }
+
+        // vector registers, sized by how many bytes they hold
+        if (Name.size() >= 4 && (Name.rfind("xmm", 0) == 0 || Name.rfind("ymm", 0) == 0) && std::isdigit((unsigned char)Name.at(3)))
+        {
+            size_t Used = 0;
+            const int Number = std::stoi(Name.substr(3), &Used);
+            if (3 + Used != Name.size() || Number > 15)
+                return std::nullopt;
+            return RegisterName{Number, Name.front() == 'x' ? 16 : 32, false, false};
+        }
+        return std::nullopt;
+    }
+
+    // number, symbol or symbol +- number
+    void ParseExpression(const std::string &Text, int64_t &Value, std::string &Symbol)
+    {
+        std::string Term;
+        int Sign = 1;
+        auto Flush = [&]()
+        {
+            const std::string Part = Trim(Term);
+            Term.clear();
+            if (Part.empty())
+                return;
+            int64_t Number = 0;
+            if (ParseNumber(Part, Number))
+                Value += Sign * Number;
+            else if (Symbol.empty() && Sign == 1)
+                Symbol = Part;
+            else
+                Fail("unsupported expression '" + Text + "'");
+        };
+
+        for (char c : Text)
+        {
+            if ((c == '+' || c == '-') && !Trim(Term).empty())
+            {
+                Flush();
+                Sign = c == '+' ? 1 : -1;
+                continue;
+            }
+            if (c == '-' && Trim(Term).empty())
+            {
+                Sign = -Sign;
+                continue;
+            }
+            if (c == '+' && Trim(Term).empty())
+                continue;
+            Term += c;
+        }
+        Flush();
+    }
+
+    Operand ParseOperand(std::string Text)
+    {
+        Operand Result;
+        Text = Trim(Text);
+
+        static const std::vector<std::pair<std::string, int>> Sizes = {{"byte", 1}, {"word", 2}, {"dword", 4}, {"qword", 8}};
+        for (const auto &[Keyword, Size] : Sizes)
+        {
+            const std::string Prefix = Lower(Text.substr(0, Keyword.size()));
+            if (Prefix == Keyword && Text.size() > Keyword.size() && (std::isspace((unsigned char)Text.at(Keyword.size())) || Text.at(Keyword.size()) == '['))
+            {
+                Result.Size = Size;
+                Text = Trim(Text.substr(Keyword.size()));
+                break;
+            }
+        }
+
+        if (!Text.empty() && Text.front() == '[')
+        {
+            if (Text.back() != ']')
+                Fail("unterminated memory operand '" + Text + "'");
+            Result.Kind = Operand::Memory;
+
+            // terms separated by + and -, register terms may be scaled
+            std::string Inner = Text.substr(1, Text.size() - 2);
+            std::string Term;
+            int Sign = 1;
+            auto Flush = [&]()
+            {
+                std::string Part = Trim(Term);
+                Term.clear();
+                if (Part.empty())
+                    return;
+
+                std::string Factor;
+                const size_t Star = Part.find('*');
+                if (Star != std::string::npos)
+                {
+                    Factor = Trim(Part.substr(Star + 1));
+                    Part = Trim(Part.substr(0, Star));
+                    if (!FindRegister(Part) && FindRegister(Factor))
+                        std::swap(Part, Factor);
+                }
+
+                if (std::optional<RegisterName> Reg = FindRegister(Part))
+                {
+                    if (Reg->Size != 8 || Sign < 0)
+                        Fail("unsupported address '" + Text + "'");
+                    int64_t Scale = 1;
+                    if (!Factor.empty() && !ParseNumber(Factor, Scale))
+                        Fail("unsupported scale in '" + Text + "'");
+                    if (Scale == 1 && Result.Base < 0)
+                        Result.Base = Reg->Reg;
+                    else if (Result.Index < 0 && Reg->Reg != 4)
+                        Result.Index = Reg->Reg, Result.Scale = Scale;
+                    else
+                        Fail("unsupported address '" + Text + "'");
+                    return;
+                }
+
+                int64_t Number = 0;
+                if (ParseNumber(Part, Number))
+                    Result.Value += Sign * Number;
+                else if (Result.Symbol.empty() && Sign == 1 && Factor.empty())
+                    Result.Symbol = Part;
+                else
+                    Fail("unsupported address '" + Text + "'");
+            };
+
+            for (char c : Inner)
+            {
+                if ((c == '+' || c == '-') && !Trim(Term).empty())
+                {
+                    Flush();
+                    Sign = c == '+' ? 1 : -1;
+                    continue;
+                }
+                if (c == '-' && Trim(Term).empty())
+                {
+                    Sign = -Sign;
+                    continue;
+                }
+                Term += c;
+            }
+            Flush();
+
+            if (Result.Scale != 1 && Result.Scale != 2 && Result.Scale != 4 && Result.Scale != 8)
+                Fail("unsupported scale in '" + Text + "'");
+            return Result;
+        }
+
+        if (std::optional<RegisterName> Reg = FindRegister(Lower(Text)))
+        {
+            Result.Kind = Operand::Register;
+            Result.Reg = Reg->Reg;
+            Result.Size = Reg->Size;
+            Result.HighByte = Reg->HighByte;
+            Result.ForcesRex = Reg->ForcesRex;
+            return Result;
+        }
+
+        Result.Kind = Operand::Immediate;
+        ParseExpression(Text, Result.Value, Result.Symbol);
+        return Result;
+    }
+
+    std::string Qualify(const std::string &Label, const std::string &Scope) const
+    {
+        return !Label.empty() && Label.front() == '.' ? Scope + Label : Label;
+    }
+
+    void Parse(const std::string &Source)
+    {
+        std::stringstream Stream(Source);
+        std::string Line;
+        AsmSection Section = AsmSection::Text;
+        std::string Scope; // the last label that was not local, for .labels
+
+        LineNumber = 0;
+        while (std::getline(Stream, Line))
+        {
+            LineNumber++;
+            std::string Code = Trim(StripComment(Line));
+            if (Code.empty())
+                continue;
+
+            const std::string First = Lower(Code.substr(0, Code.find_first_of(" \t")));
+            if (First == "section")
+            {
+                const std::string Name = Trim(Code.substr(7));
+                if (Name == ".text")
+                    Section = AsmSection::Text;
+                else if (Name == ".data")
+                    Section = AsmSection::Data;
+                else if (Name == ".rodata")
+                    Section = AsmSection::ReadOnly;
+                else if (Name == ".bss")
+                    Section = AsmSection::Bss;
+                else
+                    Fail("unknown section " + Name);
+                continue;
+            }
+            if (First == "global")
+            {
+                for (const std::string &Name : SplitList(Code.substr(6)))
+                    Globals.insert(Name);
+                continue;
+            }
+            if (First == "extern" || First == "default" || First == "bits")
+                continue;
+
+            // label: with or without something after it
+            const size_t Colon = Code.find(':');
+            if (Colon != std::string::npos && Code.find_first_of(" \t\"'[") > Colon)
+            {
+                const std::string Name = Qualify(Trim(Code.substr(0, Colon)), Scope);
+                if (Code.front() != '.')
+                    Scope = Name;
+                DefineLabel(Name, Section);
+                Code = Trim(Code.substr(Colon + 1));
+                if (Code.empty())
+                    continue;
+            }
+
+            if (Section != AsmSection::Text)
+            {
+                ParseData(Code, Section);
+                continue;
+            }
+
+            size_t Space = Code.find_first_of(" \t");
+            if (Lower(Code.substr(0, Space)) == "rep")
+                Space = Code.find_first_of(" \t", Code.find_first_not_of(" \t", Space)); // the prefix is part of the mnemonic
+            Instruction Parsed{.Mnemonic = Lower(Code.substr(0, Space)), .Line = LineNumber};
+            const std::string Rest = Space == std::string::npos ? "" : Code.substr(Space + 1);
+            std::replace(Parsed.Mnemonic.begin(), Parsed.Mnemonic.end(), '\t', ' ');
+
+            if (Parsed.Mnemonic == "call" || Parsed.Mnemonic == "jmp" || (Parsed.Mnemonic.front() == 'j' && ConditionCode(Parsed.Mnemonic.substr(1)) >= 0))
+            {
+                const std::string Target = Trim(Rest);
+                if (!FindRegister(Lower(Target)) && Target.find('[') == std::string::npos)
+                {
+                    Parsed.Target = Qualify(Target, Scope);
+                    TextItems.push_back(Item{.Instruction = Instructions.size()});
+                    Instructions.push_back(Parsed);
+                    continue;
+                }
+            }
+
+            for (const std::string &Text : SplitList(Rest))
+                Parsed.Operands.push_back(ParseOperand(Text));
+
+            TextItems.push_back(Item{.Instruction = Instructions.size()});
+            Instructions.push_back(Parsed);
+        }
+    }
+
+    void DefineLabel(const std::string &Name, AsmSection Section)
+    {
+        if (Section == AsmSection::Text)
+        {
+            TextItems.push_back(Item{.Label = Name});
+            TextLabels[Name] = 0;
+        }
+        else
+            DataSymbols.push_back(AsmSymbol{.Name = Name, .Section = Section, .Offset = Section == AsmSection::Bss ? BssSize : Bytes(Section).size()});
+    }
+
+    std::vector<uint8_t> &Bytes(AsmSection Section)
+    {
+        return Section == AsmSection::ReadOnly ? ReadOnlyData : Data;
+    }
+
+    void ParseData(const std::string &Code, AsmSection Section)
+    {
+        std::string Directive = Code.substr(0, Code.find_first_of(" \t"));
+        std::string Rest = Code.size() > Directive.size() ? Trim(Code.substr(Directive.size())) : "";
+
+        static const std::vector<std::string> Directives = {"db", "dw", "dd", "dq", "resb", "resw", "resd", "resq"};
+        if (std::find(Directives.begin(), Directives.end(), Lower(Directive)) == Directives.end())
+        {
+            // NASM allows `name db ...` without the colon
+            DefineLabel(Directive, Section);
+            Directive = Rest.substr(0, Rest.find_first_of(" \t"));
+            Rest = Rest.size() > Directive.size() ? Trim(Rest.substr(Directive.size())) : "";
+        }
+        Directive = Lower(Directive);
+
+        const int Width = Directive.back() == 'b' ? 1 : Directive.back() == 'w' ? 2
+                                                     : Directive.back() == 'd'   ? 4
+                                                                                 : 8;
+        if (Directive.rfind("res", 0) == 0)
+        {
+            int64_t Count = 0;
+            if (!ParseNumber(Rest, Count))
+                Fail("bad reservation '" + Code + "'");
+            if (Section == AsmSection::Bss)
+                BssSize += Count * Width;
+            else
+                Bytes(Section).insert(Bytes(Section).end(), Count * Width, 0);
+            return;
+        }
+        if (Section == AsmSection::Bss)
+            Fail("initialized data in .bss");
+
+        std::vector<uint8_t> &Target = Bytes(Section);
+        if (Directive != "db" && Directive != "dw" && Directive != "dd" && Directive != "dq")
+            Fail("unknown directive '" + Directive + "'");
+
+        for (const std::string &Value : SplitList(Rest))
+        {
+            if (Value.size() >= 2 && (Value.front() == '"' || Value.front() == '\'' || Value.front() == '`') && Value.back() == Value.front() && !(Value.size() == 3 && Width > 1))
+            {
+                const size_t Start = Target.size();
+                for (size_t i = 1; i + 1 < Value.size(); i++)
+                    Target.push_back(Value.at(i));
+                while ((Target.size() - Start) % Width)
+                    Target.push_back(0);
+                continue;
+            }
+
+            int64_t Number = 0;
+            if (!ParseNumber(Value, Number))
+                Fail("unsupported data '" + Value + "'");
+            for (int i = 0; i < Width; i++)
+                Target.push_back(uint8_t(uint64_t(Number) >> (8 * i)));
+        }
+    }
+
+    static int ConditionCode(const std::string &Suffix)
+    {
+        static const std::vector<std::pair<std::string, int>> Codes = {
+            {"o", 0}, {"no", 1}, {"b", 2}, {"c", 2}, {"nae", 2}, {"ae", 3}, {"nb", 3}, {"nc", 3}, {"e", 4}, {"z", 4}, {"ne", 5}, {"nz", 5}, {"be", 6}, {"na", 6}, {"a", 7}, {"nbe", 7}, {"s", 8}, {"ns", 9}, {"p", 10}, {"pe", 10}, {"np", 11}, {"po", 11}, {"l", 12}, {"nge", 12}, {"ge", 13}, {"nl", 13}, {"le", 14}, {"ng", 14}, {"g", 15}, {"nle", 15}};
+        for (const auto &[Name, Code] : Codes)
+        {
+            if (Name == Suffix)
+                return Code;
+        }
+        return -1;
+    }
+
+    static bool FitsInt8(int64_t Value)
+    {
+        return Value >= -128 && Value <= 127;
+    }
+
+    static bool FitsInt32(int64_t Value)
+    {
+        return Value >= INT32_MIN && Value <= INT32_MAX;
+    }
+
+    static void Append(std::vector<uint8_t> &Bytes, uint64_t Value, int Width)
+    {
+        for (int i = 0; i < Width; i++)
+            Bytes.push_back(uint8_t(Value >> (8 * i)));
+    }
+
+    // prefixes, REX, opcode, ModRM, SIB and displacement for an r/m operand
+    void EncodeModRM(Instruction &Out, const std::vector<uint8_t> &Opcode, int RegField, const Operand &RM, int Size, bool Default64 = false, bool RegForcesRex = false, bool RegHighByte = false)
+    {
+        std::vector<uint8_t> &Bytes = Out.Bytes;
+        if (Size == 2)
+            Bytes.push_back(0x66);
+
+        uint8_t Rex = 0;
+        if (Size == 8 && !Default64)
+            Rex |= 0x08;
+        if (RegField >= 8)
+            Rex |= 0x04;
+        if (RM.Kind == Operand::Memory)
+        {
+            if (RM.Index >= 8)
+                Rex |= 0x02;
+            if (RM.Base >= 8)
+                Rex |= 0x01;
+        }
+        else if (RM.Reg >= 8)
+            Rex |= 0x01;
+
+        const bool NeedsRex = Rex || RegForcesRex || (RM.Kind == Operand::Register && RM.ForcesRex);
+        if (NeedsRex && (RegHighByte || (RM.Kind == Operand::Register && RM.HighByte)))
+            Fail("ah, bh, ch and dh cannot be used with a REX prefix");
+        if (NeedsRex)
+            Bytes.push_back(0x40 | Rex);
+
+        Bytes.insert(Bytes.end(), Opcode.begin(), Opcode.end());
+        EncodeOperand(Out, RegField, RM);
+    }
+
+    // ModRM, SIB and displacement, what follows the opcode
+    void EncodeOperand(Instruction &Out, int RegField, const Operand &RM)
+    {
+        std::vector<uint8_t> &Bytes = Out.Bytes;
+        const uint8_t Reg = uint8_t((RegField & 7) << 3);
+        if (RM.Kind == Operand::Register)
+        {
+            Bytes.push_back(0xC0 | Reg | (RM.Reg & 7));
+            return;
+        }
+
+        // memory
+        const bool HasSymbol = !RM.Symbol.empty();
+        auto Displacement = [&](int Width)
+        {
+            if (Width == 4 && HasSymbol)
+                Out.Relocations.push_back(AsmRelocation{.Offset = Bytes.size(), .Symbol = RM.Symbol, .Addend = RM.Value});
+            Append(Bytes, Width == 4 && HasSymbol ? 0 : uint64_t(RM.Value), Width);
+        };
+
+        if (RM.Base < 0)
+        {
+            // [disp32] or [index * scale + disp32], never rip relative
+            Bytes.push_back(0x04 | Reg);
+            const int Index = RM.Index < 0 ? 4 : RM.Index & 7;
+            Bytes.push_back(uint8_t((ScaleBits(RM.Scale) << 6) | (Index << 3) | 5));
+            Displacement(4);
+            return;
+        }
+
+        int Mod = 2;
+        if (!HasSymbol && RM.Value == 0 && (RM.Base & 7) != 5)
+            Mod = 0;
+        else if (!HasSymbol && FitsInt8(RM.Value))
+            Mod = 1;
+        else if (!FitsInt32(RM.Value))
+            Fail("displacement out of range");
+
+        if (RM.Index >= 0 || (RM.Base & 7) == 4)
+        {
+            Bytes.push_back(uint8_t(Mod << 6) | Reg | 4);
+            const int Index = RM.Index < 0 ? 4 : RM.Index & 7;
+            Bytes.push_back(uint8_t((ScaleBits(RM.Scale) << 6) | (Index << 3) | (RM.Base & 7)));
+        }
+        else
+            Bytes.push_back(uint8_t(Mod << 6) | Reg | (RM.Base & 7));
+
+        if (Mod == 1)
+            Displacement(1);
+        else if (Mod == 2)
+            Displacement(4);
+    }
+
+    static int ScaleBits(int Scale)
+    {
+        return Scale == 8 ? 3 : Scale == 4 ? 2
+                            : Scale == 2   ? 1
+                                           : 0;
+    }
+
+    void Immediate(Instruction &Out, const Operand &Imm, int Width)
+    {
+        if (!Imm.Symbol.empty())
+        {
+            if (Width != 4)
+                Fail("symbol needs a 32 bit immediate");
+            Out.Relocations.push_back(AsmRelocation{.Offset = Out.Bytes.size(), .Symbol = Imm.Symbol, .Addend = Imm.Value});
+            Append(Out.Bytes, 0, 4);
+            return;
+        }
+        Append(Out.Bytes, uint64_t(Imm.Value), Width);
+    }
+
+    static int OperandSize(const Instruction &In)
+    {
+        int Size = 0;
+        for (const Operand &Op : In.Operands)
+        {
+            if (Op.Kind == Operand::Register)
+                return Op.Size;
+            if (Op.Kind == Operand::Memory && Op.Size)
+                Size = Op.Size;
+        }
+        return Size;
+    }
+
+    void Expect(const Instruction &In, size_t Count)
+    {
+        if (In.Operands.size() != Count)
+            Fail(In.Mnemonic + " expects " + std::to_string(Count) + " operands");
+    }
+
+    // the ALU group: add or adc sbb and sub xor cmp
+    void EncodeArithmetic(Instruction &In, int Group)
+    {
+        Expect(In, 2);
+        const Operand &Dst = In.Operands.at(0);
+        const Operand &Src = In.Operands.at(1);
+        const int Size = OperandSize(In);
+        if (!Size)
+            Fail("operation size not specified");
+
+        if (Src.Kind == Operand::Immediate)
+        {
+            if (Size == 1)
+            {
+                EncodeModRM(In, {0x80}, Group, Dst, Size);
+                Immediate(In, Src, 1);
+            }
+            else if (Src.Symbol.empty() && FitsInt8(Src.Value))
+            {
+                EncodeModRM(In, {0x83}, Group, Dst, Size);
+                Immediate(In, Src, 1);
+            }
+            else
+            {
+                EncodeModRM(In, {0x81}, Group, Dst, Size);
+                Immediate(In, Src, Size == 2 ? 2 : 4);
+            }
+            return;
+        }
+
+        const uint8_t Base = uint8_t(Group << 3);
+        if (Src.Kind == Operand::Register)
+            EncodeModRM(In, {uint8_t(Base | (Size == 1 ? 0 : 1))}, Src.Reg, Dst, Size, false, Src.ForcesRex, Src.HighByte);
+        else if (Dst.Kind == Operand::Register)
+            EncodeModRM(In, {uint8_t(Base | (Size == 1 ? 2 : 3))}, Dst.Reg, Src, Size, false, Dst.ForcesRex, Dst.HighByte);
+        else
+            Fail("two memory operands");
+    }
+
+    void EncodeMov(Instruction &In)
+    {
+        Expect(In, 2);
+        const Operand &Dst = In.Operands.at(0);
+        const Operand &Src = In.Operands.at(1);
+        const int Size = OperandSize(In);
+        if (!Size)
+            Fail("operation size not specified");
+
+        if (Src.Kind == Operand::Immediate)
+        {
+            if (Dst.Kind == Operand::Register && Size == 8 && Src.Symbol.empty() && !FitsInt32(Src.Value))
+            {
+                // movabs
+                if (Dst.Reg >= 8)
+                    In.Bytes.push_back(0x49);
+                else
+                    In.Bytes.push_back(0x48);
+                In.Bytes.push_back(0xB8 | (Dst.Reg & 7));
+                Append(In.Bytes, uint64_t(Src.Value), 8);
+                return;
+            }
+            if (Dst.Kind == Operand::Register && Size == 8 && Src.Symbol.empty() && Src.Value >= 0)
+            {
+                // mov r32, imm32 clears the upper half
+                if (Dst.Reg >= 8)
+                    In.Bytes.push_back(0x41);
+                In.Bytes.push_back(0xB8 | (Dst.Reg & 7));
+                Append(In.Bytes, uint64_t(Src.Value), 4);
+                return;
+            }
+            if (Size == 1)
+            {
+                EncodeModRM(In, {0xC6}, 0, Dst, Size);
+                Immediate(In, Src, 1);
+                return;
+            }
+            EncodeModRM(In, {0xC7}, 0, Dst, Size);
+            Immediate(In, Src, Size == 2 ? 2 : 4);
+            return;
+        }
+
+        if (Src.Kind == Operand::Register)
+            EncodeModRM(In, {uint8_t(Size == 1 ? 0x88 : 0x89)}, Src.Reg, Dst, Size, false, Src.ForcesRex, Src.HighByte);
+        else if (Dst.Kind == Operand::Register)
+            EncodeModRM(In, {uint8_t(Size == 1 ? 0x8A : 0x8B)}, Dst.Reg, Src, Size, false, Dst.ForcesRex, Dst.HighByte);
+        else
+            Fail("two memory operands");
+    }
+
+    // one form of an SSE or AVX instruction, names starting with v are VEX encoded
+    struct VectorForm
+    {
+        std::string Name;
+        uint8_t Prefix = 0;          // 0x66, 0xF3, 0xF2 or none
+        std::vector<uint8_t> Opcode; // 0F, 0F 38 or 0F 3A and the opcode
+        bool Store = false;          // the register operand is the source and r/m the destination
+        bool Wide = false;           // REX.W or VEX.W, 64 bit general registers
+        bool General = false;        // r/m is a general register or memory, never a vector register
+        bool Immediate = false;      // an imm8 last
+    };
+
+    static const std::vector<VectorForm> &VectorForms()
+    {
+        static const std::vector<VectorForm> All = {
+            {"movdqu", 0xF3, {0x0F, 0x6F}},
+            {"movdqu", 0xF3, {0x0F, 0x7F}, true},
+            {"movdqa", 0x66, {0x0F, 0x6F}},
+            {"movdqa", 0x66, {0x0F, 0x7F}, true},
+            {"movd", 0x66, {0x0F, 0x6E}, false, false, true},
+            {"movd", 0x66, {0x0F, 0x7E}, true, false, true},
+            {"movq", 0x66, {0x0F, 0x6E}, false, true, true},
+            {"movq", 0x66, {0x0F, 0x7E}, true, true, true},
+            {"pshufd", 0x66, {0x0F, 0x70}, false, false, false, true},
+            {"paddd", 0x66, {0x0F, 0xFE}},
+            {"psubd", 0x66, {0x0F, 0xFA}},
+            {"paddq", 0x66, {0x0F, 0xD4}},
+            {"pcmpgtd", 0x66, {0x0F, 0x66}},
+            {"pand", 0x66, {0x0F, 0xDB}},
+            {"pandn", 0x66, {0x0F, 0xDF}},
+            {"por", 0x66, {0x0F, 0xEB}},
+            {"pxor", 0x66, {0x0F, 0xEF}},
+            {"punpckldq", 0x66, {0x0F, 0x62}},
+            {"punpckhdq", 0x66, {0x0F, 0x6A}},
+            {"addsd", 0xF2, {0x0F, 0x58}},
+            {"subsd", 0xF2, {0x0F, 0x5C}},
+            {"mulsd", 0xF2, {0x0F, 0x59}},
+            {"divsd", 0xF2, {0x0F, 0x5E}},
+            {"ucomisd", 0x66, {0x0F, 0x2E}},
+            {"cvtsi2sd", 0xF2, {0x0F, 0x2A}, false, true, true},
+            {"cvttsd2si", 0xF2, {0x0F, 0x2C}, false, true},
+            {"cvtsd2si", 0xF2, {0x0F, 0x2D}, false, true},
+            {"cvtss2sd", 0xF3, {0x0F, 0x5A}},
+            {"cvtsd2ss", 0xF2, {0x0F, 0x5A}},
+            {"vmovdqu", 0xF3, {0x0F, 0x6F}},
+            {"vmovdqu", 0xF3, {0x0F, 0x7F}, true},
+            {"vmovd", 0x66, {0x0F, 0x6E}, false, false, true},
+            {"vmovd", 0x66, {0x0F, 0x7E}, true, false, true},
+            {"vmovq", 0x66, {0x0F, 0x6E}, false, true, true},
+            {"vmovq", 0x66, {0x0F, 0x7E}, true, true, true},
+            {"vpshufd", 0x66, {0x0F, 0x70}, false, false, false, true},
+            {"vpbroadcastd", 0x66, {0x0F, 0x38, 0x58}},
+            {"vpmovsxdq", 0x66, {0x0F, 0x38, 0x25}},
+            {"vextracti128", 0x66, {0x0F, 0x3A, 0x39}, true, false, false, true},
+            {"vpaddd", 0x66, {0x0F, 0xFE}},
+            {"vpsubd", 0x66, {0x0F, 0xFA}},
+            {"vpaddq", 0x66, {0x0F, 0xD4}},
+            {"vpxor", 0x66, {0x0F, 0xEF}},
+            {"vpmulld", 0x66, {0x0F, 0x38, 0x40}},
+            {"vpmaxsd", 0x66, {0x0F, 0x38, 0x3D}},
+            {"vpminsd", 0x66, {0x0F, 0x38, 0x39}},
+        };
+        return All;
+    }
+
+    static bool IsVectorRegister(const Operand &Op)
+    {
+        return Op.Kind == Operand::Register && Op.Size >= 16;
+    }
+
+    // the form for these operands, a store when the first is not a vector register
+    static const VectorForm *FindVectorForm(const Instruction &In)
+    {
+        const bool Stores = !In.Operands.empty() && !IsVectorRegister(In.Operands.front());
+        const VectorForm *Found = nullptr;
+        for (const VectorForm &Form : VectorForms())
+        {
+            if (Form.Name != In.Mnemonic)
+                continue;
+            if (!Found || Form.Store == Stores)
+                Found = &Form;
+        }
+        return Found;
+    }
+
+    // two operands and maybe an imm8, or with VEX a second source in front of the last
+    void EncodeVector(Instruction &In, const VectorForm &Form)
+    {
+        std::vector<Operand> Ops = In.Operands;
+        if (Form.Immediate)
+        {
+            if (Ops.empty() || Ops.back().Kind != Operand::Immediate)
+                Fail(In.Mnemonic + " expects an immediate");
+            Ops.pop_back();
+        }
+
+        const bool Vex = Form.Name.front() == 'v';
+        std::optional<Operand> Source; // VEX.vvvv
+        if (Vex && Ops.size() == 3)
+        {
+            Source = Ops.at(1);
+            Ops.erase(Ops.begin() + 1);
+        }
+        if (Ops.size() != 2 || (Source && !IsVectorRegister(*Source)))
+            Fail(In.Mnemonic + " expects " + std::to_string(Form.Immediate ? 3 : 2) + " operands");
+
+        const Operand &Reg = Form.Store ? Ops.at(1) : Ops.at(0);
+        const Operand &RM = Form.Store ? Ops.at(0) : Ops.at(1);
+        if (Reg.Kind != Operand::Register || (Form.General ? IsVectorRegister(RM) : RM.Kind == Operand::Register && !IsVectorRegister(RM)))
+            Fail("unsupported operands for " + In.Mnemonic);
+
+        if (!Vex)
+        {
+            if (Form.Prefix)
+                In.Bytes.push_back(Form.Prefix);
+            EncodeModRM(In, Form.Opcode, Reg.Reg, RM, Form.Wide ? 8 : 4);
+        }
+        else
+        {
+            // R, X and B inverted, then the map, W, the inverted second source, L and the prefix
+            const bool R = Reg.Reg >= 8;
+            const bool X = RM.Kind == Operand::Memory && RM.Index >= 8;
+            const bool B = RM.Kind == Operand::Memory ? RM.Base >= 8 : RM.Reg >= 8;
+            const uint8_t Map = Form.Opcode.size() == 2 ? 1 : Form.Opcode.at(1) == 0x38 ? 2
+                                                                                           : 3;
+            const uint8_t Prefix = Form.Prefix == 0x66 ? 1 : Form.Prefix == 0xF3 ? 2
+                                                         : Form.Prefix == 0xF2   ? 3
+                                                                                 : 0;
+            const bool Long = std::any_of(In.Operands.begin(), In.Operands.end(), [](const Operand &Op)
+                                          { return Op.Kind == Operand::Register && Op.Size == 32; });
+            const uint8_t Tail = uint8_t(((~(Source ? Source->Reg : 0) & 15) << 3) | (Long ? 4 : 0) | Prefix);
+
+            if (!X && !B && !Form.Wide && Map == 1)
+                In.Bytes.insert(In.Bytes.end(), {0xC5, uint8_t((R ? 0 : 0x80) | Tail)});
+            else
+                In.Bytes.insert(In.Bytes.end(), {0xC4, uint8_t((R ? 0 : 0x80) | (X ? 0 : 0x40) | (B ? 0 : 0x20) | Map), uint8_t((Form.Wide ? 0x80 : 0) | Tail)});
+            In.Bytes.push_back(Form.Opcode.back());
+            EncodeOperand(In, Reg.Reg, RM);
+        }
+
+        if (Form.Immediate)
+            Immediate(In, In.Operands.back(), 1);
+    }
+
+    void EncodeInstruction(Instruction &In)
+    {
+        const std::string &M = In.Mnemonic;
+        const std::vector<Operand> &Ops = In.Operands;
+
+        static const std::vector<std::pair<std::string, int>> Arithmetic = {{"add", 0}, {"or", 1}, {"adc", 2}, {"sbb", 3}, {"and", 4}, {"sub", 5}, {"xor", 6}, {"cmp", 7}};
+        for (const auto &[Name, Group] : Arithmetic)
+        {
+            if (M == Name)
+                return EncodeArithmetic(In, Group);
+        }
+
+        static const std::vector<std::pair<std::string, int>> Unary = {{"not", 2}, {"neg", 3}, {"mul", 4}, {"div", 6}, {"idiv", 7}};
+        for (const auto &[Name, Group] : Unary)
+        {
+            if (M == Name || (M == "imul" && Ops.size() == 1 && Name == "mul"))
+            {
+                Expect(In, 1);
+                const int Size = OperandSize(In);
+                if (!Size)
+                    Fail("operation size not specified");
+                return EncodeModRM(In, {uint8_t(Size == 1 ? 0xF6 : 0xF7)}, M == "imul" ? 5 : Group, Ops.at(0), Size);
+            }
+        }
+
+        static const std::vector<std::pair<std::string, int>> Shifts = {{"rol", 0}, {"ror", 1}, {"shl", 4}, {"sal", 4}, {"shr", 5}, {"sar", 7}};
+        for (const auto &[Name, Group] : Shifts)
+        {
+            if (M != Name)
+                continue;
+            Expect(In, 2);
+            const int Size = Ops.at(0).Size;
+            if (!Size)
+                Fail("operation size not specified");
+            if (Ops.at(1).Kind == Operand::Register && Ops.at(1).Reg == 1 && Ops.at(1).Size == 1)
+                return EncodeModRM(In, {uint8_t(Size == 1 ? 0xD2 : 0xD3)}, Group, Ops.at(0), Size);
+            if (Ops.at(1).Kind != Operand::Immediate)
+                Fail("shift count must be cl or an immediate");
+            if (Ops.at(1).Value == 1)
+                return EncodeModRM(In, {uint8_t(Size == 1 ? 0xD0 : 0xD1)}, Group, Ops.at(0), Size);
+            EncodeModRM(In, {uint8_t(Size == 1 ? 0xC0 : 0xC1)}, Group, Ops.at(0), Size);
+            return Immediate(In, Ops.at(1), 1);
+        }
+
+        if (M == "mov")
+            return EncodeMov(In);
+
+        if (M == "movzx" || M == "movsx")
+        {
+            Expect(In, 2);
+            const int SourceSize = Ops.at(1).Size;
+            if (SourceSize != 1 && SourceSize != 2)
+                Fail(M + " needs a byte or word source");
+            const uint8_t Opcode = uint8_t((M == "movzx" ? 0xB6 : 0xBE) | (SourceSize == 2 ? 1 : 0));
+            return EncodeModRM(In, {0x0F, Opcode}, Ops.at(0).Reg, Ops.at(1), Ops.at(0).Size);
+        }
+
+        if (M == "movsxd")
+        {
+            Expect(In, 2);
+            return EncodeModRM(In, {0x63}, Ops.at(0).Reg, Ops.at(1), 8);
+        }
+
+        if (M == "bsr" || M == "bsf")
+        {
+            Expect(In, 2);
+            return EncodeModRM(In, {0x0F, uint8_t(M == "bsr" ? 0xBD : 0xBC)}, Ops.at(0).Reg, Ops.at(1), Ops.at(0).Size);
+        }
+
+        if (M == "lea")
+        {
+            Expect(In, 2);
+            if (Ops.at(0).Kind != Operand::Register || Ops.at(1).Kind != Operand::Memory)
+                Fail("lea expects a register and an address");
+            return EncodeModRM(In, {0x8D}, Ops.at(0).Reg, Ops.at(1), Ops.at(0).Size);
+        }
+
+        if (M == "test")
+        {
+            Expect(In, 2);
+            const int Size = OperandSize(In);
+            if (!Size)
+                Fail("operation size not specified");
+            if (Ops.at(1).Kind == Operand::Immediate)
+            {
+                EncodeModRM(In, {uint8_t(Size == 1 ? 0xF6 : 0xF7)}, 0, Ops.at(0), Size);
+                return Immediate(In, Ops.at(1), Size == 1 ? 1 : Size == 2 ? 2
+                                                                          : 4);
+            }
+            const Operand &Reg = Ops.at(1).Kind == Operand::Register ? Ops.at(1) : Ops.at(0);
+            const Operand &RM = Ops.at(1).Kind == Operand::Register ? Ops.at(0) : Ops.at(1);
+            return EncodeModRM(In, {uint8_t(Size == 1 ? 0x84 : 0x85)}, Reg.Reg, RM, Size, false, Reg.ForcesRex, Reg.HighByte);
+        }
+
+        if (M == "imul")
+        {
+            if (Ops.size() == 2 && Ops.at(1).Kind == Operand::Immediate)
+                In.Operands.insert(In.Operands.begin() + 1, In.Operands.at(0)); // imul r, imm is imul r, r, imm
+            const std::vector<Operand> &Full = In.Operands;
+            if (Full.size() == 2)
+                return EncodeModRM(In, {0x0F, 0xAF}, Full.at(0).Reg, Full.at(1), Full.at(0).Size);
+            Expect(In, 3);
+            if (Full.at(2).Symbol.empty() && FitsInt8(Full.at(2).Value))
+            {
+                EncodeModRM(In, {0x6B}, Full.at(0).Reg, Full.at(1), Full.at(0).Size);
+                return Immediate(In, Full.at(2), 1);
+            }
+            EncodeModRM(In, {0x69}, Full.at(0).Reg, Full.at(1), Full.at(0).Size);
+            return Immediate(In, Full.at(2), Full.at(0).Size == 2 ? 2 : 4);
+        }
+
+        if (M == "inc" || M == "dec")
+        {
+            Expect(In, 1);
+            const int Size = OperandSize(In);
+            if (!Size)
+                Fail("operation size not specified");
+            return EncodeModRM(In, {uint8_t(Size == 1 ? 0xFE : 0xFF)}, M == "inc" ? 0 : 1, Ops.at(0), Size);
+        }
+
+        if (M == "push")
+        {
+            Expect(In, 1);
+            const Operand &Op = Ops.at(0);
+            if (Op.Kind == Operand::Register)
+            {
+                if (Op.Reg >= 8)
+                    In.Bytes.push_back(0x41);
+                In.Bytes.push_back(0x50 | (Op.Reg & 7));
+                return;
+            }
+            if (Op.Kind == Operand::Immediate)
+            {
+                if (Op.Symbol.empty() && FitsInt8(Op.Value))
+                {
+                    In.Bytes.push_back(0x6A);
+                    return Immediate(In, Op, 1);
+                }
+                In.Bytes.push_back(0x68);
+                return Immediate(In, Op, 4);
+            }
+            return EncodeModRM(In, {0xFF}, 6, Op, 8, true);
+        }
+
+        if (M == "pop")
+        {
+            Expect(In, 1);
+            const Operand &Op = Ops.at(0);
+            if (Op.Kind == Operand::Register)
+            {
+                if (Op.Reg >= 8)
+                    In.Bytes.push_back(0x41);
+                In.Bytes.push_back(0x58 | (Op.Reg & 7));
+                return;
+            }
+            return EncodeModRM(In, {0x8F}, 0, Op, 8, true);
+        }
+
+        if (M.rfind("cmov", 0) == 0 && ConditionCode(M.substr(4)) >= 0)
+        {
+            Expect(In, 2);
+            return EncodeModRM(In, {0x0F, uint8_t(0x40 | ConditionCode(M.substr(4)))}, Ops.at(0).Reg, Ops.at(1), Ops.at(0).Size);
+        }
+
+        if (M.rfind("set", 0) == 0 && ConditionCode(M.substr(3)) >= 0)
+        {
+            Expect(In, 1);
+            return EncodeModRM(In, {0x0F, uint8_t(0x90 | ConditionCode(M.substr(3)))}, 0, Ops.at(0), 1);
+        }
+
+        if (M == "call" || M == "jmp")
+        {
+            Expect(In, 1);
+            return EncodeModRM(In, {0xFF}, M == "call" ? 2 : 4, Ops.at(0), 8, true);
+        }
+
+        if (const VectorForm *Form = FindVectorForm(In))
+            return EncodeVector(In, *Form);
+
+        static const std::vector<std::pair<std::string, std::vector<uint8_t>>> Plain = {
+            {"ret", {0xC3}}, {"syscall", {0x0F, 0x05}}, {"cqo", {0x48, 0x99}}, {"cdq", {0x99}}, {"nop", {0x90}}, {"leave", {0xC9}}, {"hlt", {0xF4}}, {"ud2", {0x0F, 0x0B}}, {"int3", {0xCC}}, {"rep stosq", {0xF3, 0x48, 0xAB}}, {"rep stosb", {0xF3, 0xAA}}, {"rep movsq", {0xF3, 0x48, 0xA5}}, {"rep movsb", {0xF3, 0xA4}}, {"vzeroupper", {0xC5, 0xF8, 0x77}}};
+        for (const auto &[Name, Bytes] : Plain)
+        {
+            if (M == Name)
+            {
+                Expect(In, 0);
+                In.Bytes = Bytes;
+                return;
+            }
+        }
+
+        Fail("unsupported instruction '" + M + "'");
+    }
+
+    // jumps and calls to labels, short jumps only while the label is in reach
+    void EncodeBranch(Instruction &In, uint64_t Offset, bool Final)
+    {
+        In.Bytes.clear();
+        In.Relocations.clear();
+
+        const bool Known = TextLabels.count(In.Target);
+        const int64_t Destination = Known ? int64_t(TextLabels.at(In.Target)) : 0;
+
+        if (In.Mnemonic == "call")
+        {
+            In.Bytes.push_back(0xE8);
+            if (!Known)
+                In.Relocations.push_back(AsmRelocation{.Offset = 1, .Symbol = In.Target, .Addend = -4, .Type = RelocationType::Relative32});
+            Append(In.Bytes, Known ? uint64_t(Destination - int64_t(Offset + 5)) : 0, 4);
+            return;
+        }
+
+        if (!Known)
+        {
+            // a tail call into code linked before, like an unknown call
+            if (Final && In.Mnemonic == "jmp")
+            {
+                In.Bytes.push_back(0xE9);
+                In.Relocations.push_back(AsmRelocation{.Offset = 1, .Symbol = In.Target, .Addend = -4, .Type = RelocationType::Relative32});
+                Append(In.Bytes, 0, 4);
+                return;
+            }
+            if (Final)
+                Fail("undefined label " + In.Target);
+            In.Short = false;
+        }
+
+        const bool Jump = In.Mnemonic == "jmp";
+        if (In.Short)
+        {
+            In.Bytes.push_back(Jump ? 0xEB : uint8_t(0x70 | ConditionCode(In.Mnemonic.substr(1))));
+            Append(In.Bytes, uint64_t(Destination - int64_t(Offset + 2)), 1);
+            return;
+        }
+
+        if (Jump)
+            In.Bytes.push_back(0xE9);
+        else
+        {
+            In.Bytes.push_back(0x0F);
+            In.Bytes.push_back(uint8_t(0x80 | ConditionCode(In.Mnemonic.substr(1))));
+        }
+        Append(In.Bytes, uint64_t(Destination - int64_t(Offset + In.Bytes.size() + 4)), 4);
+    }
+
+    void Layout()
+    {
+        for (Instruction &In : Instructions)
+        {
+            LineNumber = In.Line;
+            if (In.Target.empty())
+                EncodeInstruction(In);
+        }
+
+        // grow short jumps that do not reach until nothing changes
+        bool Changed = true;
+        while (Changed)
+        {
+            Changed = false;
+            uint64_t Offset = 0;
+            for (const Item &Entry : TextItems)
+            {
+                if (!Entry.Label.empty())
+                {
+                    TextLabels[Entry.Label] = Offset;
+                    continue;
+                }
+                Instruction &In = Instructions.at(Entry.Instruction);
+                In.Offset = Offset;
+                if (!In.Target.empty())
+                {
+                    LineNumber = In.Line;
+                    EncodeBranch(In, Offset, false);
+                }
+                Offset += In.Bytes.size();
+            }
+
+            for (Instruction &In : Instructions)
+            {
+                if (In.Target.empty() || !In.Short || In.Mnemonic == "call")
+                    continue;
+                const int64_t Distance = int64_t(TextLabels.count(In.Target) ? TextLabels.at(In.Target) : 0) - int64_t(In.Offset + 2);
+                if (!TextLabels.count(In.Target) || !FitsInt8(Distance))
+                {
+                    In.Short = false;
+                    Changed = true;
+                }
+            }
+        }
+
+        for (Instruction &In : Instructions)
+        {
+            LineNumber = In.Line;
+            if (!In.Target.empty())
+                EncodeBranch(In, In.Offset, true);
+        }
+    }
+
+    void Emit(ObjectCode &Object)
+    {
+        Object = ObjectCode();
+        for (const Item &Entry : TextItems)
+        {
+            if (!Entry.Label.empty())
+                continue;
+            const Instruction &In = Instructions.at(Entry.Instruction);
+            for (AsmRelocation Relocation : In.Relocations)
+            {
+                Relocation.Offset += Object.Text.size();
+                Object.Relocations.push_back(Relocation);
+            }
+            Object.Text.insert(Object.Text.end(), In.Bytes.begin(), In.Bytes.end());
+        }
+
+        for (const auto &[Name, Offset] : TextLabels)
+            Object.Symbols.push_back(AsmSymbol{.Name = Name, .Section = AsmSection::Text, .Offset = Offset});
+        // read only data after the code, 16 byte aligned
+        Object.Text.resize((Object.Text.size() + 15) / 16 * 16, 0xCC);
+        const uint64_t ReadOnlyOffset = Object.Text.size();
+        Object.Text.insert(Object.Text.end(), ReadOnlyData.begin(), ReadOnlyData.end());
+
+        for (AsmSymbol Symbol : DataSymbols)
+        {
+            if (Symbol.Section == AsmSection::ReadOnly)
+            {
+                Symbol.Section = AsmSection::Text;
+                Symbol.Offset += ReadOnlyOffset;
+            }
+            Object.Symbols.push_back(Symbol);
+        }
+        for (AsmSymbol &Symbol : Object.Symbols)
+            Symbol.Global = Globals.count(Symbol.Name);
+
+        // relocations against labels of the same section are already resolved
+        Object.Relocations.erase(std::remove_if(Object.Relocations.begin(), Object.Relocations.end(),
+                                                [&](const AsmRelocation &Relocation)
+                                                { return Relocation.Type == RelocationType::Relative32 && TextLabels.count(Relocation.Symbol); }),
+                                 Object.Relocations.end());
+
+        std::sort(Object.Symbols.begin(), Object.Symbols.end(), [](const AsmSymbol &a, const AsmSymbol &b)
+                  { return std::tie(a.Section, a.Offset, a.Name) < std::tie(b.Section, b.Offset, b.Name); });
+
+        Object.Data = Data;
+        Object.BssSize = BssSize;
+    }
+};
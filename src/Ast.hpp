@@ -7,6 +7,8 @@ MapId RandomMapId();
 
 class Statement;
 class Expression;
+class FunctionDefinition;
+class CompileError;
 
 using StatementPtr = std::shared_ptr<Statement>;
 using ExpressionPtr = std::shared_ptr<Expression>;
@@ -63,7 +65,7 @@ struct TypeDescriptor
     }
 };
 
-bool operator!(TypeDescriptor TypeDesc)
+inline bool operator!(TypeDescriptor TypeDesc)
 {
     return TypeDesc.Type == ValueType::Unknown;
 }
@@ -104,6 +106,7 @@ public:
     virtual ~Expression() = default;
 
     ScriptLocation Location;
+    TypeDescriptor ResolvedType = ValueType::Unknown; // filled in by the semantic analyzer
     Expression() : Location(CurrentParseToken.Location) {}
 };
 
@@ -135,6 +138,7 @@ class VariableExpression : public Expression
 public:
     std::string Name;
     MapId Address;
+    bool AtCursor = false; // name is being typed at the editor cursor
 
     explicit VariableExpression(std::string name, MapId address) : Name(std::move(name)), Address(address) {}
 };
@@ -162,6 +166,7 @@ struct CallExpression : Expression
 {
     ExpressionPtr Callee;
     std::vector<ExpressionPtr> Arguments;
+    std::shared_ptr<FunctionDefinition> ResolvedCallee = nullptr; // overload picked by the semantic analyzer
 
     CallExpression(ExpressionPtr callee, std::vector<ExpressionPtr> args)
         : Callee(callee), Arguments(args) {}
@@ -236,8 +241,16 @@ public:
     std::vector<VarDeclaration> Arguments;
     TypeDescriptor ReturnType;
     bool Global = false;
+    bool Inline = false;   // @inline, copied into every caller whatever its size
+    bool NoInline = false; // @noinline, always called
+    bool CLinkage = false; // defn(C), labeled with its plain name so C can call it
+    bool External = false; // import defn(C), defined in a C library that -lwgcc links
     MapId UniqueId;
 
+    // set while the body of an imported function is still unparsed,
+    // parses it on the first call that selects this overload
+    std::function<std::vector<StatementPtr>(std::vector<CompileError> &)> ParseBody = nullptr;
+
     FunctionDefinition(std::vector<StatementPtr> body, std::vector<VarDeclaration> arguments = std::vector<VarDeclaration>(), TypeDescriptor returntype = TypeDescriptor(ValueType::Null))
         : Body(std::move(body)), Arguments(std::move(arguments)), ReturnType(std::move(returntype)), UniqueId(RandomMapId()) {}
 };
@@ -249,6 +262,71 @@ public:
 
     AssemblyInstructions(std::vector<Token> instructions)
         : Instructions(std::move(instructions)) {}
+
+    // the instructions as NASM lines
+    std::string ToString() const
+    {
+        std::stringstream Out;
+        bool Newline = true;
+        for (size_t i = 0; i < Instructions.size(); i++)
+        {
+            const Token &Tok = Instructions.at(i);
+            if (Tok.Type == TokenType::SemiColon)
+            {
+                if (!Newline)
+                {
+                    Out << "\n";
+                    Newline = true;
+                }
+            }
+            else if (Instructions.size() > (i + 1) && Instructions.at(i + 1).Type == TokenType::Colon)
+            {
+                Out << Tok.Text << "\n";
+                i++;
+                Newline = true;
+            }
+            else if (Instructions.size() > (i + 1) && Instructions.at(i).Type == TokenType::Dot)
+            {
+                if (Instructions.size() > (i + 2) && Instructions.at(i + 2).Type == TokenType::Colon)
+                {
+                    Out << "." << Instructions.at(i + 1).Text << ":\n";
+                    i++;
+                    i++;
+                    Newline = true;
+                }
+                else
+                {
+                    Out << " ." << Instructions.at(i + 1).Text;
+                    i++;
+                    Newline = false;
+                }
+            }
+            else if (Tok.Text == "section" || Tok.Text == "global" || Tok.Text == "extern" || Tok.Text == "segment")
+            {
+                if (Tok.Text == "segment")
+                    Out << "section";
+                else
+                    Out << Tok.Text;
+                Newline = false;
+            }
+            else
+            {
+                if (Newline)
+                {
+                    Newline = false;
+                    Out << "    " << Tok.Text;
+                }
+                else
+                {
+                    Out << " " << Tok.Text;
+                }
+            }
+        }
+
+        if (!Newline)
+            Out << "\n";
+        return Out.str();
+    }
 };
 
 class ClassBlueprint : public Expression
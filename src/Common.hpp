@@ -4,7 +4,11 @@
 #include <string>
 #include <cctype>
 #include <map>
+#include <set>
+#include <optional>
 #include <unordered_map>
+#include <unordered_set>
+#include <string_view>
 #include <variant>
 #include <iostream>
 #include <filesystem>
@@ -22,6 +26,7 @@
 #include <atomic>
 #include <shared_mutex>
 #include <climits>
+#include <cstring>
 #include "MagicEnum.hpp"
 
 // old interpreter stuff
@@ -37,12 +42,11 @@
 // #define forarg for (const std::any &Arg : Args)
 
 using MapId = unsigned long long;
-MapId RandomMapId()
+inline MapId RandomMapId()
 {
     MapId x = 2;
     MapId y = ULLONG_MAX;
-    static std::random_device Rd;
-    static std::mt19937_64 gen(Rd());
+    static thread_local std::mt19937_64 gen(std::random_device{}());
     std::uniform_int_distribution<MapId> dist(x, y);
     return dist(gen);
 }
@@ -50,7 +54,15 @@ MapId RandomMapId()
 using rt_Int = long long;
 using rt_Float = double;
 
-std::string ToString(const std::any &Val)
+// the bits of a double, as it is kept in a 64 bit register
+inline int64_t DoubleBits(rt_Float Value)
+{
+    int64_t Bits;
+    std::memcpy(&Bits, &Value, sizeof(Bits));
+    return Bits;
+}
+
+inline std::string ToString(const std::any &Val)
 {
     if (Val.type() == typeid(std::nullptr_t))
         return "null";
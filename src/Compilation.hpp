@@ -0,0 +1,262 @@
+#pragma once
+
+#include "Common.hpp"
+#include "CompileFlags.hpp"
+#include "IncludePath.hpp"
+
+#include "Lexer.hpp"
+#include "Parser.hpp"
+#include "Sema.hpp"
+#include "AsmGen.hpp"
+#include "Assembler.hpp"
+#include "ElfWriter.hpp"
+#include "Jit.hpp"
+
+namespace furn
+{
+    /*
+     * one compilation of a single source file, it owns the options,
+     * the source, the diagnostics and the outputs so any number of
+     * them can run at the same time on different threads
+     */
+    class Compilation
+    {
+    public:
+        CompileFlags Flags;
+
+        std::filesystem::path FileName;                                          // used in diagnostics and for relative imports
+        std::filesystem::path OutputDirectory = std::filesystem::current_path(); // where the .asm, .o and executable are written
+        std::filesystem::path IncludeDirectory;                                  // packages, usually IncludePath::Init()
+        std::string Source;
+
+        std::vector<StatementPtr> Ast;
+        std::vector<CompileError> ParseErrors;
+        std::vector<CompileError> Errors; // semantic analysis, code generation, then writing or running the program
+        std::vector<std::string> MacroNames;
+        std::vector<std::string> ClassNames;
+        std::vector<std::string> AvailableIdentifiers;
+        std::string Assembly;
+        std::string IR;        // SSA listing of the lowered functions
+        std::string PassDumps; // -print-after listings
+        std::map<std::string, size_t> Statistics; // what the optimizations did, "bounds checks removed" to how often
+        std::vector<std::filesystem::path> Outputs; // the files Build() wrote
+        std::string AssemblerNote;                  // why Build() fell back to nasm, if it did
+
+        Compilation() = default;
+
+        // the parser keeps a reference to Tokens for lazily parsed bodies
+        Compilation(const Compilation &) = delete;
+        Compilation &operator=(const Compilation &) = delete;
+
+        bool LoadFile(const std::filesystem::path &Path)
+        {
+            std::ifstream File(Path, std::ios::binary);
+            if (!File.is_open())
+                return false;
+
+            FileName = Path;
+            Source.assign((std::istreambuf_iterator<char>(File)), std::istreambuf_iterator<char>());
+            return true;
+        }
+
+        // true if there were no syntax errors
+        bool ParseSource()
+        {
+            Lexer Lex(Source);
+            Lex.Location.File = FileName;
+            Lex.CursorPosition = Flags.CursorPosition;
+            Tokens = Lex.Tokenize();
+
+            Parse = std::make_unique<Parser>(Tokens);
+            Parse->IncludeDirectory = IncludeDirectory;
+
+            if (Parse->Check(TokenType::Package))
+            {
+                Parse->Tokens.erase(Parse->Tokens.begin()); // skip package keyword
+                Parse->Tokens.erase(Parse->Tokens.begin()); // skip package name
+            }
+
+            Ast = Parse->ParseProgram();
+
+            ParseErrors = Parse->Errors;
+            MacroNames = Parse->MacroNames;
+            ClassNames = Parse->ClassNames;
+
+            return !HasErrors(ParseErrors);
+        }
+
+        // type checks the parsed program without generating anything
+        bool Check()
+        {
+            SemanticAnalyzer Sema(Ast, Flags);
+            Sema.AnalyzeProgram();
+
+            Errors = std::move(Sema.Errors);
+            return !HasErrors(Errors);
+        }
+
+        bool Compile()
+        {
+            AsmGenerator Gen(Ast, Flags);
+            Assembly = Gen.GenerateProgram();
+            IR = std::move(Gen.IRListing);
+            PassDumps = std::move(Gen.PassDumps);
+            Statistics = std::move(Gen.Statistics);
+
+            Errors = std::move(Gen.Errors);
+            AvailableIdentifiers = std::move(Gen.AvailableIdentifiers);
+            return Errors.empty();
+        }
+
+        // OutputDirectory/<name>.<Extension>, name from -out or the source file
+        std::filesystem::path OutputPath(const std::string &Extension = "") const
+        {
+            std::filesystem::path Stem = Flags.OutputFlag.empty() ? FileName.stem() : Flags.OutputFlag.stem();
+            return OutputDirectory / Stem.concat(Extension);
+        }
+
+        // assembles and links in process, -S writes the assembly instead
+        bool Build()
+        {
+            Outputs.clear();
+            AssemblerNote.clear();
+
+            if (Flags.EmitIR)
+            {
+                std::ofstream IRFile(OutputPath(".ir"));
+                if (!IRFile.is_open())
+                    return false;
+                IRFile << IR;
+                Outputs.push_back(OutputPath(".ir"));
+            }
+
+            if (Flags.EmitAssembly)
+                return WriteAssembly();
+
+            X64Assembler Assembler;
+            ObjectCode Object;
+            if (!Assembler.Assemble(Assembly, Object))
+            {
+                // hand written inline assembly can use more than the assembler knows
+                AssemblerNote = Assembler.Error;
+                return WriteAssembly() && BuildExternally();
+            }
+
+            ElfWriter Writer;
+            if (!Flags.LinkWithGcc)
+            {
+                if (!Writer.WriteExecutable(Object, OutputPath()))
+                {
+                    Report(Writer.Error);
+                    return false;
+                }
+                Outputs.push_back(OutputPath());
+                return true;
+            }
+
+            if (!Writer.WriteObject(Object, OutputPath(".o")))
+            {
+                Report(Writer.Error);
+                return false;
+            }
+            Outputs.push_back(OutputPath(".o"));
+
+            const std::string Name = OutputPath().filename().string();
+            if (system(("cd \"" + OutputDirectory.string() + "\"; gcc -nostdlib -no-pie " + Name + ".o -lc -o " + Name).c_str()) != 0)
+                return false;
+            Outputs.push_back(OutputPath());
+            return true;
+        }
+
+        // assembles into memory and runs it there, false if it has to be built and run from disk instead
+        bool RunInMemory(int &ExitCode)
+        {
+            Outputs.clear();
+            if (Flags.EmitIR)
+            {
+                std::ofstream IRFile(OutputPath(".ir"));
+                if (IRFile.is_open())
+                {
+                    IRFile << IR;
+                    Outputs.push_back(OutputPath(".ir"));
+                }
+            }
+
+            X64Assembler Assembler;
+            ObjectCode Object;
+            if (!Assembler.Assemble(Assembly, Object))
+            {
+                AssemblerNote = Assembler.Error;
+                return false;
+            }
+
+            JitImage Image;
+            if (!Image.Load(Object))
+            {
+                AssemblerNote = Image.Error;
+                return false;
+            }
+
+            ExitCode = Image.Execute();
+            if (!Image.Error.empty())
+                Report(Image.Error);
+            return true;
+        }
+
+        int Run() const
+        {
+            return system(("cd \"" + OutputDirectory.string() + "\"; ./" + OutputPath().filename().string()).c_str());
+        }
+
+    private:
+        std::vector<Token> Tokens;
+        std::unique_ptr<Parser> Parse;
+
+        bool WriteAssembly()
+        {
+            std::ofstream f(OutputPath(".asm"));
+            if (!f.is_open())
+                return false;
+            f << Assembly;
+            Outputs.push_back(OutputPath(".asm"));
+            return true;
+        }
+
+        // the old nasm and ld round trip
+        bool BuildExternally()
+        {
+            const std::string Dir = "cd \"" + OutputDirectory.string() + "\"; ";
+            const std::string Name = OutputPath().filename().string();
+
+            if (system((Dir + "nasm -felf64 " + Name + ".asm").c_str()) != 0)
+                return false;
+            Outputs.push_back(OutputPath(".o"));
+
+            if (Flags.LinkWithGcc)
+            {
+                if (system((Dir + "gcc -nostdlib -no-pie " + Name + ".o -lc -o " + Name).c_str()) != 0)
+                    return false;
+            }
+            else if (system((Dir + "ld " + Name + ".o -o " + Name).c_str()) != 0)
+                return false;
+            Outputs.push_back(OutputPath());
+            return true;
+        }
+
+        // a failure that belongs to no line of the source, line 0 tells the driver not to show one
+        void Report(const std::string &Message)
+        {
+            Errors.push_back(CompileError(Message, Error, ScriptLocation(FileName.string(), 0)));
+        }
+
+        static bool HasErrors(const std::vector<CompileError> &List)
+        {
+            for (const CompileError &Error : List)
+            {
+                if (Error.Severity >= SyntaxError)
+                    return true;
+            }
+            return false;
+        }
+    };
+}
@@ -1,16 +1,27 @@
 
 #pragma once
 
-namespace CmplFlags
+// options of a single compilation, each furn::Compilation owns its own
+struct CompileFlags
 {
     bool ParseInfo = false;
     bool CompileInfo = false;
     bool StrictMode = false;
     std::filesystem::path OutputFlag;
     bool RunAfterComp = false;
+    bool CheckOnly = false;
     bool QuietComp = false;
     bool LinkWithGcc = false;
     bool BoundsChecking = true;
     int CursorPosition = 0;
+    size_t CompletionLimit = 50;
     bool GarbageCollect = true;
-}
+    bool EmitIR = false;
+    bool EmitAssembly = false;             // -S, NASM text instead of an executable
+    int OptimizationLevel = 1;             // 0 skips the IR and generates straight from the AST
+    std::set<std::string> DisabledPasses; // -fno-<pass>
+    std::set<std::string> PrintAfter;     // -print-after=<pass>
+    size_t InlineThreshold = 20;           // -inline-threshold=<n>, instructions a callee may have to be inlined anywhere
+    size_t UnrollFactor = 4;               // -unroll=<n>, copies of a counted loop's body per trip at -O2
+    bool AVX2 = false;                     // -march=<cpu>, vector loops use ymm registers instead of SSE2's xmm
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "Common.hpp"
+
+/*
+ * prefix index of the identifiers visible to the
+ * code generator, one sorted bucket per scope level
+ * so the editor only gets the names that start with
+ * what is typed at the cursor, closest scope first
+ */
+class CompletionIndex
+{
+public:
+    enum class EntryKind
+    {
+        Function,
+        Namespace,
+        Name,
+    };
+
+    struct Entry
+    {
+        std::string_view Name; // points into Interned
+        EntryKind Kind;
+    };
+
+    void Insert(const std::string &Name, const EntryKind Kind, const uint64_t Scope)
+    {
+        if (Scopes.size() <= Scope)
+            Scopes.resize(Scope + 1);
+
+        std::string_view Interned = Intern(Name);
+        std::vector<Entry> &Bucket = Scopes.at(Scope);
+
+        auto It = std::lower_bound(Bucket.begin(), Bucket.end(), Interned, [](const Entry &E, std::string_view N)
+                                   { return E.Name < N; });
+        Bucket.insert(It, Entry{.Name = Interned, .Kind = Kind});
+    }
+
+    void Erase(const std::string &Name, const uint64_t Scope)
+    {
+        if (Scopes.size() <= Scope)
+            return;
+
+        std::vector<Entry> &Bucket = Scopes.at(Scope);
+
+        auto It = std::lower_bound(Bucket.begin(), Bucket.end(), std::string_view(Name), [](const Entry &E, std::string_view N)
+                                   { return E.Name < N; });
+        if (It != Bucket.end() && It->Name == Name)
+            Bucket.erase(It);
+    }
+
+    // at most Limit names starting with Prefix, innermost scope first
+    // and alphabetical within a scope, shadowed names are reported once
+    std::vector<std::string> Query(const std::string &Prefix, const size_t Limit) const
+    {
+        std::vector<std::string> Results;
+        std::unordered_set<std::string_view> Seen;
+
+        for (auto Bucket = Scopes.rbegin(); Bucket != Scopes.rend(); ++Bucket)
+        {
+            auto It = std::lower_bound(Bucket->begin(), Bucket->end(), std::string_view(Prefix), [](const Entry &E, std::string_view N)
+                                       { return E.Name < N; });
+
+            for (; It != Bucket->end() && It->Name.substr(0, Prefix.size()) == Prefix; ++It)
+            {
+                if (Results.size() >= Limit)
+                    return Results;
+
+                if (!Seen.insert(It->Name).second)
+                    continue;
+
+                switch (It->Kind)
+                {
+                case EntryKind::Function:
+                    Results.push_back("(Function): " + std::string(It->Name));
+                    break;
+                case EntryKind::Namespace:
+                    Results.push_back("(Namespace): " + std::string(It->Name));
+                    break;
+                default:
+                    Results.push_back("(Name): " + std::string(It->Name));
+                    break;
+                }
+            }
+        }
+
+        return Results;
+    }
+
+private:
+    std::string_view Intern(const std::string &Name)
+    {
+        // node based set, so the views stay valid on rehash
+        return *Interned.insert(Name).first;
+    }
+
+    std::unordered_set<std::string> Interned;
+    std::vector<std::vector<Entry>> Scopes;
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Ast.hpp"
+
+/*
+ * for loops of the direct code generator whose counter provably stays
+ * inside an array, the parser turns `for (i: mut = 0; i < sizeof(a); ++i)`
+ * into the counter declaration followed by a while loop ending in the
+ * increment, so a[i] in the body can skip its bounds check as long as
+ * nothing else in the body assigns i or a
+ */
+class CountedLoop
+{
+public:
+    MapId Counter = 0;
+    MapId Array = 0;
+
+    static std::optional<CountedLoop> Match(const VarDeclaration &Decl, const WhileStatement &Loop)
+    {
+        // starts at a constant that is not negative
+        auto Start = std::dynamic_pointer_cast<ValueExpression>(Decl.Initializer);
+        if (!Start || Start->Val.type() != typeid(rt_Int) || std::any_cast<rt_Int>(Start->Val) < 0)
+            return std::nullopt;
+
+        // counter < sizeof(array)
+        auto Condition = std::dynamic_pointer_cast<BinaryExpression>(Loop.Condition);
+        if (!Condition || Condition->Operator != OperationType::LessThan || !IsVariable(Condition->A, Decl.Address))
+            return std::nullopt;
+        auto Size = std::dynamic_pointer_cast<SizeOfExpression>(Condition->B);
+        auto Array = Size ? std::dynamic_pointer_cast<VariableExpression>(Size->Expr) : nullptr;
+        if (!Array || Loop.Body.empty())
+            return std::nullopt;
+
+        // counter = counter + a positive constant, last
+        auto Step = std::dynamic_pointer_cast<ExpressionStatement>(Loop.Body.back());
+        auto Increment = Step ? std::dynamic_pointer_cast<AssignmentExpression>(Step->Expr) : nullptr;
+        auto Sum = Increment ? std::dynamic_pointer_cast<BinaryExpression>(Increment->Value) : nullptr;
+        auto Amount = Sum ? std::dynamic_pointer_cast<ValueExpression>(Sum->B) : nullptr;
+        if (!Increment || !IsVariable(Increment->Name, Decl.Address) || !Sum || Sum->Operator != OperationType::Add || !IsVariable(Sum->A, Decl.Address) || !Amount || Amount->Val.type() != typeid(rt_Int) || std::any_cast<rt_Int>(Amount->Val) <= 0 || std::any_cast<rt_Int>(Amount->Val) > (1 << 20))
+            return std::nullopt;
+
+        const std::set<MapId> Kept = {Decl.Address, Array->Address};
+        for (size_t i = 0; i + 1 < Loop.Body.size(); i++)
+        {
+            if (!Keeps(Loop.Body.at(i), Kept))
+                return std::nullopt;
+        }
+        return CountedLoop{.Counter = Decl.Address, .Array = Array->Address};
+    }
+
+    bool Covers(const IndexExpression &Index) const
+    {
+        return IsVariable(Index.Object, Array) && IsVariable(Index.Index, Counter);
+    }
+
+private:
+    static bool IsVariable(const ExpressionPtr &Expr, MapId Address)
+    {
+        auto Var = std::dynamic_pointer_cast<VariableExpression>(Expr);
+        return Var && Var->Address == Address;
+    }
+
+    // false if the statement could assign one of the variables, or is something this does not look into
+    static bool Keeps(const StatementPtr &Stmt, const std::set<MapId> &Variables)
+    {
+        if (!Stmt || std::dynamic_pointer_cast<EmptyStatement>(Stmt) || std::dynamic_pointer_cast<BreakStatement>(Stmt) || std::dynamic_pointer_cast<AssemblyInstructions>(Stmt))
+            return true;
+        if (auto ExprStmt = std::dynamic_pointer_cast<ExpressionStatement>(Stmt))
+            return Keeps(ExprStmt->Expr, Variables);
+        if (auto Return = std::dynamic_pointer_cast<ReturnStatement>(Stmt))
+            return Keeps(Return->Expr, Variables);
+        if (auto Decl = std::dynamic_pointer_cast<VarDeclaration>(Stmt))
+            return std::dynamic_pointer_cast<FunctionDefinition>(Decl->Initializer) || Keeps(Decl->Initializer, Variables);
+        if (auto Multi = std::dynamic_pointer_cast<MultiStatement>(Stmt))
+            return std::all_of(Multi->Statements.begin(), Multi->Statements.end(), [&](const StatementPtr &Inner)
+                               { return Keeps(Inner, Variables); });
+        if (auto While = std::dynamic_pointer_cast<WhileStatement>(Stmt))
+            return Keeps(While->Condition, Variables) && std::all_of(While->Body.begin(), While->Body.end(), [&](const StatementPtr &Inner)
+                                                                     { return Keeps(Inner, Variables); });
+        if (auto If = std::dynamic_pointer_cast<IfStatement>(Stmt))
+        {
+            for (const ExpressionPtr &Condition : If->Conditions)
+            {
+                if (!Keeps(Condition, Variables))
+                    return false;
+            }
+            for (const std::vector<StatementPtr> &Then : If->Then)
+            {
+                for (const StatementPtr &Inner : Then)
+                {
+                    if (!Keeps(Inner, Variables))
+                        return false;
+                }
+            }
+            return true;
+        }
+        return false; // `use` could alias a variable under another name
+    }
+
+    static bool Keeps(const ExpressionPtr &Expr, const std::set<MapId> &Variables)
+    {
+        if (!Expr || std::dynamic_pointer_cast<ValueExpression>(Expr) || std::dynamic_pointer_cast<VariableExpression>(Expr) || std::dynamic_pointer_cast<SizeOfTypeExpression>(Expr))
+            return true;
+        if (auto Assign = std::dynamic_pointer_cast<AssignmentExpression>(Expr))
+        {
+            if (auto Var = std::dynamic_pointer_cast<VariableExpression>(Assign->Name))
+                return !Variables.count(Var->Address) && Keeps(Assign->Value, Variables);
+            return Keeps(Assign->Name, Variables) && Keeps(Assign->Value, Variables);
+        }
+        if (auto Call = std::dynamic_pointer_cast<CallExpression>(Expr))
+            return Keeps(Call->Callee, Variables) && std::all_of(Call->Arguments.begin(), Call->Arguments.end(), [&](const ExpressionPtr &Argument)
+                                                                 { return Keeps(Argument, Variables); });
+        if (auto Index = std::dynamic_pointer_cast<IndexExpression>(Expr))
+            return Keeps(Index->Object, Variables) && Keeps(Index->Index, Variables);
+        if (auto Access = std::dynamic_pointer_cast<MemberExpression>(Expr))
+            return Keeps(Access->Object, Variables);
+        if (auto Bin = std::dynamic_pointer_cast<BinaryExpression>(Expr))
+            return Keeps(Bin->A, Variables) && Keeps(Bin->B, Variables);
+        if (auto Unary = std::dynamic_pointer_cast<UnaryExpression>(Expr))
+            return Keeps(Unary->Expr, Variables);
+        if (auto SizeOf = std::dynamic_pointer_cast<SizeOfExpression>(Expr))
+            return Keeps(SizeOf->Expr, Variables);
+        if (auto Cast = std::dynamic_pointer_cast<ClassCastExpression>(Expr))
+            return Keeps(Cast->Expr, Variables);
+        if (auto New = std::dynamic_pointer_cast<UseExpression>(Expr))
+            return std::all_of(New->Arguments.begin(), New->Arguments.end(), [&](const ExpressionPtr &Argument)
+                               { return Keeps(Argument, Variables); });
+        return false;
+    }
+};
@@ -0,0 +1,322 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Assembler.hpp"
+
+/*
+ * writes assembled ObjectCode as an ELF64 file, either a static
+ * executable that needs nothing else or a relocatable object for
+ * a system linker when the program links against libc
+ */
+class ElfWriter
+{
+public:
+    static constexpr uint64_t ImageBase = 0x400000;
+    static constexpr uint64_t PageSize = 0x1000;
+
+    std::string Error; // why a Write function returned false
+
+    // sections the way a static executable places them
+    struct Placement
+    {
+        uint64_t TextOffset = PageSize; // in the file
+        uint64_t DataOffset = 0;
+        uint64_t TextAddress = 0;
+        uint64_t DataAddress = 0;
+        uint64_t BssAddress = 0;
+    };
+
+    static Placement Place(const ObjectCode &Object)
+    {
+        Placement Where;
+        Where.TextAddress = ImageBase + Where.TextOffset;
+        Where.DataOffset = Align(Where.TextOffset + Object.Text.size(), PageSize);
+        Where.DataAddress = ImageBase + Where.DataOffset;
+        Where.BssAddress = Align(Where.DataAddress + Object.Data.size(), 16);
+        return Where;
+    }
+
+    bool WriteExecutable(const ObjectCode &Object, const std::filesystem::path &Path)
+    {
+        const Placement Where = Place(Object);
+
+        std::vector<uint8_t> Text;
+        std::string Missing;
+        if (!Object.Link(Text, Where.TextAddress, Where.DataAddress, Where.BssAddress, Missing))
+        {
+            Error = "undefined symbol " + Missing;
+            return false;
+        }
+
+        const AsmSymbol *Entry = Object.FindSymbol("_start");
+        if (!Entry || Entry->Section != AsmSection::Text)
+        {
+            Error = "no _start to enter the program at";
+            return false;
+        }
+
+        std::vector<uint8_t> File;
+        const uint64_t MemorySize = Where.BssAddress + Object.BssSize - Where.DataAddress;
+
+        // text and the headers in one read and execute segment, data and bss in a writable one
+        Header(File, 2, Where.TextAddress + Entry->Offset, 2);
+        ProgramHeader(File, 5, 0, ImageBase, Where.TextOffset + Text.size(), Where.TextOffset + Text.size());
+        ProgramHeader(File, 6, Where.DataOffset, Where.DataAddress, Object.Data.size(), MemorySize);
+
+        File.resize(Where.TextOffset, 0);
+        File.insert(File.end(), Text.begin(), Text.end());
+        File.resize(Where.DataOffset, 0);
+        File.insert(File.end(), Object.Data.begin(), Object.Data.end());
+
+        Sections Table;
+        Table.Add(".text", 1, 6, Where.TextAddress, Where.TextOffset, Text.size(), 0, 0, 16, 0);
+        Table.Add(".data", 1, 3, Where.DataAddress, Where.DataOffset, Object.Data.size(), 0, 0, 4, 0);
+        Table.Add(".bss", 8, 3, Where.BssAddress, Where.DataOffset + Object.Data.size(), Object.BssSize, 0, 0, 16, 0);
+
+        // locals have to come before globals
+        std::vector<uint8_t> Symbols(24, 0), Names(1, 0);
+        uint32_t FirstGlobal = 0;
+        for (bool Global : {false, true})
+        {
+            if (Global)
+                FirstGlobal = uint32_t(Symbols.size() / 24);
+            for (const AsmSymbol &Symbol : Object.Symbols)
+            {
+                if (Symbol.Global != Global)
+                    continue;
+                const uint64_t Base = Symbol.Section == AsmSection::Text ? Where.TextAddress : Symbol.Section == AsmSection::Data ? Where.DataAddress
+                                                                                                                                    : Where.BssAddress;
+                SymbolEntry(Symbols, Names, Symbol.Name, Global, SectionIndex(Symbol.Section), Base + Symbol.Offset);
+            }
+        }
+        Table.AddSymbols(File, Symbols, Names, FirstGlobal);
+
+        return Table.Finish(File, Path, true, Error);
+    }
+
+    // .o for a system linker, symbols nobody defined become undefined references
+    bool WriteObject(const ObjectCode &Object, const std::filesystem::path &Path)
+    {
+        std::vector<uint8_t> File;
+        Header(File, 1, 0, 0);
+
+        Sections Table;
+        const uint64_t TextOffset = Align(File.size(), 16);
+        File.resize(TextOffset, 0);
+        File.insert(File.end(), Object.Text.begin(), Object.Text.end());
+        Table.Add(".text", 1, 6, 0, TextOffset, Object.Text.size(), 0, 0, 16, 0);
+
+        const uint64_t DataOffset = Align(File.size(), 16);
+        File.resize(DataOffset, 0);
+        File.insert(File.end(), Object.Data.begin(), Object.Data.end());
+        Table.Add(".data", 1, 3, 0, DataOffset, Object.Data.size(), 0, 0, 4, 0);
+        Table.Add(".bss", 8, 3, 0, File.size(), Object.BssSize, 0, 0, 16, 0);
+
+        // null, the three section symbols, then locals, then globals and undefined symbols
+        std::vector<uint8_t> Symbols(24, 0), Names(1, 0);
+        for (uint16_t Section = 1; Section <= 3; Section++)
+        {
+            Put(Symbols, 0, 4);
+            Put(Symbols, 3, 1); // STB_LOCAL, STT_SECTION
+            Put(Symbols, 0, 1);
+            Put(Symbols, Section, 2);
+            Put(Symbols, 0, 16);
+        }
+
+        std::unordered_map<std::string, uint32_t> Index;
+        for (const AsmSymbol &Symbol : Object.Symbols)
+        {
+            if (Symbol.Global)
+                continue;
+            Index[Symbol.Name] = uint32_t(Symbols.size() / 24);
+            SymbolEntry(Symbols, Names, Symbol.Name, false, SectionIndex(Symbol.Section), Symbol.Offset);
+        }
+
+        const uint32_t FirstGlobal = uint32_t(Symbols.size() / 24);
+        for (const AsmSymbol &Symbol : Object.Symbols)
+        {
+            if (!Symbol.Global)
+                continue;
+            Index[Symbol.Name] = uint32_t(Symbols.size() / 24);
+            SymbolEntry(Symbols, Names, Symbol.Name, true, SectionIndex(Symbol.Section), Symbol.Offset);
+        }
+        for (const AsmRelocation &Relocation : Object.Relocations)
+        {
+            if (Index.count(Relocation.Symbol))
+                continue;
+            Index[Relocation.Symbol] = uint32_t(Symbols.size() / 24);
+            SymbolEntry(Symbols, Names, Relocation.Symbol, true, 0, 0);
+        }
+
+        std::vector<uint8_t> Relocations;
+        for (const AsmRelocation &Relocation : Object.Relocations)
+        {
+            const AsmSymbol *Symbol = Object.FindSymbol(Relocation.Symbol);
+            uint64_t Target = Index.at(Relocation.Symbol);
+            int64_t Addend = Relocation.Addend;
+
+            // locals are referenced through their section so the linker does not need them
+            if (Symbol && !Symbol->Global)
+            {
+                Target = SectionIndex(Symbol->Section);
+                Addend += Symbol->Offset;
+            }
+
+            const uint64_t Type = Relocation.Type == RelocationType::Relative32 ? 4 : 11; // R_X86_64_PLT32, R_X86_64_32S
+            Put(Relocations, Relocation.Offset, 8);
+            Put(Relocations, Target << 32 | Type, 8);
+            Put(Relocations, uint64_t(Addend), 8);
+        }
+
+        const uint64_t RelocationOffset = Align(File.size(), 8);
+        File.resize(RelocationOffset, 0);
+        File.insert(File.end(), Relocations.begin(), Relocations.end());
+        // .rela.text links to .symtab, which AddSymbols puts right after it
+        Table.Add(".rela.text", 4, 0x40, 0, RelocationOffset, Relocations.size(), 5, 1, 8, 24);
+
+        Table.AddSymbols(File, Symbols, Names, FirstGlobal);
+        return Table.Finish(File, Path, false, Error);
+    }
+
+private:
+    static uint64_t Align(uint64_t Value, uint64_t Alignment)
+    {
+        return (Value + Alignment - 1) / Alignment * Alignment;
+    }
+
+    static void Put(std::vector<uint8_t> &Bytes, uint64_t Value, int Width)
+    {
+        for (int i = 0; i < Width; i++)
+            Bytes.push_back(uint8_t(i < 8 ? Value >> (8 * i) : 0));
+    }
+
+    static void Patch(std::vector<uint8_t> &Bytes, size_t Offset, uint64_t Value, int Width)
+    {
+        for (int i = 0; i < Width; i++)
+            Bytes.at(Offset + i) = uint8_t(Value >> (8 * i));
+    }
+
+    static uint16_t SectionIndex(AsmSection Section)
+    {
+        return Section == AsmSection::Text ? 1 : Section == AsmSection::Data ? 2
+                                                                             : 3;
+    }
+
+    // e_shoff, e_shnum and e_shstrndx are patched by Sections::Finish
+    static void Header(std::vector<uint8_t> &File, uint16_t Type, uint64_t Entry, uint16_t ProgramHeaders)
+    {
+        const uint8_t Identity[16] = {0x7F, 'E', 'L', 'F', 2, 1, 1, 0};
+        File.insert(File.end(), Identity, Identity + 16);
+        Put(File, Type, 2);
+        Put(File, 62, 2); // EM_X86_64
+        Put(File, 1, 4);
+        Put(File, Entry, 8);
+        Put(File, ProgramHeaders ? 64 : 0, 8);
+        Put(File, 0, 8); // e_shoff
+        Put(File, 0, 4);
+        Put(File, 64, 2);
+        Put(File, ProgramHeaders ? 56 : 0, 2);
+        Put(File, ProgramHeaders, 2);
+        Put(File, 64, 2);
+        Put(File, 0, 2); // e_shnum
+        Put(File, 0, 2); // e_shstrndx
+    }
+
+    static void ProgramHeader(std::vector<uint8_t> &File, uint32_t Flags, uint64_t Offset, uint64_t Address, uint64_t FileSize, uint64_t MemorySize)
+    {
+        Put(File, 1, 4); // PT_LOAD
+        Put(File, Flags, 4);
+        Put(File, Offset, 8);
+        Put(File, Address, 8);
+        Put(File, Address, 8);
+        Put(File, FileSize, 8);
+        Put(File, MemorySize, 8);
+        Put(File, PageSize, 8);
+    }
+
+    static void SymbolEntry(std::vector<uint8_t> &Symbols, std::vector<uint8_t> &Names, const std::string &Name, bool Global, uint16_t Section, uint64_t Value)
+    {
+        Put(Symbols, Names.size(), 4);
+        Names.insert(Names.end(), Name.begin(), Name.end());
+        Names.push_back(0);
+        Put(Symbols, Global ? 0x10 : 0, 1); // STB_GLOBAL or STB_LOCAL, STT_NOTYPE
+        Put(Symbols, 0, 1);
+        Put(Symbols, Section, 2);
+        Put(Symbols, Value, 8);
+        Put(Symbols, 0, 8);
+    }
+
+    // the section header table, written after everything else
+    struct Sections
+    {
+        std::vector<uint8_t> Headers = std::vector<uint8_t>(64, 0);
+        std::vector<uint8_t> Names = std::vector<uint8_t>(1, 0);
+
+        void Add(const std::string &Name, uint32_t Type, uint64_t Flags, uint64_t Address, uint64_t Offset, uint64_t Size, uint32_t Link, uint32_t Info, uint64_t Alignment, uint64_t EntrySize)
+        {
+            Put(Headers, Names.size(), 4);
+            Names.insert(Names.end(), Name.begin(), Name.end());
+            Names.push_back(0);
+            Put(Headers, Type, 4);
+            Put(Headers, Flags, 8);
+            Put(Headers, Address, 8);
+            Put(Headers, Offset, 8);
+            Put(Headers, Size, 8);
+            Put(Headers, Link, 4);
+            Put(Headers, Info, 4);
+            Put(Headers, Alignment, 8);
+            Put(Headers, EntrySize, 8);
+        }
+
+        size_t Count() const
+        {
+            return Headers.size() / 64;
+        }
+
+        // .symtab and the .strtab it links to
+        void AddSymbols(std::vector<uint8_t> &File, const std::vector<uint8_t> &Symbols, const std::vector<uint8_t> &SymbolNames, uint32_t FirstGlobal)
+        {
+            const uint64_t SymbolOffset = Align(File.size(), 8);
+            File.resize(SymbolOffset, 0);
+            File.insert(File.end(), Symbols.begin(), Symbols.end());
+            Add(".symtab", 2, 0, 0, SymbolOffset, Symbols.size(), uint32_t(Count() + 1), FirstGlobal, 8, 24);
+
+            const uint64_t NamesOffset = File.size();
+            File.insert(File.end(), SymbolNames.begin(), SymbolNames.end());
+            Add(".strtab", 3, 0, 0, NamesOffset, SymbolNames.size(), 0, 0, 1, 0);
+        }
+
+        bool Finish(std::vector<uint8_t> &File, const std::filesystem::path &Path, bool Executable, std::string &Error)
+        {
+            const uint64_t NamesOffset = File.size();
+            const size_t Index = Count();
+            const std::string Name = ".shstrtab";
+            Add(Name, 3, 0, 0, NamesOffset, Names.size() + Name.size() + 1, 0, 0, 1, 0); // counts its own name
+            File.insert(File.end(), Names.begin(), Names.end());
+
+            const uint64_t HeadersOffset = Align(File.size(), 8);
+            File.resize(HeadersOffset, 0);
+            File.insert(File.end(), Headers.begin(), Headers.end());
+
+            Patch(File, 40, HeadersOffset, 8);
+            Patch(File, 60, Count(), 2);
+            Patch(File, 62, Index, 2);
+
+            std::ofstream Out(Path, std::ios::binary | std::ios::trunc);
+            if (!Out.is_open())
+            {
+                Error = "cannot write " + Path.string();
+                return false;
+            }
+            Out.write(reinterpret_cast<const char *>(File.data()), File.size());
+            Out.close();
+
+            if (Executable)
+            {
+                std::error_code Ignored;
+                std::filesystem::permissions(Path, std::filesystem::perms::owner_all | std::filesystem::perms::group_read | std::filesystem::perms::group_exec | std::filesystem::perms::others_read | std::filesystem::perms::others_exec, Ignored);
+            }
+            return true;
+        }
+    };
+};
@@ -3,4 +3,5 @@
 
 #include "Token.hpp"
 
-Token CurrentParseToken = Token(TokenType::Null, "init");
+// per thread so compilations running on other threads do not interfere
+inline thread_local Token CurrentParseToken = Token(TokenType::Null, "init");
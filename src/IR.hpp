@@ -0,0 +1,547 @@
+#pragma once
+
+#include "Common.hpp"
+
+/*
+ * three address SSA intermediate representation, functions are
+ * lists of basic blocks ending in exactly one terminator and every
+ * value is defined once by the instruction with the same Id
+ */
+
+enum class IRType
+{
+    Void,
+    I64,
+    Ptr,
+    F64, // the bits of a double, kept where an i64 would be
+};
+
+enum class IROpcode
+{
+    Const,       // Imm
+    Param,       // Imm = parameter index
+    String,      // Text = the bytes, an immortal read only char[]
+    Add,
+    Sub,
+    Mul,
+    Neg,
+    CmpGT,
+    CmpLT,
+    CmpGE,
+    CmpLE,
+    FAdd,
+    FSub,
+    FMul,
+    FDiv,
+    FNeg,
+    FCmpGT,
+    FCmpLT,
+    FCmpGE,
+    FCmpLE,
+    IntToFloat, // an integer to the nearest double
+    FloatToInt, // a double truncated toward zero
+    FloatRound, // a double to the nearest float and back, what storing a float keeps
+    Phi,         // Operands[i] flows in from block Targets[i]
+    Call,        // Text = label, Operands = arguments, Imm = 1 for a C function
+    Load,        // pointer, index, Imm = element size, Signed if it sign extends, Floating for a float or double
+    Store,       // pointer, index, value, Imm = element size, Floating for a float or double
+    Length,      // element count of an array
+    NewArray,    // element count, Imm = element size
+    Copy,        // string literal, a counted char[] of its bytes the program may write through
+    StackArray,  // element count (a constant), Imm = element size, in the frame until the function returns
+    BoundsCheck, // pointer, index, exits the program when out of bounds
+    RefInc,      // pointer
+    Release,     // pointer, drops a reference and frees at zero, Imm = element size
+    Collect,     // pointer, frees it if nothing references it, Imm = element size
+    Free,        // pointer, frees it without looking at its count, Imm = element size
+    Asm,         // Text = inline assembly, Operands = the value it expects in rax if any, may change any register
+    VectorEnd,   // start, bound, arrays to stay inside, Imm = lanes, where a vector loop from start has to stop
+    VectorLoop,  // Text = operation, start, end, its arrays and values, Imm = lanes, the result of a reduction
+
+    // only exist until the locals are promoted to SSA values
+    LocalGet, // Imm = local
+    LocalSet, // value, Imm = local
+
+    // terminators
+    Br,     // Targets[0]
+    CondBr, // condition, Targets = {then, else}
+    Ret,    // value
+};
+
+struct IRInstruction
+{
+    IROpcode Op;
+    IRType Type = IRType::Void;
+    uint32_t Id = 0; // 0 when no value is produced
+    std::vector<uint32_t> Operands;
+    std::vector<uint32_t> Targets;
+    int64_t Imm = 0;
+    std::string Text;
+    bool Signed = false;   // Load of an element narrower than 8 bytes
+    bool Floating = false; // Load or Store of a float or double element, a float is widened to a double in registers
+
+    bool IsTerminator() const
+    {
+        return Op == IROpcode::Br || Op == IROpcode::CondBr || Op == IROpcode::Ret;
+    }
+
+    // false if removing an unused instance would change the program
+    bool IsPure() const
+    {
+        switch (Op)
+        {
+        case IROpcode::Const:
+        case IROpcode::Param:
+        case IROpcode::Add:
+        case IROpcode::Sub:
+        case IROpcode::Mul:
+        case IROpcode::Neg:
+        case IROpcode::CmpGT:
+        case IROpcode::CmpLT:
+        case IROpcode::CmpGE:
+        case IROpcode::CmpLE:
+        case IROpcode::FAdd:
+        case IROpcode::FSub:
+        case IROpcode::FMul:
+        case IROpcode::FDiv:
+        case IROpcode::FNeg:
+        case IROpcode::FCmpGT:
+        case IROpcode::FCmpLT:
+        case IROpcode::FCmpGE:
+        case IROpcode::FCmpLE:
+        case IROpcode::IntToFloat:
+        case IROpcode::FloatToInt:
+        case IROpcode::FloatRound:
+        case IROpcode::Phi:
+        case IROpcode::Length:
+        case IROpcode::Load:
+        case IROpcode::LocalGet:
+        case IROpcode::String:
+        case IROpcode::VectorEnd:
+            return true;
+        default:
+            return false;
+        }
+    }
+};
+
+struct IRBlock
+{
+    uint32_t Id = 0;
+    std::vector<IRInstruction> Instructions;
+
+    // filled in by IRFunction::ComputeCFG()
+    std::vector<uint32_t> Predecessors;
+    std::vector<uint32_t> Successors;
+
+    bool Terminated() const
+    {
+        return !Instructions.empty() && Instructions.back().IsTerminator();
+    }
+};
+
+struct IRFunction
+{
+    std::string Name; // the mangled label
+    bool IsMain = false;
+    bool Global = false;
+    bool Inline = false;   // @inline
+    bool NoInline = false; // @noinline
+    bool CLinkage = false; // defn(C)
+    size_t UnrollFactor = 0; // copies of the body an unrolled loop runs per trip, below 2 never unrolls
+    size_t VectorLanes = 0;  // 4 byte elements a vector loop does at once, 0 never vectorizes
+    std::vector<IRType> Parameters;
+    std::vector<IRBlock> Blocks; // Blocks[0] is the entry
+    uint32_t NextValue = 1;
+    uint32_t NextBlock = 0;
+    std::map<std::string, size_t> Statistics; // what the passes did, "bounds checks removed" to how often
+
+    // filled in by ComputeCFG() and ComputeDominance()
+    std::vector<uint32_t> ReversePostOrder;
+    std::unordered_map<uint32_t, uint32_t> ImmediateDominator; // the entry dominates itself
+    std::unordered_map<uint32_t, std::vector<uint32_t>> DominatorTree;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> DominanceFrontier;
+
+    IRBlock &Block(uint32_t Id)
+    {
+        for (IRBlock &Block : Blocks)
+        {
+            if (Block.Id == Id)
+                return Block;
+        }
+        throw std::out_of_range("no IR block bb" + std::to_string(Id));
+    }
+
+    uint32_t NewBlock()
+    {
+        Blocks.push_back(IRBlock{.Id = NextBlock});
+        return NextBlock++;
+    }
+
+    // appends to the block and returns the new value, 0 for void instructions
+    uint32_t Append(uint32_t BlockId, IRInstruction Instruction)
+    {
+        if (Instruction.Type != IRType::Void)
+            Instruction.Id = NextValue++;
+        Block(BlockId).Instructions.push_back(Instruction);
+        return Instruction.Id;
+    }
+
+    // every instruction that produces a value, by Id
+    std::unordered_map<uint32_t, IRInstruction *> Definitions()
+    {
+        std::unordered_map<uint32_t, IRInstruction *> Result;
+        for (IRBlock &Block : Blocks)
+        {
+            for (IRInstruction &Instruction : Block.Instructions)
+            {
+                if (Instruction.Id)
+                    Result[Instruction.Id] = &Instruction;
+            }
+        }
+        return Result;
+    }
+
+    void ReplaceAllUses(uint32_t From, uint32_t To)
+    {
+        for (IRBlock &Block : Blocks)
+        {
+            for (IRInstruction &Instruction : Block.Instructions)
+            {
+                std::replace(Instruction.Operands.begin(), Instruction.Operands.end(), From, To);
+            }
+        }
+    }
+
+    // phis nothing reads and phis that only ever merge one value
+    void RemoveRedundantPhis()
+    {
+        bool Changed = true;
+        while (Changed)
+        {
+            Changed = false;
+
+            std::unordered_map<uint32_t, size_t> Uses;
+            for (const IRBlock &Block : Blocks)
+            {
+                for (const IRInstruction &Instruction : Block.Instructions)
+                {
+                    for (uint32_t Operand : Instruction.Operands)
+                    {
+                        if (Operand != Instruction.Id)
+                            Uses[Operand]++;
+                    }
+                }
+            }
+
+            for (IRBlock &Block : Blocks)
+            {
+                for (size_t i = 0; i < Block.Instructions.size(); i++)
+                {
+                    IRInstruction &Phi = Block.Instructions.at(i);
+                    if (Phi.Op != IROpcode::Phi)
+                        continue;
+
+                    std::optional<uint32_t> Same;
+                    bool Trivial = true;
+                    for (uint32_t Operand : Phi.Operands)
+                    {
+                        if (Operand == Phi.Id || (Same && *Same == Operand))
+                            continue;
+                        if (Same)
+                            Trivial = false;
+                        Same = Operand;
+                    }
+
+                    if (!Uses.count(Phi.Id) || (Trivial && Same))
+                    {
+                        if (Uses.count(Phi.Id))
+                            ReplaceAllUses(Phi.Id, *Same);
+                        Block.Instructions.erase(Block.Instructions.begin() + i);
+                        Changed = true;
+                        break;
+                    }
+                }
+                if (Changed)
+                    break;
+            }
+        }
+    }
+
+    // predecessors, successors and reverse post order, unreachable blocks are removed
+    void ComputeCFG()
+    {
+        std::unordered_set<uint32_t> Visited;
+        std::vector<uint32_t> PostOrder;
+        std::vector<std::pair<uint32_t, size_t>> Stack = {{Blocks.front().Id, 0}};
+        Visited.insert(Blocks.front().Id);
+
+        while (!Stack.empty())
+        {
+            auto &[Id, Next] = Stack.back();
+            const IRBlock &Current = Block(Id);
+            const std::vector<uint32_t> &Targets = Current.Terminated() ? Current.Instructions.back().Targets : std::vector<uint32_t>();
+
+            // the first target is visited last so it follows its block in the order
+            if (Next < Targets.size())
+            {
+                const uint32_t Target = Targets.at(Targets.size() - 1 - Next++);
+                if (Visited.insert(Target).second)
+                    Stack.push_back({Target, 0});
+                continue;
+            }
+
+            PostOrder.push_back(Id);
+            Stack.pop_back();
+        }
+
+        Blocks.erase(std::remove_if(Blocks.begin(), Blocks.end(),
+                                    [&](const IRBlock &Block)
+                                    { return !Visited.count(Block.Id); }),
+                     Blocks.end());
+
+        for (IRBlock &Block : Blocks)
+        {
+            Block.Predecessors.clear();
+            Block.Successors.clear();
+        }
+
+        for (IRBlock &From : Blocks)
+        {
+            if (!From.Terminated())
+                continue;
+            for (uint32_t Target : From.Instructions.back().Targets)
+            {
+                if (std::find(From.Successors.begin(), From.Successors.end(), Target) != From.Successors.end())
+                    continue;
+                From.Successors.push_back(Target);
+                Block(Target).Predecessors.push_back(From.Id);
+            }
+        }
+
+        // phis only keep the edges that still exist
+        for (IRBlock &Block : Blocks)
+        {
+            for (IRInstruction &Instruction : Block.Instructions)
+            {
+                if (Instruction.Op != IROpcode::Phi)
+                    continue;
+                for (size_t i = Instruction.Targets.size(); i-- > 0;)
+                {
+                    if (std::find(Block.Predecessors.begin(), Block.Predecessors.end(), Instruction.Targets.at(i)) != Block.Predecessors.end())
+                        continue;
+                    Instruction.Targets.erase(Instruction.Targets.begin() + i);
+                    Instruction.Operands.erase(Instruction.Operands.begin() + i);
+                }
+            }
+        }
+
+        ReversePostOrder.assign(PostOrder.rbegin(), PostOrder.rend());
+    }
+
+    // Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm"
+    void ComputeDominance()
+    {
+        std::unordered_map<uint32_t, size_t> Order;
+        for (size_t i = 0; i < ReversePostOrder.size(); i++)
+            Order[ReversePostOrder.at(i)] = i;
+
+        const uint32_t Entry = ReversePostOrder.front();
+        ImmediateDominator.clear();
+        ImmediateDominator[Entry] = Entry;
+
+        auto Intersect = [&](uint32_t a, uint32_t b)
+        {
+            while (a != b)
+            {
+                while (Order.at(a) > Order.at(b))
+                    a = ImmediateDominator.at(a);
+                while (Order.at(b) > Order.at(a))
+                    b = ImmediateDominator.at(b);
+            }
+            return a;
+        };
+
+        bool Changed = true;
+        while (Changed)
+        {
+            Changed = false;
+            for (uint32_t Id : ReversePostOrder)
+            {
+                if (Id == Entry)
+                    continue;
+
+                std::optional<uint32_t> NewDominator;
+                for (uint32_t Pred : Block(Id).Predecessors)
+                {
+                    if (!ImmediateDominator.count(Pred))
+                        continue;
+                    NewDominator = NewDominator ? Intersect(Pred, *NewDominator) : Pred;
+                }
+
+                if (NewDominator && (!ImmediateDominator.count(Id) || ImmediateDominator.at(Id) != *NewDominator))
+                {
+                    ImmediateDominator[Id] = *NewDominator;
+                    Changed = true;
+                }
+            }
+        }
+
+        DominatorTree.clear();
+        DominanceFrontier.clear();
+        for (uint32_t Id : ReversePostOrder)
+        {
+            if (Id != Entry)
+                DominatorTree[ImmediateDominator.at(Id)].push_back(Id);
+
+            const std::vector<uint32_t> &Predecessors = Block(Id).Predecessors;
+            if (Predecessors.size() < 2)
+                continue;
+
+            for (uint32_t Runner : Predecessors)
+            {
+                while (Runner != ImmediateDominator.at(Id))
+                {
+                    std::vector<uint32_t> &Frontier = DominanceFrontier[Runner];
+                    if (std::find(Frontier.begin(), Frontier.end(), Id) == Frontier.end())
+                        Frontier.push_back(Id);
+                    Runner = ImmediateDominator.at(Runner);
+                }
+            }
+        }
+    }
+
+    bool Dominates(uint32_t a, uint32_t b) const
+    {
+        while (true)
+        {
+            if (a == b)
+                return true;
+            const uint32_t Parent = ImmediateDominator.at(b);
+            if (Parent == b)
+                return false;
+            b = Parent;
+        }
+    }
+
+    std::string ToString() const
+    {
+        std::stringstream Out;
+
+        Out << "function " << Name << "(";
+        for (size_t i = 0; i < Parameters.size(); i++)
+            Out << (i ? ", " : "") << TypeName(Parameters.at(i));
+        Out << ") {\n";
+
+        for (const IRBlock &Block : Blocks)
+        {
+            Out << "bb" << Block.Id << ":";
+            if (!Block.Predecessors.empty())
+            {
+                Out << " ; preds";
+                for (uint32_t Pred : Block.Predecessors)
+                    Out << " bb" << Pred;
+            }
+            Out << "\n";
+
+            for (const IRInstruction &Instruction : Block.Instructions)
+            {
+                Out << "    ";
+                if (Instruction.Id)
+                    Out << "%" << Instruction.Id << " = ";
+                Out << OpcodeName(Instruction.Op);
+                if (Instruction.Type != IRType::Void)
+                    Out << " " << TypeName(Instruction.Type);
+
+                const char *Separator = " ";
+                if (Instruction.Op == IROpcode::Phi)
+                {
+                    for (size_t i = 0; i < Instruction.Operands.size(); i++, Separator = ", ")
+                        Out << Separator << "[%" << Instruction.Operands.at(i) << ", bb" << Instruction.Targets.at(i) << "]";
+                }
+                else
+                {
+                    if (Instruction.Op == IROpcode::Call)
+                    {
+                        Out << " @" << Instruction.Text;
+                        Separator = ", ";
+                    }
+                    else if (Instruction.Op == IROpcode::VectorLoop)
+                    {
+                        Out << " " << Instruction.Text;
+                        Separator = ", ";
+                    }
+                    for (uint32_t Operand : Instruction.Operands)
+                    {
+                        Out << Separator << "%" << Operand;
+                        Separator = ", ";
+                    }
+                    for (uint32_t Target : Instruction.Targets)
+                    {
+                        Out << Separator << "bb" << Target;
+                        Separator = ", ";
+                    }
+                }
+
+                switch (Instruction.Op)
+                {
+                case IROpcode::Const:
+                case IROpcode::Param:
+                case IROpcode::Load:
+                    Out << Separator << Instruction.Imm << (Instruction.Signed ? " signed" : "") << (Instruction.Floating ? " floating" : "");
+                    break;
+                case IROpcode::Store:
+                    Out << Separator << Instruction.Imm << (Instruction.Floating ? " floating" : "");
+                    break;
+                case IROpcode::NewArray:
+                case IROpcode::StackArray:
+                case IROpcode::Release:
+                case IROpcode::Collect:
+                case IROpcode::Free:
+                case IROpcode::LocalGet:
+                case IROpcode::LocalSet:
+                case IROpcode::VectorEnd:
+                case IROpcode::VectorLoop:
+                    Out << Separator << Instruction.Imm;
+                    break;
+                case IROpcode::String:
+                    Out << Separator << "\"" << Instruction.Text << "\"";
+                    break;
+                case IROpcode::Asm:
+                    Out << Separator << std::count(Instruction.Text.begin(), Instruction.Text.end(), '\n') << " lines";
+                    break;
+                default:
+                    break;
+                }
+
+                Out << "\n";
+            }
+        }
+
+        Out << "}\n";
+        return Out.str();
+    }
+
+    static std::string TypeName(IRType Type)
+    {
+        switch (Type)
+        {
+        case IRType::I64:
+            return "i64";
+        case IRType::Ptr:
+            return "ptr";
+        case IRType::F64:
+            return "f64";
+        default:
+            return "void";
+        }
+    }
+
+    static std::string OpcodeName(IROpcode Op)
+    {
+        std::string Name(magic_enum::enum_name(Op));
+        std::transform(Name.begin(), Name.end(), Name.begin(), [](unsigned char c)
+                       { return std::tolower(c); });
+        return Name;
+    }
+};
@@ -0,0 +1,760 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Ast.hpp"
+#include "SymbolResolver.hpp"
+#include "IR.hpp"
+
+/*
+ * lowers one function body from the AST to SSA form, symbols are resolved
+ * on a copy of the code generator's table so nothing declared or reported
+ * here leaks into the real compilation
+ */
+class IRLowering : public SymbolResolver
+{
+public:
+    IRLowering(const SymbolResolver &Generator)
+        : SymbolResolver(Generator)
+    {
+        Errors.clear();
+    }
+
+    // nullptr when the body uses something the IR cannot express yet,
+    // the code generator then emits that function directly
+    std::shared_ptr<IRFunction> LowerFunction(const std::shared_ptr<FunctionDefinition> &Func, const std::string &Label, bool IsMain)
+    {
+        Function = std::make_shared<IRFunction>();
+        Function->Name = Label;
+        Function->IsMain = IsMain;
+        Function->Global = Func->Global || IsMain;
+        Function->Inline = Func->Inline;
+        Function->NoInline = Func->NoInline;
+        Function->CLinkage = Func->CLinkage;
+        Function->UnrollFactor = CmplFlags.UnrollFactor;
+        Function->VectorLanes = CmplFlags.AVX2 ? 8 : 4;
+        Current = Function->NewBlock();
+
+        // C passes floating arguments in the xmm registers, only the direct path takes them from there
+        if (PassesFloatsToC(*Func))
+            Fail();
+
+        for (size_t j = 0; j < Func->Arguments.size(); j++)
+        {
+            const VarDeclaration &ParamDecl = Func->Arguments.at(j);
+            const IRType Type = LowerType(ParamDecl.Type);
+            Function->Parameters.push_back(Type);
+
+            DeclareVariable(Variable{.TypeDesc = ParamDecl.Type, .Address = ParamDecl.Address, .Name = ParamDecl.Name});
+            SetLocal(ParamDecl.Address, Type, Emit(IRInstruction{.Op = IROpcode::Param, .Type = Type, .Imm = int64_t(j)}));
+        }
+
+        OpenScope(); // parameters destroyed by the caller
+
+        for (const StatementPtr &Stmt : Func->Body)
+        {
+            LowerStatement(Stmt);
+        }
+
+        CloseScope();
+
+        // return null
+        Emit(IRInstruction{.Op = IROpcode::Ret, .Operands = {Constant(0)}});
+
+        for (const CompileError &Error : Errors)
+        {
+            if (Error.Severity >= SyntaxError)
+                Unsupported = true;
+        }
+
+        if (Unsupported)
+            return nullptr;
+
+        PromoteLocals();
+        return Function;
+    }
+
+private:
+    std::shared_ptr<IRFunction> Function;
+    uint32_t Current = 0;
+    bool Unsupported = false;
+    uint32_t LastExpression = 0; // value of the statement just lowered if it was an expression
+
+    std::unordered_map<MapId, int64_t> Locals; // address to local number
+    std::vector<IRType> LocalTypes;
+
+    std::shared_ptr<ExpressionStatement> EvalExpr = std::make_shared<ExpressionStatement>(nullptr); // CurrentEval of expressions
+
+    void DeclareNamespaceMember(const StatementPtr &Stmt) override
+    {
+        Unsupported = true;
+    }
+
+    uint32_t Fail()
+    {
+        Unsupported = true;
+        return 0;
+    }
+
+    uint32_t Emit(IRInstruction Instruction)
+    {
+        // code after a return goes into a block nothing branches to
+        if (Function->Block(Current).Terminated())
+            Current = Function->NewBlock();
+        return Function->Append(Current, std::move(Instruction));
+    }
+
+    uint32_t Constant(int64_t Value)
+    {
+        return Emit(IRInstruction{.Op = IROpcode::Const, .Type = IRType::I64, .Imm = Value});
+    }
+
+    void Branch(uint32_t Target)
+    {
+        Emit(IRInstruction{.Op = IROpcode::Br, .Targets = {Target}});
+    }
+
+    IRType LowerType(const TypeDescriptor &Type)
+    {
+        if (Type.Type == ValueType::Custom || Type.CustomTypeName)
+        {
+            Unsupported = true;
+            return IRType::Void;
+        }
+        if (Type.PointerDepth)
+            return IRType::Ptr;
+        return IsFloatingType(Type) ? IRType::F64 : IRType::I64;
+    }
+
+    bool IsRefCounted(const TypeDescriptor &Type)
+    {
+        return Type.PointerDepth && CmplFlags.GarbageCollect;
+    }
+
+    int64_t ElementSize(TypeDescriptor Type)
+    {
+        Type.PointerDepth--;
+        return SizeOfType(Type);
+    }
+
+    void SetLocal(MapId Address, IRType Type, uint32_t Value)
+    {
+        if (!Locals.count(Address))
+        {
+            Locals[Address] = LocalTypes.size();
+            LocalTypes.push_back(Type);
+        }
+        Emit(IRInstruction{.Op = IROpcode::LocalSet, .Operands = {Value}, .Imm = Locals.at(Address)});
+    }
+
+    uint32_t GetLocal(MapId Address)
+    {
+        const int64_t Local = Locals.at(Address);
+        return Emit(IRInstruction{.Op = IROpcode::LocalGet, .Type = LocalTypes.at(Local), .Imm = Local});
+    }
+
+    void OpenScope()
+    {
+        CurrentScope++;
+    }
+
+    void CloseScope()
+    {
+        const int64_t ScopeLoc = CurrentScope--;
+
+        for (int i = Variables.size() - 1; i >= 0; i--)
+        {
+            Variable &Var = Variables.at(i);
+
+            if (Var.Funcs || Var.Class || Var.Namespace)
+                continue;
+            if (int64_t(Var.ScopeI) < ScopeLoc)
+                continue;
+
+            if (IsRefCounted(Var.TypeDesc) && Locals.count(Var.Address))
+                Emit(IRInstruction{.Op = IROpcode::Release, .Operands = {GetLocal(Var.Address)}, .Imm = ElementSize(Var.TypeDesc)});
+
+            DiscardVariable(i);
+        }
+    }
+
+    void LowerBlock(const std::vector<StatementPtr> &Body)
+    {
+        OpenScope();
+        for (const StatementPtr &Stmt : Body)
+        {
+            LowerStatement(Stmt);
+        }
+        CloseScope();
+    }
+
+    void LowerStatement(const StatementPtr &Stmt)
+    {
+        CurrentEval = Stmt;
+
+        // what an expression statement leaves in rax for the assembly after it
+        const uint32_t Accumulator = std::exchange(LastExpression, 0);
+
+        if (auto ExprStmt = std::dynamic_pointer_cast<ExpressionStatement>(Stmt))
+        {
+            LastExpression = LowerExpression(ExprStmt->Expr);
+        }
+        else if (auto Asm = std::dynamic_pointer_cast<AssemblyInstructions>(Stmt))
+        {
+            if (!FrameIndependent(*Asm))
+            {
+                Fail();
+                return;
+            }
+
+            // consecutive blocks stay one, nothing may run between them
+            std::vector<IRInstruction> &Instructions = Function->Block(Current).Instructions;
+            if (!Accumulator && !Instructions.empty() && Instructions.back().Op == IROpcode::Asm)
+                Instructions.back().Text += Asm->ToString();
+            else
+                Emit(IRInstruction{.Op = IROpcode::Asm, .Operands = Accumulator ? std::vector<uint32_t>{Accumulator} : std::vector<uint32_t>{}, .Text = Asm->ToString()});
+        }
+        else if (auto Multi = std::dynamic_pointer_cast<MultiStatement>(Stmt))
+        {
+            for (const StatementPtr &Stmt : Multi->Statements)
+            {
+                LowerStatement(Stmt);
+            }
+        }
+        else if (auto Decl = std::dynamic_pointer_cast<VarDeclaration>(Stmt))
+        {
+            CmplSymbol Symbol = ResolveSymbol(Decl->Initializer);
+
+            // nested functions, namespaces and classes
+            if (Symbol.Funcs || Symbol.Namespace || Symbol.Class)
+            {
+                Fail();
+                return;
+            }
+
+            TypeDescriptor Type = Decl->Type;
+            if (Type.Type == ValueType::Unknown)
+            {
+                Type = Symbol.TypeDesc;
+                Type.Constant = Decl->Type.Constant;
+            }
+            else if (!CompileTypeMatch(Symbol.TypeDesc, Decl->Type))
+            {
+                Fail();
+                return;
+            }
+
+            const IRType LocalType = LowerType(Type);
+            DeclareVariable(Variable{.TypeDesc = Type, .Address = Decl->Address, .Name = Decl->Name});
+
+            const uint32_t Value = LowerBinding(Decl->Initializer, Type);
+            if (IsRefCounted(Type))
+                Emit(IRInstruction{.Op = IROpcode::RefInc, .Operands = {Value}});
+            SetLocal(Decl->Address, LocalType, Value);
+        }
+        else if (auto If = std::dynamic_pointer_cast<IfStatement>(Stmt))
+        {
+            const uint32_t End = Function->NewBlock();
+
+            for (size_t i = 0; i < If->Then.size(); i++)
+            {
+                const uint32_t Condition = LowerExpression(If->Conditions.at(i));
+                const uint32_t Then = Function->NewBlock();
+                const uint32_t Next = Function->NewBlock();
+                Emit(IRInstruction{.Op = IROpcode::CondBr, .Operands = {Condition}, .Targets = {Then, Next}});
+
+                Current = Then;
+                LowerBlock(If->Then.at(i));
+                Branch(End);
+
+                Current = Next;
+            }
+
+            Branch(End);
+            Current = End;
+            LastExpression = 0; // defined in a branch
+        }
+        else if (auto While = std::dynamic_pointer_cast<WhileStatement>(Stmt))
+        {
+            const uint32_t Header = Function->NewBlock();
+            const uint32_t Body = Function->NewBlock();
+            const uint32_t Exit = Function->NewBlock();
+
+            Branch(Header);
+            Current = Header;
+            const uint32_t Condition = LowerExpression(While->Condition);
+            Emit(IRInstruction{.Op = IROpcode::CondBr, .Operands = {Condition}, .Targets = {Body, Exit}});
+
+            Current = Body;
+            LowerBlock(While->Body);
+            Branch(Header);
+
+            Current = Exit;
+            LastExpression = 0;
+        }
+        else if (auto Return = std::dynamic_pointer_cast<ReturnStatement>(Stmt))
+        {
+            Emit(IRInstruction{.Op = IROpcode::Ret, .Operands = {LowerExpression(Return->Expr)}});
+        }
+        else
+        {
+            // use statements
+            Fail();
+        }
+    }
+
+    // assembly that only passes values through rax and keeps its pushes balanced,
+    // it cannot see the frame of a lowered function or be copied with its own labels
+    static bool FrameIndependent(const AssemblyInstructions &Asm)
+    {
+        bool InMemoryOperand = false;
+        for (size_t i = 0; i < Asm.Instructions.size(); i++)
+        {
+            const Token &Tok = Asm.Instructions.at(i);
+            if (Tok.Type == TokenType::LBracket)
+                InMemoryOperand = true;
+            else if (Tok.Type == TokenType::RBracket)
+                InMemoryOperand = false;
+            else if (InMemoryOperand && (Tok.Text == "rsp" || Tok.Text == "rbp"))
+                return false;
+
+            if (Tok.Text == "ret" || Tok.Text == "leave" || Tok.Text == "section" || Tok.Text == "segment" || Tok.Text == "global")
+                return false;
+            if (i + 1 < Asm.Instructions.size() && Asm.Instructions.at(i + 1).Type == TokenType::Colon && (i == 0 || Asm.Instructions.at(i - 1).Type != TokenType::Dot))
+                return false;
+        }
+        return true;
+    }
+
+    uint32_t LowerCall(const std::shared_ptr<CallExpression> &Call)
+    {
+        CmplSymbol Symbol = ResolveSymbol(Call->Callee);
+        if (!Symbol.Funcs)
+            return Fail();
+
+        auto Func = CalculateBestOverload(Symbol.Funcs, Call, true);
+        if (!Func)
+            return Fail();
+
+        // selection passes doubles to a C function in xmm registers, a float or
+        // a function of ours that C calls is left to the direct path
+        if (PassesFloatsToC(*Func))
+        {
+            bool Direct = !Func->External || (IsFloatingType(Func->ReturnType) && Func->ReturnType.Type == ValueType::Float);
+            for (const VarDeclaration &Argument : Func->Arguments)
+                Direct |= IsFloatingType(Argument.Type) && Argument.Type.Type == ValueType::Float;
+            if (Direct)
+                return Fail();
+        }
+
+        std::vector<uint32_t> Arguments;
+        for (size_t i = 0; i < Call->Arguments.size(); i++)
+        {
+            Arguments.push_back(LowerBinding(Call->Arguments.at(i), Func->Arguments.at(i).Type));
+        }
+
+        const uint32_t Result = Emit(IRInstruction{.Op = IROpcode::Call, .Type = LowerType(Func->ReturnType), .Operands = Arguments, .Imm = Func->External, .Text = MangleFunctionSignature(*Func)});
+
+        // arguments nothing else holds a reference to die with the call
+        for (size_t i = 0; i < Call->Arguments.size(); i++)
+        {
+            const TypeDescriptor ArgType = ResolveSymbol(Call->Arguments.at(i)).TypeDesc;
+            if (IsRefCounted(ArgType))
+                Emit(IRInstruction{.Op = IROpcode::Collect, .Operands = {Arguments.at(i)}, .Imm = ElementSize(ArgType)});
+        }
+
+        return Result;
+    }
+
+    // literals are read only, one bound where the program may write through it gets a copy of its own
+    uint32_t LowerBinding(const ExpressionPtr &Expr, const TypeDescriptor &Type)
+    {
+        const uint32_t Value = LowerExpression(Expr);
+        auto Literal = std::dynamic_pointer_cast<ValueExpression>(Expr);
+        if (!Literal || Literal->Val.type() != typeid(std::string) || Type.Constant)
+            return Value;
+        return Emit(IRInstruction{.Op = IROpcode::Copy, .Type = IRType::Ptr, .Operands = {Value}});
+    }
+
+    uint32_t LowerExpression(const ExpressionPtr &Expr)
+    {
+        EvalExpr->Expr = Expr;
+        CurrentEval = EvalExpr;
+
+        if (auto Literal = std::dynamic_pointer_cast<ValueExpression>(Expr))
+        {
+            if (Literal->Val.type() == typeid(std::string))
+                return Emit(IRInstruction{.Op = IROpcode::String, .Type = IRType::Ptr, .Text = ToString(Literal->Val)});
+            if (Literal->Val.type() == typeid(char))
+                return Constant((unsigned char)std::any_cast<char>(Literal->Val));
+            if (Literal->Val.type() == typeid(std::nullptr_t))
+                return Constant(0);
+            if (Literal->Val.type() == typeid(bool))
+                return Constant(std::any_cast<bool>(Literal->Val));
+            if (Literal->Val.type() == typeid(rt_Int))
+                return Constant(std::any_cast<rt_Int>(Literal->Val));
+            if (Literal->Val.type() == typeid(rt_Float))
+                return Emit(IRInstruction{.Op = IROpcode::Const, .Type = IRType::F64, .Imm = DoubleBits(std::any_cast<rt_Float>(Literal->Val))});
+            return Fail();
+        }
+        else if (auto VarExpr = std::dynamic_pointer_cast<VariableExpression>(Expr))
+        {
+            if (VarExpr->Name.empty() || VarExpr->AtCursor)
+                return Fail();
+
+            CmplSymbol Symbol = ResolveSymbol(VarExpr);
+
+            if (Symbol.Funcs)
+                return LowerCall(std::make_shared<CallExpression>(CallExpression(VarExpr, {})));
+            if (!Symbol.Var || !Locals.count(VarExpr->Address))
+                return Fail();
+
+            return GetLocal(VarExpr->Address);
+        }
+        else if (auto Access = std::dynamic_pointer_cast<MemberExpression>(Expr))
+        {
+            CmplSymbol ObjectSymbol = ResolveSymbol(Access->Object);
+            CmplSymbol Symbol = ResolveSymbol(Access);
+
+            // only functions of a namespace, objects are not lowered yet
+            if (!ObjectSymbol.Namespace || !ObjectSymbol.Namespace->count(Access->Member) || !Symbol.Funcs)
+                return Fail();
+
+            return LowerCall(std::make_shared<CallExpression>(CallExpression(Access, {})));
+        }
+        else if (auto Index = std::dynamic_pointer_cast<IndexExpression>(Expr))
+        {
+            CmplSymbol ObjectSymbol = ResolveSymbol(Index->Object);
+            const CmplSymbol &IndexSymbol = ResolveSymbol(Index->Index);
+
+            if (!CompileTypeMatch(IndexSymbol.TypeDesc, ValueType::Long) || ObjectSymbol.TypeDesc.Nullable || !ObjectSymbol.TypeDesc.PointerDepth)
+                return Fail();
+
+            const uint32_t Pointer = LowerExpression(Index->Object);
+            const uint32_t Offset = LowerExpression(Index->Index);
+            if (CmplFlags.BoundsChecking)
+                Emit(IRInstruction{.Op = IROpcode::BoundsCheck, .Operands = {Pointer, Offset}});
+
+            TypeDescriptor ElementType = ObjectSymbol.TypeDesc;
+            ElementType.PointerDepth--;
+            return Emit(IRInstruction{.Op = IROpcode::Load, .Type = LowerType(ElementType), .Operands = {Pointer, Offset}, .Imm = SizeOfType(ElementType), .Signed = IsSignedType(ElementType), .Floating = IsFloatingType(ElementType)});
+        }
+        else if (auto Assign = std::dynamic_pointer_cast<AssignmentExpression>(Expr))
+        {
+            CmplSymbol NameSymbol = ResolveSymbol(Assign->Name);
+            CmplSymbol ValSymbol = ResolveSymbol(Assign->Value);
+
+            if (NameSymbol.TypeDesc.Constant || !CompileTypeMatch(ValSymbol.TypeDesc, NameSymbol.TypeDesc))
+                return Fail();
+
+            if (auto IndexExpr = std::dynamic_pointer_cast<IndexExpression>(Assign->Name))
+            {
+                CmplSymbol ObjectSymbol = ResolveSymbol(IndexExpr->Object);
+                if (!ObjectSymbol.TypeDesc.PointerDepth)
+                    return Fail();
+
+                const uint32_t Pointer = LowerExpression(IndexExpr->Object);
+                const uint32_t Offset = LowerExpression(IndexExpr->Index);
+                const uint32_t Value = LowerBinding(Assign->Value, NameSymbol.TypeDesc);
+                TypeDescriptor ElementType = ObjectSymbol.TypeDesc;
+                ElementType.PointerDepth--;
+                Emit(IRInstruction{.Op = IROpcode::Store, .Operands = {Pointer, Offset, Value}, .Imm = SizeOfType(ElementType), .Floating = IsFloatingType(ElementType)});
+                return Value;
+            }
+
+            auto VarExpr = std::dynamic_pointer_cast<VariableExpression>(Assign->Name);
+            if (!VarExpr || !NameSymbol.Var || !Locals.count(VarExpr->Address))
+                return Fail();
+
+            const uint32_t Value = LowerBinding(Assign->Value, NameSymbol.TypeDesc);
+            if (IsRefCounted(NameSymbol.Var->TypeDesc))
+            {
+                const uint32_t Old = GetLocal(VarExpr->Address);
+                Emit(IRInstruction{.Op = IROpcode::RefInc, .Operands = {Value}});
+                Emit(IRInstruction{.Op = IROpcode::Release, .Operands = {Old}, .Imm = ElementSize(NameSymbol.Var->TypeDesc)});
+            }
+            SetLocal(VarExpr->Address, LowerType(NameSymbol.Var->TypeDesc), Value);
+            return Value;
+        }
+        else if (auto Call = std::dynamic_pointer_cast<CallExpression>(Expr))
+        {
+            return LowerCall(Call);
+        }
+        else if (auto NewExpr = std::dynamic_pointer_cast<UseExpression>(Expr))
+        {
+            if (!NewExpr->Type.PointerDepth && NewExpr->Type.Type != ValueType::Custom)
+                return LowerConversion(ResolveSymbol(NewExpr->Arguments.at(0)).TypeDesc, NewExpr->Type, NewExpr->Arguments.at(0));
+
+            if (!NewExpr->Type.PointerDepth || !CompileTypeMatch(ResolveSymbol(NewExpr->Arguments.at(0)).TypeDesc, ValueType::Long))
+                return Fail();
+
+            LowerType(NewExpr->Type);
+            const uint32_t Count = LowerExpression(NewExpr->Arguments.at(0));
+            return Emit(IRInstruction{.Op = IROpcode::NewArray, .Type = IRType::Ptr, .Operands = {Count}, .Imm = ElementSize(NewExpr->Type)});
+        }
+        else if (auto _SizeOfType = std::dynamic_pointer_cast<SizeOfTypeExpression>(Expr))
+        {
+            return Constant(SizeOfType(_SizeOfType->Type));
+        }
+        else if (auto SizeOf = std::dynamic_pointer_cast<SizeOfExpression>(Expr))
+        {
+            CmplSymbol ObjectSymbol = ResolveSymbol(SizeOf->Expr);
+            if (ObjectSymbol.TypeDesc.Nullable || !ObjectSymbol.TypeDesc.PointerDepth)
+                return Fail();
+
+            return Emit(IRInstruction{.Op = IROpcode::Length, .Type = IRType::I64, .Operands = {LowerExpression(SizeOf->Expr)}});
+        }
+        else if (auto Cast = std::dynamic_pointer_cast<ClassCastExpression>(Expr))
+        {
+            return LowerExpression(Cast->Expr);
+        }
+        else if (auto Bin = std::dynamic_pointer_cast<BinaryExpression>(Expr))
+        {
+            const CmplSymbol &SymbolA = ResolveSymbol(Bin->A);
+            const CmplSymbol &SymbolB = ResolveSymbol(Bin->B);
+            if (SymbolA.TypeDesc.Nullable || SymbolB.TypeDesc.Nullable)
+                return Fail();
+
+            if (IsFloatingType(SymbolA.TypeDesc) || IsFloatingType(SymbolB.TypeDesc))
+                return LowerFloatingOperation(Bin, IsFloatingType(SymbolA.TypeDesc), IsFloatingType(SymbolB.TypeDesc));
+
+            IROpcode Op;
+            switch (Bin->Operator)
+            {
+            case OperationType::Add:
+                Op = IROpcode::Add;
+                break;
+            case OperationType::Subtract:
+                Op = IROpcode::Sub;
+                break;
+            case OperationType::Multiply:
+                Op = IROpcode::Mul;
+                break;
+            case OperationType::GreaterThan:
+                Op = IROpcode::CmpGT;
+                break;
+            case OperationType::LessThan:
+                Op = IROpcode::CmpLT;
+                break;
+            case OperationType::GreaterThanOrEqualTo:
+                Op = IROpcode::CmpGE;
+                break;
+            case OperationType::LessThanOrEqualTo:
+                Op = IROpcode::CmpLE;
+                break;
+            default:
+                return Fail();
+            }
+
+            const uint32_t A = LowerExpression(Bin->A);
+            const uint32_t B = LowerExpression(Bin->B);
+            return Emit(IRInstruction{.Op = Op, .Type = IRType::I64, .Operands = {A, B}});
+        }
+        else if (auto Un = std::dynamic_pointer_cast<UnaryExpression>(Expr))
+        {
+            CmplSymbol Symbol = ResolveSymbol(Un->Expr);
+
+            switch (Un->Operator)
+            {
+            case OperationType::Subtract:
+                if (IsFloatingType(Symbol.TypeDesc))
+                    return Emit(IRInstruction{.Op = IROpcode::FNeg, .Type = IRType::F64, .Operands = {LowerExpression(Un->Expr)}});
+                return Emit(IRInstruction{.Op = IROpcode::Neg, .Type = IRType::I64, .Operands = {LowerExpression(Un->Expr)}});
+            case OperationType::ForceUnwrap:
+                if (!Symbol.TypeDesc.Nullable)
+                    return Fail();
+                return LowerExpression(Un->Expr);
+            default:
+                return Fail();
+            }
+        }
+
+        return Fail();
+    }
+
+    // an integer side is converted to a double first
+    uint32_t LowerFloatingOperation(const std::shared_ptr<BinaryExpression> &Bin, bool FloatingA, bool FloatingB)
+    {
+        IROpcode Op;
+        switch (Bin->Operator)
+        {
+        case OperationType::Add:
+            Op = IROpcode::FAdd;
+            break;
+        case OperationType::Subtract:
+            Op = IROpcode::FSub;
+            break;
+        case OperationType::Multiply:
+            Op = IROpcode::FMul;
+            break;
+        case OperationType::Divide:
+            Op = IROpcode::FDiv;
+            break;
+        case OperationType::GreaterThan:
+            Op = IROpcode::FCmpGT;
+            break;
+        case OperationType::LessThan:
+            Op = IROpcode::FCmpLT;
+            break;
+        case OperationType::GreaterThanOrEqualTo:
+            Op = IROpcode::FCmpGE;
+            break;
+        case OperationType::LessThanOrEqualTo:
+            Op = IROpcode::FCmpLE;
+            break;
+        default:
+            return Fail();
+        }
+
+        uint32_t A = LowerExpression(Bin->A);
+        if (!FloatingA)
+            A = Emit(IRInstruction{.Op = IROpcode::IntToFloat, .Type = IRType::F64, .Operands = {A}});
+        uint32_t B = LowerExpression(Bin->B);
+        if (!FloatingB)
+            B = Emit(IRInstruction{.Op = IROpcode::IntToFloat, .Type = IRType::F64, .Operands = {B}});
+
+        const bool Compare = Op >= IROpcode::FCmpGT && Op <= IROpcode::FCmpLE;
+        return Emit(IRInstruction{.Op = Op, .Type = Compare ? IRType::I64 : IRType::F64, .Operands = {A, B}});
+    }
+
+    // int(x), float(x) and double(x), what bool(x) tests is left to the direct path
+    uint32_t LowerConversion(const TypeDescriptor &From, const TypeDescriptor &To, const ExpressionPtr &Value)
+    {
+        if (To.Type == ValueType::Bool || From.PointerDepth || From.Nullable)
+            return Fail();
+
+        uint32_t Converted = LowerExpression(Value);
+        if (IsFloatingType(To) && !IsFloatingType(From))
+            Converted = Emit(IRInstruction{.Op = IROpcode::IntToFloat, .Type = IRType::F64, .Operands = {Converted}});
+        else if (!IsFloatingType(To) && IsFloatingType(From))
+            return Emit(IRInstruction{.Op = IROpcode::FloatToInt, .Type = IRType::I64, .Operands = {Converted}});
+
+        if (To.Type == ValueType::Float && From.Type != ValueType::Float)
+            Converted = Emit(IRInstruction{.Op = IROpcode::FloatRound, .Type = IRType::F64, .Operands = {Converted}});
+        return Converted;
+    }
+
+    // Cytron et al. SSA construction, phis go on the iterated dominance
+    // frontier of every block that sets a local, then a walk down the
+    // dominator tree renames each read to the value that reaches it
+    void PromoteLocals()
+    {
+        Function->ComputeCFG();
+        Function->ComputeDominance();
+
+        std::unordered_map<uint32_t, int64_t> PhiLocals; // phi to the local it merges
+
+        for (int64_t Local = 0; Local < int64_t(LocalTypes.size()); Local++)
+        {
+            std::vector<uint32_t> Worklist;
+            for (const IRBlock &Block : Function->Blocks)
+            {
+                for (const IRInstruction &Instruction : Block.Instructions)
+                {
+                    if (Instruction.Op == IROpcode::LocalSet && Instruction.Imm == Local)
+                    {
+                        Worklist.push_back(Block.Id);
+                        break;
+                    }
+                }
+            }
+
+            std::unordered_set<uint32_t> Defining(Worklist.begin(), Worklist.end());
+            std::unordered_set<uint32_t> HasPhi;
+            while (!Worklist.empty())
+            {
+                const uint32_t Id = Worklist.back();
+                Worklist.pop_back();
+
+                if (!Function->DominanceFrontier.count(Id))
+                    continue;
+                for (uint32_t Frontier : Function->DominanceFrontier.at(Id))
+                {
+                    if (!HasPhi.insert(Frontier).second)
+                        continue;
+
+                    IRInstruction Phi{.Op = IROpcode::Phi, .Type = LocalTypes.at(Local), .Id = Function->NextValue++};
+                    PhiLocals[Phi.Id] = Local;
+                    std::vector<IRInstruction> &Instructions = Function->Block(Frontier).Instructions;
+                    Instructions.insert(Instructions.begin(), Phi);
+
+                    if (Defining.insert(Frontier).second)
+                        Worklist.push_back(Frontier);
+                }
+            }
+        }
+
+        // reads before any write see 0
+        std::vector<IRInstruction> &Entry = Function->Blocks.front().Instructions;
+        const uint32_t Undefined = Function->NextValue++;
+        Entry.insert(Entry.begin(), IRInstruction{.Op = IROpcode::Const, .Type = IRType::I64, .Id = Undefined});
+
+        std::vector<std::vector<uint32_t>> Stacks(LocalTypes.size());
+        std::unordered_map<uint32_t, uint32_t> Renamed; // LocalGet to the value it read
+
+        auto Top = [&](int64_t Local)
+        {
+            return Stacks.at(Local).empty() ? Undefined : Stacks.at(Local).back();
+        };
+
+        std::function<void(uint32_t)> Rename = [&](uint32_t Id)
+        {
+            std::vector<int64_t> Pushed;
+
+            for (IRInstruction &Instruction : Function->Block(Id).Instructions)
+            {
+                for (uint32_t &Operand : Instruction.Operands)
+                {
+                    if (Renamed.count(Operand))
+                        Operand = Renamed.at(Operand);
+                }
+
+                if (Instruction.Op == IROpcode::Phi && PhiLocals.count(Instruction.Id))
+                {
+                    Stacks.at(PhiLocals.at(Instruction.Id)).push_back(Instruction.Id);
+                    Pushed.push_back(PhiLocals.at(Instruction.Id));
+                }
+                else if (Instruction.Op == IROpcode::LocalGet)
+                {
+                    Renamed[Instruction.Id] = Top(Instruction.Imm);
+                }
+                else if (Instruction.Op == IROpcode::LocalSet)
+                {
+                    Stacks.at(Instruction.Imm).push_back(Instruction.Operands.at(0));
+                    Pushed.push_back(Instruction.Imm);
+                }
+            }
+
+            for (uint32_t Successor : Function->Block(Id).Successors)
+            {
+                for (IRInstruction &Instruction : Function->Block(Successor).Instructions)
+                {
+                    if (Instruction.Op != IROpcode::Phi || !PhiLocals.count(Instruction.Id))
+                        continue;
+                    Instruction.Operands.push_back(Top(PhiLocals.at(Instruction.Id)));
+                    Instruction.Targets.push_back(Id);
+                }
+            }
+
+            if (Function->DominatorTree.count(Id))
+            {
+                for (uint32_t Child : Function->DominatorTree.at(Id))
+                    Rename(Child);
+            }
+
+            for (int64_t Local : Pushed)
+                Stacks.at(Local).pop_back();
+        };
+
+        Rename(Function->Blocks.front().Id);
+
+        for (IRBlock &Block : Function->Blocks)
+        {
+            Block.Instructions.erase(std::remove_if(Block.Instructions.begin(), Block.Instructions.end(),
+                                                    [](const IRInstruction &Instruction)
+                                                    { return Instruction.Op == IROpcode::LocalGet || Instruction.Op == IROpcode::LocalSet; }),
+                                     Block.Instructions.end());
+        }
+
+        Function->RemoveRedundantPhis();
+    }
+};
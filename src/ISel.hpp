@@ -0,0 +1,1324 @@
+#pragma once
+
+#include "Common.hpp"
+#include "CompileFlags.hpp"
+#include "IR.hpp"
+#include "AsmBuffer.hpp"
+#include "Runtime.hpp"
+#include "Scalars.hpp"
+
+/*
+ * instruction selection from SSA IR to x86-64, values are placed by a
+ * linear scan over live intervals from a liveness analysis of the CFG
+ * and phis become parallel moves on the edges that reach them
+ */
+class InstructionSelector
+{
+public:
+    // the only registers calls, syscalls and inline assembly leave alone,
+    // values live across any of those need one of these or a stack slot
+    inline static const std::vector<std::string> CalleeSaved = {"r12", "r13", "r14", "r15"};
+    // free to use between calls, rax, rcx and rdx stay scratch
+    inline static const std::vector<std::string> CallerSaved = {"rbx", "rsi", "rdi", "r8", "r9", "r10", "r11"};
+    // System V, what follows goes on the stack
+    inline static const std::vector<std::string> ArgumentRegisters = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+
+    // where C has each argument, a floating one in the next of xmm0 to xmm7 and any
+    // other in the next argument register, empty for those that go on the stack
+    static std::vector<std::string> CArgumentRegisters(const std::vector<bool> &Floating)
+    {
+        std::vector<std::string> Registers;
+        size_t Integers = 0, Vectors = 0;
+        for (bool IsFloating : Floating)
+        {
+            if (IsFloating)
+                Registers.push_back(Vectors < 8 ? "xmm" + std::to_string(Vectors++) : "");
+            else
+                Registers.push_back(Integers < ArgumentRegisters.size() ? ArgumentRegisters.at(Integers++) : "");
+        }
+        return Registers;
+    }
+
+    std::map<std::string, size_t> Statistics; // what selection did on top of the passes, "tail calls"
+
+    // OutOfBoundsPath returns the label of cold code that reports an index register out of
+    // bounds of an array register and exits, StringLiteral the label of the read only copy of a literal
+    InstructionSelector(const CompileFlags &flags, std::function<std::string()> createlabel, std::function<std::string(const std::string &, const std::string &)> outofboundspath, std::function<std::string(const std::string &)> stringliteral)
+        : CmplFlags(flags), CreateLabel(std::move(createlabel)), OutOfBoundsPath(std::move(outofboundspath)), StringLiteral(std::move(stringliteral))
+    {
+    }
+
+    AsmBuffer Select(IRFunction Function)
+    {
+        Fn = &Function;
+
+        SplitCriticalEdges();
+        ComputeLiveness();
+        BuildIntervals();
+        AllocateRegisters();
+        PlaceArrays();
+
+        if (Function.Global)
+            Output << "global " << Function.Name << "\n";
+        Output << Function.Name << ": ; begin function\n";
+
+        if (!Function.IsMain)
+        {
+            for (const std::string &Register : Saved)
+                Output << "    push " << Register << "\n";
+        }
+        if (Slots || ArrayBytes)
+            Output << "    sub rsp, " << Slots * 8 + ArrayBytes << " ; spill slots and arrays\n";
+        MoveParameters();
+
+        for (size_t i = 0; i < Fn->ReversePostOrder.size(); i++)
+        {
+            const IRBlock &Block = Fn->Block(Fn->ReversePostOrder.at(i));
+            NextBlock = i + 1 < Fn->ReversePostOrder.size() ? std::optional<uint32_t>(Fn->ReversePostOrder.at(i + 1)) : std::nullopt;
+
+            if (i)
+                Output << BlockLabel(Block.Id) << ":\n";
+
+            for (const IRInstruction &Instruction : Block.Instructions)
+            {
+                if (!Skipped.count(&Instruction))
+                    SelectInstruction(Block, Instruction);
+            }
+        }
+
+        Output << "; end function " << Function.Name << "\n";
+        return Output.Take();
+    }
+
+private:
+    struct Location
+    {
+        std::string Register;
+        int64_t Slot = -1;
+    };
+
+    struct Interval
+    {
+        size_t Start = SIZE_MAX;
+        size_t End = 0;
+    };
+
+    const CompileFlags &CmplFlags;
+    std::function<std::string()> CreateLabel;
+    std::function<std::string(const std::string &, const std::string &)> OutOfBoundsPath;
+    std::function<std::string(const std::string &)> StringLiteral;
+
+    IRFunction *Fn = nullptr;
+    AsmStream Output;
+    std::optional<uint32_t> NextBlock;
+
+    std::unordered_map<uint32_t, IRInstruction *> Definitions;
+    std::unordered_map<uint32_t, size_t> UseCount;
+    std::unordered_map<uint32_t, int64_t> Immediates; // constants that fit an imm32 are never allocated
+    std::unordered_set<uint32_t> FusedCompares;      // compares only their block's condbr reads
+
+    std::unordered_map<uint32_t, std::unordered_set<uint32_t>> LiveIn;
+    std::unordered_map<uint32_t, std::unordered_set<uint32_t>> LiveOut;
+    std::unordered_map<uint32_t, Interval> Intervals;
+    std::vector<size_t> Clobbers; // positions of calls and syscalls
+
+    std::unordered_map<uint32_t, Location> Locations;
+    std::vector<std::string> Saved; // callee saved registers this function uses
+    int64_t Slots = 0;
+    int64_t ArrayBytes = 0;                           // of StackArray above the spill slots
+    std::unordered_map<uint32_t, int64_t> ArrayOffsets; // StackArray to where its length is, from the first byte above the slots
+    int64_t PushDepth = 0; // bytes pushed since the spill slots were reserved
+    std::unordered_map<uint32_t, std::string> BlockLabels;
+    std::unordered_set<const IRInstruction *> Skipped; // done by the tail call before them
+
+    static bool ClobbersAll(IROpcode Op)
+    {
+        return Op == IROpcode::Call || Op == IROpcode::NewArray || Op == IROpcode::Copy || Op == IROpcode::Release || Op == IROpcode::Collect || Op == IROpcode::Free || Op == IROpcode::Asm || Op == IROpcode::VectorLoop;
+    }
+
+    bool Allocated(uint32_t Value) const
+    {
+        return !Immediates.count(Value) && !FusedCompares.count(Value);
+    }
+
+    std::string BlockLabel(uint32_t Id)
+    {
+        if (!BlockLabels.count(Id))
+            BlockLabels[Id] = CreateLabel();
+        return BlockLabels.at(Id);
+    }
+
+    // an edge from a block with two successors into a block with phis
+    // gets its own block so the phi moves only run on that edge
+    void SplitCriticalEdges()
+    {
+        std::vector<std::tuple<uint32_t, size_t, uint32_t>> Edges; // from, target index, to
+        for (const IRBlock &Block : Fn->Blocks)
+        {
+            if (!Block.Terminated() || Block.Instructions.back().Op != IROpcode::CondBr)
+                continue;
+
+            const std::vector<uint32_t> &Targets = Block.Instructions.back().Targets;
+            for (size_t k = 0; k < Targets.size(); k++)
+            {
+                const IRBlock &To = Fn->Block(Targets.at(k));
+                if (To.Predecessors.size() > 1 && !To.Instructions.empty() && To.Instructions.front().Op == IROpcode::Phi)
+                    Edges.push_back({Block.Id, k, To.Id});
+            }
+        }
+
+        for (const auto &[From, k, To] : Edges)
+        {
+            const uint32_t Split = Fn->NewBlock();
+            Fn->Append(Split, IRInstruction{.Op = IROpcode::Br, .Targets = {To}});
+            Fn->Block(From).Instructions.back().Targets.at(k) = Split;
+
+            for (IRInstruction &Phi : Fn->Block(To).Instructions)
+            {
+                if (Phi.Op != IROpcode::Phi)
+                    break;
+                auto It = std::find(Phi.Targets.begin(), Phi.Targets.end(), From);
+                if (It != Phi.Targets.end())
+                    *It = Split;
+            }
+        }
+
+        Fn->ComputeCFG();
+    }
+
+    void ComputeLiveness()
+    {
+        Definitions = Fn->Definitions();
+
+        for (const IRBlock &Block : Fn->Blocks)
+        {
+            for (const IRInstruction &Instruction : Block.Instructions)
+            {
+                if (Instruction.Op == IROpcode::Const && Instruction.Imm >= INT32_MIN && Instruction.Imm <= INT32_MAX)
+                    Immediates[Instruction.Id] = Instruction.Imm;
+                for (uint32_t Operand : Instruction.Operands)
+                    UseCount[Operand]++;
+            }
+        }
+
+        for (const IRBlock &Block : Fn->Blocks)
+        {
+            const std::vector<IRInstruction> &Instructions = Block.Instructions;
+            if (Instructions.size() < 2 || Instructions.back().Op != IROpcode::CondBr)
+                continue;
+
+            const IRInstruction &Compare = Instructions.at(Instructions.size() - 2);
+            if (Compare.Id == Instructions.back().Operands.at(0) && UseCount.at(Compare.Id) == 1 && IsCompare(Compare.Op))
+                FusedCompares.insert(Compare.Id);
+        }
+
+        bool Changed = true;
+        while (Changed)
+        {
+            Changed = false;
+
+            for (auto It = Fn->ReversePostOrder.rbegin(); It != Fn->ReversePostOrder.rend(); It++)
+            {
+                const IRBlock &Block = Fn->Block(*It);
+                std::unordered_set<uint32_t> Live;
+
+                for (uint32_t Successor : Block.Successors)
+                {
+                    for (const IRInstruction &Instruction : Fn->Block(Successor).Instructions)
+                    {
+                        if (Instruction.Op != IROpcode::Phi)
+                            continue;
+                        for (size_t i = 0; i < Instruction.Targets.size(); i++)
+                        {
+                            if (Instruction.Targets.at(i) == Block.Id && Allocated(Instruction.Operands.at(i)))
+                                Live.insert(Instruction.Operands.at(i));
+                        }
+                    }
+                    for (uint32_t Value : LiveIn[Successor])
+                    {
+                        if (Definitions.at(Value)->Op != IROpcode::Phi || !std::count_if(Fn->Block(Successor).Instructions.begin(), Fn->Block(Successor).Instructions.end(), [&](const IRInstruction &Phi)
+                                                                                         { return Phi.Id == Value; }))
+                            Live.insert(Value);
+                    }
+                }
+
+                LiveOut[Block.Id] = Live;
+
+                for (auto Instruction = Block.Instructions.rbegin(); Instruction != Block.Instructions.rend(); Instruction++)
+                {
+                    if (Instruction->Id)
+                        Live.erase(Instruction->Id);
+                    if (Instruction->Op == IROpcode::Phi)
+                        continue;
+                    for (uint32_t Operand : Instruction->Operands)
+                    {
+                        if (Allocated(Operand))
+                            Live.insert(Operand);
+                    }
+                }
+
+                if (Live != LiveIn[Block.Id])
+                {
+                    LiveIn[Block.Id] = Live;
+                    Changed = true;
+                }
+            }
+        }
+    }
+
+    void BuildIntervals()
+    {
+        auto Extend = [&](uint32_t Value, size_t Position)
+        {
+            if (!Allocated(Value))
+                return;
+            Interval &Range = Intervals[Value];
+            Range.Start = std::min(Range.Start, Position);
+            Range.End = std::max(Range.End, Position);
+        };
+
+        std::unordered_map<uint32_t, size_t> BlockEnd;
+        size_t Position = 0;
+
+        for (uint32_t Id : Fn->ReversePostOrder)
+        {
+            const IRBlock &Block = Fn->Block(Id);
+            const size_t BlockStart = Position;
+            Position += 2;
+
+            for (uint32_t Value : LiveIn.at(Id))
+                Extend(Value, BlockStart);
+
+            for (const IRInstruction &Instruction : Block.Instructions)
+            {
+                if (Instruction.Op == IROpcode::Phi)
+                {
+                    Extend(Instruction.Id, BlockStart);
+                    continue;
+                }
+
+                for (uint32_t Operand : Instruction.Operands)
+                    Extend(Operand, Position);
+                if (Instruction.Id)
+                    Extend(Instruction.Id, Position);
+                if (ClobbersAll(Instruction.Op))
+                    Clobbers.push_back(Position);
+                Position += 2;
+            }
+
+            BlockEnd[Id] = Position;
+            for (uint32_t Value : LiveOut.at(Id))
+                Extend(Value, Position);
+            Position += 2;
+        }
+
+        // a phi is written by the moves at the end of every incoming block
+        for (const IRBlock &Block : Fn->Blocks)
+        {
+            for (const IRInstruction &Instruction : Block.Instructions)
+            {
+                if (Instruction.Op != IROpcode::Phi)
+                    continue;
+                for (uint32_t Incoming : Instruction.Targets)
+                    Extend(Instruction.Id, BlockEnd.at(Incoming));
+            }
+        }
+    }
+
+    bool CrossesClobber(const Interval &Range) const
+    {
+        auto It = std::upper_bound(Clobbers.begin(), Clobbers.end(), Range.Start);
+        return It != Clobbers.end() && *It < Range.End;
+    }
+
+    void AllocateRegisters()
+    {
+        std::vector<uint32_t> Order;
+        for (const auto &[Value, Range] : Intervals)
+            Order.push_back(Value);
+        std::sort(Order.begin(), Order.end(), [&](uint32_t a, uint32_t b)
+                  { return Intervals.at(a).Start != Intervals.at(b).Start ? Intervals.at(a).Start < Intervals.at(b).Start : a < b; });
+
+        std::vector<std::string> FreeCallee = CalleeSaved;
+        std::vector<std::string> FreeCaller = CallerSaved;
+        std::vector<uint32_t> Active; // by increasing end
+
+        auto IsCalleeSaved = [](const std::string &Register)
+        {
+            return std::find(CalleeSaved.begin(), CalleeSaved.end(), Register) != CalleeSaved.end();
+        };
+
+        auto Release = [&](const std::string &Register)
+        {
+            std::vector<std::string> &Pool = IsCalleeSaved(Register) ? FreeCallee : FreeCaller;
+            const std::vector<std::string> &Order = IsCalleeSaved(Register) ? CalleeSaved : CallerSaved;
+            Pool.push_back(Register);
+            std::sort(Pool.begin(), Pool.end(), [&](const std::string &a, const std::string &b)
+                      { return std::find(Order.begin(), Order.end(), a) < std::find(Order.begin(), Order.end(), b); });
+        };
+
+        auto Activate = [&](uint32_t Value)
+        {
+            auto It = std::find_if(Active.begin(), Active.end(), [&](uint32_t a)
+                                   { return Intervals.at(a).End > Intervals.at(Value).End; });
+            Active.insert(It, Value);
+        };
+
+        for (uint32_t Value : Order)
+        {
+            const Interval &Range = Intervals.at(Value);
+
+            while (!Active.empty() && Intervals.at(Active.front()).End <= Range.Start)
+            {
+                Release(Locations.at(Active.front()).Register);
+                Active.erase(Active.begin());
+            }
+
+            const bool NeedsCalleeSaved = CrossesClobber(Range);
+
+            if (!NeedsCalleeSaved && !FreeCaller.empty())
+            {
+                Locations[Value].Register = FreeCaller.front();
+                FreeCaller.erase(FreeCaller.begin());
+                Activate(Value);
+                continue;
+            }
+            if (!FreeCallee.empty())
+            {
+                Locations[Value].Register = FreeCallee.front();
+                FreeCallee.erase(FreeCallee.begin());
+                Activate(Value);
+                continue;
+            }
+
+            // under pressure the interval that ends last goes to memory
+            auto Victim = std::find_if(Active.rbegin(), Active.rend(), [&](uint32_t a)
+                                       { return !NeedsCalleeSaved || IsCalleeSaved(Locations.at(a).Register); });
+            if (Victim != Active.rend() && Intervals.at(*Victim).End > Range.End)
+            {
+                const uint32_t Spilled = *Victim;
+                Locations[Value].Register = Locations.at(Spilled).Register;
+                Locations[Spilled] = Location{.Slot = Slots++};
+                Active.erase(std::next(Victim).base());
+                Activate(Value);
+                continue;
+            }
+
+            Locations[Value] = Location{.Slot = Slots++};
+        }
+
+        std::set<std::string> Used;
+        for (const auto &[Value, Place] : Locations)
+        {
+            if (!Place.Register.empty())
+                Used.insert(Place.Register);
+        }
+        if (Fn->CLinkage)
+            Saved.push_back("rbx"); // C keeps it, the stdlib's assembly does not
+        for (const std::string &Register : CalleeSaved)
+        {
+            if (Used.count(Register))
+                Saved.push_back(Register);
+        }
+    }
+
+    // the register arguments into their places before anything else runs,
+    // a place can be the register another one arrives in
+    void MoveParameters()
+    {
+        std::vector<const IRInstruction *> Parameters;
+        for (const IRBlock &Block : Fn->Blocks)
+        {
+            for (const IRInstruction &Instruction : Block.Instructions)
+            {
+                if (Instruction.Op == IROpcode::Param && Instruction.Imm < int64_t(ArgumentRegisters.size()) && UseCount.count(Instruction.Id))
+                    Parameters.push_back(&Instruction);
+            }
+        }
+
+        bool Overlap = false;
+        for (const IRInstruction *Parameter : Parameters)
+        {
+            for (const IRInstruction *Other : Parameters)
+                Overlap |= Parameter != Other && Operand(Parameter->Id) == ArgumentRegisters.at(Other->Imm);
+        }
+
+        if (!Overlap)
+        {
+            for (const IRInstruction *Parameter : Parameters)
+                Move(Operand(Parameter->Id), ArgumentRegisters.at(Parameter->Imm));
+            return;
+        }
+
+        for (const IRInstruction *Parameter : Parameters)
+        {
+            Output << "    push " << ArgumentRegisters.at(Parameter->Imm) << "\n";
+            PushDepth += 8;
+        }
+        for (auto Parameter = Parameters.rbegin(); Parameter != Parameters.rend(); Parameter++)
+        {
+            Output << "    pop rax\n";
+            PushDepth -= 8;
+            Move(Operand((*Parameter)->Id), "rax");
+        }
+    }
+
+    // the first six arguments into their registers, an argument in a
+    // register an earlier one is moved into goes through the stack
+    void MoveArguments(const std::vector<uint32_t> &Arguments)
+    {
+        const size_t InRegisters = std::min(Arguments.size(), ArgumentRegisters.size());
+
+        bool Overlap = false;
+        for (size_t i = 0; i < InRegisters; i++)
+        {
+            for (size_t j = 0; j < i; j++)
+                Overlap |= Operand(Arguments.at(i)) == ArgumentRegisters.at(j);
+        }
+        if (!Overlap)
+        {
+            for (size_t i = 0; i < InRegisters; i++)
+                Move(ArgumentRegisters.at(i), Operand(Arguments.at(i)));
+            return;
+        }
+
+        for (size_t i = InRegisters; i > 0; i--)
+        {
+            Output << "    push " << Operand(Arguments.at(i - 1)) << "\n";
+            PushDepth += 8;
+        }
+        for (size_t i = 0; i < InRegisters; i++)
+        {
+            Output << "    pop " << ArgumentRegisters.at(i) << "\n";
+            PushDepth -= 8;
+        }
+    }
+
+    // a call whose result is returned right away, with nothing after it
+    // but collecting our own parameters that the caller collects anyway,
+    // becomes a jump that reuses this frame's place for the callee's,
+    // not out of a C function since the callee would not keep rbx
+    bool TailCall(const IRBlock &Block, const IRInstruction &Call)
+    {
+        if (Fn->IsMain || Fn->CLinkage || Call.Imm || !CmplFlags.OptimizationLevel || CmplFlags.DisabledPasses.count("tailcall"))
+            return false;
+
+        const std::vector<IRInstruction> &Instructions = Block.Instructions;
+        size_t i = &Call - Instructions.data() + 1;
+        while (i < Instructions.size() && Instructions.at(i).Op == IROpcode::Collect && Definitions.at(Instructions.at(i).Operands.at(0))->Op == IROpcode::Param)
+            i++;
+        if (i >= Instructions.size() || Instructions.at(i).Op != IROpcode::Ret || Instructions.at(i).Operands.at(0) != Call.Id)
+            return false;
+
+        // the callee's stack arguments go where ours came in
+        const std::vector<uint32_t> &Arguments = Call.Operands;
+        if (Arguments.size() > ArgumentRegisters.size() && Arguments.size() > Fn->Parameters.size())
+            return false;
+
+        const int64_t Frame = Slots * 8 + ArrayBytes + Saved.size() * 8;
+        for (size_t j = ArgumentRegisters.size(); j < Arguments.size(); j++)
+        {
+            Move("rax", Operand(Arguments.at(j)));
+            Output << "    mov [rsp + " << PushDepth + Frame + 8 + (j - ArgumentRegisters.size()) * 8 << "], rax\n";
+        }
+        MoveArguments(Arguments);
+
+        if (PushDepth + Slots * 8 + ArrayBytes)
+            Output << "    add rsp, " << PushDepth + Slots * 8 + ArrayBytes << "\n";
+        for (auto Register = Saved.rbegin(); Register != Saved.rend(); Register++)
+            Output << "    pop " << *Register << "\n";
+        Output << "    jmp " << Call.Text << " ; tail call\n";
+
+        for (size_t j = &Call - Instructions.data() + 1; j <= i; j++)
+            Skipped.insert(&Instructions.at(j));
+        Statistics["tail calls"]++;
+        return true;
+    }
+
+    // register, stack slot or immediate
+    // every StackArray gets its own part of the frame, the length and then the elements
+    void PlaceArrays()
+    {
+        for (const IRBlock &Block : Fn->Blocks)
+        {
+            for (const IRInstruction &Instruction : Block.Instructions)
+            {
+                if (Instruction.Op != IROpcode::StackArray)
+                    continue;
+                ArrayOffsets[Instruction.Id] = ArrayBytes;
+                ArrayBytes += (8 + Definitions.at(Instruction.Operands.at(0))->Imm * Instruction.Imm + 15) / 16 * 16;
+            }
+        }
+    }
+
+    std::string Operand(uint32_t Value)
+    {
+        if (Immediates.count(Value))
+            return std::to_string(Immediates.at(Value));
+
+        const Location &Place = Locations.at(Value);
+        if (!Place.Register.empty())
+            return Place.Register;
+        return "QWORD [rsp + " + std::to_string(PushDepth + Place.Slot * 8) + "]";
+    }
+
+    static bool IsMemory(const std::string &Operand)
+    {
+        return Operand.find('[') != std::string::npos;
+    }
+
+    static bool IsImmediate(const std::string &Operand)
+    {
+        return !Operand.empty() && (std::isdigit((unsigned char)Operand.front()) || Operand.front() == '-');
+    }
+
+    void Move(const std::string &To, const std::string &From)
+    {
+        if (To == From)
+            return;
+        if (IsMemory(To) && IsMemory(From))
+        {
+            Output << "    mov rcx, " << From << "\n";
+            Output << "    mov " << To << ", rcx\n";
+            return;
+        }
+        Output << "    mov " << To << ", " << From << "\n";
+    }
+
+    // [Base + Index * Size], a constant index becomes a displacement
+    std::string Element(const IRInstruction &Instruction, const std::string &Base)
+    {
+        const uint32_t Index = Instruction.Operands.at(1);
+        if (Immediates.count(Index))
+            return "[" + Base + " + " + std::to_string(Immediates.at(Index) * Instruction.Imm) + "]";
+        return "[" + Base + " + " + InRegister(Index, "rcx") + " * " + std::to_string(Instruction.Imm) + "]";
+    }
+
+    // the value in a register, loaded into Scratch if it is not in one
+    std::string InRegister(uint32_t Value, const std::string &Scratch)
+    {
+        const std::string Place = Operand(Value);
+        if (IsMemory(Place) || IsImmediate(Place))
+        {
+            Output << "    mov " << Scratch << ", " << Place << "\n";
+            return Scratch;
+        }
+        return Place;
+    }
+
+    // the bits of a double into an xmm register, an immediate goes through rax
+    void FloatingOperand(const std::string &Register, uint32_t Value)
+    {
+        const std::string Bits = InRegister(Value, "rax");
+        Output << "    movq " << Register << ", " << Bits << "\n";
+    }
+
+    void Define(const IRInstruction &Instruction, const std::string &From)
+    {
+        if (!UseCount.count(Instruction.Id))
+            return; // nothing reads it
+        Move(Operand(Instruction.Id), From);
+    }
+
+    // phis of To read their operand for From all at once
+    void EdgeMoves(uint32_t From, uint32_t To)
+    {
+        std::vector<std::pair<std::string, std::string>> Moves; // to, from
+        for (const IRInstruction &Phi : Fn->Block(To).Instructions)
+        {
+            if (Phi.Op != IROpcode::Phi)
+                break;
+            for (size_t i = 0; i < Phi.Targets.size(); i++)
+            {
+                if (Phi.Targets.at(i) != From)
+                    continue;
+                const std::string Destination = Operand(Phi.Id);
+                const std::string Source = Operand(Phi.Operands.at(i));
+                if (Destination != Source)
+                    Moves.push_back({Destination, Source});
+            }
+        }
+
+        while (!Moves.empty())
+        {
+            bool Progress = false;
+            for (size_t i = 0; i < Moves.size(); i++)
+            {
+                const std::string Destination = Moves.at(i).first;
+                const bool StillRead = std::any_of(Moves.begin(), Moves.end(), [&](const auto &Move)
+                                                   { return Move.second == Destination; });
+                if (StillRead)
+                    continue;
+
+                Move(Destination, Moves.at(i).second);
+                Moves.erase(Moves.begin() + i);
+                Progress = true;
+                break;
+            }
+
+            if (Progress)
+                continue;
+
+            // a cycle, park one destination in rax and read it from there
+            const std::string Parked = Moves.front().first;
+            Output << "    mov rax, " << Parked << "\n";
+            for (auto &Move : Moves)
+            {
+                if (Move.second == Parked)
+                    Move.second = "rax";
+            }
+        }
+    }
+
+    void Jump(uint32_t Target)
+    {
+        if (NextBlock && *NextBlock == Target)
+            return;
+        Output << "    jmp " << BlockLabel(Target) << "\n";
+    }
+
+    static bool IsCompare(IROpcode Op)
+    {
+        return (Op >= IROpcode::CmpGT && Op <= IROpcode::CmpLE) || (Op >= IROpcode::FCmpGT && Op <= IROpcode::FCmpLE);
+    }
+
+    static std::string ConditionCode(IROpcode Op, bool Inverse)
+    {
+        switch (Op)
+        {
+        case IROpcode::FCmpGT:
+        case IROpcode::FCmpLT:
+            return Inverse ? "be" : "a";
+        case IROpcode::FCmpGE:
+        case IROpcode::FCmpLE:
+            return Inverse ? "b" : "ae";
+        case IROpcode::CmpGT:
+            return Inverse ? "le" : "g";
+        case IROpcode::CmpLT:
+            return Inverse ? "ge" : "l";
+        case IROpcode::CmpGE:
+            return Inverse ? "l" : "ge";
+        default:
+            return Inverse ? "g" : "le";
+        }
+    }
+
+    // ucomisd has the sides of a floating less than swapped, above is false when either is NaN
+    void Compare(const IRInstruction &Instruction)
+    {
+        if (Instruction.Op >= IROpcode::FCmpGT && Instruction.Op <= IROpcode::FCmpLE)
+        {
+            const bool Swapped = Instruction.Op == IROpcode::FCmpLT || Instruction.Op == IROpcode::FCmpLE;
+            FloatingOperand("xmm0", Instruction.Operands.at(Swapped ? 1 : 0));
+            FloatingOperand("xmm1", Instruction.Operands.at(Swapped ? 0 : 1));
+            Output << "    ucomisd xmm0, xmm1\n";
+            return;
+        }
+
+        const std::string Lhs = InRegister(Instruction.Operands.at(0), "rax");
+        Output << "    cmp " << Lhs << ", " << Operand(Instruction.Operands.at(1)) << "\n";
+    }
+
+    // string literals are immortal and never counted
+    void AdjustRefCount(const std::string &Object, const std::string &Mnemonic)
+    {
+        const std::string Immortal = CreateLabel();
+        Output << "    cmp QWORD [" << Object << " - 16], " << HeapRuntime::ImmortalRefCount << " ; immortal literal\n";
+        Output << "    je " << Immortal << "\n";
+        Output << "    " << Mnemonic << " QWORD [" << Object << " - 16]\n";
+        Output << Immortal << ":\n";
+    }
+
+    void Collect(const IRInstruction &Instruction)
+    {
+        const std::string SkipLabel = CreateLabel();
+        Output << "    mov rbx, rax\n";
+        Output << "    mov rax, [rbx - 16] ; refcount\n";
+        Output << "    test rax, rax\n";
+        Output << "    jnz " << SkipLabel << "\n";
+        Free("rbx", Instruction.Imm);
+        Output << SkipLabel << ":\n";
+    }
+
+    void Free(const std::string &Object, int64_t ElementSize)
+    {
+        Output << "    lea rdi, [" << Object << " - 16] ; addr\n";
+        Output << "    mov rsi, [rdi + 8] ; length\n";
+        Output << "    imul rsi, " << ElementSize << "\n";
+        Output << "    add rsi, 16\n";
+        Output << "    call " << HeapRuntime::Free << "\n";
+    }
+
+    void Allocate(const std::string &Size)
+    {
+        Output << "    mov rsi, " << Size << " ; size\n";
+        Output << "    call " << HeapRuntime::Allocate << "\n";
+    }
+
+    // the loop a VectorLoop stands for, its operands go where a call's arguments
+    // would so rdi counts from the start up to the end in rsi by the lanes,
+    // rdx and on hold the arrays and values, xmm registers or AVX2's ymm ones
+    void VectorLoop(const IRInstruction &Instruction)
+    {
+        const int64_t Lanes = Instruction.Imm;
+        const bool Wide = Lanes == 8;
+        auto Vector = [&](size_t Number)
+        { return (Wide ? "ymm" : "xmm") + std::to_string(Number); };
+
+        std::stringstream Words(Instruction.Text);
+        std::string Operation;
+        Words >> Operation;
+
+        Output << "    ; vectorized " << Instruction.Text << ", " << Lanes << " lanes\n";
+        MoveArguments(Instruction.Operands);
+        const std::string Loop = CreateLabel();
+        const std::string Done = CreateLabel();
+        auto Step = [&]()
+        {
+            Output << "    add rdi, " << Lanes << "\n";
+            Output << "    cmp rdi, rsi\n";
+            Output << "    jl " << Loop << "\n";
+        };
+
+        if (Operation == "sum" || Operation == "max" || Operation == "min")
+        {
+            // the start value in rdx and the array in rcx
+            Output << "    mov rax, rdx\n";
+            Output << "    cmp rdi, rsi\n";
+            Output << "    jge " << Done << "\n";
+            if (Operation == "sum")
+                SumLanes(Wide, Loop, Step);
+            else
+                SelectLanes(Operation == "max", Wide, Lanes, Loop, Step);
+            Output << Done << ":\n";
+            Define(Instruction, "rax");
+            return;
+        }
+
+        // the array stored to in rdx, each source after it an array loaded every
+        // trip or a value the lanes are filled with before the loop
+        std::vector<std::string> Values;
+        std::vector<std::string> Loads;
+        std::string Kind;
+        for (size_t k = 0; Words >> Kind; k++)
+        {
+            const std::string Register = ArgumentRegisters.at(3 + k);
+            if (Kind == "array")
+            {
+                Values.push_back(Vector(k));
+                Loads.push_back(Register);
+                continue;
+            }
+
+            const std::string Filled = "xmm" + std::to_string(2 + k);
+            Output << "    " << (Wide ? "v" : "") << "movd " << Filled << ", " << ScalarAccess::Register(Register, 4) << "\n";
+            if (Wide)
+                Output << "    vpbroadcastd " << Vector(2 + k) << ", " << Filled << "\n";
+            else
+                Output << "    pshufd " << Filled << ", " << Filled << ", 0\n";
+            Values.push_back(Vector(2 + k));
+            Loads.push_back("");
+        }
+
+        Output << "    cmp rdi, rsi\n";
+        Output << "    jge " << Done << "\n";
+        Output << Loop << ":\n";
+        for (size_t k = 0; k < Loads.size(); k++)
+        {
+            if (!Loads.at(k).empty())
+                Output << "    " << (Wide ? "v" : "") << "movdqu " << Values.at(k) << ", [" << Loads.at(k) << " + rdi * 4]\n";
+        }
+
+        std::string Result = Values.front();
+        if (Values.size() == 2)
+        {
+            const std::string Mnemonic = Operation == "add" ? "paddd" : Operation == "sub" ? "psubd"
+                                                                                          : "pmulld";
+            if (Wide)
+                Output << "    v" << Mnemonic << " ymm0, " << Values.at(0) << ", " << Values.at(1) << "\n";
+            else
+            {
+                if (Values.at(0) != "xmm0")
+                    Output << "    movdqa xmm0, " << Values.at(0) << "\n";
+                Output << "    " << Mnemonic << " xmm0, " << Values.at(1) << "\n";
+            }
+            Result = Vector(0);
+        }
+        Output << "    " << (Wide ? "v" : "") << "movdqu [rdx + rdi * 4], " << Result << "\n";
+        Step();
+        Output << Done << ":\n";
+        if (Wide)
+            Output << "    vzeroupper\n";
+    }
+
+    // the elements sign extended and added up in 64 bit lanes, the total added to rax
+    void SumLanes(bool Wide, const std::string &Loop, const std::function<void()> &Step)
+    {
+        if (Wide)
+        {
+            Output << "    vpxor ymm0, ymm0, ymm0\n";
+            Output << Loop << ":\n";
+            Output << "    vpmovsxdq ymm1, [rcx + rdi * 4]\n";
+            Output << "    vpmovsxdq ymm2, [rcx + rdi * 4 + 16]\n";
+            Output << "    vpaddq ymm0, ymm0, ymm1\n";
+            Output << "    vpaddq ymm0, ymm0, ymm2\n";
+            Step();
+            Output << "    vextracti128 xmm1, ymm0, 1\n";
+            Output << "    vpaddq xmm0, xmm0, xmm1\n";
+            Output << "    vpshufd xmm1, xmm0, 78\n";
+            Output << "    vpaddq xmm0, xmm0, xmm1\n";
+            Output << "    vmovq rcx, xmm0\n";
+            Output << "    vzeroupper\n";
+        }
+        else
+        {
+            Output << "    pxor xmm0, xmm0\n";
+            Output << Loop << ":\n";
+            Output << "    movdqu xmm1, [rcx + rdi * 4]\n";
+            Output << "    pxor xmm3, xmm3\n";
+            Output << "    pcmpgtd xmm3, xmm1 ; the signs, to widen with\n";
+            Output << "    movdqa xmm2, xmm1\n";
+            Output << "    punpckldq xmm1, xmm3\n";
+            Output << "    punpckhdq xmm2, xmm3\n";
+            Output << "    paddq xmm0, xmm1\n";
+            Output << "    paddq xmm0, xmm2\n";
+            Step();
+            Output << "    pshufd xmm1, xmm0, 78\n";
+            Output << "    paddq xmm0, xmm1\n";
+            Output << "    movq rcx, xmm0\n";
+        }
+        Output << "    add rax, rcx\n";
+    }
+
+    // the largest or smallest element, the lanes start from the first ones
+    // and are folded into one at the end, rax keeps it if it was already past it
+    void SelectLanes(bool Largest, bool Wide, int64_t Lanes, const std::string &Loop, const std::function<void()> &Step)
+    {
+        const std::string Reduce = CreateLabel();
+        const std::string Mnemonic = Largest ? "vpmaxsd" : "vpminsd";
+
+        // xmm0 = the larger or smaller of xmm0 and xmm1 in each lane, SSE2 has no pmaxsd
+        auto Select = [&]()
+        {
+            if (Wide)
+            {
+                Output << "    " << Mnemonic << " xmm0, xmm0, xmm1\n";
+                return;
+            }
+            Output << "    movdqa xmm2, " << (Largest ? "xmm1" : "xmm0") << "\n";
+            Output << "    pcmpgtd xmm2, " << (Largest ? "xmm0" : "xmm1") << "\n";
+            Output << "    pand xmm1, xmm2\n";
+            Output << "    pandn xmm2, xmm0\n";
+            Output << "    por xmm1, xmm2\n";
+            Output << "    movdqa xmm0, xmm1\n";
+        };
+
+        Output << "    " << (Wide ? "vmovdqu ymm0" : "movdqu xmm0") << ", [rcx + rdi * 4]\n";
+        Output << "    add rdi, " << Lanes << "\n";
+        Output << "    cmp rdi, rsi\n";
+        Output << "    jge " << Reduce << "\n";
+        Output << Loop << ":\n";
+        if (Wide)
+            Output << "    " << Mnemonic << " ymm0, ymm0, [rcx + rdi * 4]\n";
+        else
+        {
+            Output << "    movdqu xmm1, [rcx + rdi * 4]\n";
+            Select();
+        }
+        Step();
+
+        Output << Reduce << ":\n";
+        if (Wide)
+        {
+            Output << "    vextracti128 xmm1, ymm0, 1\n";
+            Select();
+        }
+        Output << "    " << (Wide ? "v" : "") << "pshufd xmm1, xmm0, 78\n";
+        Select();
+        Output << "    " << (Wide ? "v" : "") << "pshufd xmm1, xmm0, 177\n";
+        Select();
+        Output << "    " << (Wide ? "v" : "") << "movd ecx, xmm0\n";
+        if (Wide)
+            Output << "    vzeroupper\n";
+        Output << "    movsxd rcx, ecx\n";
+        Output << "    cmp rcx, rax\n";
+        Output << "    cmov" << (Largest ? "g" : "l") << " rax, rcx\n";
+    }
+
+    void SelectInstruction(const IRBlock &Block, const IRInstruction &Instruction)
+    {
+        switch (Instruction.Op)
+        {
+        case IROpcode::Const:
+            if (!Immediates.count(Instruction.Id))
+            {
+                Output << "    mov rax, " << Instruction.Imm << "\n";
+                Define(Instruction, "rax");
+            }
+            break;
+
+        case IROpcode::Param:
+        {
+            // the first six were moved in by the prologue, the rest are above the return address
+            const int64_t Stacked = Instruction.Imm - ArgumentRegisters.size();
+            const int64_t Frame = Slots * 8 + ArrayBytes + (Fn->IsMain ? 0 : Saved.size() * 8);
+            if (Stacked >= 0 && UseCount.count(Instruction.Id))
+                Move(Operand(Instruction.Id), "QWORD [rsp + " + std::to_string(PushDepth + Frame + 8 + Stacked * 8) + "]");
+            break;
+        }
+
+        case IROpcode::String:
+        {
+            Define(Instruction, StringLiteral(Instruction.Text) + " + 16");
+            break;
+        }
+
+        case IROpcode::Add:
+        case IROpcode::Sub:
+        case IROpcode::Mul:
+        {
+            const std::string Mnemonic = Instruction.Op == IROpcode::Add ? "add" : Instruction.Op == IROpcode::Sub ? "sub"
+                                                                                                                    : "imul";
+            const std::string Destination = Operand(Instruction.Id);
+            const std::string Rhs = Operand(Instruction.Operands.at(1));
+
+            // straight into the destination unless that would overwrite the right operand
+            const std::string Work = (!IsMemory(Destination) && Destination != Rhs) ? Destination : "rax";
+            Move(Work, Operand(Instruction.Operands.at(0)));
+            Output << "    " << Mnemonic << " " << Work << ", " << Rhs << "\n";
+            Move(Destination, Work);
+            break;
+        }
+
+        case IROpcode::Neg:
+            Output << "    mov rax, " << Operand(Instruction.Operands.at(0)) << "\n";
+            Output << "    neg rax\n";
+            Define(Instruction, "rax");
+            break;
+
+        case IROpcode::FAdd:
+        case IROpcode::FSub:
+        case IROpcode::FMul:
+        case IROpcode::FDiv:
+        {
+            const std::string Mnemonic = Instruction.Op == IROpcode::FAdd ? "addsd" : Instruction.Op == IROpcode::FSub ? "subsd"
+                                                                                  : Instruction.Op == IROpcode::FMul   ? "mulsd"
+                                                                                                                       : "divsd";
+            FloatingOperand("xmm0", Instruction.Operands.at(0));
+            FloatingOperand("xmm1", Instruction.Operands.at(1));
+            Output << "    " << Mnemonic << " xmm0, xmm1\n";
+            Output << "    movq rax, xmm0\n";
+            Define(Instruction, "rax");
+            break;
+        }
+
+        case IROpcode::FNeg:
+            Output << "    mov rax, " << Operand(Instruction.Operands.at(0)) << "\n";
+            Output << "    mov rcx, 1\n";
+            Output << "    shl rcx, 63\n";
+            Output << "    xor rax, rcx ; flip the sign bit\n";
+            Define(Instruction, "rax");
+            break;
+
+        case IROpcode::IntToFloat:
+        {
+            const std::string Integer = InRegister(Instruction.Operands.at(0), "rax");
+            Output << "    cvtsi2sd xmm0, " << Integer << "\n";
+            Output << "    movq rax, xmm0\n";
+            Define(Instruction, "rax");
+            break;
+        }
+
+        case IROpcode::FloatToInt:
+            FloatingOperand("xmm0", Instruction.Operands.at(0));
+            Output << "    cvttsd2si rax, xmm0\n";
+            Define(Instruction, "rax");
+            break;
+
+        case IROpcode::FloatRound:
+            FloatingOperand("xmm0", Instruction.Operands.at(0));
+            Output << "    cvtsd2ss xmm0, xmm0\n";
+            Output << "    cvtss2sd xmm0, xmm0\n";
+            Output << "    movq rax, xmm0\n";
+            Define(Instruction, "rax");
+            break;
+
+        case IROpcode::CmpGT:
+        case IROpcode::CmpLT:
+        case IROpcode::CmpGE:
+        case IROpcode::CmpLE:
+        case IROpcode::FCmpGT:
+        case IROpcode::FCmpLT:
+        case IROpcode::FCmpGE:
+        case IROpcode::FCmpLE:
+            if (FusedCompares.count(Instruction.Id))
+                break; // the branch compares
+
+            Compare(Instruction);
+            Output << "    set" << ConditionCode(Instruction.Op, false) << " al\n";
+            Output << "    movzx eax, al\n";
+            Define(Instruction, "rax");
+            break;
+
+        case IROpcode::Phi:
+            break; // moved into place by the incoming edges
+
+        case IROpcode::Call:
+        {
+            if (TailCall(Block, Instruction))
+                break;
+
+            // C has double arguments in xmm0 to xmm7 and the others in the argument registers
+            std::vector<uint32_t> Arguments;
+            size_t VectorArguments = 0;
+            for (uint32_t Argument : Instruction.Operands)
+            {
+                if (Instruction.Imm && Definitions.at(Argument)->Type == IRType::F64)
+                    FloatingOperand("xmm" + std::to_string(VectorArguments++), Argument);
+                else
+                    Arguments.push_back(Argument);
+            }
+            const size_t InRegisters = std::min(Arguments.size(), ArgumentRegisters.size());
+            const int64_t Stacked = Arguments.size() - InRegisters;
+
+            for (size_t i = Arguments.size(); i > InRegisters; i--)
+            {
+                Output << "    push " << Operand(Arguments.at(i - 1)) << "\n";
+                PushDepth += 8;
+            }
+            MoveArguments(Arguments);
+
+            if (Instruction.Imm)
+            {
+                // C expects the stack 16 byte aligned and al to count the vector arguments
+                Output << "    mov rbx, rsp\n";
+                Output << "    and rsp, -16\n";
+                if (VectorArguments)
+                    Output << "    mov eax, " << VectorArguments << "\n";
+                else
+                    Output << "    xor eax, eax\n";
+                Output << "    call " << Instruction.Text << "\n";
+                Output << "    mov rsp, rbx\n";
+                if (Instruction.Type == IRType::F64)
+                    Output << "    movq rax, xmm0 ; C returns it in xmm0\n";
+            }
+            else
+            {
+                Output << "    call " << Instruction.Text << "\n";
+            }
+            if (Stacked)
+            {
+                Output << "    add rsp, " << Stacked * 8 << " ; cleanup arguments\n";
+                PushDepth -= Stacked * 8;
+            }
+            Define(Instruction, "rax");
+            break;
+        }
+
+        case IROpcode::Load:
+        {
+            const std::string Address = Element(Instruction, InRegister(Instruction.Operands.at(0), "rax"));
+            Output << "    " << ScalarAccess::Load("rax", Address, Instruction.Imm, Instruction.Signed, Instruction.Floating) << " ; load index\n";
+            Define(Instruction, "rax");
+            break;
+        }
+
+        case IROpcode::Store:
+        {
+            const std::string Address = Element(Instruction, InRegister(Instruction.Operands.at(0), "rax"));
+            const uint32_t Value = Instruction.Operands.at(2);
+            const bool Narrowed = Instruction.Floating && Instruction.Imm == 4; // a float goes through xmm0
+            const std::string Stored = Immediates.count(Value) && !Narrowed ? Operand(Value) : InRegister(Value, "rdx");
+            Output << "    " << ScalarAccess::Store(Address, Stored, Instruction.Imm, Instruction.Floating) << " ; store index\n";
+            break;
+        }
+
+        case IROpcode::Length:
+        {
+            // a spilled array is reloaded first, before the load is written out
+            const std::string Array = InRegister(Instruction.Operands.at(0), "rax");
+            Output << "    mov rax, [" << Array << " - 8] ; array size\n";
+            Define(Instruction, "rax");
+            break;
+        }
+
+        case IROpcode::NewArray:
+            Output << "    ; allocate memory space for an array\n";
+            Output << "    mov rax, " << Operand(Instruction.Operands.at(0)) << "\n";
+            Output << "    mov rbx, rax ; save array size\n";
+            Output << "    imul rax, " << Instruction.Imm << "\n";
+            Output << "    add rax, 16 ; space for the array size to be stored\n";
+            Allocate("rax");
+            Output << "    mov QWORD [rax + 0], 0 ; store reference count\n";
+            Output << "    mov QWORD [rax + 8], rbx ; store array size\n";
+            Output << "    add rax, 16 ; above array size\n";
+            Define(Instruction, "rax");
+            break;
+
+        case IROpcode::Copy:
+            Output << "    mov rdi, " << Operand(Instruction.Operands.at(0)) << "\n";
+            Output << "    call " << HeapRuntime::Copy << " ; written through, not the read only literal\n";
+            Define(Instruction, "rax");
+            break;
+
+        case IROpcode::StackArray:
+        {
+            const int64_t Count = Definitions.at(Instruction.Operands.at(0))->Imm;
+            const int64_t Words = (Count * Instruction.Imm + 7) / 8;
+            Output << "    ; array in the frame\n";
+            Output << "    lea rax, [rsp + " << PushDepth + Slots * 8 + ArrayOffsets.at(Instruction.Id) + 8 << "]\n";
+            Output << "    mov QWORD [rax - 8], " << Count << " ; store array size\n";
+            if (Words <= 8)
+            {
+                for (int64_t i = 0; i < Words; i++)
+                    Output << "    mov QWORD [rax + " << i * 8 << "], 0\n";
+            }
+            else
+            {
+                const std::string ZeroLabel = CreateLabel();
+                Output << "    mov rcx, " << Words << "\n";
+                Output << ZeroLabel << ":\n";
+                Output << "    mov QWORD [rax + rcx * 8 - 8], 0\n";
+                Output << "    dec rcx\n";
+                Output << "    jnz " << ZeroLabel << "\n";
+            }
+            Define(Instruction, "rax");
+            break;
+        }
+
+        case IROpcode::BoundsCheck:
+        {
+            const std::string Index = InRegister(Instruction.Operands.at(1), "rax");
+            const std::string Array = InRegister(Instruction.Operands.at(0), "rcx");
+            Output << "    ; bounds checking\n";
+            Output << "    cmp " << Index << ", [" << Array << " - 8]\n";
+            Output << "    jae " << OutOfBoundsPath(Index, Array) << "\n";
+            break;
+        }
+
+        case IROpcode::RefInc:
+            AdjustRefCount(InRegister(Instruction.Operands.at(0), "rax"), "inc");
+            break;
+
+        case IROpcode::Release:
+            Output << "    mov rax, " << Operand(Instruction.Operands.at(0)) << "\n";
+            AdjustRefCount("rax", "dec");
+            Collect(Instruction);
+            break;
+
+        case IROpcode::Collect:
+            Output << "    mov rax, " << Operand(Instruction.Operands.at(0)) << "\n";
+            Collect(Instruction);
+            break;
+
+        case IROpcode::Free:
+            Output << "    mov rax, " << Operand(Instruction.Operands.at(0)) << "\n";
+            Free("rax", Instruction.Imm);
+            break;
+
+        case IROpcode::Asm:
+            if (!Instruction.Operands.empty())
+                Move("rax", Operand(Instruction.Operands.at(0)));
+            // its .local labels belong to this one, another copy may be in the same block
+            Output << CreateLabel() << ": ; inline assembly begin\n";
+            Output << Instruction.Text;
+            Output << "; inline assembly end\n";
+            break;
+
+        case IROpcode::VectorEnd:
+        {
+            // the start plus a multiple of the lanes, not past the bound or the checked arrays' lengths
+            Move("rdx", Operand(Instruction.Operands.at(1)));
+            for (size_t i = 2; i < Instruction.Operands.size(); i++)
+            {
+                const std::string Array = InRegister(Instruction.Operands.at(i), "rcx");
+                Output << "    cmp rdx, [" << Array << " - 8]\n";
+                Output << "    cmovg rdx, [" << Array << " - 8]\n";
+            }
+            const uint32_t Start = Instruction.Operands.at(0);
+            const std::string From = InRegister(Start, "rax");
+            Output << "    sub rdx, " << From << "\n";
+            Output << "    xor ecx, ecx\n";
+            Output << "    test rdx, rdx\n";
+            Output << "    cmovs rdx, rcx\n";
+            if (!Immediates.count(Start) || Immediates.at(Start) < 0)
+            {
+                Output << "    test " << From << ", " << From << "\n";
+                Output << "    cmovs rdx, rcx ; no vector loop from below 0\n";
+            }
+            Output << "    and rdx, " << -Instruction.Imm << "\n";
+            Output << "    add rdx, " << From << "\n";
+            Define(Instruction, "rdx");
+            break;
+        }
+
+        case IROpcode::VectorLoop:
+            VectorLoop(Instruction);
+            break;
+
+        case IROpcode::Br:
+            EdgeMoves(Block.Id, Instruction.Targets.at(0));
+            Jump(Instruction.Targets.at(0));
+            break;
+
+        case IROpcode::CondBr:
+        {
+            const uint32_t Condition = Instruction.Operands.at(0);
+            const uint32_t Then = Instruction.Targets.at(0);
+            const uint32_t Else = Instruction.Targets.at(1);
+
+            if (Immediates.count(Condition))
+            {
+                Jump(Immediates.at(Condition) ? Then : Else);
+                break;
+            }
+
+            std::string Code = "nz";
+            std::string Inverse = "z";
+            if (FusedCompares.count(Condition))
+            {
+                const IRInstruction &Compared = *Definitions.at(Condition);
+                Compare(Compared);
+                Code = ConditionCode(Compared.Op, false);
+                Inverse = ConditionCode(Compared.Op, true);
+            }
+            else
+            {
+                const std::string Place = Operand(Condition);
+                if (IsMemory(Place))
+                    Output << "    cmp " << Place << ", 0\n";
+                else
+                    Output << "    test " << Place << ", " << Place << "\n";
+            }
+
+            if (NextBlock && *NextBlock == Then)
+            {
+                Output << "    j" << Inverse << " " << BlockLabel(Else) << "\n";
+                break;
+            }
+            Output << "    j" << Code << " " << BlockLabel(Then) << "\n";
+            Jump(Else);
+            break;
+        }
+
+        case IROpcode::Ret:
+            Move("rax", Operand(Instruction.Operands.at(0)));
+            if (Fn->IsMain)
+            {
+                Output << "    mov rax, 60 ; sysexit\n";
+                Output << "    mov rdi, 0 ; exit code\n";
+                Output << "    syscall ; call exit\n";
+                break;
+            }
+            if (Slots || ArrayBytes)
+                Output << "    add rsp, " << Slots * 8 + ArrayBytes << "\n";
+            for (auto Register = Saved.rbegin(); Register != Saved.rend(); Register++)
+                Output << "    pop " << *Register << "\n";
+            Output << "    ret\n";
+            break;
+
+        default:
+            throw std::logic_error("instruction selection: unexpected " + IRFunction::OpcodeName(Instruction.Op));
+        }
+    }
+};
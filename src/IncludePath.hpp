@@ -4,9 +4,7 @@
 
 namespace IncludePath
 {
-    std::filesystem::path DirPath;
-
-    std::filesystem::path GetPersistentPath(const std::string &FolderName = ".Furn_IncludePath")
+    inline std::filesystem::path GetPersistentPath(const std::string &FolderName = ".Furn_IncludePath")
     {
         const char *home = std::getenv("HOME");
 
@@ -20,17 +18,16 @@ namespace IncludePath
         return base / FolderName;
     }
 
-    void Init(const std::string &FolderName = ".Furn_IncludePath")
+    // creates the include directory if needed and returns it
+    inline std::filesystem::path Init(const std::string &FolderName = ".Furn_IncludePath")
     {
-        DirPath = GetPersistentPath(FolderName);
+        std::filesystem::path DirPath = GetPersistentPath(FolderName);
         std::filesystem::create_directories(DirPath);
+        return DirPath;
     }
 
-    bool Write(const std::string &FileName, const std::string &contents)
+    inline bool Write(const std::filesystem::path &DirPath, const std::string &FileName, const std::string &contents)
     {
-        if (DirPath.empty())
-            Init();
-
         std::ofstream Out(DirPath / FileName, std::ios::out | std::ios::trunc);
         if (!Out.is_open())
             return false;
@@ -38,11 +35,4 @@ namespace IncludePath
         Out << contents;
         return true;
     }
-
-    std::filesystem::path Path()
-    {
-        if (DirPath.empty())
-            Init();
-        return DirPath;
-    }
 }
@@ -0,0 +1,202 @@
+#pragma once
+
+#include "Common.hpp"
+#include "CompileFlags.hpp"
+#include "IR.hpp"
+
+/*
+ * copies the bodies of lowered functions into the lowered functions
+ * calling them, before the passes run so they optimize across the
+ * call, a callee goes in when it is marked @inline, has at most
+ * InlineThreshold instructions or is only called once and not
+ * exported, never when it is marked @noinline, calls itself or is main
+ *
+ * parameters are never counted by the callee and the caller still
+ * collects the arguments after the body like it did after the call,
+ * so reference counts come out the same
+ */
+class Inliner
+{
+public:
+    static constexpr size_t MaxRounds = 3;        // callees inlined into a callee that is inlined again
+    static constexpr size_t LargestCaller = 4000; // instructions a caller may grow to
+
+    Inliner(const CompileFlags &flags) : CmplFlags(flags) {}
+
+    bool Run(const std::vector<IRFunction *> &Functions)
+    {
+        std::unordered_map<std::string, IRFunction *> ByName;
+        for (IRFunction *Function : Functions)
+            ByName[Function->Name] = Function;
+
+        std::unordered_map<std::string, size_t> CallSites;
+        for (IRFunction *Function : Functions)
+        {
+            ForEachCall(*Function, [&](const IRInstruction &Call)
+                        { CallSites[Call.Text]++; });
+        }
+
+        bool Changed = false;
+        for (size_t Round = 0; Round < MaxRounds; Round++)
+        {
+            bool RoundChanged = false;
+            for (IRFunction *Caller : Functions)
+            {
+                // only as many as the caller had when the round began, calls the
+                // inlined bodies brought along wait for the next round
+                size_t Budget = 0;
+                ForEachCall(*Caller, [&](const IRInstruction &)
+                            { Budget++; });
+
+                // the first call to inline, the caller changes under the search otherwise
+                while (Budget > 0 && Size(*Caller) < LargestCaller)
+                {
+                    std::optional<std::pair<uint32_t, size_t>> Site;
+                    for (const IRBlock &Block : Caller->Blocks)
+                    {
+                        for (size_t i = 0; i < Block.Instructions.size() && !Site; i++)
+                        {
+                            const IRInstruction &Instruction = Block.Instructions.at(i);
+                            if (Instruction.Op == IROpcode::Call && ByName.count(Instruction.Text) && ByName.at(Instruction.Text) != Caller && Worth(*ByName.at(Instruction.Text), CallSites[Instruction.Text]))
+                                Site = {Block.Id, i};
+                        }
+                        if (Site)
+                            break;
+                    }
+                    if (!Site)
+                        break;
+
+                    const IRFunction &Callee = *ByName.at(Caller->Block(Site->first).Instructions.at(Site->second).Text);
+                    InlineCall(*Caller, Site->first, Site->second, Callee);
+                    Caller->Statistics["calls inlined"]++;
+                    Budget--;
+                    RoundChanged = true;
+                }
+            }
+
+            Changed |= RoundChanged;
+            if (!RoundChanged)
+                break;
+        }
+        return Changed;
+    }
+
+private:
+    const CompileFlags &CmplFlags;
+
+    static void ForEachCall(const IRFunction &Function, const std::function<void(const IRInstruction &)> &Visit)
+    {
+        for (const IRBlock &Block : Function.Blocks)
+        {
+            for (const IRInstruction &Instruction : Block.Instructions)
+            {
+                if (Instruction.Op == IROpcode::Call)
+                    Visit(Instruction);
+            }
+        }
+    }
+
+    static size_t Size(const IRFunction &Function)
+    {
+        size_t Result = 0;
+        for (const IRBlock &Block : Function.Blocks)
+        {
+            for (const IRInstruction &Instruction : Block.Instructions)
+            {
+                if (Instruction.Op != IROpcode::Param && Instruction.Op != IROpcode::Const && Instruction.Op != IROpcode::Br)
+                    Result++;
+            }
+        }
+        return Result;
+    }
+
+    bool Worth(const IRFunction &Callee, size_t CallSites) const
+    {
+        if (Callee.IsMain || Callee.NoInline)
+            return false;
+
+        bool CallsItself = false;
+        ForEachCall(Callee, [&](const IRInstruction &Call)
+                    { CallsItself |= Call.Text == Callee.Name; });
+        if (CallsItself)
+            return false;
+
+        return Callee.Inline || Size(Callee) <= CmplFlags.InlineThreshold || (CallSites == 1 && !Callee.Global);
+    }
+
+    // splits the block at the call, the callee's blocks go in between
+    // with its parameters replaced by the arguments and its returns
+    // branching to the rest of the block, where a phi takes the call's place
+    void InlineCall(IRFunction &Caller, uint32_t BlockId, size_t Index, const IRFunction &Callee)
+    {
+        const IRInstruction Call = Caller.Block(BlockId).Instructions.at(Index);
+
+        const uint32_t Continue = Caller.NewBlock();
+        {
+            std::vector<IRInstruction> &Instructions = Caller.Block(BlockId).Instructions;
+            Caller.Block(Continue).Instructions.assign(Instructions.begin() + Index + 1, Instructions.end());
+            Instructions.erase(Instructions.begin() + Index, Instructions.end());
+        }
+
+        // the successors are reached from the second half now
+        for (IRBlock &Block : Caller.Blocks)
+        {
+            for (IRInstruction &Phi : Block.Instructions)
+            {
+                if (Phi.Op != IROpcode::Phi)
+                    continue;
+                std::replace(Phi.Targets.begin(), Phi.Targets.end(), BlockId, Continue);
+            }
+        }
+
+        std::unordered_map<uint32_t, uint32_t> Values;
+        std::unordered_map<uint32_t, uint32_t> Blocks;
+        for (const IRBlock &Block : Callee.Blocks)
+        {
+            Blocks[Block.Id] = Caller.NewBlock();
+            for (const IRInstruction &Instruction : Block.Instructions)
+            {
+                if (Instruction.Op == IROpcode::Param)
+                    Values[Instruction.Id] = Call.Operands.at(Instruction.Imm);
+                else if (Instruction.Id)
+                    Values[Instruction.Id] = Caller.NextValue++;
+            }
+        }
+
+        IRInstruction Result{.Op = IROpcode::Phi, .Type = Call.Type, .Id = Call.Id};
+        for (const IRBlock &Block : Callee.Blocks)
+        {
+            std::vector<IRInstruction> &Copy = Caller.Block(Blocks.at(Block.Id)).Instructions;
+            for (IRInstruction Instruction : Block.Instructions)
+            {
+                if (Instruction.Op == IROpcode::Param)
+                    continue;
+
+                if (Instruction.Id)
+                    Instruction.Id = Values.at(Instruction.Id);
+                for (uint32_t &Operand : Instruction.Operands)
+                    Operand = Values.at(Operand);
+                for (uint32_t &Target : Instruction.Targets)
+                    Target = Blocks.at(Target);
+
+                if (Instruction.Op == IROpcode::Ret)
+                {
+                    Result.Operands.push_back(Instruction.Operands.at(0));
+                    Result.Targets.push_back(Blocks.at(Block.Id));
+                    Instruction = IRInstruction{.Op = IROpcode::Br, .Targets = {Continue}};
+                }
+                Copy.push_back(std::move(Instruction));
+            }
+        }
+
+        Caller.Block(BlockId).Instructions.push_back(IRInstruction{.Op = IROpcode::Br, .Targets = {Blocks.at(Callee.Blocks.front().Id)}});
+        if (Call.Id && !Result.Operands.empty())
+        {
+            std::vector<IRInstruction> &Instructions = Caller.Block(Continue).Instructions;
+            Instructions.insert(Instructions.begin(), Result);
+        }
+
+        Caller.ComputeCFG();
+        Caller.ComputeDominance();
+    }
+};
@@ -0,0 +1,407 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Assembler.hpp"
+
+#ifdef __linux__
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+/*
+ * places assembled code in this process's memory so it can run
+ * without an executable on disk, the generated code exits with a
+ * syscall instead of returning so it is entered in a forked child
+ */
+class JitImage
+{
+public:
+    std::string Error; // why Load() or Execute() failed
+
+    JitImage() = default;
+    JitImage(const JitImage &) = delete;
+    JitImage &operator=(const JitImage &) = delete;
+
+    ~JitImage()
+    {
+        Unload();
+    }
+
+    // maps text, data and bss below 2GB where the 32 bit absolute addresses reach them, then links
+    bool Load(const ObjectCode &Object)
+    {
+#ifdef __linux__
+        Unload();
+
+        const uint64_t TextSize = Align(Object.Text.size(), PageSize);
+        const uint64_t DataSize = Align(Align(Object.Data.size(), 16) + Object.BssSize, PageSize);
+        Size = TextSize + std::max<uint64_t>(DataSize, PageSize);
+
+        void *Mapped = mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+        if (Mapped == MAP_FAILED)
+        {
+            Error = "cannot map memory for the program";
+            Size = 0;
+            return false;
+        }
+        Memory = static_cast<uint8_t *>(Mapped);
+
+        TextAddress = reinterpret_cast<uint64_t>(Memory);
+        const uint64_t DataAddress = TextAddress + TextSize;
+        const uint64_t BssAddress = DataAddress + Align(Object.Data.size(), 16);
+
+        std::vector<uint8_t> Text;
+        std::string Missing;
+        if (!Object.Link(Text, TextAddress, DataAddress, BssAddress, Missing))
+        {
+            Error = "undefined symbol " + Missing;
+            Unload();
+            return false;
+        }
+
+        std::copy(Text.begin(), Text.end(), Memory);
+        std::copy(Object.Data.begin(), Object.Data.end(), Memory + TextSize);
+        if (mprotect(Memory, TextSize, PROT_READ | PROT_EXEC) != 0)
+        {
+            Error = "cannot make the program executable";
+            Unload();
+            return false;
+        }
+
+        Symbols.clear();
+        for (const AsmSymbol &Symbol : Object.Symbols)
+        {
+            const uint64_t Base = Symbol.Section == AsmSection::Text ? TextAddress : Symbol.Section == AsmSection::Data ? DataAddress
+                                                                                                                          : BssAddress;
+            Symbols[Symbol.Name] = Base + Symbol.Offset;
+        }
+        return true;
+#else
+        Error = "running in memory is only supported on linux";
+        return false;
+#endif
+    }
+
+    // 0 if the image has no such symbol
+    uint64_t Address(const std::string &Symbol) const
+    {
+        return Symbols.count(Symbol) ? Symbols.at(Symbol) : 0;
+    }
+
+    // runs from Entry in a child process and waits for it, the exit code or -1
+    int Execute(const std::string &Entry = "_start")
+    {
+#ifdef __linux__
+        const uint64_t Start = Address(Entry);
+        if (!Start)
+        {
+            Error = "no " + Entry + " to enter the program at";
+            return -1;
+        }
+
+        // the child writes straight to the file descriptors
+        std::cout.flush();
+        std::cerr.flush();
+        fflush(nullptr);
+
+        const pid_t Child = fork();
+        if (Child < 0)
+        {
+            Error = "cannot start the program";
+            return -1;
+        }
+        if (Child == 0)
+        {
+            reinterpret_cast<void (*)()>(Start)();
+            _exit(0); // generated code ends with the exit syscall, this only runs if it returned
+        }
+
+        int Status = 0;
+        while (waitpid(Child, &Status, 0) < 0)
+        {
+            if (errno != EINTR)
+            {
+                Error = "lost the program";
+                return -1;
+            }
+        }
+
+        if (WIFSIGNALED(Status))
+        {
+            Error = "program terminated by signal " + std::to_string(WTERMSIG(Status));
+            return 128 + WTERMSIG(Status);
+        }
+        return WEXITSTATUS(Status);
+#else
+        Error = "running in memory is only supported on linux";
+        return -1;
+#endif
+    }
+
+private:
+    static constexpr uint64_t PageSize = 0x1000;
+
+    uint8_t *Memory = nullptr;
+    uint64_t Size = 0;
+    uint64_t TextAddress = 0;
+    std::unordered_map<std::string, uint64_t> Symbols;
+
+    static uint64_t Align(uint64_t Value, uint64_t Alignment)
+    {
+        return (Value + Alignment - 1) / Alignment * Alignment;
+    }
+
+    void Unload()
+    {
+#ifdef __linux__
+        if (Memory)
+            munmap(Memory, Size);
+#endif
+        Memory = nullptr;
+        Size = 0;
+        Symbols.clear();
+    }
+};
+
+/*
+ * keeps code resident for furn --repl, objects are linked one after
+ * another into memory shared with a child process that calls into them
+ * when asked, so the functions and globals of an entry outlive it and an
+ * entry that crashes or exits takes down the child, not the session's
+ * compiler state
+ */
+class JitSession
+{
+public:
+    std::string Error; // why the last Start(), Load() or Call() failed
+
+    JitSession() = default;
+    JitSession(const JitSession &) = delete;
+    JitSession &operator=(const JitSession &) = delete;
+
+    ~JitSession()
+    {
+        Stop();
+    }
+
+    // maps the memory for every object of the session and starts the child that runs them
+    bool Start()
+    {
+#ifdef __linux__
+        Stop();
+
+        void *Mapped = mmap(nullptr, TextCapacity + DataCapacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+        if (Mapped == MAP_FAILED)
+        {
+            Error = "cannot map memory for the session";
+            return false;
+        }
+        Memory = static_cast<uint8_t *>(Mapped);
+
+        int Channel[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, Channel) != 0)
+        {
+            Error = "cannot start the session";
+            Stop();
+            return false;
+        }
+
+        std::cout.flush();
+        std::cerr.flush();
+        fflush(nullptr);
+
+        Child = fork();
+        if (Child < 0)
+        {
+            Error = "cannot start the session";
+            close(Channel[0]);
+            close(Channel[1]);
+            Stop();
+            return false;
+        }
+        if (Child == 0)
+        {
+            close(Channel[0]);
+            Serve(Channel[1]);
+        }
+
+        close(Channel[1]);
+        Socket = Channel[0];
+        return true;
+#else
+        Error = "running in memory is only supported on linux";
+        return false;
+#endif
+    }
+
+    // false once the child is gone, Start() begins a new session
+    bool Alive() const
+    {
+        return Child > 0;
+    }
+
+    // places the object after everything loaded so far and links it against their symbols
+    bool Load(const ObjectCode &Object)
+    {
+        if (!Alive())
+        {
+            Error = "the session is not running";
+            return false;
+        }
+
+        const uint64_t DataSize = Align(Object.Data.size(), 16);
+        const uint64_t TextEnd = TextUsed + Align(Object.Text.size(), 16);
+        const uint64_t DataEnd = DataUsed + Align(DataSize + Object.BssSize, 16);
+        if (TextEnd > TextCapacity || DataEnd > DataCapacity)
+        {
+            Error = "the session is out of memory, :reset starts a new one";
+            return false;
+        }
+
+        const uint64_t TextAddress = reinterpret_cast<uint64_t>(Memory) + TextUsed;
+        const uint64_t DataAddress = reinterpret_cast<uint64_t>(Memory) + TextCapacity + DataUsed;
+        const uint64_t BssAddress = DataAddress + DataSize;
+
+        std::vector<uint8_t> Text;
+        std::string Missing;
+        if (!Object.Link(Text, TextAddress, DataAddress, BssAddress, Missing, Symbols))
+        {
+            Error = "undefined symbol " + Missing;
+            return false;
+        }
+
+        // bss is still zero, nothing was placed this far yet
+        std::copy(Text.begin(), Text.end(), Memory + TextUsed);
+        std::copy(Object.Data.begin(), Object.Data.end(), Memory + TextCapacity + DataUsed);
+        TextUsed = TextEnd;
+        DataUsed = DataEnd;
+
+        // a later definition of the same symbol is the one later objects link to
+        for (const AsmSymbol &Symbol : Object.Symbols)
+        {
+            const uint64_t Base = Symbol.Section == AsmSection::Text ? TextAddress : Symbol.Section == AsmSection::Data ? DataAddress
+                                                                                                                          : BssAddress;
+            Symbols[Symbol.Name] = Base + Symbol.Offset;
+        }
+        return true;
+    }
+
+    // calls a loaded function in the child and waits for it to return, false if the child did not survive it
+    bool Call(const std::string &Entry)
+    {
+#ifdef __linux__
+        if (!Alive() || !Symbols.count(Entry))
+        {
+            Error = "no " + Entry + " to call";
+            return false;
+        }
+
+        // the child writes straight to the file descriptors
+        std::cout.flush();
+        std::cerr.flush();
+        fflush(nullptr);
+
+        const uint64_t Address = Symbols.at(Entry);
+        if (send(Socket, &Address, sizeof(Address), MSG_NOSIGNAL) != sizeof(Address))
+            return Lost();
+
+        // ctrl-c stops the entry, the terminal sends it to the child as well
+        struct sigaction Ignore = {};
+        struct sigaction Previous = {};
+        Ignore.sa_handler = SIG_IGN;
+        sigaction(SIGINT, &Ignore, &Previous);
+
+        uint8_t Done = 0;
+        ssize_t Received = 0;
+        while ((Received = read(Socket, &Done, 1)) < 0 && errno == EINTR)
+            ;
+        sigaction(SIGINT, &Previous, nullptr);
+
+        if (Received != 1)
+            return Lost();
+        return true;
+#else
+        Error = "running in memory is only supported on linux";
+        return false;
+#endif
+    }
+
+private:
+    static constexpr uint64_t TextCapacity = 16 << 20;
+    static constexpr uint64_t DataCapacity = 16 << 20;
+
+    uint8_t *Memory = nullptr;
+    uint64_t TextUsed = 0;
+    uint64_t DataUsed = 0;
+    std::unordered_map<std::string, uint64_t> Symbols;
+    int Socket = -1;
+    int Child = -1;
+
+    static uint64_t Align(uint64_t Value, uint64_t Alignment)
+    {
+        return (Value + Alignment - 1) / Alignment * Alignment;
+    }
+
+#ifdef __linux__
+    // the child, text is only executable here while the parent keeps writing it
+    [[noreturn]] void Serve(int Channel)
+    {
+        if (mprotect(Memory, TextCapacity, PROT_READ | PROT_EXEC) != 0)
+            _exit(127);
+
+        uint64_t Entry = 0;
+        while (read(Channel, &Entry, sizeof(Entry)) == sizeof(Entry))
+        {
+            reinterpret_cast<void (*)()>(Entry)();
+
+            const uint8_t Done = 1;
+            if (write(Channel, &Done, 1) != 1)
+                break;
+        }
+        _exit(0);
+    }
+
+    // the child ended in the middle of a call, says how
+    bool Lost()
+    {
+        close(Socket);
+        Socket = -1;
+
+        int Status = 0;
+        while (waitpid(Child, &Status, 0) < 0 && errno == EINTR)
+            ;
+        Child = -1;
+
+        if (WIFSIGNALED(Status))
+            Error = "program terminated by signal " + std::to_string(WTERMSIG(Status));
+        else
+            Error = "program exited with " + std::to_string(WEXITSTATUS(Status));
+        return false;
+    }
+#endif
+
+    void Stop()
+    {
+#ifdef __linux__
+        if (Socket >= 0)
+            close(Socket);
+        if (Child > 0)
+        {
+            kill(Child, SIGKILL);
+            while (waitpid(Child, nullptr, 0) < 0 && errno == EINTR)
+                ;
+        }
+        if (Memory)
+            munmap(Memory, TextCapacity + DataCapacity);
+#endif
+        Socket = -1;
+        Child = -1;
+        Memory = nullptr;
+        TextUsed = 0;
+        DataUsed = 0;
+        Symbols.clear();
+    }
+};
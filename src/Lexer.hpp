@@ -1,10 +1,9 @@
 #pragma once
 #include "Token.hpp"
 #include "Common.hpp"
-#include "CompileFlags.hpp"
 
 #define _CheckCursorPos                                                   \
-    if (Position == CmplFlags::CursorPosition && !Tokens.empty())                            \
+    if (Position == CursorPosition && !Tokens.empty())                                       \
     {                                                                     \
         Tokens.at(Tokens.size() - 1).IsCursor = true; \
     }
@@ -313,6 +312,7 @@ public:
 
     std::string &Source;
     size_t Position;
+    size_t CursorPosition = SIZE_MAX; // offset of the editor cursor in Source
 
     char Peek(size_t Offset = 0) const
     {
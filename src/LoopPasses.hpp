@@ -0,0 +1,1129 @@
+#pragma once
+
+#include "Common.hpp"
+#include "IR.hpp"
+
+/*
+ * passes that look at the natural loops of a function, found from the
+ * back edges of the dominator tree, same contract as ScalarPasses.hpp
+ */
+
+struct IRLoop
+{
+    uint32_t Header = 0;
+    std::set<uint32_t> Blocks;         // header included
+    std::vector<uint32_t> Latches;     // blocks with a back edge to the header
+    std::optional<uint32_t> Preheader; // the one block outside the loop entering it, if it only goes there
+};
+
+// a phi of the header that goes around the loop with a constant added
+struct IRInduction
+{
+    uint32_t Phi = 0;
+    uint32_t Initial = 0; // what the preheader passes in
+    uint32_t Next = 0;    // Phi + Step, what the latch passes back
+    int64_t Step = 0;
+};
+
+// every loop, inner loops before the loops around them
+inline std::vector<IRLoop> FindLoops(IRFunction &Function)
+{
+    std::map<uint32_t, IRLoop> ByHeader;
+    for (const IRBlock &Block : Function.Blocks)
+    {
+        for (uint32_t Successor : Block.Successors)
+        {
+            if (!Function.Dominates(Successor, Block.Id))
+                continue;
+
+            IRLoop &Loop = ByHeader[Successor];
+            Loop.Header = Successor;
+            Loop.Latches.push_back(Block.Id);
+            Loop.Blocks.insert(Successor);
+
+            // everything that reaches the latch without passing the header
+            std::vector<uint32_t> Work = {Block.Id};
+            while (!Work.empty())
+            {
+                const uint32_t Id = Work.back();
+                Work.pop_back();
+                if (!Loop.Blocks.insert(Id).second)
+                    continue;
+                for (uint32_t Pred : Function.Block(Id).Predecessors)
+                    Work.push_back(Pred);
+            }
+        }
+    }
+
+    std::vector<IRLoop> Loops;
+    for (auto &[Header, Loop] : ByHeader)
+    {
+        std::vector<uint32_t> Outside;
+        for (uint32_t Pred : Function.Block(Header).Predecessors)
+        {
+            if (!Loop.Blocks.count(Pred))
+                Outside.push_back(Pred);
+        }
+        if (Outside.size() == 1 && Function.Block(Outside.front()).Successors.size() == 1)
+            Loop.Preheader = Outside.front();
+        Loops.push_back(std::move(Loop));
+    }
+
+    std::sort(Loops.begin(), Loops.end(), [](const IRLoop &a, const IRLoop &b)
+              { return a.Blocks.size() < b.Blocks.size(); });
+    return Loops;
+}
+
+// the counters of a loop with a preheader and one latch
+inline std::vector<IRInduction> FindInductions(IRFunction &Function, const IRLoop &Loop)
+{
+    std::vector<IRInduction> Result;
+    if (!Loop.Preheader || Loop.Latches.size() != 1)
+        return Result;
+
+    const std::unordered_map<uint32_t, IRInstruction *> Definitions = Function.Definitions();
+    for (const IRInstruction &Phi : Function.Block(Loop.Header).Instructions)
+    {
+        if (Phi.Op != IROpcode::Phi || Phi.Operands.size() != 2)
+            continue;
+
+        IRInduction Counter{.Phi = Phi.Id};
+        for (size_t i = 0; i < 2; i++)
+            (Phi.Targets.at(i) == *Loop.Preheader ? Counter.Initial : Counter.Next) = Phi.Operands.at(i);
+        if (!Counter.Initial || !Counter.Next || !Definitions.count(Counter.Next))
+            continue;
+
+        const IRInstruction &Step = *Definitions.at(Counter.Next);
+        if (Step.Op != IROpcode::Add || Step.Operands.at(0) != Phi.Id || !Definitions.count(Step.Operands.at(1)) || Definitions.at(Step.Operands.at(1))->Op != IROpcode::Const)
+            continue;
+        Counter.Step = Definitions.at(Step.Operands.at(1))->Imm;
+        Result.push_back(Counter);
+    }
+    return Result;
+}
+
+/*
+ * a check is dropped when the index is known to be at least 0 and a
+ * dominating branch compared it against the length of the same array,
+ * the way every `for (i: mut = 0; i < sizeof(a); ++i)` loop does, or
+ * when both are constants, or an identical check already ran, index
+ * ranges only follow constants, lengths, additions and counting loops
+ * and give up well before anything could wrap around
+ */
+class BoundsCheckElimination
+{
+public:
+    explicit BoundsCheckElimination(IRFunction &function) : Function(function) {}
+
+    bool Run()
+    {
+        Index();
+
+        std::unordered_set<const IRInstruction *> Removed;
+        for (uint32_t Id : Function.ReversePostOrder)
+        {
+            for (const IRInstruction &Check : Function.Block(Id).Instructions)
+            {
+                if (Check.Op != IROpcode::BoundsCheck)
+                    continue;
+                if (Redundant(Id, Check))
+                    Removed.insert(&Check);
+                else
+                    Performed[{Check.Operands.at(0), Check.Operands.at(1)}].push_back(Id);
+            }
+        }
+
+        for (IRBlock &Block : Function.Blocks)
+        {
+            Block.Instructions.erase(std::remove_if(Block.Instructions.begin(), Block.Instructions.end(),
+                                                    [&](const IRInstruction &Instruction)
+                                                    { return Removed.count(&Instruction); }),
+                                     Block.Instructions.end());
+        }
+        if (!Removed.empty())
+            Function.Statistics["bounds checks removed"] += Removed.size();
+
+        const bool Hoisted = Hoist();
+        return !Removed.empty() || Hoisted;
+    }
+
+private:
+    static constexpr uint64_t LargestConstant = uint64_t(1) << 40;
+    static constexpr uint64_t LargestLength = uint64_t(1) << 48; // more elements than fit in the address space
+    static constexpr uint64_t LargestRange = uint64_t(1) << 62;
+
+    IRFunction &Function;
+    std::unordered_map<uint32_t, IRInstruction *> Definitions;
+    std::unordered_map<uint32_t, uint32_t> DefinedIn;
+    std::map<std::pair<uint32_t, uint32_t>, std::vector<uint32_t>> Performed; // checks kept so far, by array and index, to their blocks
+    std::unordered_map<uint32_t, std::optional<uint64_t>> Ranges;
+    std::unordered_set<uint32_t> Visiting;
+
+    // instructions move when blocks change, so this runs again after every change
+    void Index()
+    {
+        Definitions.clear();
+        DefinedIn.clear();
+        for (IRBlock &Block : Function.Blocks)
+        {
+            for (IRInstruction &Instruction : Block.Instructions)
+            {
+                if (Instruction.Id)
+                {
+                    Definitions[Instruction.Id] = &Instruction;
+                    DefinedIn[Instruction.Id] = Block.Id;
+                }
+            }
+        }
+    }
+
+    std::optional<int64_t> Constant(uint32_t Value) const
+    {
+        if (Definitions.count(Value) && Definitions.at(Value)->Op == IROpcode::Const)
+            return Definitions.at(Value)->Imm;
+        return std::nullopt;
+    }
+
+    // the length of an array whose allocation is in sight
+    std::optional<int64_t> KnownLength(uint32_t Array) const
+    {
+        if (!Definitions.count(Array) || (Definitions.at(Array)->Op != IROpcode::NewArray && Definitions.at(Array)->Op != IROpcode::StackArray))
+            return std::nullopt;
+        return Constant(Definitions.at(Array)->Operands.at(0));
+    }
+
+    // facts Lhs < Rhs that hold in Block because a dominating branch only goes there when they do
+    std::vector<std::pair<uint32_t, uint32_t>> Facts(uint32_t Block) const
+    {
+        std::vector<std::pair<uint32_t, uint32_t>> Result;
+        for (uint32_t Id = Block;; Id = Function.ImmediateDominator.at(Id))
+        {
+            const IRBlock &Current = Function.Block(Id);
+            if (Current.Predecessors.size() == 1)
+            {
+                const IRBlock &From = Function.Block(Current.Predecessors.front());
+                const IRInstruction &Branch = From.Instructions.back();
+                if (Branch.Op == IROpcode::CondBr && Branch.Targets.at(0) != Branch.Targets.at(1) && Definitions.count(Branch.Operands.at(0)))
+                {
+                    const IRInstruction &Compare = *Definitions.at(Branch.Operands.at(0));
+                    const bool Taken = Branch.Targets.at(0) == Id;
+                    if (Compare.Operands.size() == 2)
+                    {
+                        const uint32_t A = Compare.Operands.at(0), B = Compare.Operands.at(1);
+                        if ((Compare.Op == IROpcode::CmpLT && Taken) || (Compare.Op == IROpcode::CmpGE && !Taken))
+                            Result.push_back({A, B});
+                        else if ((Compare.Op == IROpcode::CmpGT && Taken) || (Compare.Op == IROpcode::CmpLE && !Taken))
+                            Result.push_back({B, A});
+                    }
+                }
+            }
+            if (Function.ImmediateDominator.at(Id) == Id)
+                break;
+        }
+        return Result;
+    }
+
+    // the largest value, if it is sure to be between 0 and that
+    std::optional<uint64_t> Range(uint32_t Value)
+    {
+        if (Ranges.count(Value))
+            return Ranges.at(Value);
+        if (!Definitions.count(Value) || !Visiting.insert(Value).second)
+            return std::nullopt;
+
+        const IRInstruction &Instruction = *Definitions.at(Value);
+        std::optional<uint64_t> Result;
+        switch (Instruction.Op)
+        {
+        case IROpcode::Const:
+            if (Instruction.Imm >= 0 && uint64_t(Instruction.Imm) <= LargestConstant)
+                Result = Instruction.Imm;
+            break;
+
+        case IROpcode::Length:
+            Result = LargestLength;
+            break;
+
+        case IROpcode::Add:
+        {
+            const std::optional<uint64_t> A = Range(Instruction.Operands.at(0));
+            const std::optional<uint64_t> B = Range(Instruction.Operands.at(1));
+            if (A && B && *A + *B <= LargestRange)
+                Result = *A + *B;
+            break;
+        }
+
+        case IROpcode::Phi:
+            Result = PhiRange(Instruction);
+            break;
+
+        default:
+            break;
+        }
+
+        Visiting.erase(Value);
+        Ranges[Value] = Result;
+        return Result;
+    }
+
+    // a counter, every value coming around the loop adds a constant to the phi where a branch has kept it below a bound
+    std::optional<uint64_t> PhiRange(const IRInstruction &Phi)
+    {
+        uint64_t Largest = 0;
+        for (size_t i = 0; i < Phi.Operands.size(); i++)
+        {
+            const uint32_t Incoming = Phi.Operands.at(i);
+            const IRInstruction *Step = Definitions.count(Incoming) ? Definitions.at(Incoming) : nullptr;
+
+            if (Step && Step->Op == IROpcode::Add && Step->Operands.at(0) == Phi.Id && Constant(Step->Operands.at(1)))
+            {
+                const int64_t Increment = *Constant(Step->Operands.at(1));
+                if (Increment < 0 || uint64_t(Increment) > LargestConstant)
+                    return std::nullopt;
+
+                std::optional<uint64_t> Bound;
+                for (const auto &[Lhs, Rhs] : Facts(Phi.Targets.at(i)))
+                {
+                    if (Lhs != Phi.Id)
+                        continue;
+                    if (Definitions.count(Rhs) && Definitions.at(Rhs)->Op == IROpcode::Length)
+                        Bound = LargestLength;
+                    else if (Constant(Rhs) && *Constant(Rhs) >= 0 && uint64_t(*Constant(Rhs)) <= LargestConstant)
+                        Bound = *Constant(Rhs);
+                    if (Bound)
+                        break;
+                }
+                if (!Bound)
+                    return std::nullopt;
+                Largest = std::max(Largest, *Bound + Increment);
+                continue;
+            }
+
+            const std::optional<uint64_t> Operand = Range(Incoming);
+            if (!Operand)
+                return std::nullopt;
+            Largest = std::max(Largest, *Operand);
+        }
+        return Largest;
+    }
+
+    bool Redundant(uint32_t Block, const IRInstruction &Check)
+    {
+        const uint32_t Array = Check.Operands.at(0);
+        const uint32_t Index = Check.Operands.at(1);
+
+        // the same check already ran on every path here
+        if (Performed.count({Array, Index}))
+        {
+            for (uint32_t Earlier : Performed.at({Array, Index}))
+            {
+                if (Function.Dominates(Earlier, Block))
+                    return true;
+            }
+        }
+
+        const std::optional<int64_t> ConstantIndex = Constant(Index);
+        const std::optional<int64_t> Length = KnownLength(Array);
+        if (ConstantIndex && Length && *ConstantIndex >= 0 && *ConstantIndex < *Length)
+            return true;
+
+        if (!Range(Index))
+            return false;
+
+        for (const auto &[Lhs, Rhs] : Facts(Block))
+        {
+            if (Lhs != Index)
+                continue;
+            if (Definitions.count(Rhs) && Definitions.at(Rhs)->Op == IROpcode::Length && Definitions.at(Rhs)->Operands.at(0) == Array)
+                return true;
+            if (Length && Constant(Rhs) && *Constant(Rhs) <= *Length)
+                return true;
+        }
+        return false;
+    }
+
+    // instructions before Position in the block that could be seen if the check moved in front of them
+    static bool SideEffectsBefore(const IRBlock &Block, size_t Position)
+    {
+        for (size_t i = 0; i < Position; i++)
+        {
+            if (!Block.Instructions.at(i).IsPure())
+                return true;
+        }
+        return false;
+    }
+
+    // whether the header branches to Block on the way in, with the values the loop starts with
+    bool EnteredFirst(const IRLoop &Loop, uint32_t Block)
+    {
+        const IRBlock &Header = Function.Block(Loop.Header);
+        const IRInstruction &Branch = Header.Instructions.back();
+        if (Branch.Op != IROpcode::CondBr || !Definitions.count(Branch.Operands.at(0)))
+            return false;
+
+        const IRInstruction &Compare = *Definitions.at(Branch.Operands.at(0));
+        if (Compare.Op < IROpcode::CmpGT || Compare.Op > IROpcode::CmpLE)
+            return false;
+
+        // a phi of the header starts with what the preheader passes it
+        const auto Initial = [&](uint32_t Value) -> std::optional<int64_t>
+        {
+            const IRInstruction *Definition = Definitions.count(Value) ? Definitions.at(Value) : nullptr;
+            if (Definition && Definition->Op == IROpcode::Phi && DefinedIn.at(Value) == Loop.Header)
+            {
+                for (size_t i = 0; i < Definition->Targets.size(); i++)
+                {
+                    if (Definition->Targets.at(i) == *Loop.Preheader)
+                        return Constant(Definition->Operands.at(i));
+                }
+                return std::nullopt;
+            }
+            return Constant(Value);
+        };
+
+        const std::optional<int64_t> A = Initial(Compare.Operands.at(0));
+        const std::optional<int64_t> B = Initial(Compare.Operands.at(1));
+        if (!A || !B)
+            return false;
+
+        bool Holds = Compare.Op == IROpcode::CmpGT ? *A > *B : Compare.Op == IROpcode::CmpLT ? *A < *B
+                                                           : Compare.Op == IROpcode::CmpGE   ? *A >= *B
+                                                                                             : *A <= *B;
+        return Branch.Targets.at(Holds ? 0 : 1) == Block;
+    }
+
+    // checks of values from outside a loop that run before the loop does anything else are done once in front of it
+    bool Hoist()
+    {
+        bool Changed = false;
+        for (const IRLoop &Loop : FindLoops(Function))
+        {
+            if (!Loop.Preheader)
+                continue;
+
+            const IRBlock &Header = Function.Block(Loop.Header);
+            if (SideEffectsBefore(Header, Header.Instructions.size() - 1))
+                continue;
+
+            std::vector<uint32_t> Candidates = {Loop.Header};
+            for (uint32_t Successor : Header.Successors)
+            {
+                if (Loop.Blocks.count(Successor) && Function.Block(Successor).Predecessors.size() == 1 && EnteredFirst(Loop, Successor))
+                    Candidates.push_back(Successor);
+            }
+
+            for (uint32_t Id : Candidates)
+            {
+                IRBlock &Block = Function.Block(Id);
+                for (size_t i = 0; i < Block.Instructions.size(); i++)
+                {
+                    const IRInstruction Check = Block.Instructions.at(i);
+                    if (Check.Op != IROpcode::BoundsCheck)
+                        continue;
+                    if (SideEffectsBefore(Block, i))
+                        break;
+
+                    // operands from outside the loop, constants in it are made again in front of it
+                    bool Invariant = true;
+                    std::vector<uint32_t> Operands;
+                    for (uint32_t Operand : Check.Operands)
+                    {
+                        if (!DefinedIn.count(Operand) || !Loop.Blocks.count(DefinedIn.at(Operand)))
+                            Operands.push_back(Operand);
+                        else if (Constant(Operand))
+                            Operands.push_back(Function.NextValue++);
+                        else
+                            Invariant = false;
+                    }
+                    if (!Invariant)
+                        continue;
+
+                    std::vector<IRInstruction> Moved;
+                    for (size_t k = 0; k < Operands.size(); k++)
+                    {
+                        if (Operands.at(k) != Check.Operands.at(k))
+                            Moved.push_back(IRInstruction{.Op = IROpcode::Const, .Type = IRType::I64, .Id = Operands.at(k), .Imm = *Constant(Check.Operands.at(k))});
+                    }
+                    Moved.push_back(IRInstruction{.Op = IROpcode::BoundsCheck, .Operands = Operands});
+
+                    std::vector<IRInstruction> &Into = Function.Block(*Loop.Preheader).Instructions;
+                    Into.insert(Into.end() - 1, Moved.begin(), Moved.end());
+                    Block.Instructions.erase(Block.Instructions.begin() + i--);
+                    Function.Statistics["bounds checks hoisted"]++;
+                    Changed = true;
+                    Index();
+                }
+            }
+        }
+        return Changed;
+    }
+};
+
+inline bool EliminateBoundsChecks(IRFunction &Function)
+{
+    return BoundsCheckElimination(Function).Run();
+}
+
+/*
+ * what a loop computes the same way on every trip moves to the end of
+ * its preheader, arithmetic and lengths from anywhere in the loop since
+ * they cannot fault, loads only from the start of the header of a loop
+ * that writes no memory, since the header runs whenever the loop does
+ */
+inline bool HoistLoopInvariants(IRFunction &Function)
+{
+    bool Changed = false;
+    size_t Hoisted = 0;
+    for (const IRLoop &Loop : FindLoops(Function))
+    {
+        if (!Loop.Preheader)
+            continue;
+
+        std::unordered_set<uint32_t> Inside; // values defined in the loop
+        bool Writes = false;
+        for (uint32_t Id : Loop.Blocks)
+        {
+            for (const IRInstruction &Instruction : Function.Block(Id).Instructions)
+            {
+                if (Instruction.Id)
+                    Inside.insert(Instruction.Id);
+                Writes |= !Instruction.IsPure() && !Instruction.IsTerminator() && Instruction.Op != IROpcode::BoundsCheck && Instruction.Op != IROpcode::RefInc;
+            }
+        }
+
+        // blocks in order so operands move before what uses them
+        std::vector<IRInstruction> Moved;
+        for (uint32_t Id : Function.ReversePostOrder)
+        {
+            if (!Loop.Blocks.count(Id))
+                continue;
+
+            std::vector<IRInstruction> &Instructions = Function.Block(Id).Instructions;
+            bool SideEffects = false;
+            for (size_t i = 0; i < Instructions.size(); i++)
+            {
+                const IRInstruction &Instruction = Instructions.at(i);
+                const bool Invariant = std::none_of(Instruction.Operands.begin(), Instruction.Operands.end(), [&](uint32_t Operand)
+                                                    { return Inside.count(Operand); });
+                const bool Arithmetic = Instruction.Op == IROpcode::Const || Instruction.Op == IROpcode::String || (Instruction.Op >= IROpcode::Add && Instruction.Op <= IROpcode::FloatRound);
+                const bool Load = Instruction.Op == IROpcode::Load && Id == Loop.Header && !SideEffects && !Writes;
+
+                if (Invariant && (Arithmetic || Load || Instruction.Op == IROpcode::Length))
+                {
+                    if (Instruction.Op != IROpcode::Const)
+                        Hoisted++;
+                    Inside.erase(Instruction.Id);
+                    Moved.push_back(Instruction);
+                    Instructions.erase(Instructions.begin() + i--);
+                    continue;
+                }
+                SideEffects |= !Instruction.IsPure();
+            }
+        }
+
+        std::vector<IRInstruction> &Into = Function.Block(*Loop.Preheader).Instructions;
+        Into.insert(Into.end() - 1, Moved.begin(), Moved.end());
+        Changed |= !Moved.empty();
+    }
+
+    if (Hoisted)
+        Function.Statistics["loop invariants hoisted"] += Hoisted;
+    return Changed;
+}
+
+/*
+ * a counter times a value the loop does not change becomes a counter
+ * of its own, started at the product and stepped by step times that
+ * value, so every trip adds where it multiplied
+ */
+inline bool ReduceStrength(IRFunction &Function)
+{
+    size_t Reduced = 0;
+    for (const IRLoop &Loop : FindLoops(Function))
+    {
+        const std::vector<IRInduction> Counters = FindInductions(Function, Loop);
+        if (Counters.empty())
+            continue;
+
+        std::unordered_set<uint32_t> Inside;
+        for (uint32_t Id : Loop.Blocks)
+        {
+            for (const IRInstruction &Instruction : Function.Block(Id).Instructions)
+            {
+                if (Instruction.Id)
+                    Inside.insert(Instruction.Id);
+            }
+        }
+
+        // the product and the counter and factor it multiplies
+        std::vector<std::tuple<uint32_t, IRInduction, uint32_t>> Products;
+        for (uint32_t Id : Loop.Blocks)
+        {
+            for (const IRInstruction &Instruction : Function.Block(Id).Instructions)
+            {
+                if (Instruction.Op != IROpcode::Mul)
+                    continue;
+                for (const IRInduction &Counter : Counters)
+                {
+                    const std::vector<uint32_t> &Operands = Instruction.Operands;
+                    if (Operands.at(0) == Counter.Phi && !Inside.count(Operands.at(1)))
+                        Products.push_back({Instruction.Id, Counter, Operands.at(1)});
+                    else if (Operands.at(1) == Counter.Phi && !Inside.count(Operands.at(0)))
+                        Products.push_back({Instruction.Id, Counter, Operands.at(0)});
+                    else
+                        continue;
+                    break;
+                }
+            }
+        }
+        if (Products.empty())
+            continue;
+
+        std::unordered_map<uint32_t, int64_t> Constants;
+        for (const auto &[Id, Definition] : Function.Definitions())
+        {
+            if (Definition->Op == IROpcode::Const)
+                Constants[Id] = Definition->Imm;
+        }
+
+        // in front of the preheader's branch, folded when both are known
+        std::vector<IRInstruction> &Preheader = Function.Block(*Loop.Preheader).Instructions;
+        auto Emit = [&](IRInstruction Instruction)
+        {
+            Instruction.Type = IRType::I64;
+            Instruction.Id = Function.NextValue++;
+            Preheader.insert(Preheader.end() - 1, Instruction);
+            return Instruction.Id;
+        };
+        auto Multiply = [&](uint32_t A, uint32_t B)
+        {
+            if (Constants.count(A) && Constants.count(B))
+                return Emit(IRInstruction{.Op = IROpcode::Const, .Imm = int64_t(uint64_t(Constants.at(A)) * uint64_t(Constants.at(B)))});
+            return Emit(IRInstruction{.Op = IROpcode::Mul, .Operands = {A, B}});
+        };
+
+        for (const auto &[Product, Counter, Factor] : Products)
+        {
+            const uint32_t Start = Multiply(Counter.Initial, Factor);
+            const uint32_t Step = Emit(IRInstruction{.Op = IROpcode::Const, .Imm = Counter.Step});
+            Constants[Step] = Counter.Step;
+            const uint32_t Stride = Multiply(Step, Factor);
+
+            const uint32_t Carried = Function.NextValue++;
+            const uint32_t Next = Function.NextValue++;
+            std::vector<IRInstruction> &Header = Function.Block(Loop.Header).Instructions;
+            Header.insert(Header.begin(), IRInstruction{.Op = IROpcode::Phi, .Type = IRType::I64, .Id = Carried, .Operands = {Start, Next}, .Targets = {*Loop.Preheader, Loop.Latches.front()}});
+            std::vector<IRInstruction> &Latch = Function.Block(Loop.Latches.front()).Instructions;
+            Latch.insert(Latch.end() - 1, IRInstruction{.Op = IROpcode::Add, .Type = IRType::I64, .Id = Next, .Operands = {Carried, Stride}});
+
+            Function.ReplaceAllUses(Product, Carried);
+            for (uint32_t Id : Loop.Blocks)
+            {
+                std::vector<IRInstruction> &Instructions = Function.Block(Id).Instructions;
+                Instructions.erase(std::remove_if(Instructions.begin(), Instructions.end(),
+                                                  [&](const IRInstruction &Instruction)
+                                                  { return Instruction.Id == Product; }),
+                                   Instructions.end());
+            }
+            Reduced++;
+        }
+    }
+
+    if (Reduced)
+        Function.Statistics["multiplications strength reduced"] += Reduced;
+    return Reduced;
+}
+
+/*
+ * a loop counting up by one to a bound it does not change that only
+ * copies, fills, adds, subtracts or multiplies 4 byte elements at the
+ * counter, or only sums up or keeps the largest or smallest element of
+ * one array, gets a vector loop in front of it doing VectorLanes
+ * elements a trip and the original loop does the rest, products only
+ * with AVX2 since SSE2 has no 32 bit multiply
+ *
+ * two arrays are either the same one or do not overlap at all and each
+ * element is read before it is written at the same index, so it does
+ * not matter which arrays alias, the vector loop stops short of the
+ * first element a bounds check left in the loop would fail on and the
+ * original loop reports it after the same stores
+ */
+class LoopVectorizer
+{
+public:
+    explicit LoopVectorizer(IRFunction &function) : Function(function) {}
+
+    bool Run()
+    {
+        if (Function.VectorLanes < 2)
+            return false;
+
+        size_t Vectorized = 0;
+        for (const IRLoop &Loop : FindLoops(Function))
+        {
+            const std::optional<Plan> Found = Match(Loop);
+            if (!Found)
+                continue;
+            Apply(Loop, *Found);
+            Vectorized++;
+        }
+
+        if (Vectorized)
+            Function.Statistics["loops vectorized"] += Vectorized;
+        return Vectorized;
+    }
+
+private:
+    // what the vector loop does besides counting from the loop's start to its bound
+    struct Plan
+    {
+        IRInduction Counter;
+        uint32_t Bound = 0;
+        std::string Operation;          // the VectorLoop's Text
+        std::vector<uint32_t> Operands; // arrays and values from outside the loop
+        std::vector<uint32_t> Checked;  // arrays the loop still checks the counter against
+        uint32_t Reduction = 0;         // the header's phi that starts with a reduction's result
+    };
+
+    IRFunction &Function;
+    std::unordered_map<uint32_t, IRInstruction *> Definitions;
+    std::unordered_set<uint32_t> Inside; // values the loop defines
+    std::unordered_map<uint32_t, uint32_t> Loaded; // elements at the counter to their arrays
+
+    std::optional<Plan> Match(const IRLoop &Loop)
+    {
+        if (!Loop.Preheader || Loop.Latches.size() != 1)
+            return std::nullopt;
+
+        // the header only merges the counter and at most one other value and compares the counter
+        const IRBlock &Header = Function.Block(Loop.Header);
+        if (Header.Instructions.size() < 3 || Header.Instructions.size() > 4)
+            return std::nullopt;
+        const size_t Phis = Header.Instructions.size() - 2;
+        const IRInstruction &Compare = Header.Instructions.at(Phis);
+        const IRInstruction &Branch = Header.Instructions.back();
+        if (Branch.Op != IROpcode::CondBr || !Loop.Blocks.count(Branch.Targets.at(0)) || Loop.Blocks.count(Branch.Targets.at(1)))
+            return std::nullopt;
+        if (Compare.Op != IROpcode::CmpLT || Compare.Id != Branch.Operands.at(0))
+            return std::nullopt;
+        if (std::any_of(Header.Instructions.begin(), Header.Instructions.begin() + Phis, [](const IRInstruction &Instruction)
+                        { return Instruction.Op != IROpcode::Phi; }))
+            return std::nullopt;
+
+        Definitions = Function.Definitions();
+        Inside.clear();
+        Loaded.clear();
+        for (uint32_t Id : Loop.Blocks)
+        {
+            for (const IRInstruction &Instruction : Function.Block(Id).Instructions)
+            {
+                if (Instruction.Id)
+                    Inside.insert(Instruction.Id);
+            }
+        }
+
+        const std::vector<IRInduction> Counters = FindInductions(Function, Loop);
+        auto Counter = std::find_if(Counters.begin(), Counters.end(), [&](const IRInduction &Counter)
+                                    { return Counter.Phi == Compare.Operands.at(0); });
+        if (Counter == Counters.end() || Counter->Step != 1 || Inside.count(Compare.Operands.at(1)))
+            return std::nullopt;
+
+        // what is left over after a vector loop
+        if (Definitions.count(Counter->Initial) && Definitions.at(Counter->Initial)->Op == IROpcode::VectorEnd)
+            return std::nullopt;
+
+        Plan Result{.Counter = *Counter, .Bound = Compare.Operands.at(1)};
+        const IRInstruction *Carried = nullptr;
+        for (size_t i = 0; i < Phis; i++)
+        {
+            if (Header.Instructions.at(i).Id != Counter->Phi)
+                Carried = &Header.Instructions.at(i);
+        }
+
+        const IRBlock &Body = Function.Block(Branch.Targets.at(0));
+        if (Body.Predecessors.size() != 1)
+            return std::nullopt;
+
+        bool Matched = false;
+        if (Loop.Blocks.size() == 2 && !Carried)
+            Matched = MatchStore(Body, Result);
+        else if (Loop.Blocks.size() == 2)
+            Matched = MatchSum(Body, *Carried, *Loop.Preheader, Result);
+        else if (Carried)
+            Matched = MatchSelect(Loop, Body, *Carried, Result);
+        if (!Matched)
+            return std::nullopt;
+        return Result;
+    }
+
+    // bounds checks of the counter and loads of 4 byte elements at it
+    bool Access(const IRInstruction &Instruction, Plan &Result)
+    {
+        if (Instruction.Op != IROpcode::BoundsCheck && Instruction.Op != IROpcode::Load)
+            return false;
+        const uint32_t Array = Instruction.Operands.at(0);
+        if (Instruction.Operands.at(1) != Result.Counter.Phi || Inside.count(Array))
+            return false;
+
+        if (Instruction.Op == IROpcode::Load)
+        {
+            if (Instruction.Imm != 4 || !Instruction.Signed)
+                return false;
+            Loaded[Instruction.Id] = Array;
+        }
+        else if (std::find(Result.Checked.begin(), Result.Checked.end(), Array) == Result.Checked.end())
+            Result.Checked.push_back(Array);
+        return true;
+    }
+
+    // a[i] = b[i] op c[i] where either side can also be a value from outside, or just a[i] = b[i] or a[i] = v
+    bool MatchStore(const IRBlock &Body, Plan &Result)
+    {
+        const IRInstruction *Arithmetic = nullptr;
+        const IRInstruction *Stored = nullptr;
+        for (const IRInstruction &Instruction : Body.Instructions)
+        {
+            if (Instruction.Id == Result.Counter.Next || Instruction.Op == IROpcode::Br || Access(Instruction, Result))
+                continue;
+            const bool Operation = Instruction.Op == IROpcode::Add || Instruction.Op == IROpcode::Sub || Instruction.Op == IROpcode::Mul;
+            if (Operation && !Arithmetic)
+                Arithmetic = &Instruction;
+            else if (Instruction.Op == IROpcode::Store && !Stored && Instruction.Imm == 4 && !Instruction.Floating && Instruction.Operands.at(1) == Result.Counter.Phi && !Inside.count(Instruction.Operands.at(0)))
+                Stored = &Instruction;
+            else
+                return false;
+        }
+        if (!Stored || (Arithmetic && Stored->Operands.at(2) != Arithmetic->Id))
+            return false;
+
+        std::vector<uint32_t> Sources = {Stored->Operands.at(2)};
+        Result.Operation = "copy";
+        if (Arithmetic)
+        {
+            if (Arithmetic->Op == IROpcode::Mul && Function.VectorLanes < 8)
+                return false;
+            Sources = Arithmetic->Operands;
+            Result.Operation = Arithmetic->Op == IROpcode::Add ? "add" : Arithmetic->Op == IROpcode::Sub ? "sub"
+                                                                                                         : "mul";
+        }
+
+        Result.Operands = {Stored->Operands.at(0)};
+        for (uint32_t Source : Sources)
+        {
+            if (Loaded.count(Source))
+            {
+                Result.Operands.push_back(Loaded.at(Source));
+                Result.Operation += " array";
+            }
+            else if (!Inside.count(Source))
+            {
+                Result.Operands.push_back(Source);
+                Result.Operation += " value";
+            }
+            else
+                return false;
+        }
+        return true;
+    }
+
+    // s = s + a[i]
+    bool MatchSum(const IRBlock &Body, const IRInstruction &Sum, uint32_t Preheader, Plan &Result)
+    {
+        const size_t Back = Sum.Targets.at(0) == Preheader ? 1 : 0;
+        const IRInstruction *Added = nullptr;
+        for (const IRInstruction &Instruction : Body.Instructions)
+        {
+            if (Instruction.Id == Result.Counter.Next || Instruction.Op == IROpcode::Br || Access(Instruction, Result))
+                continue;
+            if (Instruction.Op != IROpcode::Add || Instruction.Id != Sum.Operands.at(Back) || Added)
+                return false;
+            Added = &Instruction;
+        }
+        if (!Added)
+            return false;
+
+        const std::vector<uint32_t> &Terms = Added->Operands;
+        const uint32_t Element = Terms.at(0) == Sum.Id ? Terms.at(1) : Terms.at(0);
+        if ((Terms.at(0) != Sum.Id && Terms.at(1) != Sum.Id) || !Loaded.count(Element))
+            return false;
+
+        Result.Operation = "sum";
+        Result.Operands = {Sum.Operands.at(1 - Back), Loaded.at(Element)};
+        Result.Reduction = Sum.Id;
+        return true;
+    }
+
+    // if (a[i] > m) { m = a[i] } and the other three ways to compare
+    bool MatchSelect(const IRLoop &Loop, const IRBlock &Test, const IRInstruction &Kept, Plan &Result)
+    {
+        const uint32_t Preheader = *Loop.Preheader;
+        const IRBlock &Join = Function.Block(Loop.Latches.front());
+        if (Test.Instructions.size() < 3 || Join.Instructions.size() != 3 || Join.Instructions.front().Op != IROpcode::Phi || Join.Instructions.at(1).Id != Result.Counter.Next)
+            return false;
+        const IRInstruction &Merge = Join.Instructions.front();
+        const size_t Back = Kept.Targets.at(0) == Preheader ? 1 : 0;
+        if (Merge.Operands.size() != 2 || Kept.Operands.at(Back) != Merge.Id)
+            return false;
+
+        // loads and checks, the compare and the branch on it
+        const IRInstruction &Branch = Test.Instructions.back();
+        const IRInstruction &Compare = Test.Instructions.at(Test.Instructions.size() - 2);
+        for (size_t i = 0; i + 2 < Test.Instructions.size(); i++)
+        {
+            if (!Access(Test.Instructions.at(i), Result))
+                return false;
+        }
+        if (Branch.Op != IROpcode::CondBr || Branch.Operands.at(0) != Compare.Id || Compare.Op < IROpcode::CmpGT || Compare.Op > IROpcode::CmpLE || Branch.Targets.at(0) == Branch.Targets.at(1))
+            return false;
+
+        // each way into the join comes straight from the test or through a block that only loads
+        std::unordered_set<uint32_t> Blocks = {Loop.Header, Test.Id, Join.Id};
+        std::optional<bool> ElementWhenTrue;
+        std::optional<uint32_t> Array;
+        for (size_t i = 0; i < 2; i++)
+        {
+            const uint32_t From = Merge.Targets.at(i);
+            if (From != Test.Id)
+            {
+                const IRBlock &Between = Function.Block(From);
+                if (Between.Predecessors.size() != 1 || Between.Predecessors.front() != Test.Id || Between.Instructions.back().Op != IROpcode::Br)
+                    return false;
+                for (size_t k = 0; k + 1 < Between.Instructions.size(); k++)
+                {
+                    if (!Access(Between.Instructions.at(k), Result))
+                        return false;
+                }
+                Blocks.insert(From);
+            }
+
+            const uint32_t Value = Merge.Operands.at(i);
+            const bool True = Branch.Targets.at(0) == (From == Test.Id ? Join.Id : From);
+            if (Value == Kept.Id)
+                continue;
+            if (!Loaded.count(Value) || ElementWhenTrue || (Array && *Array != Loaded.at(Value)))
+                return false;
+            ElementWhenTrue = True;
+            Array = Loaded.at(Value);
+        }
+        if (!ElementWhenTrue || Blocks.size() != Loop.Blocks.size())
+            return false;
+
+        // the compare is between the element and the kept value
+        const std::vector<uint32_t> &Sides = Compare.Operands;
+        const bool ElementFirst = Sides.at(1) == Kept.Id && Loaded.count(Sides.at(0)) && Loaded.at(Sides.at(0)) == *Array;
+        const bool ElementSecond = Sides.at(0) == Kept.Id && Loaded.count(Sides.at(1)) && Loaded.at(Sides.at(1)) == *Array;
+        if (!ElementFirst && !ElementSecond)
+            return false;
+        const bool Greater = (Compare.Op == IROpcode::CmpGT || Compare.Op == IROpcode::CmpGE) == ElementFirst;
+
+        Result.Operation = Greater == *ElementWhenTrue ? "max" : "min";
+        Result.Operands = {Kept.Operands.at(1 - Back), *Array};
+        Result.Reduction = Kept.Id;
+        return true;
+    }
+
+    // the vector loop goes at the end of the preheader and the loop starts where it stopped
+    void Apply(const IRLoop &Loop, const Plan &Found)
+    {
+        const uint32_t Preheader = *Loop.Preheader;
+        const int64_t Lanes = Function.VectorLanes;
+
+        IRInstruction End{.Op = IROpcode::VectorEnd, .Type = IRType::I64, .Id = Function.NextValue++, .Operands = {Found.Counter.Initial, Found.Bound}, .Imm = Lanes};
+        End.Operands.insert(End.Operands.end(), Found.Checked.begin(), Found.Checked.end());
+
+        IRInstruction Vector{.Op = IROpcode::VectorLoop, .Type = Found.Reduction ? IRType::I64 : IRType::Void, .Id = Found.Reduction ? Function.NextValue++ : 0, .Operands = {Found.Counter.Initial, End.Id}, .Imm = Lanes, .Text = Found.Operation};
+        Vector.Operands.insert(Vector.Operands.end(), Found.Operands.begin(), Found.Operands.end());
+
+        for (IRInstruction &Phi : Function.Block(Loop.Header).Instructions)
+        {
+            for (size_t i = 0; i < Phi.Targets.size() && Phi.Op == IROpcode::Phi; i++)
+            {
+                if (Phi.Targets.at(i) != Preheader)
+                    continue;
+                if (Phi.Id == Found.Counter.Phi)
+                    Phi.Operands.at(i) = End.Id;
+                else if (Phi.Id == Found.Reduction)
+                    Phi.Operands.at(i) = Vector.Id;
+            }
+        }
+
+        std::vector<IRInstruction> &Instructions = Function.Block(Preheader).Instructions;
+        Instructions.insert(Instructions.end() - 1, {End, Vector});
+    }
+};
+
+inline bool VectorizeLoops(IRFunction &Function)
+{
+    return LoopVectorizer(Function).Run();
+}
+
+/*
+ * a loop of one block counting up to a bound it does not change gets
+ * a copy in front of it that runs the body UnrollFactor times a trip
+ * while that many trips are left, the original loop then does the
+ * rest, the copy compares the counter it will reach on the last of them
+ */
+inline bool UnrollLoops(IRFunction &Function)
+{
+    static constexpr size_t LargestUnrolled = 256;            // instructions of all the copies of the body
+    static constexpr int64_t LargestBound = int64_t(1) << 48; // the counter cannot wrap stepping past it
+    static constexpr int64_t LargestStep = int64_t(1) << 20;
+
+    const int64_t Factor = Function.UnrollFactor;
+    if (Factor < 2)
+        return false;
+
+    size_t Unrolled = 0;
+    for (const IRLoop &Loop : FindLoops(Function))
+    {
+        if (Loop.Blocks.size() != 2 || Loop.Latches.size() != 1)
+            continue;
+        const uint32_t BodyId = Loop.Latches.front();
+        const IRBlock &Header = Function.Block(Loop.Header);
+        const IRBlock &Body = Function.Block(BodyId);
+
+        const IRInstruction &Branch = Header.Instructions.back();
+        if (Branch.Op != IROpcode::CondBr || Branch.Targets.at(0) != BodyId || Loop.Blocks.count(Branch.Targets.at(1)) || Body.Predecessors.size() != 1)
+            continue;
+
+        // the header only merges values and compares the counter
+        if (Header.Instructions.size() < 3)
+            continue;
+        const size_t Phis = Header.Instructions.size() - 2;
+        const IRInstruction &Compare = Header.Instructions.at(Phis);
+        if (Compare.Id != Branch.Operands.at(0) || (Compare.Op != IROpcode::CmpLT && Compare.Op != IROpcode::CmpLE))
+            continue;
+        if (std::any_of(Header.Instructions.begin(), Header.Instructions.begin() + Phis, [](const IRInstruction &Instruction)
+                        { return Instruction.Op != IROpcode::Phi; }))
+            continue;
+
+        const std::vector<IRInduction> Counters = FindInductions(Function, Loop);
+        auto Counter = std::find_if(Counters.begin(), Counters.end(), [&](const IRInduction &Counter)
+                                    { return Counter.Phi == Compare.Operands.at(0); });
+        if (Counter == Counters.end() || Counter->Step <= 0 || Counter->Step > LargestStep)
+            continue;
+
+        // fewer trips than a vector loop's lanes are left over for the loop after one
+        const std::unordered_map<uint32_t, IRInstruction *> Definitions = Function.Definitions();
+        if (Definitions.count(Counter->Initial) && Definitions.at(Counter->Initial)->Op == IROpcode::VectorEnd)
+            continue;
+
+        // a bound from outside the loop, an array's length or a constant the counter can step past
+        const uint32_t Bound = Compare.Operands.at(1);
+        if (!Definitions.count(Bound))
+            continue;
+        const IRInstruction &Limit = *Definitions.at(Bound);
+        auto Defines = [&](const IRBlock &Block)
+        {
+            return std::any_of(Block.Instructions.begin(), Block.Instructions.end(), [&](const IRInstruction &Instruction)
+                               { return &Instruction == &Limit; });
+        };
+        if (Defines(Header) || Defines(Body))
+            continue;
+        if (Limit.Op != IROpcode::Length && (Limit.Op != IROpcode::Const || Limit.Imm < 0 || Limit.Imm > LargestBound))
+            continue;
+
+        // every copy needs its own values, the header's compare has none to give them
+        const size_t BodySize = Body.Instructions.size() - 1;
+        bool Copyable = BodySize * Factor <= LargestUnrolled && Body.Instructions.back().Op == IROpcode::Br;
+        for (size_t i = 0; i < BodySize && Copyable; i++)
+        {
+            const IRInstruction &Instruction = Body.Instructions.at(i);
+            Copyable = Instruction.Op != IROpcode::Phi && Instruction.Op != IROpcode::Asm && Instruction.Op != IROpcode::StackArray &&
+                       std::find(Instruction.Operands.begin(), Instruction.Operands.end(), Compare.Id) == Instruction.Operands.end();
+        }
+        if (!Copyable)
+            continue;
+
+        const uint32_t Preheader = *Loop.Preheader;
+        const uint32_t HeaderId = Loop.Header;
+        const IRInstruction OriginalCompare = Compare;
+        const std::vector<IRInstruction> Merges(Header.Instructions.begin(), Header.Instructions.begin() + Phis);
+        const std::vector<IRInstruction> Copied(Body.Instructions.begin(), Body.Instructions.end() - 1);
+        const IRInduction Induction = *Counter;
+
+        const uint32_t UnrolledHeader = Function.NewBlock();
+        const uint32_t UnrolledBody = Function.NewBlock();
+
+        // the copy's merges start like the loop's do
+        std::unordered_map<uint32_t, uint32_t> Started;
+        std::vector<IRInstruction> Entry;
+        for (const IRInstruction &Merge : Merges)
+        {
+            const size_t FromPreheader = Merge.Targets.at(0) == Preheader ? 0 : 1;
+            const uint32_t Id = Function.NextValue++;
+            Entry.push_back(IRInstruction{.Op = IROpcode::Phi, .Type = Merge.Type, .Id = Id, .Operands = {Merge.Operands.at(FromPreheader)}, .Targets = {Preheader}});
+            Started[Merge.Id] = Id;
+        }
+        std::unordered_map<uint32_t, uint32_t> Current = Started;
+
+        const uint32_t Ahead = Function.NextValue++;
+        const uint32_t Last = Function.NextValue++;
+        const uint32_t Enough = Function.NextValue++;
+        Entry.push_back(IRInstruction{.Op = IROpcode::Const, .Type = IRType::I64, .Id = Ahead, .Imm = (Factor - 1) * Induction.Step});
+        Entry.push_back(IRInstruction{.Op = IROpcode::Add, .Type = IRType::I64, .Id = Last, .Operands = {Current.at(Induction.Phi), Ahead}});
+        Entry.push_back(IRInstruction{.Op = OriginalCompare.Op, .Type = IRType::I64, .Id = Enough, .Operands = {Last, Bound}});
+        Entry.push_back(IRInstruction{.Op = IROpcode::CondBr, .Operands = {Enough}, .Targets = {UnrolledBody, HeaderId}});
+
+        std::vector<IRInstruction> Copies;
+        for (int64_t k = 0; k < Factor; k++)
+        {
+            std::unordered_map<uint32_t, uint32_t> Values = Current;
+            for (IRInstruction Instruction : Copied)
+            {
+                for (uint32_t &Operand : Instruction.Operands)
+                {
+                    if (Values.count(Operand))
+                        Operand = Values.at(Operand);
+                }
+                if (Instruction.Id)
+                    Instruction.Id = Values[Instruction.Id] = Function.NextValue++;
+                Copies.push_back(std::move(Instruction));
+            }
+
+            // what the latch passes back is what the next copy starts with
+            for (const IRInstruction &Merge : Merges)
+            {
+                const uint32_t Back = Merge.Operands.at(Merge.Targets.at(0) == Preheader ? 1 : 0);
+                Current[Merge.Id] = Values.count(Back) ? Values.at(Back) : Back;
+            }
+        }
+        Copies.push_back(IRInstruction{.Op = IROpcode::Br, .Targets = {UnrolledHeader}});
+
+        for (size_t i = 0; i < Merges.size(); i++)
+        {
+            Entry.at(i).Operands.push_back(Current.at(Merges.at(i).Id));
+            Entry.at(i).Targets.push_back(UnrolledBody);
+        }
+        Function.Block(UnrolledHeader).Instructions = std::move(Entry);
+        Function.Block(UnrolledBody).Instructions = std::move(Copies);
+
+        // the original loop is entered from the copy with whatever is left
+        for (IRInstruction &Merge : Function.Block(HeaderId).Instructions)
+        {
+            if (Merge.Op != IROpcode::Phi)
+                continue;
+            for (size_t i = 0; i < Merge.Targets.size(); i++)
+            {
+                if (Merge.Targets.at(i) != Preheader)
+                    continue;
+                Merge.Targets.at(i) = UnrolledHeader;
+                Merge.Operands.at(i) = Started.at(Merge.Id);
+            }
+        }
+        for (uint32_t &Target : Function.Block(Preheader).Instructions.back().Targets)
+        {
+            if (Target == HeaderId)
+                Target = UnrolledHeader;
+        }
+        Unrolled++;
+    }
+
+    if (!Unrolled)
+        return false;
+
+    Function.ComputeCFG();
+    Function.ComputeDominance();
+    Function.Statistics["loops unrolled"] += Unrolled;
+    return true;
+}
@@ -5,11 +5,6 @@
 
 #include "Common.hpp"
 
-std::filesystem::path FileName;
-std::filesystem::path LocalDirectory;
-std::vector<std::string> argv;
-std::filesystem::path SystemIncludePath;
-
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -19,34 +14,29 @@ std::filesystem::path SystemIncludePath;
 #include <memory>
 #include <iostream>
 
-#include "IncludePath.hpp"
-
-#include "Lexer.hpp"
-#include "Parser.hpp"
-#include "AsmGen.hpp"
+#include "Compilation.hpp"
+#include "Repl.hpp"
 
-#include "GlobalParseLoc.hpp"
-
-int Validate(Parser &Parse, std::vector<StatementPtr> &Ast)
+int Validate(furn::Compilation &Comp)
 {
-    if (CmplFlags::ParseInfo)
+    if (Comp.Flags.ParseInfo)
     {
-        for (CompileError &Error : Parse.Errors)
+        for (CompileError &Error : Comp.ParseErrors)
         {
-            if (Error.Location.File != FileName)
+            if (Error.Location.File != Comp.FileName)
                 continue;
             std::cout << Error.ToString(true) << '\n';
         }
-        for (std::string &Name : Parse.MacroNames)
+        for (std::string &Name : Comp.MacroNames)
         {
             std::cout << "(Macro): " << Name << '\n';
         }
-        for (std::string &Name : Parse.ClassNames)
+        for (std::string &Name : Comp.ClassNames)
         {
             std::cout << "(Class): " << Name << '\n';
         }
 
-        for (StatementPtr &Stmt : Ast)
+        for (StatementPtr &Stmt : Comp.Ast)
         {
             if (auto UseStmt = std::dynamic_pointer_cast<UseStatement>(Stmt))
             {
@@ -63,11 +53,11 @@ int Validate(Parser &Parse, std::vector<StatementPtr> &Ast)
             }
         }
 
-        return !Parse.Errors.empty();
+        return !Comp.ParseErrors.empty();
     }
 
     long ErrorCount = 0;
-    for (CompileError &Error : Parse.Errors)
+    for (CompileError &Error : Comp.ParseErrors)
     {
         if (Error.Severity >= SyntaxError)
             ErrorCount++;
@@ -76,16 +66,16 @@ int Validate(Parser &Parse, std::vector<StatementPtr> &Ast)
     if (ErrorCount > 0)
     {
         CompileError Last;
-        for (size_t i = 0; i < Parse.Errors.size(); i++)
+        for (size_t i = 0; i < Comp.ParseErrors.size(); i++)
         {
-            CompileError Error = Parse.Errors[i];
+            CompileError Error = Comp.ParseErrors[i];
 
             if (Error.Severity <= Hint)
                 continue;
 
             CompileError Next;
-            if (i + 1 < Parse.Errors.size())
-                Next = Parse.Errors[i + 1];
+            if (i + 1 < Comp.ParseErrors.size())
+                Next = Comp.ParseErrors[i + 1];
 
             if (Error.Location.File != Last.Location.File)
                 std::cerr << Error.ToString(false) << "\n\n";
@@ -100,7 +90,7 @@ int Validate(Parser &Parse, std::vector<StatementPtr> &Ast)
     }
     else
     {
-        for (CompileError &Error : Parse.Errors)
+        for (CompileError &Error : Comp.ParseErrors)
         {
             if (Error.Severity >= Warning)
                 std::cerr << Error.ToString() << "\n\n";
@@ -110,182 +100,230 @@ int Validate(Parser &Parse, std::vector<StatementPtr> &Ast)
     return 0;
 }
 
-void SetupParse(Parser &Parse)
+// what -march=<cpu> selects, nullopt for a name it does not know
+std::optional<bool> HasAVX2(const std::string &Cpu)
+{
+    static const std::set<std::string> Without = {"x86-64", "x86-64-v2", "core2", "nehalem", "westmere", "sandybridge", "ivybridge", "btver2", "bdver1"};
+    static const std::set<std::string> With = {"x86-64-v3", "x86-64-v4", "haswell", "broadwell", "skylake", "skylake-avx512", "icelake-client", "icelake-server", "alderlake", "sapphirerapids", "znver1", "znver2", "znver3", "znver4", "znver5"};
+    if (Cpu == "native")
+        return __builtin_cpu_supports("avx2") != 0;
+    if (Without.count(Cpu))
+        return false;
+    if (With.count(Cpu))
+        return true;
+    return std::nullopt;
+}
+
+// the diagnostics from First on, the ones before it were reported already
+void ReportCompileErrors(furn::Compilation &Comp, size_t First = 0)
 {
-    if (Parse.Check(TokenType::Package))
+    const CompileFlags &CmplFlags = Comp.Flags;
+    std::vector<CompileError> &Errors = Comp.Errors;
+
+    for (size_t i = First; i < Errors.size(); i++)
     {
-        Parse.Tokens.erase(Parse.Tokens.begin()); // skip package keyword
-        Parse.Tokens.erase(Parse.Tokens.begin()); // skip package name
-    }
+        CompileError &Error = Errors.at(i);
+        const std::filesystem::path &File = Error.Location.File;
+        size_t Line = Error.Location.Line;
+        size_t Column = Error.Location.Column;
+
+        if (CmplFlags.CompileInfo)
+        {
+            std::cout << Error.ToString(false, true, Line > 0) << "\n";
+        }
+        else
+        {
+            std::cerr << Error.ToString(false, true, Line > 0) << "\n\n";
+        }
+
+        if (!CmplFlags.CompileInfo && Line > 0)
+        {
+            std::ifstream In(File);
 
-    std::vector<Token> ImplicitStatements = {};
+            if (In)
+            {
+                std::string Text;
+
+                for (size_t i = 1; i <= Line && std::getline(In, Text); ++i)
+                {
+                    if (i == Line)
+                    {
+                        std::cerr << Text << '\n';
+                        if (Column > 1)
+                        {
+                            std::cerr << std::string(Column - 2, ' ') << "\x1b[1;97m^\x1b[0m\n";
+                            std::cerr << std::string(Column - 2, ' ') << "\x1b[96mnote: here\x1b[0m\n\n";
+                        }
+                    }
+                }
 
-    Parse.Tokens.insert(Parse.Tokens.begin(), ImplicitStatements.begin(), ImplicitStatements.end());
+                In.close();
+            }
+        }
+    }
 }
 
 int main(int argc, const char *_argv[])
 {
-    argv = std::vector<std::string>(_argv, _argv + argc);
+    const std::vector<std::string> argv(_argv, _argv + argc);
+    furn::Compilation Comp;
+    CompileFlags &CmplFlags = Comp.Flags;
 
     for (size_t c = 2; c < argv.size(); c++)
     {
         const std::string arg = argv.at(c);
 
         if (arg == "-parseinfo")
-            CmplFlags::ParseInfo = true;
+            CmplFlags.ParseInfo = true;
         else if (arg == "-compileinfo")
-            CmplFlags::CompileInfo = true;
+            CmplFlags.CompileInfo = true;
         else if (arg == "-strict")
-            CmplFlags::StrictMode = true;
+            CmplFlags.StrictMode = true;
         else if (arg == "-out")
-            CmplFlags::OutputFlag = argv.at(++c);
+            CmplFlags.OutputFlag = argv.at(++c);
         else if (arg == "-r")
-            CmplFlags::RunAfterComp = true;
+            CmplFlags.RunAfterComp = true;
         else if (arg == "-q")
-            CmplFlags::QuietComp = true;
+            CmplFlags.QuietComp = true;
         else if (arg == "-lwgcc")
-            CmplFlags::LinkWithGcc = true;
+            CmplFlags.LinkWithGcc = true;
         else if (arg == "--release")
         {
-            CmplFlags::BoundsChecking = false;
+            CmplFlags.BoundsChecking = false;
         }
         else if (arg == "-nogarbagecollect")
-            CmplFlags::GarbageCollect = false;
+            CmplFlags.GarbageCollect = false;
         else if (arg == "-cursor")
         {
             // throw std::runtime_error(argv.at(++c));
-            CmplFlags::CursorPosition = std::stoi(argv.at(++c));
+            CmplFlags.CursorPosition = std::stoi(argv.at(++c));
         }
+        else if (arg == "-check")
+            CmplFlags.CheckOnly = true;
+        else if (arg == "-emit-ir")
+            CmplFlags.EmitIR = true;
+        else if (arg == "-S")
+            CmplFlags.EmitAssembly = true;
+        else if (arg == "-O0" || arg == "-O1" || arg == "-O2")
+            CmplFlags.OptimizationLevel = arg.back() - '0';
+        else if (arg.rfind("-fno-", 0) == 0 && PassManager::IsPass(arg.substr(5)))
+            CmplFlags.DisabledPasses.insert(arg.substr(5));
+        else if (arg.rfind("-print-after=", 0) == 0 && PassManager::IsPass(arg.substr(13)))
+            CmplFlags.PrintAfter.insert(arg.substr(13));
+        else if (arg.rfind("-inline-threshold=", 0) == 0)
+            CmplFlags.InlineThreshold = std::stoul(arg.substr(18));
+        else if (arg.rfind("-unroll=", 0) == 0)
+            CmplFlags.UnrollFactor = std::stoul(arg.substr(8));
+        else if (arg.rfind("-march=", 0) == 0 && HasAVX2(arg.substr(7)))
+            CmplFlags.AVX2 = *HasAVX2(arg.substr(7));
+        else if (arg == "-completions")
+            CmplFlags.CompletionLimit = std::stoul(argv.at(++c));
         else
             std::cout << "unrecognized flag '" << arg << '\'' << std::endl;
     }
 
-    IncludePath::Init();
-    SystemIncludePath = IncludePath::DirPath;
+    Comp.IncludeDirectory = IncludePath::Init();
 
     // Printing optimizations
     std::ios::sync_with_stdio(false);
     std::cin.tie(nullptr);
 
-    if (argc > 1)
-        FileName = argv[1];
-    else
+    if (argc <= 1)
     {
-        std::cout << "usage:\nfurn <file> [ flags... ]\n";
+        std::cout << "usage:\nfurn <file> [ flags... ]\nfurn --repl [ flags... ]\n";
         return 0;
-        // std::cout << "No file attached\nCompile file: ";
-        // std::cout.flush();
-        // std::string _FileName;
-        // std::getline(std::cin, _FileName);
-        // FileName = _FileName;
     }
 
-    std::ifstream File(FileName, std::ios::binary);
-    if (!File.is_open())
+    if (argv[1] == "--repl")
+        return furn::Repl(CmplFlags, Comp.IncludeDirectory).Loop(std::cin);
+
+    if (!Comp.LoadFile(argv[1]))
     {
-        std::cerr << "Failed to open: " << FileName << '\n';
+        std::cerr << "Failed to open: " << std::filesystem::path(argv[1]) << '\n';
         return 1;
     }
 
-    LocalDirectory = std::filesystem::current_path(); // std::filesystem::path(FileName).parent_path();
-    std::string Content((std::istreambuf_iterator<char>(File)),
-                     std::istreambuf_iterator<char>());
+    Comp.OutputDirectory = std::filesystem::current_path(); // std::filesystem::path(FileName).parent_path();
+    Comp.ParseSource();
 
-    File.close();
+    const int Validation = Validate(Comp);
+    if (Validation == 0 && CmplFlags.CheckOnly)
+    {
+        // type check only, nothing is emitted or assembled
+        const bool Ok = Comp.Check();
 
-    Lexer Lex(Content);
-    Lex.Location.File = FileName;
-    std::vector<Token> Tokens = Lex.Tokenize();
+        ReportCompileErrors(Comp);
+        std::cout.flush();
+        std::cerr.flush();
 
-    Parser Parse(Tokens);
-    SetupParse(Parse);
-    std::vector<StatementPtr> Ast = Parse.ParseProgram();
+        return Ok ? 0 : 1;
+    }
 
-    const int Validation = Validate(Parse, Ast);
-    if (Validation == 0 && (!CmplFlags::ParseInfo || CmplFlags::CompileInfo))
+    if (Validation == 0 && (!CmplFlags.ParseInfo || CmplFlags.CompileInfo))
     {
         std::stringstream CompConsoleOut;
 
-        std::filesystem::path OutputFile = CmplFlags::OutputFlag.empty() ? LocalDirectory / FileName.stem().concat(".asm") : LocalDirectory / CmplFlags::OutputFlag.stem().concat(".asm");
-        
         CompConsoleOut << "compiling..." << std::endl;
 
-        AsmGenerator Gen(Ast);
-        std::string Result = Gen.GenerateProgram();
-
-        for (CompileError &Error : Gen.Errors)
-        {
-            const std::filesystem::path &File = Error.Location.File;
-            size_t Line = Error.Location.Line;
-            size_t Column = Error.Location.Column;
-
-            if (CmplFlags::CompileInfo)
-            {
-                std::cout << Error.ToString(false, true, true) << "\n";
-            }
-            else
-            {
-                std::cerr << Error.ToString(false, true, true) << "\n\n";
-            }
-
-            if (!CmplFlags::CompileInfo && Line > 0)
-            {
-                std::ifstream In(File);
-
-                if (In)
-                {
-                    std::string Text;
-
-                    for (size_t i = 1; i <= Line && std::getline(In, Text); ++i)
-                    {
-                        if (i == Line)
-                        {
-                            std::cerr << Text << '\n';
-                            if (Column > 0)
-                            {
-                                std::cerr << std::string(Column - 2, ' ') << "\x1b[1;97m^\x1b[0m\n";
-                                std::cerr << std::string(Column - 2, ' ') << "\x1b[96mnote: here\x1b[0m\n\n";
-                            }
-                        }
-                    }
+        const bool Ok = Comp.Compile();
+        std::cerr << Comp.PassDumps;
 
-                    In.close();
-                }
-            }
-        }
+        ReportCompileErrors(Comp);
         std::cout.flush();
         std::cerr.flush();
-        if (CmplFlags::CompileInfo)
+        if (CmplFlags.CompileInfo)
         {
-            for (auto &Name : Gen.AvailableIdentifiers)
+            for (auto &Name : Comp.AvailableIdentifiers)
             {
-                std::cout << Name << std::endl;
+                std::cout << Name << '\n';
             }
 
             return 0;
         }
-        if (!Gen.Errors.empty())
+        if (!Ok)
         {
             return 1;
         }
 
-        std::ofstream f(OutputFile);
-        f << Result;
-        f.close(); // gcc -nostdlib -no-pie hello.o -lc -o hello
-        CompConsoleOut << ".asm in " << OutputFile.stem().concat(".asm") << std::endl;
-        system((("cd \"" + LocalDirectory.string() + "\"") + "; nasm -felf64 " + OutputFile.stem().concat(".asm").string()).c_str());
-        CompConsoleOut << ".o in " << OutputFile.stem().concat(".o") << std::endl;
-        if (CmplFlags::LinkWithGcc)
-            system((("cd \"" + LocalDirectory.string() + "\"") + "; gcc -nostdlib -no-pie " + OutputFile.stem().concat(".o").string() + " -lc -o " + OutputFile.stem().string()).c_str());
-        else
-            system((("cd \"" + LocalDirectory.string() + "\"") + "; ld " + OutputFile.stem().concat(".o").string() + " -o " + OutputFile.stem().string()).c_str());
-        CompConsoleOut << "executable in " << OutputFile.stem() << std::endl;
+        for (const auto &[Name, Count] : Comp.Statistics)
+        {
+            CompConsoleOut << Count << " " << Name << std::endl;
+        }
 
-        if (!CmplFlags::QuietComp)
+        // -r runs from memory unless the program needs a system linker
+        if (CmplFlags.RunAfterComp && !CmplFlags.EmitAssembly && !CmplFlags.LinkWithGcc)
+        {
+            if (!CmplFlags.QuietComp)
+                std::cout << CompConsoleOut.str();
+            CompConsoleOut.str("");
+
+            int ExitCode = 0;
+            const size_t Reported = Comp.Errors.size();
+            const bool Ran = Comp.RunInMemory(ExitCode);
+            ReportCompileErrors(Comp, Reported);
+            if (Ran)
+                return 0;
+        }
+
+        const size_t Reported = Comp.Errors.size();
+        const bool Built = Comp.Build();
+        ReportCompileErrors(Comp, Reported);
+        if (!Comp.AssemblerNote.empty())
+            CompConsoleOut << "using nasm, " << Comp.AssemblerNote << std::endl;
+        for (const std::filesystem::path &Output : Comp.Outputs)
+        {
+            const std::string Extension = Output.extension().string();
+            CompConsoleOut << (Extension.empty() ? "executable" : Extension) << " in " << Output.filename() << std::endl;
+        }
+
+        if (!CmplFlags.QuietComp)
             std::cout << CompConsoleOut.str();
 
-        if (CmplFlags::RunAfterComp)
-            system((("cd \"" + LocalDirectory.string() + "\"") + "; ./" + OutputFile.stem().string()).c_str());
+        if (!Built)
+            return 1;
+
+        if (CmplFlags.RunAfterComp && !CmplFlags.EmitAssembly)
+            Comp.Run();
     }
     return 0;
 }
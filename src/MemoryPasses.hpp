@@ -0,0 +1,264 @@
+#pragma once
+
+#include "Common.hpp"
+#include "IR.hpp"
+#include "LoopPasses.hpp"
+
+/*
+ * passes that follow where an allocation goes, same contract as
+ * ScalarPasses.hpp
+ */
+
+/*
+ * an array from `new` that is only indexed, measured and compared,
+ * never passed, returned, stored or merged with another value, can
+ * only be reached through the locals holding it, when exactly one
+ * local takes it and lets it go once the count goes 0 -> 1 -> 0 on
+ * every path, so the counting is dropped and the release becomes a
+ * free placed right after the last use
+ */
+class OwnershipAnalysis
+{
+public:
+    OwnershipAnalysis(IRFunction &function) : Function(function) {}
+
+    bool Run()
+    {
+        std::unordered_map<uint32_t, std::vector<Use>> Uses;
+        std::vector<uint32_t> Allocations;
+        for (const IRBlock &Block : Function.Blocks)
+        {
+            for (size_t i = 0; i < Block.Instructions.size(); i++)
+            {
+                const IRInstruction &Instruction = Block.Instructions.at(i);
+                if (Instruction.Op == IROpcode::NewArray)
+                    Allocations.push_back(Instruction.Id);
+                for (size_t j = 0; j < Instruction.Operands.size(); j++)
+                    Uses[Instruction.Operands.at(j)].push_back(Use{.Block = Block.Id, .Index = i, .Operand = j});
+            }
+        }
+
+        const std::vector<IRLoop> Loops = FindLoops(Function);
+        std::vector<std::pair<Use, Use>> Owned; // the reference taken and the one dropped
+        for (uint32_t Allocation : Allocations)
+        {
+            std::optional<Use> Taken;
+            std::optional<Use> Dropped;
+            bool Unique = true;
+            for (const Use &Use : Uses[Allocation])
+            {
+                const IRInstruction &User = At(Use);
+                if (User.Op == IROpcode::RefInc && !Taken)
+                    Taken = Use;
+                else if (User.Op == IROpcode::Release && !Dropped)
+                    Dropped = Use;
+                else if (!Contained(User, Use.Operand))
+                    Unique = false;
+            }
+            if (!Unique || !Taken || !Dropped || !Before(*Taken, *Dropped))
+                continue;
+
+            // a release in a loop the allocation is outside of could run twice
+            const uint32_t Defined = DefiningBlock(Allocation);
+            if (std::any_of(Loops.begin(), Loops.end(), [&](const IRLoop &Loop)
+                            { return Loop.Blocks.count(Dropped->Block) && !Loop.Blocks.count(Defined); }))
+                continue;
+
+            Owned.push_back({*Taken, *Dropped});
+        }
+
+        std::unordered_set<const IRInstruction *> Uncounted;
+        for (auto &[Taken, Dropped] : Owned)
+        {
+            Uncounted.insert(&At(Taken));
+            At(Dropped).Op = IROpcode::Free;
+        }
+
+        for (IRBlock &Block : Function.Blocks)
+        {
+            Block.Instructions.erase(std::remove_if(Block.Instructions.begin(), Block.Instructions.end(),
+                                                    [&](const IRInstruction &Instruction)
+                                                    { return Uncounted.count(&Instruction); }),
+                                     Block.Instructions.end());
+
+            // each free moves up to right after the last use in its block
+            std::vector<IRInstruction> &Instructions = Block.Instructions;
+            for (size_t i = 0; i < Instructions.size(); i++)
+            {
+                if (Instructions.at(i).Op != IROpcode::Free)
+                    continue;
+
+                const uint32_t Object = Instructions.at(i).Operands.at(0);
+                size_t Last = i;
+                while (Last > 0 && !Touches(Instructions.at(Last - 1), Object))
+                    Last--;
+                std::rotate(Instructions.begin() + Last, Instructions.begin() + i, Instructions.begin() + i + 1);
+            }
+        }
+
+        if (!Owned.empty())
+            Function.Statistics["reference counts elided"] += Owned.size();
+        return !Owned.empty();
+    }
+
+private:
+    struct Use
+    {
+        uint32_t Block = 0;
+        size_t Index = 0;   // of the instruction in the block
+        size_t Operand = 0; // which of its operands
+    };
+
+    IRFunction &Function;
+
+    IRInstruction &At(const Use &Use)
+    {
+        return Function.Block(Use.Block).Instructions.at(Use.Index);
+    }
+
+    // uses that neither keep the array nor hand it to anything that could
+    static bool Contained(const IRInstruction &User, size_t Operand)
+    {
+        switch (User.Op)
+        {
+        case IROpcode::Load:
+        case IROpcode::Length:
+        case IROpcode::BoundsCheck:
+            return Operand == 0;
+        case IROpcode::Store:
+            return Operand == 0 && User.Operands.at(2) != User.Operands.at(0);
+        case IROpcode::VectorEnd:
+        case IROpcode::VectorLoop:
+            return Operand >= 2; // the arrays, the values there are only ever elements
+        case IROpcode::CmpGT:
+        case IROpcode::CmpLT:
+        case IROpcode::CmpGE:
+        case IROpcode::CmpLE:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static bool Touches(const IRInstruction &Instruction, uint32_t Object)
+    {
+        return Instruction.Op == IROpcode::Phi || Instruction.Id == Object || std::find(Instruction.Operands.begin(), Instruction.Operands.end(), Object) != Instruction.Operands.end();
+    }
+
+    bool Before(const Use &a, const Use &b) const
+    {
+        if (a.Block == b.Block)
+            return a.Index < b.Index;
+        return Function.Dominates(a.Block, b.Block);
+    }
+
+    uint32_t DefiningBlock(uint32_t Value) const
+    {
+        for (const IRBlock &Block : Function.Blocks)
+        {
+            for (const IRInstruction &Instruction : Block.Instructions)
+            {
+                if (Instruction.Id == Value)
+                    return Block.Id;
+            }
+        }
+        return Function.Blocks.front().Id;
+    }
+};
+
+inline bool ElideReferenceCounts(IRFunction &Function)
+{
+    return OwnershipAnalysis(Function).Run();
+}
+
+/*
+ * a `new` array of a constant size whose only other uses are indexing,
+ * sizeof, compares and the free the ownership pass gave it moves into
+ * the frame, its one slot is reused by every pass through a loop since
+ * nothing from one iteration can still see it in the next, without a
+ * count it keeps only the length in front of the elements, objects are
+ * never lowered so RegisterAllocator.hpp places those
+ */
+inline bool AllocateOnStack(IRFunction &Function)
+{
+    static constexpr int64_t LargestArray = 4096; // bytes of elements
+    static constexpr int64_t FrameBudget = 32768; // bytes of arrays in one frame
+
+    std::unordered_map<uint32_t, int64_t> Constants;
+    std::unordered_map<uint32_t, std::vector<std::pair<const IRInstruction *, uint32_t>>> Uses; // user and its block
+    int64_t Budget = FrameBudget;
+    for (const IRBlock &Block : Function.Blocks)
+    {
+        for (const IRInstruction &Instruction : Block.Instructions)
+        {
+            if (Instruction.Op == IROpcode::Const)
+                Constants[Instruction.Id] = Instruction.Imm;
+            for (uint32_t Operand : Instruction.Operands)
+                Uses[Operand].push_back({&Instruction, Block.Id});
+        }
+    }
+
+    auto Bytes = [&](const IRInstruction &Array) -> std::optional<int64_t>
+    {
+        const uint32_t Count = Array.Operands.at(0);
+        if (!Constants.count(Count) || Constants.at(Count) < 0 || Constants.at(Count) > LargestArray / std::max<int64_t>(Array.Imm, 1))
+            return std::nullopt;
+        return Constants.at(Count) * Array.Imm;
+    };
+
+    for (const IRBlock &Block : Function.Blocks)
+    {
+        for (const IRInstruction &Instruction : Block.Instructions)
+        {
+            if (Instruction.Op == IROpcode::StackArray)
+                Budget -= Bytes(Instruction).value_or(0);
+        }
+    }
+
+    const std::vector<IRLoop> Loops = FindLoops(Function);
+    std::unordered_set<uint32_t> Placed;
+    for (IRBlock &Block : Function.Blocks)
+    {
+        for (IRInstruction &Instruction : Block.Instructions)
+        {
+            if (Instruction.Op != IROpcode::NewArray)
+                continue;
+            const std::optional<int64_t> Size = Bytes(Instruction);
+            if (!Size || *Size > Budget)
+                continue;
+
+            bool Local = true;
+            for (const auto &[User, UserBlock] : Uses[Instruction.Id])
+            {
+                const bool Contained = (User->Op == IROpcode::Load || User->Op == IROpcode::Length || User->Op == IROpcode::BoundsCheck || User->Op == IROpcode::Free) && User->Operands.at(0) == Instruction.Id;
+                const bool Stored = User->Op == IROpcode::Store && User->Operands.at(0) == Instruction.Id && User->Operands.at(2) != Instruction.Id;
+                const bool Compared = User->Op >= IROpcode::CmpGT && User->Op <= IROpcode::CmpLE;
+                const bool Vectored = (User->Op == IROpcode::VectorEnd || User->Op == IROpcode::VectorLoop) && User->Operands.at(0) != Instruction.Id && User->Operands.at(1) != Instruction.Id;
+
+                // a use outside a loop the array is made in would see the last iteration's
+                const bool SameIteration = std::all_of(Loops.begin(), Loops.end(), [&](const IRLoop &Loop)
+                                                       { return !Loop.Blocks.count(Block.Id) || Loop.Blocks.count(UserBlock); });
+                if (!(Contained || Stored || Compared || Vectored) || !SameIteration)
+                    Local = false;
+            }
+            if (!Local)
+                continue;
+
+            Instruction.Op = IROpcode::StackArray;
+            Budget -= *Size;
+            Placed.insert(Instruction.Id);
+        }
+    }
+
+    for (IRBlock &Block : Function.Blocks)
+    {
+        Block.Instructions.erase(std::remove_if(Block.Instructions.begin(), Block.Instructions.end(),
+                                                [&](const IRInstruction &Instruction)
+                                                { return Instruction.Op == IROpcode::Free && Placed.count(Instruction.Operands.at(0)); }),
+                                 Block.Instructions.end());
+    }
+
+    if (!Placed.empty())
+        Function.Statistics["arrays placed on the stack"] += Placed.size();
+    return !Placed.empty();
+}
@@ -8,9 +8,7 @@ class Parser;
 #include "Error.hpp"
 #include "GlobalParseLoc.hpp"
 
-#define ret return nullptr;
-
-std::string TokenTypeString(TokenType Type)
+inline std::string TokenTypeString(TokenType Type)
 {
     return std::string(magic_enum::enum_name(Type));
 }
@@ -42,7 +40,9 @@ public:
             else if (Stmt)
             {
                 Statements.push_back(Stmt);
-                Throw("Expected a declaration before main execution", false);
+                // furn --repl runs statements as they are entered
+                if (!REPL)
+                    Throw("Expected a declaration before main execution", false);
             }
         }
 
@@ -51,13 +51,42 @@ public:
 
     bool IsAtEnd() const { return Peek().Type == TokenType::Eof; }
 
+    // replaces every use of the macro from Position on
+    void ExpandMacro(const std::string &MacroName, std::vector<Token> MacroTokens)
+    {
+        size_t OriginalPosition = Position;
+        while (!IsAtEnd())
+        {
+            if (Check(TokenType::Identifier) && Peek().Text == MacroName)
+            {
+                for (Token &Tok : MacroTokens)
+                    Tok.Location = Peek().Location;
+                Advance();
+                Tokens.insert(Tokens.begin() + Position, MacroTokens.begin(), MacroTokens.end());
+                Tokens.erase(Tokens.begin() + Position - 1);
+                Position += MacroTokens.size();
+                continue;
+            }
+            Advance();
+        }
+
+        Position = OriginalPosition;
+    }
+
     std::vector<Token> &Tokens;
     std::vector<CompileError> Errors;
     std::vector<std::string> MacroNames;
+    std::unordered_map<std::string, std::vector<Token>> Macros; // by name, for tokens appended after they were defined
     std::vector<std::string> ClassNames;
     std::unordered_map<std::string, MapId> ImportCache;
 
     bool REPL = false;
+    std::filesystem::path IncludeDirectory; // where packages are looked up
+
+    // scopes of the imported namespace being parsed, filled in once it
+    // closes and shared by every function body skipped inside of it
+    std::shared_ptr<std::vector<std::unordered_map<std::string, Symbol>>> NamespaceScopes = nullptr;
+    size_t NamespaceScopeDepth = 0;
 
     size_t Position = 0;
 
@@ -392,6 +421,10 @@ private:
 
         if (Match(TokenType::Function))
         {
+            const bool CLinkage = Check(TokenType::LParen);
+            if (CLinkage)
+                ParseLinkage();
+
             if (PeekNext().Type == TokenType::Equals || PeekNext().Type == TokenType::Colon)
             {
                 Throw("A 'defn' statement defines functions, not variables", false, SyntaxError, Previous());
@@ -399,7 +432,8 @@ private:
 
             std::shared_ptr<VarDeclaration> Decl = std::dynamic_pointer_cast<VarDeclaration>(ParseFunctionDefinition());
             std::shared_ptr<FunctionDefinition> Func = std::dynamic_pointer_cast<FunctionDefinition>(Decl->Initializer);
-            Func->Global = IsExport;
+            Func->Global = IsExport || CLinkage;
+            Func->CLinkage = CLinkage;
             *Decl->Initializer = *Func;
             return Decl;
         }
@@ -440,6 +474,9 @@ private:
     {
         if (Match(TokenType::Import))
         {
+            if (Match(TokenType::Function))
+                return ParseExternFunction();
+
             const Token &ImportToken = Previous();
             std::filesystem::path ImportDirectory = std::filesystem::path(Previous().Location.File).parent_path();
 
@@ -486,7 +523,7 @@ private:
 
                                 CollectEntries(Content);
 
-                                IncludePath::DirPath = Content;
+                                IncludeDirectory = Content;
 
                                 continue;
                             }
@@ -561,7 +598,7 @@ private:
             {
                 // look for packages
 
-                CollectEntries(IncludePath::DirPath);
+                CollectEntries(IncludeDirectory);
 
                 for (auto &Entry : Entries)
                 {
@@ -670,24 +707,8 @@ private:
                 Advance();
             }
 
-            size_t OriginalPosition = Position;
-            while (!IsAtEnd())
-            {
-                Token Current = Peek();
-                if (Check(TokenType::Identifier) && Peek().Text == MacroName)
-                {
-                    for (Token &Tok : MacroTokens)
-                        Tok.Location = Peek().Location;
-                    Advance();
-                    Tokens.insert(Tokens.begin() + Position, MacroTokens.begin(), MacroTokens.end());
-                    Tokens.erase(Tokens.begin() + Position - 1);
-                    Position += MacroTokens.size();
-                    continue;
-                }
-                Advance();
-            }
-
-            Position = OriginalPosition;
+            Macros[MacroName] = MacroTokens;
+            ExpandMacro(MacroName, MacroTokens);
         }
         else if (PreprocessType == "Asmbl")
         {
@@ -709,6 +730,21 @@ private:
             
             return std::make_shared<AssemblyInstructions>(Instructions);
         }
+        else if (PreprocessType == "inline" || PreprocessType == "noinline")
+        {
+            StatementPtr Stmt = ParseStatement();
+
+            auto Decl = std::dynamic_pointer_cast<VarDeclaration>(Stmt);
+            auto Func = Decl ? std::dynamic_pointer_cast<FunctionDefinition>(Decl->Initializer) : nullptr;
+            if (!Func)
+            {
+                Throw("@" + PreprocessType + " must be followed by a function definition", false, SyntaxError);
+                return Stmt;
+            }
+
+            (PreprocessType == "inline" ? Func->Inline : Func->NoInline) = true;
+            return Stmt;
+        }
         else
         {
             Throw("Invalid preprocess type");
@@ -786,6 +822,35 @@ private:
         }
     }
 
+    // finds the brace closing the body at the cursor without parsing it,
+    // bodies that define macros have to be parsed in place
+    bool SkipFunctionBody(std::vector<Token> &BodyTokens)
+    {
+        size_t Depth = 0;
+        for (size_t i = Position; i < Tokens.size(); i++)
+        {
+            const Token &Tok = Tokens[i];
+
+            if (Tok.Type == TokenType::Eof)
+                return false;
+            if (Tok.Type == TokenType::At && i + 1 < Tokens.size() && Tokens[i + 1].Text == "Define")
+                return false;
+
+            if (Tok.Type == TokenType::LBrace)
+                Depth++;
+            else if (Tok.Type == TokenType::RBrace && --Depth == 0)
+            {
+                BodyTokens.assign(Tokens.begin() + Position, Tokens.begin() + i + 1);
+                BodyTokens.push_back(Token(TokenType::Eof, "", Tok.Location)); // errors at the end point at the brace
+                Position = i + 1;
+                CurrentParseToken = Previous();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
     StatementPtr ParseFunctionDefinition()
     {
         std::string Name = ParseName();
@@ -845,16 +910,25 @@ private:
         }
 
         std::vector<StatementPtr> Body;
+        std::vector<Token> BodyTokens;
+        bool Skipped = false;
 
         if (!Match(TokenType::RArrowThick))
         {
             if (ReturnType.Type == ValueType::Unknown)
                 ReturnType = TypeDescriptor(ValueType::Null).AsConstant();
 
-            Expect(TokenType::LBrace);
+            // only functions declared directly in an imported namespace
+            if (NamespaceScopes && LocalScopes.size() == NamespaceScopeDepth + 1 && Check(TokenType::LBrace))
+                Skipped = SkipFunctionBody(BodyTokens);
 
-            while (!Match(TokenType::RBrace))
-                Body.push_back(ParseStatement());
+            if (!Skipped)
+            {
+                Expect(TokenType::LBrace);
+
+                while (!Match(TokenType::RBrace))
+                    Body.push_back(ParseStatement());
+            }
         }
         else
         {
@@ -866,8 +940,99 @@ private:
             Body.push_back(std::make_shared<ReturnStatement>(Expr));
         }
 
+        std::unordered_map<std::string, Symbol> BodyScope;
+        if (Skipped)
+            BodyScope = CurrentLocalScope(); // parameters
+
+        PopLocalScope();
+
+        std::vector<TypeDescriptor> FuncSubtypes;
+        FuncSubtypes.push_back(ReturnType);
+        for (auto &&Param : Params)
+        {
+            FuncSubtypes.push_back(Param.Type);
+        }
+
+        CurrentLocalScope()[Name] = Symbol(TypeDescriptor(ValueType::Function, {ReturnType}), Var, FunctionAddress);
+
+        auto Func = std::make_shared<FunctionDefinition>(Body, Params, ReturnType);
+        if (Skipped)
+        {
+            Func->ParseBody = [this, BodyTokens = std::move(BodyTokens), BodyScope = std::move(BodyScope), EnclosingScopes = NamespaceScopes](std::vector<CompileError> &BodyErrors) mutable
+            {
+                Parser BodyParser(BodyTokens);
+                BodyParser.LocalScopes = *EnclosingScopes;
+                BodyParser.LocalScopes.push_back(std::move(BodyScope));
+                BodyParser.AddressCount = AddressCount;
+                BodyParser.ImportCache = ImportCache;
+                BodyParser.IncludeDirectory = IncludeDirectory;
+
+                std::vector<StatementPtr> Body;
+                BodyParser.Expect(TokenType::LBrace);
+                while (!BodyParser.Match(TokenType::RBrace))
+                    Body.push_back(BodyParser.ParseStatement());
+
+                // keep addresses unique across everything parsed so far
+                AddressCount = BodyParser.AddressCount;
+                ImportCache = BodyParser.ImportCache;
+                IncludeDirectory = BodyParser.IncludeDirectory;
+                BodyErrors.insert(BodyErrors.end(), BodyParser.Errors.begin(), BodyParser.Errors.end());
+
+                return Body;
+            };
+        }
+
+        return std::make_shared<VarDeclaration>(Func, Name, FunctionAddress, TypeDescriptor(ValueType::Function, FuncSubtypes, nullptr, false, true));
+    }
+
+    // the (C) in defn(C), the only linkage besides furn's own
+    void ParseLinkage()
+    {
+        Expect(TokenType::LParen);
+        if (Expect(TokenType::Identifier).Text != "C")
+            Throw("Expected C linkage", false, SyntaxError, Previous());
+        Expect(TokenType::RParen);
+    }
+
+    // import defn(C) name(type, ...) return type, a function from a C library
+    StatementPtr ParseExternFunction()
+    {
+        ParseLinkage();
+        std::string Name = ParseName();
+
+        PushLocalScope();
+
+        std::vector<VarDeclaration> Params;
+        Expect(TokenType::LParen);
+        if (!Check(TokenType::RParen))
+        {
+            do
+            {
+                // C only cares about the types, names are optional
+                std::string ParamName = "_" + std::to_string(Params.size());
+                if (Check(TokenType::Identifier) && PeekNext().Type == TokenType::Colon)
+                {
+                    ParamName = ParseName();
+                    Expect(TokenType::Colon);
+                }
+
+                TypeDescriptor ParamType = ParseType();
+                CurrentLocalScope()[ParamName] = NewSymbol(ParamType, Parameter);
+                Params.push_back(VarDeclaration(nullptr, ParamName, AddressCount, ParamType));
+            } while (Match(TokenType::Comma));
+        }
+        Expect(TokenType::RParen);
+
         PopLocalScope();
 
+        TypeDescriptor ReturnType = TypeDescriptor(ValueType::Null).AsConstant();
+        if (Match(TokenType::Return))
+        {
+            ReturnType = ParseType();
+            ReturnType.Constant = true;
+        }
+        MatchTerminator();
+
         std::vector<TypeDescriptor> FuncSubtypes;
         FuncSubtypes.push_back(ReturnType);
         for (auto &&Param : Params)
@@ -875,9 +1040,13 @@ private:
             FuncSubtypes.push_back(Param.Type);
         }
 
+        const MapId FunctionAddress = NewAddress();
         CurrentLocalScope()[Name] = Symbol(TypeDescriptor(ValueType::Function, {ReturnType}), Var, FunctionAddress);
 
-        return std::make_shared<VarDeclaration>(std::make_shared<FunctionDefinition>(Body, Params, ReturnType), Name, FunctionAddress, TypeDescriptor(ValueType::Function, FuncSubtypes, nullptr, false, true));
+        auto Func = std::make_shared<FunctionDefinition>(std::vector<StatementPtr>(), Params, ReturnType);
+        Func->CLinkage = true;
+        Func->External = true;
+        return std::make_shared<VarDeclaration>(Func, Name, FunctionAddress, TypeDescriptor(ValueType::Function, FuncSubtypes, nullptr, false, true));
     }
 
     StatementPtr ParseNamespaceStatement(const std::string AddToCache)
@@ -893,6 +1062,11 @@ private:
 
         PushLocalScope();
 
+        auto OuterNamespaceScopes = NamespaceScopes;
+        const size_t OuterNamespaceScopeDepth = NamespaceScopeDepth;
+        NamespaceScopes = std::make_shared<std::vector<std::unordered_map<std::string, Symbol>>>();
+        NamespaceScopeDepth = LocalScopes.size();
+
         std::unordered_map<std::string, MapId> Definition;
         std::vector<StatementPtr> Statements;
         while (!Match(TokenType::RBrace))
@@ -918,6 +1092,10 @@ private:
             }
         }
 
+        *NamespaceScopes = LocalScopes;
+        NamespaceScopes = OuterNamespaceScopes;
+        NamespaceScopeDepth = OuterNamespaceScopeDepth;
+
         PopLocalScope();
 
         return std::make_shared<VarDeclaration>(std::make_shared<NamespaceDefinition>(Definition, Statements), Name, NamespaceAddress, TypeDescriptor(ValueType::Namespace, {}, nullptr, false, true));
@@ -1545,7 +1723,7 @@ private:
             return std::make_shared<UnownedReferenceExpression>(Expr);
         }
 
-        if (Check(TokenType::BoolType) || Check(TokenType::IntType) || Check(TokenType::FloatType))
+        if (Check(TokenType::BoolType) || Check(TokenType::IntType) || Check(TokenType::FloatType) || Check(TokenType::DoubleType))
         {
             TypeDescriptor Type = ParseType();
             Expect(TokenType::LParen);
@@ -1672,11 +1850,14 @@ private:
 
         if (Check(TokenType::Identifier))
         {
+            const bool AtCursor = Peek().IsCursor;
             Symbol Decl = LookupVariable(Peek().Text, PeekNext().Type != TokenType::LParen);
             Advance();
             if (Decl.VarType == Member)
                 return std::make_shared<MemberExpression>(std::make_shared<VariableExpression>("self", 2), Previous().Text);
-            return std::make_shared<VariableExpression>(Previous().Text, Decl.Address);
+            auto VarExpr = std::make_shared<VariableExpression>(Previous().Text, Decl.Address);
+            VarExpr->AtCursor = AtCursor;
+            return VarExpr;
         }
         if (Check(TokenType::This))
         {
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "Common.hpp"
+#include "CompileFlags.hpp"
+#include "IR.hpp"
+#include "ScalarPasses.hpp"
+#include "LoopPasses.hpp"
+#include "MemoryPasses.hpp"
+#include "Inliner.hpp"
+
+struct OptimizationPass
+{
+    std::string Name;                      // what -fno-<name> and -print-after=<name> refer to
+    int Level = 1;                         // the lowest -O that runs it
+    std::function<bool(IRFunction &)> Run; // true if it changed anything
+};
+
+/*
+ * runs the passes the optimization level selects over each lowered
+ * function, in the order they are listed in Passes()
+ */
+class PassManager
+{
+public:
+    PassManager(const CompileFlags &flags) : CmplFlags(flags) {}
+
+    // every pass in pipeline order
+    static const std::vector<OptimizationPass> &Passes()
+    {
+        static const std::vector<OptimizationPass> All = {
+            {"constfold", 1, FoldConstants},
+            {"cse", 2, EliminateCommonSubexpressions},
+            {"bce", 1, EliminateBoundsChecks},
+            {"ownership", 1, ElideReferenceCounts},
+            {"stackalloc", 1, AllocateOnStack},
+            {"licm", 1, HoistLoopInvariants},
+            {"strength", 1, ReduceStrength},
+            {"vectorize", 2, VectorizeLoops},
+            {"unroll", 2, UnrollLoops},
+            {"simplifycfg", 1, SimplifyCFG},
+            {"dce", 1, EliminateDeadCode},
+        };
+        return All;
+    }
+
+    // done on the generated code instead of the IR, and the lowest -O that does them
+    static const std::vector<std::pair<std::string, int>> &MachinePasses()
+    {
+        static const std::vector<std::pair<std::string, int>> All = {
+            {"tailcall", 1},
+            {"peephole", 1},
+            {"scalarrepl", 1}, // members of an object in the frame kept in registers
+        };
+        return All;
+    }
+
+    // passes over every lowered function at once, run before the ones above
+    static const std::vector<std::pair<std::string, int>> &ModulePasses()
+    {
+        static const std::vector<std::pair<std::string, int>> All = {
+            {"inline", 1},
+        };
+        return All;
+    }
+
+    static bool IsPass(const std::string &Name)
+    {
+        auto Named = [&](const auto &Pass)
+        { return Pass.first == Name; };
+        return std::any_of(Passes().begin(), Passes().end(), [&](const OptimizationPass &Pass)
+                           { return Pass.Name == Name; }) ||
+               std::any_of(MachinePasses().begin(), MachinePasses().end(), Named) ||
+               std::any_of(ModulePasses().begin(), ModulePasses().end(), Named);
+    }
+
+    bool Enabled(const std::string &Pass) const
+    {
+        // stackalloc also places objects for the code generated without the IR
+        for (const OptimizationPass &IRPass : Passes())
+        {
+            if (IRPass.Name == Pass)
+                return IRPass.Level <= CmplFlags.OptimizationLevel && !CmplFlags.DisabledPasses.count(Pass);
+        }
+        for (const auto *List : {&MachinePasses(), &ModulePasses()})
+        {
+            for (const auto &[Name, Level] : *List)
+            {
+                if (Name == Pass)
+                    return Level <= CmplFlags.OptimizationLevel && !CmplFlags.DisabledPasses.count(Name);
+            }
+        }
+        return false;
+    }
+
+    // the passes this compilation runs
+    std::vector<const OptimizationPass *> Pipeline() const
+    {
+        std::vector<const OptimizationPass *> Result;
+        for (const OptimizationPass &Pass : Passes())
+        {
+            if (Pass.Level <= CmplFlags.OptimizationLevel && !CmplFlags.DisabledPasses.count(Pass.Name))
+                Result.push_back(&Pass);
+        }
+        return Result;
+    }
+
+    // listings asked for with -print-after are appended to Dump
+    void Run(IRFunction &Function, std::string &Dump) const
+    {
+        Function.ComputeCFG();
+        Function.ComputeDominance();
+
+        // -O2 repeats the pipeline while it keeps finding something
+        const int Rounds = CmplFlags.OptimizationLevel >= 2 ? 4 : 1;
+        for (int Round = 0; Round < Rounds; Round++)
+        {
+            bool Changed = false;
+            for (const OptimizationPass *Pass : Pipeline())
+            {
+                Changed |= Pass->Run(Function);
+
+                if (CmplFlags.PrintAfter.count(Pass->Name))
+                    Dump += "; after " + Pass->Name + "\n" + Function.ToString() + "\n";
+            }
+
+            if (!Changed)
+                break;
+        }
+    }
+
+    void RunModule(const std::vector<IRFunction *> &Functions, std::string &Dump) const
+    {
+        if (!Enabled("inline") || !Inliner(CmplFlags).Run(Functions))
+            return;
+
+        if (CmplFlags.PrintAfter.count("inline"))
+        {
+            for (IRFunction *Function : Functions)
+                Dump += "; after inline\n" + Function->ToString() + "\n";
+        }
+    }
+
+private:
+    const CompileFlags &CmplFlags;
+};
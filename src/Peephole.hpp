@@ -0,0 +1,422 @@
+#pragma once
+
+#include "Common.hpp"
+#include "AsmBuffer.hpp"
+
+/*
+ * rewrites short windows of consecutive instructions into fewer ones,
+ * a rule that drops a register write first proves nothing reads it
+ * on any path before it is written again
+ */
+class PeepholeOptimizer
+{
+public:
+    // the number of rewrites
+    size_t Run(AsmBuffer &Buffer)
+    {
+        Lines = &Buffer.Lines;
+        size_t Rewrites = 0;
+
+        bool Changed = true;
+        while (Changed)
+        {
+            Changed = false;
+            IndexLabels();
+
+            for (size_t i = 0; i < Lines->size(); i++)
+            {
+                if (!Lines->at(i).IsInstruction() && Lines->at(i).Label.empty())
+                    continue;
+                if (Rewrite(i))
+                {
+                    Rewrites++;
+                    Changed = true;
+                    IndexLabels();
+                    i = i > 8 ? i - 9 : SIZE_MAX; // a rewrite can complete a window that starts a little earlier
+                }
+            }
+        }
+
+        return Rewrites;
+    }
+
+private:
+    std::vector<AsmLine> *Lines = nullptr;
+    std::unordered_map<std::string, size_t> Labels;
+
+    inline static const std::vector<std::vector<std::string>> Families = {
+        {"rax", "eax", "ax", "al", "ah"},
+        {"rbx", "ebx", "bx", "bl", "bh"},
+        {"rcx", "ecx", "cx", "cl", "ch"},
+        {"rdx", "edx", "dx", "dl", "dh"},
+        {"rsi", "esi", "si", "sil"},
+        {"rdi", "edi", "di", "dil"},
+        {"rbp", "ebp", "bp", "bpl"},
+        {"rsp", "esp", "sp", "spl"},
+        {"r8", "r8d", "r8w", "r8b"},
+        {"r9", "r9d", "r9w", "r9b"},
+        {"r10", "r10d", "r10w", "r10b"},
+        {"r11", "r11d", "r11w", "r11b"},
+        {"r12", "r12d", "r12w", "r12b"},
+        {"r13", "r13d", "r13w", "r13b"},
+        {"r14", "r14d", "r14w", "r14b"},
+        {"r15", "r15d", "r15w", "r15b"},
+    };
+
+    static const std::vector<std::string> *FamilyOf(const std::string &Register)
+    {
+        for (const std::vector<std::string> &Family : Families)
+        {
+            if (std::find(Family.begin(), Family.end(), Register) != Family.end())
+                return &Family;
+        }
+        return nullptr;
+    }
+
+    static bool IsRegister(const std::string &Operand)
+    {
+        return FamilyOf(Operand) != nullptr;
+    }
+
+    static bool IsFullRegister(const std::string &Operand)
+    {
+        const std::vector<std::string> *Family = FamilyOf(Operand);
+        return Family && (Family->at(0) == Operand || Family->at(1) == Operand); // 32 bit writes zero the rest
+    }
+
+    static bool IsMemory(const std::string &Operand)
+    {
+        return Operand.find('[') != std::string::npos;
+    }
+
+    static bool IsImmediate(const std::string &Operand)
+    {
+        return !Operand.empty() && (std::isdigit((unsigned char)Operand.front()) || Operand.front() == '-');
+    }
+
+    static bool FitsImm32(const std::string &Immediate)
+    {
+        const long long Value = std::stoll(Immediate);
+        return Value >= INT32_MIN && Value <= INT32_MAX;
+    }
+
+    // true if the operand reads or addresses through any part of Register
+    static bool Mentions(const std::string &Operand, const std::string &Register)
+    {
+        const std::vector<std::string> *Family = FamilyOf(Register);
+        std::string Word;
+        for (size_t i = 0; i <= Operand.size(); i++)
+        {
+            if (i < Operand.size() && std::isalnum((unsigned char)Operand.at(i)))
+            {
+                Word += Operand.at(i);
+                continue;
+            }
+            if (!Word.empty() && Family && std::find(Family->begin(), Family->end(), Word) != Family->end())
+                return true;
+            Word.clear();
+        }
+        return false;
+    }
+
+    static bool SameRegister(const std::string &a, const std::string &b)
+    {
+        return IsRegister(a) && FamilyOf(a) == FamilyOf(b);
+    }
+
+    static bool IsConditionalJump(const std::string &Mnemonic)
+    {
+        return Mnemonic.size() > 1 && Mnemonic.front() == 'j' && Mnemonic != "jmp";
+    }
+
+    void IndexLabels()
+    {
+        Labels.clear();
+        for (size_t i = 0; i < Lines->size(); i++)
+        {
+            if (!Lines->at(i).Label.empty())
+                Labels[Lines->at(i).Label] = i;
+        }
+    }
+
+    // the next instruction in the same straight line of code, npos past a label or barrier
+    size_t Next(size_t i) const
+    {
+        for (i++; i < Lines->size(); i++)
+        {
+            const AsmLine &Line = Lines->at(i);
+            if (Line.IsInstruction())
+                return i;
+            if (!Line.Label.empty() || Line.Barrier)
+                return std::string::npos;
+        }
+        return std::string::npos;
+    }
+
+    // true if no path from line i reads Register before writing all of it
+    bool IsDead(const std::string &Register, size_t i, int Budget = 64) const
+    {
+        std::unordered_set<size_t> Seen;
+        return IsDeadFrom(Register, i, Budget, Seen);
+    }
+
+    bool IsDeadFrom(const std::string &Register, size_t i, int &Budget, std::unordered_set<size_t> &Seen) const
+    {
+        for (; i < Lines->size(); i++)
+        {
+            if (--Budget < 0 || !Seen.insert(i).second)
+                return Budget >= 0; // a loop back to code already checked
+            const AsmLine &Line = Lines->at(i);
+            if (Line.Barrier)
+                return false;
+            if (!Line.IsInstruction())
+                continue;
+
+            const std::string &Op = Line.Mnemonic;
+            const std::vector<std::string> &Operands = Line.Operands;
+
+            if (Op == "jmp")
+                return Labels.count(Operands.at(0)) && IsDeadFrom(Register, Labels.at(Operands.at(0)), Budget, Seen);
+            if (IsConditionalJump(Op))
+            {
+                if (!Labels.count(Operands.at(0)) || !IsDeadFrom(Register, Labels.at(Operands.at(0)), Budget, Seen))
+                    return false;
+                continue;
+            }
+            if (Op == "ret")
+                return !SameRegister("rax", Register);
+            if (Op == "syscall")
+            {
+                if (SameRegister("rcx", Register) || SameRegister("r11", Register))
+                    return true;
+                return false; // arguments and the number
+            }
+            if (Op == "call")
+            {
+                if (SameRegister("r10", Register) || SameRegister("r11", Register))
+                    return true;
+                static const std::vector<std::string> Preserved = {"rbx", "rbp", "r12", "r13", "r14", "r15"};
+                if (std::none_of(Preserved.begin(), Preserved.end(), [&](const std::string &Saved)
+                                 { return SameRegister(Saved, Register); }))
+                    return false;
+                continue;
+            }
+
+            const bool PureWrite = Op == "mov" || Op == "movzx" || Op == "movsx" || Op == "movsxd" || Op == "lea" || Op == "pop";
+            bool Read = false;
+            for (size_t k = 0; k < Operands.size(); k++)
+            {
+                if (k == 0 && PureWrite && IsRegister(Operands.at(0)))
+                    continue;
+                Read |= Mentions(Operands.at(k), Register);
+            }
+            if (Op == "div" || Op == "idiv" || Op == "mul" || Op == "cqo" || (Op == "imul" && Operands.size() == 1))
+                Read |= SameRegister("rax", Register) || SameRegister("rdx", Register);
+            if (Op == "push" || Op == "pop")
+                Read |= SameRegister("rsp", Register);
+
+            if (Read)
+                return false;
+
+            const bool Kills = (PureWrite && !Operands.empty() && IsFullRegister(Operands.at(0)) && SameRegister(Operands.at(0), Register)) || (Op == "xor" && Operands.size() == 2 && Operands.at(0) == Operands.at(1) && SameRegister(Operands.at(0), Register));
+            if (Kills)
+                return true;
+
+            static const std::vector<std::string> Known = {"mov", "movzx", "movsx", "movsxd", "lea", "pop", "push", "add", "sub", "imul", "and", "or", "xor", "cmp", "test", "inc", "dec", "neg", "not", "shl", "shr", "sar", "div", "idiv", "mul", "cqo"};
+            if (std::find(Known.begin(), Known.end(), Op) == Known.end() && Op.rfind("cmov", 0) != 0 && Op.rfind("set", 0) != 0)
+                return false; // does not know what it touches
+        }
+        return false;
+    }
+
+    void Replace(size_t i, const std::string &Mnemonic, const std::vector<std::string> &Operands)
+    {
+        AsmLine &Line = Lines->at(i);
+        Line.Mnemonic = Mnemonic;
+        Line.Operands = Operands;
+        Line.Modified = true;
+    }
+
+    void Erase(size_t i)
+    {
+        Lines->erase(Lines->begin() + i);
+    }
+
+    static std::string InvertCondition(const std::string &Condition)
+    {
+        static const std::vector<std::pair<std::string, std::string>> Pairs = {
+            {"g", "le"}, {"l", "ge"}, {"a", "be"}, {"b", "ae"}, {"e", "ne"}, {"z", "nz"}};
+        for (const auto &[a, b] : Pairs)
+        {
+            if (Condition == a)
+                return b;
+            if (Condition == b)
+                return a;
+        }
+        return "";
+    }
+
+    bool Rewrite(size_t i)
+    {
+        const AsmLine &A = Lines->at(i);
+
+        // jmp to the label right after it
+        if (A.Mnemonic == "jmp")
+        {
+            for (size_t k = i + 1; k < Lines->size(); k++)
+            {
+                const AsmLine &Line = Lines->at(k);
+                if (Line.Label == A.Operands.at(0))
+                {
+                    Erase(i);
+                    return true;
+                }
+                if (Line.IsInstruction() || Line.Barrier)
+                    break;
+            }
+            return false;
+        }
+
+        if (!A.IsInstruction())
+            return false;
+
+        const std::vector<std::string> &Ao = A.Operands;
+
+        // mov x, x
+        if (A.Mnemonic == "mov" && Ao.size() == 2 && Ao.at(0) == Ao.at(1))
+        {
+            Erase(i);
+            return true;
+        }
+
+        const size_t j = Next(i);
+        if (j == std::string::npos)
+            return false;
+        const AsmLine &B = Lines->at(j);
+        const std::vector<std::string> &Bo = B.Operands;
+
+        // mov a, b then mov b, a
+        if (A.Mnemonic == "mov" && B.Mnemonic == "mov" && Ao.size() == 2 && Bo.size() == 2 && Ao.at(0) == Bo.at(1) && Ao.at(1) == Bo.at(0) && !Mentions(Ao.at(1), Ao.at(0)))
+        {
+            Erase(j);
+            return true;
+        }
+
+        // push x then pop y
+        if (A.Mnemonic == "push" && B.Mnemonic == "pop" && IsRegister(Bo.at(0)) && (IsRegister(Ao.at(0)) || IsImmediate(Ao.at(0)) || IsMemory(Ao.at(0))))
+        {
+            if (Ao.at(0) == Bo.at(0))
+            {
+                Erase(j);
+                Erase(i);
+                return true;
+            }
+            Replace(i, "mov", {Bo.at(0), IsMemory(Ao.at(0)) && Ao.at(0).rfind("QWORD", 0) != 0 ? "QWORD " + Ao.at(0) : Ao.at(0)});
+            Erase(j);
+            return true;
+        }
+
+        // mov r, x then mov r, y where y does not read r
+        if (A.Mnemonic == "mov" && B.Mnemonic == "mov" && Ao.size() == 2 && Bo.size() == 2 && IsFullRegister(Ao.at(0)) && Ao.at(0) == Bo.at(0) && !Mentions(Bo.at(1), Ao.at(0)))
+        {
+            Erase(i);
+            return true;
+        }
+
+        // mov r, x then mov y, r with r dead afterwards
+        if (A.Mnemonic == "mov" && B.Mnemonic == "mov" && Ao.size() == 2 && Bo.size() == 2 && IsFullRegister(Ao.at(0)) && Bo.at(1) == Ao.at(0) && !Mentions(Bo.at(0), Ao.at(0)) && !(IsMemory(Bo.at(0)) && IsMemory(Ao.at(1))) && !(IsMemory(Bo.at(0)) && IsImmediate(Ao.at(1)) && (Bo.at(0).rfind("QWORD", 0) != 0 || !FitsImm32(Ao.at(1)))) && IsDead(Ao.at(0), j + 1))
+        {
+            Replace(j, "mov", {Bo.at(0), Ao.at(1)});
+            Erase(i);
+            return true;
+        }
+
+        // mov rcx, 0 / sub rcx, rax / mov rax, rcx
+        if (A.Mnemonic == "mov" && Ao.size() == 2 && Ao.at(1) == "0" && IsFullRegister(Ao.at(0)) && B.Mnemonic == "sub" && Bo.at(0) == Ao.at(0) && IsFullRegister(Bo.at(1)))
+        {
+            const size_t k = Next(j);
+            if (k != std::string::npos)
+            {
+                const AsmLine &C = Lines->at(k);
+                if (C.Mnemonic == "mov" && C.Operands.size() == 2 && C.Operands.at(0) == Bo.at(1) && C.Operands.at(1) == Ao.at(0))
+                {
+                    const std::string Negated = Bo.at(1);
+                    const std::string Temporary = Ao.at(0);
+                    if (IsDead(Temporary, k + 1))
+                    {
+                        Erase(k);
+                        Erase(j);
+                        Replace(i, "neg", {Negated});
+                    }
+                    else
+                    {
+                        Replace(k, "mov", {Temporary, Negated});
+                        Erase(j);
+                        Replace(i, "neg", {Negated});
+                    }
+                    return true;
+                }
+            }
+        }
+
+        // mov rax, 0 / mov rcx, 1 / cmovcc rax, rcx / test rax, rax / jz label
+        if (A.Mnemonic == "mov" && Ao.size() == 2 && Ao.at(1) == "0" && B.Mnemonic == "mov" && Bo.size() == 2 && Bo.at(1) == "1")
+        {
+            const size_t k = Next(j);
+            const size_t l = k == std::string::npos ? k : Next(k);
+            const size_t m = l == std::string::npos ? l : Next(l);
+            if (m != std::string::npos)
+            {
+                const AsmLine &C = Lines->at(k);
+                const AsmLine &D = Lines->at(l);
+                const AsmLine &E = Lines->at(m);
+                const std::string Condition = C.Mnemonic.rfind("cmov", 0) == 0 ? C.Mnemonic.substr(4) : "";
+                const std::string Result = Ao.at(0);
+
+                if (!Condition.empty() && !InvertCondition(Condition).empty() && C.Operands == std::vector<std::string>{Result, Bo.at(0)} && D.Mnemonic == "test" && D.Operands == std::vector<std::string>{Result, Result} && (E.Mnemonic == "jz" || E.Mnemonic == "jnz") && Labels.count(E.Operands.at(0)))
+                {
+                    const std::string Target = E.Operands.at(0);
+                    if (IsDead(Result, m + 1) && IsDead(Bo.at(0), m + 1) && IsDead(Result, Labels.at(Target)) && IsDead(Bo.at(0), Labels.at(Target)))
+                    {
+                        const std::string Jump = "j" + (E.Mnemonic == "jz" ? InvertCondition(Condition) : Condition);
+                        Replace(m, Jump, {Target});
+                        Erase(l);
+                        Erase(k);
+                        Erase(j);
+                        Erase(i);
+                        return true;
+                    }
+                }
+            }
+        }
+
+        // imul r, scale then [base + r] becomes [base + r * scale]
+        if (A.Mnemonic == "imul" && Ao.size() == 2 && IsFullRegister(Ao.at(0)) && (Ao.at(1) == "1" || Ao.at(1) == "2" || Ao.at(1) == "4" || Ao.at(1) == "8"))
+        {
+            const std::string Index = Ao.at(0);
+            for (size_t o = 0; o < Bo.size(); o++)
+            {
+                const std::string &Operand = Bo.at(o);
+                const size_t Plus = Operand.find(" + " + Index + "]");
+                if (!IsMemory(Operand) || Plus == std::string::npos || Mentions(Operand.substr(0, Plus), Index))
+                    continue;
+
+                // nothing else in B may read the scaled value
+                bool OtherUse = false;
+                for (size_t p = 0; p < Bo.size(); p++)
+                    OtherUse |= p != o && Mentions(Bo.at(p), Index) && !(p == 0 && B.Mnemonic == "mov" && Bo.at(0) == Index);
+                const bool Overwritten = B.Mnemonic == "mov" && Bo.at(0) == Index;
+                if (OtherUse || (!Overwritten && !IsDead(Index, j + 1)))
+                    continue;
+
+                std::vector<std::string> Operands = Bo;
+                Operands.at(o) = Operand.substr(0, Plus) + " + " + Index + " * " + Ao.at(1) + "]";
+                Replace(j, B.Mnemonic, Operands);
+                Erase(i);
+                return true;
+            }
+        }
+
+        return false;
+    }
+};
@@ -0,0 +1,543 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Ast.hpp"
+#include "CompileFlags.hpp"
+
+// where one function keeps its locals and the operands
+// it holds on to while the other operand is evaluated
+struct RegisterAllocation
+{
+    std::unordered_map<MapId, std::string> Locals;                   // by VarDeclaration::Address, missing = on the stack
+    std::unordered_map<const Expression *, std::string> Temporaries; // empty = spilled with push/pop
+    std::vector<std::string> CalleeSaved;                            // saved by the prologue, restored before ret
+    std::unordered_set<MapId> Objects;                               // locals naming a `new` object that stays in the frame
+    std::map<std::pair<MapId, std::string>, std::string> Members;    // the used members of those, empty = in the frame
+};
+
+/*
+ * linear scan register allocation over the live intervals of one function,
+ * positions are handed out in the same order the code generator evaluates
+ * the body so an interval covers exactly the code that needs the value,
+ * intervals that no call or inline assembly falls inside can also take the
+ * caller saved registers, which cost no save in the prologue
+ *
+ * a local that takes a `new` object and is only ever the object of a
+ * member access never hands the object to anything, so the object goes
+ * in the frame instead of the heap and each member it uses gets its own
+ * interval, a scalar that can take a register like any local
+ */
+class RegisterAllocator
+{
+public:
+    // nothing else in the generated code, the stdlib or a syscall
+    // touches these, so values in them survive calls and inline assembly
+    inline static const std::vector<std::string> Pool = {"r12", "r13", "r14", "r15"};
+
+    // the generated code only touches these on its way to exit, calls and the stdlib's assembly clobber them
+    inline static const std::vector<std::string> CallerSaved = {"r10", "r11"};
+
+    // FitsInFrame picks the objects small enough for the frame, nullptr keeps them all on
+    // the heap, without ScalarMembers the members of one in the frame stay in its memory
+    RegisterAllocator(const CompileFlags &flags, std::function<bool(const UseExpression &)> fitsInFrame = nullptr, bool scalarMembers = false)
+        : CmplFlags(flags), FitsInFrame(std::move(fitsInFrame)), ScalarMembers(scalarMembers) {}
+
+    RegisterAllocation Allocate(const FunctionDefinition &Func)
+    {
+        for (const VarDeclaration &Param : Func.Arguments)
+            Parameters.insert(Param.Address);
+
+        if (FitsInFrame)
+        {
+            for (const StatementPtr &Stmt : Func.Body)
+                ScanStatement(Stmt);
+            for (MapId Address : Escaped)
+                Objects.erase(Address);
+        }
+
+        Scopes.emplace_back();
+        for (const StatementPtr &Stmt : Func.Body)
+            VisitStatement(Stmt);
+        CloseScope();
+
+        for (Interval &Range : Intervals)
+        {
+            if (!Range.Local)
+                continue;
+
+            // a value from before a loop has to survive every iteration
+            for (const auto &[LoopStart, LoopEnd] : Loops)
+            {
+                if (Range.Start >= LoopStart)
+                    continue;
+                for (size_t Use : Range.Uses)
+                {
+                    if (Use >= LoopStart && Use <= LoopEnd)
+                    {
+                        Range.End = std::max(Range.End, LoopEnd);
+                        break;
+                    }
+                }
+            }
+        }
+
+        return LinearScan();
+    }
+
+    // true if evaluating the expression cannot clobber a scratch register
+    static bool IsLeaf(const ExpressionPtr &Expr)
+    {
+        return std::dynamic_pointer_cast<ValueExpression>(Expr) || std::dynamic_pointer_cast<VariableExpression>(Expr) || std::dynamic_pointer_cast<SizeOfTypeExpression>(Expr);
+    }
+
+private:
+    struct Interval
+    {
+        size_t Start = 0;
+        size_t End = 0;
+        MapId Local = 0;                  // 0 for temporaries
+        std::string Member;               // of the object Local names, empty for the local itself
+        const Expression *Temp = nullptr; // the expression holding the value
+        std::vector<size_t> Uses;
+        std::string Register;
+    };
+
+    const CompileFlags &CmplFlags;
+    std::function<bool(const UseExpression &)> FitsInFrame;
+    bool ScalarMembers = false;
+
+    size_t Position = 0;
+    std::vector<Interval> Intervals;
+    std::unordered_map<MapId, size_t> LocalIntervals; // address to index in Intervals
+    std::unordered_map<MapId, MapId> Aliases;         // `use` names to the local they name
+    std::unordered_set<MapId> Parameters;
+    std::vector<size_t> Clobbers; // positions of calls and inline assembly, increasing
+    std::vector<std::vector<size_t>> Scopes;
+    std::vector<std::pair<size_t, size_t>> Loops;
+
+    std::unordered_set<MapId> Objects;
+    std::unordered_set<MapId> Escaped;                           // locals read as a value somewhere
+    std::unordered_map<MapId, std::pair<size_t, size_t>> Placed; // object to where it was made and the scope it belongs to
+    std::map<std::pair<MapId, std::string>, size_t> MemberIntervals;
+
+    void Define(MapId Address)
+    {
+        LocalIntervals[Address] = Intervals.size();
+        Intervals.push_back(Interval{.Start = ++Position, .End = Position, .Local = Address});
+        Scopes.back().push_back(Intervals.size() - 1);
+    }
+
+    void Use(MapId Address)
+    {
+        if (Aliases.count(Address))
+            Address = Aliases.at(Address);
+        if (Parameters.count(Address))
+            return;
+        if (!LocalIntervals.count(Address))
+        {
+            Clobber(); // a global or a function called without parentheses
+            return;
+        }
+
+        Interval &Range = Intervals.at(LocalIntervals.at(Address));
+        Range.End = ++Position;
+        Range.Uses.push_back(Position);
+    }
+
+    // a member of an object in the frame, its interval starts where the object is made
+    void UseMember(MapId Object, const std::string &Member)
+    {
+        const std::pair<MapId, std::string> Key = {Object, Member};
+        if (!MemberIntervals.count(Key))
+        {
+            const auto &[Start, Scope] = Placed.at(Object);
+            MemberIntervals[Key] = Intervals.size();
+            Intervals.push_back(Interval{.Start = Start, .End = Start, .Local = Object, .Member = Member});
+            Scopes.at(Scope).push_back(Intervals.size() - 1);
+        }
+
+        Interval &Range = Intervals.at(MemberIntervals.at(Key));
+        Range.End = ++Position;
+        Range.Uses.push_back(Position);
+    }
+
+    // the object local a member access goes through, 0 if it is not one in the frame
+    MapId FrameObject(const MemberExpression &Access) const
+    {
+        auto VarExpr = std::dynamic_pointer_cast<VariableExpression>(Access.Object);
+        return VarExpr && Objects.count(VarExpr->Address) ? VarExpr->Address : 0;
+    }
+
+    void ScanStatement(const StatementPtr &Stmt)
+    {
+        if (auto ExprStmt = std::dynamic_pointer_cast<ExpressionStatement>(Stmt))
+        {
+            ScanExpression(ExprStmt->Expr);
+        }
+        else if (auto Multi = std::dynamic_pointer_cast<MultiStatement>(Stmt))
+        {
+            for (const StatementPtr &Stmt : Multi->Statements)
+                ScanStatement(Stmt);
+        }
+        else if (auto Decl = std::dynamic_pointer_cast<VarDeclaration>(Stmt))
+        {
+            auto New = std::dynamic_pointer_cast<UseExpression>(Decl->Initializer);
+            if (New && New->Type.Type == ValueType::Custom && !New->Type.PointerDepth && New->InlineDefinition.empty() && FitsInFrame(*New))
+                Objects.insert(Decl->Address);
+            ScanExpression(Decl->Initializer);
+        }
+        else if (auto Using = std::dynamic_pointer_cast<UseStatement>(Stmt))
+        {
+            ScanExpression(Using->Expr);
+        }
+        else if (auto If = std::dynamic_pointer_cast<IfStatement>(Stmt))
+        {
+            for (size_t i = 0; i < If->Then.size(); i++)
+            {
+                ScanExpression(If->Conditions.at(i));
+                for (const StatementPtr &Stmt : If->Then.at(i))
+                    ScanStatement(Stmt);
+            }
+        }
+        else if (auto While = std::dynamic_pointer_cast<WhileStatement>(Stmt))
+        {
+            ScanExpression(While->Condition);
+            for (const StatementPtr &Stmt : While->Body)
+                ScanStatement(Stmt);
+        }
+        else if (auto Return = std::dynamic_pointer_cast<ReturnStatement>(Stmt))
+        {
+            ScanExpression(Return->Expr);
+        }
+    }
+
+    // every local read as a value instead of through a member goes in Escaped
+    void ScanExpression(const ExpressionPtr &Expr)
+    {
+        if (auto VarExpr = std::dynamic_pointer_cast<VariableExpression>(Expr))
+        {
+            Escaped.insert(VarExpr->Address);
+        }
+        else if (auto Access = std::dynamic_pointer_cast<MemberExpression>(Expr))
+        {
+            if (!std::dynamic_pointer_cast<VariableExpression>(Access->Object))
+                ScanExpression(Access->Object);
+        }
+        else if (auto Index = std::dynamic_pointer_cast<IndexExpression>(Expr))
+        {
+            ScanExpression(Index->Object);
+            ScanExpression(Index->Index);
+        }
+        else if (auto Assign = std::dynamic_pointer_cast<AssignmentExpression>(Expr))
+        {
+            ScanExpression(Assign->Name);
+            ScanExpression(Assign->Value);
+        }
+        else if (auto Call = std::dynamic_pointer_cast<CallExpression>(Expr))
+        {
+            ScanExpression(Call->Callee);
+            for (const ExpressionPtr &Arg : Call->Arguments)
+                ScanExpression(Arg);
+        }
+        else if (auto NewExpr = std::dynamic_pointer_cast<UseExpression>(Expr))
+        {
+            for (const ExpressionPtr &Arg : NewExpr->Arguments)
+                ScanExpression(Arg);
+        }
+        else if (auto SizeOf = std::dynamic_pointer_cast<SizeOfExpression>(Expr))
+        {
+            ScanExpression(SizeOf->Expr);
+        }
+        else if (auto Cast = std::dynamic_pointer_cast<ClassCastExpression>(Expr))
+        {
+            ScanExpression(Cast->Expr);
+        }
+        else if (auto Eq = std::dynamic_pointer_cast<ClassEqExpression>(Expr))
+        {
+            ScanExpression(Eq->Expr);
+        }
+        else if (auto Bin = std::dynamic_pointer_cast<BinaryExpression>(Expr))
+        {
+            ScanExpression(Bin->A);
+            ScanExpression(Bin->B);
+        }
+        else if (auto Un = std::dynamic_pointer_cast<UnaryExpression>(Expr))
+        {
+            ScanExpression(Un->Expr);
+        }
+        else if (auto UnownedReference = std::dynamic_pointer_cast<UnownedReferenceExpression>(Expr))
+        {
+            ScanExpression(UnownedReference->Expr);
+        }
+    }
+
+    void Clobber()
+    {
+        Clobbers.push_back(++Position);
+    }
+
+    bool CrossesClobber(const Interval &Range) const
+    {
+        auto It = std::upper_bound(Clobbers.begin(), Clobbers.end(), Range.Start);
+        return It != Clobbers.end() && *It < Range.End;
+    }
+
+    void CloseScope()
+    {
+        ++Position;
+        for (size_t i : Scopes.back())
+        {
+            // refcounted locals are read again when the scope destroys them
+            if (CmplFlags.GarbageCollect)
+                Intervals.at(i).End = Position;
+        }
+        Scopes.pop_back();
+    }
+
+    // the value of Held stays live while Operand is evaluated
+    void VisitHeldOperand(const Expression *Held, const ExpressionPtr &Operand)
+    {
+        const size_t Start = ++Position;
+        VisitExpression(Operand);
+        if (!IsLeaf(Operand))
+            Intervals.push_back(Interval{.Start = Start, .End = ++Position, .Temp = Held});
+    }
+
+    void VisitStatement(const StatementPtr &Stmt)
+    {
+        if (auto ExprStmt = std::dynamic_pointer_cast<ExpressionStatement>(Stmt))
+        {
+            VisitExpression(ExprStmt->Expr);
+        }
+        else if (auto Multi = std::dynamic_pointer_cast<MultiStatement>(Stmt))
+        {
+            for (const StatementPtr &Stmt : Multi->Statements)
+                VisitStatement(Stmt);
+        }
+        else if (auto Decl = std::dynamic_pointer_cast<VarDeclaration>(Stmt))
+        {
+            // nested functions get their own allocation
+            if (std::dynamic_pointer_cast<FunctionDefinition>(Decl->Initializer) || std::dynamic_pointer_cast<NamespaceDefinition>(Decl->Initializer) || std::dynamic_pointer_cast<ClassBlueprint>(Decl->Initializer))
+                return;
+
+            if (Objects.count(Decl->Address))
+            {
+                Placed[Decl->Address] = {++Position, Scopes.size() - 1};
+                return;
+            }
+
+            VisitExpression(Decl->Initializer);
+            Define(Decl->Address);
+        }
+        else if (auto Using = std::dynamic_pointer_cast<UseStatement>(Stmt))
+        {
+            if (auto VarExpr = std::dynamic_pointer_cast<VariableExpression>(Using->Expr))
+            {
+                Aliases[Using->Address] = Aliases.count(VarExpr->Address) ? Aliases.at(VarExpr->Address) : VarExpr->Address;
+                Use(VarExpr->Address);
+            }
+        }
+        else if (auto If = std::dynamic_pointer_cast<IfStatement>(Stmt))
+        {
+            for (size_t i = 0; i < If->Then.size(); i++)
+            {
+                VisitExpression(If->Conditions.at(i));
+
+                Scopes.emplace_back();
+                for (const StatementPtr &Stmt : If->Then.at(i))
+                    VisitStatement(Stmt);
+                CloseScope();
+            }
+        }
+        else if (auto While = std::dynamic_pointer_cast<WhileStatement>(Stmt))
+        {
+            const size_t LoopStart = ++Position;
+            VisitExpression(While->Condition);
+
+            Scopes.emplace_back();
+            for (const StatementPtr &Stmt : While->Body)
+                VisitStatement(Stmt);
+            CloseScope();
+
+            Loops.push_back({LoopStart, ++Position});
+        }
+        else if (auto Return = std::dynamic_pointer_cast<ReturnStatement>(Stmt))
+        {
+            VisitExpression(Return->Expr);
+        }
+        else if (std::dynamic_pointer_cast<AssemblyInstructions>(Stmt))
+        {
+            Clobber();
+        }
+    }
+
+    void VisitExpression(const ExpressionPtr &Expr)
+    {
+        if (auto VarExpr = std::dynamic_pointer_cast<VariableExpression>(Expr))
+        {
+            Use(VarExpr->Address);
+        }
+        else if (auto Access = std::dynamic_pointer_cast<MemberExpression>(Expr))
+        {
+            if (MapId Object = FrameObject(*Access))
+                return UseMember(Object, Access->Member);
+
+            VisitExpression(Access->Object);
+            if (!std::dynamic_pointer_cast<VariableExpression>(Access->Object))
+                Clobber(); // a namespace can hold functions
+        }
+        else if (auto Index = std::dynamic_pointer_cast<IndexExpression>(Expr))
+        {
+            VisitExpression(Index->Object);
+            VisitHeldOperand(Index.get(), Index->Index);
+        }
+        else if (auto Assign = std::dynamic_pointer_cast<AssignmentExpression>(Expr))
+        {
+            // the object or element address is held while the value is evaluated
+            auto AccessExpr = std::dynamic_pointer_cast<MemberExpression>(Assign->Name);
+            if (MapId Object = AccessExpr ? FrameObject(*AccessExpr) : 0)
+            {
+                VisitExpression(Assign->Value);
+                UseMember(Object, AccessExpr->Member); // the store
+            }
+            else if (AccessExpr)
+            {
+                VisitExpression(AccessExpr->Object);
+                VisitHeldOperand(Assign.get(), Assign->Value);
+            }
+            else if (auto IndexExpr = std::dynamic_pointer_cast<IndexExpression>(Assign->Name))
+            {
+                VisitExpression(IndexExpr->Object);
+                VisitHeldOperand(IndexExpr.get(), IndexExpr->Index);
+                VisitHeldOperand(Assign.get(), Assign->Value);
+            }
+            else
+            {
+                VisitExpression(Assign->Value);
+            }
+            if (auto VarExpr = std::dynamic_pointer_cast<VariableExpression>(Assign->Name))
+                Use(VarExpr->Address); // the store
+        }
+        else if (auto Call = std::dynamic_pointer_cast<CallExpression>(Expr))
+        {
+            for (const ExpressionPtr &Arg : Call->Arguments)
+                VisitExpression(Arg);
+            Clobber();
+        }
+        else if (auto NewExpr = std::dynamic_pointer_cast<UseExpression>(Expr))
+        {
+            for (const ExpressionPtr &Arg : NewExpr->Arguments)
+                VisitExpression(Arg);
+        }
+        else if (auto SizeOf = std::dynamic_pointer_cast<SizeOfExpression>(Expr))
+        {
+            VisitExpression(SizeOf->Expr);
+        }
+        else if (auto Cast = std::dynamic_pointer_cast<ClassCastExpression>(Expr))
+        {
+            VisitExpression(Cast->Expr);
+        }
+        else if (auto Bin = std::dynamic_pointer_cast<BinaryExpression>(Expr))
+        {
+            VisitExpression(Bin->A);
+            VisitHeldOperand(Bin.get(), Bin->B);
+        }
+        else if (auto Un = std::dynamic_pointer_cast<UnaryExpression>(Expr))
+        {
+            VisitExpression(Un->Expr);
+        }
+    }
+
+    RegisterAllocation LinearScan()
+    {
+        RegisterAllocation Result;
+        Result.Objects = Objects;
+
+        std::vector<size_t> Order(Intervals.size());
+        for (size_t i = 0; i < Order.size(); i++)
+            Order[i] = i;
+        std::stable_sort(Order.begin(), Order.end(), [&](size_t a, size_t b)
+                         { return Intervals.at(a).Start < Intervals.at(b).Start; });
+
+        // caller saved first so short intervals leave the callee saved ones free
+        std::vector<std::string> Registers = CallerSaved;
+        Registers.insert(Registers.end(), Pool.begin(), Pool.end());
+
+        std::vector<size_t> Active; // by increasing end
+        std::set<size_t> Free;      // indices into Registers
+        for (size_t i = 0; i < Registers.size(); i++)
+            Free.insert(i);
+
+        auto RegisterIndex = [&](const std::string &Register)
+        {
+            return size_t(std::find(Registers.begin(), Registers.end(), Register) - Registers.begin());
+        };
+
+        auto Fits = [&](const Interval &Range, const std::string &Register)
+        {
+            return RegisterIndex(Register) >= CallerSaved.size() || !CrossesClobber(Range);
+        };
+
+        auto Activate = [&](size_t i)
+        {
+            auto It = std::find_if(Active.begin(), Active.end(), [&](size_t a)
+                                   { return Intervals.at(a).End > Intervals.at(i).End; });
+            Active.insert(It, i);
+        };
+
+        for (size_t i : Order)
+        {
+            Interval &Current = Intervals.at(i);
+            if (!Current.Member.empty() && !ScalarMembers)
+                continue; // the object keeps every member in the frame
+
+            while (!Active.empty() && Intervals.at(Active.front()).End < Current.Start)
+            {
+                Free.insert(RegisterIndex(Intervals.at(Active.front()).Register));
+                Active.erase(Active.begin());
+            }
+
+            auto Register = std::find_if(Free.begin(), Free.end(), [&](size_t Index)
+                                         { return Fits(Current, Registers.at(Index)); });
+            if (Register != Free.end())
+            {
+                Current.Register = Registers.at(*Register);
+                Free.erase(Register);
+                Activate(i);
+                continue;
+            }
+
+            // under pressure the interval that ends last goes to memory
+            auto Last = std::find_if(Active.rbegin(), Active.rend(), [&](size_t a)
+                                     { return Fits(Current, Intervals.at(a).Register); });
+            if (Last != Active.rend() && Intervals.at(*Last).End > Current.End)
+            {
+                Current.Register = Intervals.at(*Last).Register;
+                Intervals.at(*Last).Register.clear();
+                Active.erase(std::next(Last).base());
+                Activate(i);
+            }
+        }
+
+        std::set<std::string> Used;
+        for (const Interval &Range : Intervals)
+        {
+            if (Range.Local && !Range.Member.empty())
+                Result.Members[{Range.Local, Range.Member}] = Range.Register;
+            else if (Range.Local && !Range.Register.empty())
+                Result.Locals[Range.Local] = Range.Register;
+            if (Range.Temp)
+                Result.Temporaries[Range.Temp] = Range.Register;
+            if (!Range.Register.empty())
+                Used.insert(Range.Register);
+        }
+
+        for (const std::string &Register : Pool)
+        {
+            if (Used.count(Register))
+                Result.CalleeSaved.push_back(Register);
+        }
+
+        return Result;
+    }
+};
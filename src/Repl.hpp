@@ -0,0 +1,284 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Compilation.hpp"
+#include "Jit.hpp"
+
+#include <chrono>
+
+namespace furn
+{
+    /*
+     * furn --repl, one parser and one code generator last the whole
+     * session so the scopes and variables of earlier entries are there
+     * for the next one. every entry is compiled into a function of its
+     * own, linked into the session after the entries before it and called
+     * right away, its top level variables become globals and the functions
+     * it defines stay resident for later entries to call
+     *
+     * C functions are not linked into the session, code compiled before a
+     * function is defined again keeps calling the old definition, and an
+     * entry that exits or crashes ends the session so it starts over
+     */
+    class Repl
+    {
+    public:
+        Repl(const CompileFlags &flags, const std::filesystem::path &includeDirectory)
+            : Flags(flags), IncludeDirectory(includeDirectory)
+        {
+            Flags.RunAfterComp = false;
+        }
+
+        Repl(const Repl &) = delete;
+        Repl &operator=(const Repl &) = delete;
+
+        int Loop(std::istream &In)
+        {
+            std::cout << "furn repl, :time toggles timing, :reset clears the session, :quit leaves\n";
+            if (!Begin())
+                return 1;
+
+            std::string Input;
+            std::string Line;
+            while (true)
+            {
+                std::cout << (Input.empty() ? ">>> " : "... ") << std::flush;
+                if (!std::getline(In, Line))
+                    break;
+
+                if (Input.empty())
+                {
+                    const std::string Command = Trim(Line);
+                    if (Command == ":quit" || Command == ":q")
+                        break;
+                    if (Command == ":time")
+                    {
+                        Timing = !Timing;
+                        std::cout << "timing " << (Timing ? "on" : "off") << '\n';
+                        continue;
+                    }
+                    if (Command == ":reset")
+                    {
+                        if (!Begin())
+                            return 1;
+                        continue;
+                    }
+                    if (Command.empty())
+                        continue;
+                }
+
+                Input += Line + "\n";
+                if (Depth(Input) > 0)
+                    continue; // keep reading until the braces close
+
+                const bool Ran = Evaluate(Input);
+                Input.clear();
+
+                if (Ran && Timing)
+                {
+                    const auto Milliseconds = [](auto Duration)
+                    { return std::chrono::duration<double, std::milli>(Duration).count(); };
+                    std::cout << "compiled in " << Milliseconds(CompileTime) << " ms, ran in " << Milliseconds(RunTime) << " ms\n";
+                }
+
+                // the entry took the session down with it
+                if (!Session.Alive() && !Begin())
+                    return 1;
+            }
+
+            std::cout << '\n';
+            return 0;
+        }
+
+        // compiles one entry into the session and runs it, true if it ran and the session survived
+        bool Evaluate(const std::string &Input)
+        {
+            const auto CompileStart = std::chrono::steady_clock::now();
+
+            const ParserState Before = SaveParser();
+            std::vector<StatementPtr> Statements;
+            if (!ParseEntry(Input, Statements))
+            {
+                RestoreParser(Before);
+                return false;
+            }
+
+            const std::string Label = "_repl_" + std::to_string(EntryCount++);
+            const std::string Assembly = Gen->GenerateEntry(Statements, Label);
+            for (CompileError &Error : Gen->Errors)
+                std::cerr << Error.ToString(false, false, false) << '\n';
+
+            X64Assembler Assembler;
+            ObjectCode Object;
+            bool Ok = Gen->Errors.empty();
+            if (Ok && !Assembler.Assemble(Assembly, Object))
+            {
+                std::cerr << "cannot assemble, " << Assembler.Error << '\n';
+                Ok = false;
+            }
+            if (Ok && !Session.Load(Object))
+            {
+                std::cerr << Session.Error << '\n';
+                Ok = false;
+            }
+
+            // the entry never reached the session, nothing it declared did either
+            if (!Ok)
+            {
+                Gen->DiscardEntry();
+                RestoreParser(Before);
+                return false;
+            }
+
+            const auto RunStart = std::chrono::steady_clock::now();
+            const bool Survived = Session.Call(Label);
+            RunTime = std::chrono::steady_clock::now() - RunStart;
+            CompileTime = RunStart - CompileStart;
+
+            if (!Survived)
+            {
+                std::cerr << Session.Error << ", the session starts over\n";
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        // what a failed entry puts back, the tokens are only ever appended to
+        struct ParserState
+        {
+            size_t TokenCount = 0;
+            std::vector<Token> End; // the end of file the entry replaced
+            std::vector<std::unordered_map<std::string, Symbol>> LocalScopes;
+            std::vector<std::string> MacroNames;
+            std::unordered_map<std::string, std::vector<Token>> Macros;
+            std::vector<std::string> ClassNames;
+        };
+
+        CompileFlags Flags; // the generator keeps a reference to them
+        std::filesystem::path IncludeDirectory;
+        std::vector<Token> Tokens; // and the parser to these
+        std::unique_ptr<Parser> Parse;
+        std::unique_ptr<AsmGenerator> Gen;
+        JitSession Session;
+        size_t EntryCount = 0;
+
+        bool Timing = false;
+        std::chrono::steady_clock::duration CompileTime{};
+        std::chrono::steady_clock::duration RunTime{};
+
+        // a new session with the runtime and the console package in it
+        bool Begin()
+        {
+            Tokens.clear();
+            Parse = std::make_unique<Parser>(Tokens);
+            Parse->IncludeDirectory = IncludeDirectory;
+            Parse->REPL = true;
+            Gen = std::make_unique<AsmGenerator>(std::vector<StatementPtr>(), Flags);
+            EntryCount = 0;
+
+            X64Assembler Assembler;
+            ObjectCode Runtime;
+            if (!Assembler.Assemble(AsmGenerator::SessionRuntime(), Runtime))
+            {
+                std::cerr << "cannot assemble the runtime, " << Assembler.Error << '\n';
+                return false;
+            }
+            if (!Session.Start() || !Session.Load(Runtime))
+            {
+                std::cerr << Session.Error << '\n';
+                return false;
+            }
+            return Evaluate("import pkg console\n");
+        }
+
+        // the entry's tokens go where the end of file of the last one was
+        bool ParseEntry(std::string Input, std::vector<StatementPtr> &Statements)
+        {
+            Lexer Lex(Input);
+            Lex.Location.File = "repl";
+            const std::vector<Token> Entry = Lex.Tokenize();
+
+            size_t Start = Tokens.size();
+            if (Start && Tokens.back().Type == TokenType::Eof)
+                Start--;
+            Tokens.erase(Tokens.begin() + Start, Tokens.end());
+            Tokens.insert(Tokens.end(), Entry.begin(), Entry.end());
+
+            Parse->Position = Start;
+            Parse->Errors.clear();
+            for (const auto &[Name, Body] : Parse->Macros)
+                Parse->ExpandMacro(Name, Body);
+            Statements = Parse->ParseProgram();
+
+            bool Ok = true;
+            for (CompileError &Error : Parse->Errors)
+            {
+                if (Error.Severity < SyntaxError)
+                    continue;
+                std::cerr << Error.ToString(false, false, false) << '\n';
+                Ok = false;
+            }
+            return Ok;
+        }
+
+        ParserState SaveParser() const
+        {
+            ParserState State{.TokenCount = Tokens.size(), .LocalScopes = Parse->LocalScopes, .MacroNames = Parse->MacroNames, .Macros = Parse->Macros, .ClassNames = Parse->ClassNames};
+            if (!Tokens.empty() && Tokens.back().Type == TokenType::Eof)
+            {
+                State.TokenCount--;
+                State.End.push_back(Tokens.back());
+            }
+            return State;
+        }
+
+        void RestoreParser(const ParserState &State)
+        {
+            Tokens.erase(Tokens.begin() + State.TokenCount, Tokens.end());
+            Tokens.insert(Tokens.end(), State.End.begin(), State.End.end());
+            Parse->Position = Tokens.size();
+            Parse->LocalScopes = State.LocalScopes;
+            Parse->MacroNames = State.MacroNames;
+            Parse->Macros = State.Macros;
+            Parse->ClassNames = State.ClassNames;
+        }
+
+        static std::string Trim(const std::string &Text)
+        {
+            const size_t Begin = Text.find_first_not_of(" \t\r\n");
+            if (Begin == std::string::npos)
+                return "";
+            return Text.substr(Begin, Text.find_last_not_of(" \t\r\n") - Begin + 1);
+        }
+
+        static int Depth(const std::string &Input)
+        {
+            int Result = 0;
+            char Quote = 0;
+            for (size_t i = 0; i < Input.size(); i++)
+            {
+                const char c = Input.at(i);
+                if (Quote)
+                {
+                    if (c == '\\')
+                        i++;
+                    else if (c == Quote)
+                        Quote = 0;
+                }
+                else if (c == '\'' || c == '"')
+                    Quote = c;
+                else if (c == '#')
+                {
+                    while (i < Input.size() && Input.at(i) != '\n')
+                        i++;
+                }
+                else if (c == '{')
+                    Result++;
+                else if (c == '}')
+                    Result--;
+            }
+            return Result;
+        }
+    };
+}
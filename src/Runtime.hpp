@@ -0,0 +1,195 @@
+#pragma once
+
+#include "Common.hpp"
+
+/*
+ * the heap every program links in, `call _furn_alloc` with the size in
+ * rsi returns zeroed memory in rax and `call _furn_free` with the block
+ * in rdi and its size in rsi gives it back, both keep rbx, rbp and
+ * r8-r15 and clobber rax, rcx, rdx, rsi and rdi, generated code keeps
+ * values in r8 and r9 across them the way it did across the syscalls,
+ * `call _furn_copy` with a string literal in rdi returns a counted copy
+ * of it in rax that the program may write through, under the same rules
+ *
+ * blocks up to 32 KiB come from power of two size classes, 16 bytes
+ * and up, bumped out of 1 MiB chunks and recycled through a free list
+ * per class, bigger ones are still mapped and unmapped on their own,
+ * freed blocks of two pages or more hand all but their first page back
+ * with madvise(MADV_FREE) once a MiB of them has piled up
+ */
+class HeapRuntime
+{
+public:
+    static constexpr const char *Allocate = "_furn_alloc";
+    static constexpr const char *Free = "_furn_free";
+    static constexpr const char *Copy = "_furn_copy";
+    static constexpr int64_t ImmortalRefCount = -1; // string literals, reference counting leaves them alone
+
+    static constexpr int64_t LargestSmallBlock = 32768;
+    static constexpr int64_t ChunkSize = 1 << 20;
+    static constexpr int64_t AdviseBatch = 1 << 20;
+
+    // what the allocator keeps in .bss, the free lists are indexed by log2 of the block size minus 4
+    static std::string Bss()
+    {
+        std::stringstream Output;
+        Output << "    _heap_free resq 12\n";
+        Output << "    _heap_bump resq 1\n";
+        Output << "    _heap_end resq 1\n";
+        Output << "    _heap_unadvised resq 1 ; bytes freed into the large classes since the last madvise\n";
+        return Output.str();
+    }
+
+    static std::string Text()
+    {
+        std::stringstream Output;
+
+        // rcx = log2 of the size class, rsi = requested bytes
+        const auto SizeClass = [&]()
+        {
+            Output << "    mov rcx, 4 ; 16 bytes is the smallest class\n";
+            Output << "    cmp rsi, 16\n";
+            Output << "    jbe .class\n";
+            Output << "    lea rcx, [rsi - 1]\n";
+            Output << "    bsr rcx, rcx\n";
+            Output << "    add rcx, 1 ; rounded up to a power of two\n";
+            Output << ".class:\n";
+            Output << "    lea r8, [_heap_free + rcx * 8 - 32] ; free list of the class\n";
+        };
+
+        // r8-r11 are the caller's, the size class and the syscalls use them
+        const auto Save = [&]()
+        {
+            for (const char *Register : {"r8", "r9", "r10", "r11"})
+                Output << "    push " << Register << "\n";
+        };
+
+        const auto Return = [&]()
+        {
+            for (const char *Register : {"r11", "r10", "r9", "r8"})
+                Output << "    pop " << Register << "\n";
+            Output << "    ret\n";
+        };
+
+        const auto Map = [&](const std::string &Size)
+        {
+            Output << "    mov rsi, " << Size << " ; size\n";
+            Output << "    mov rax, 9       ; mmap\n";
+            Output << "    mov rdi, 0       ; addr\n";
+            Output << "    mov rdx, 3       ; PROT_READ|PROT_WRITE\n";
+            Output << "    mov r10, 34      ; MAP_PRIVATE|MAP_ANONYMOUS\n";
+            Output << "    mov r8, -1       ; fd\n";
+            Output << "    mov r9, 0        ; offset\n";
+            Output << "    syscall\n";
+        };
+
+        Output << Allocate << ": ; begin function\n";
+        Save();
+        Output << "    cmp rsi, " << LargestSmallBlock << "\n";
+        Output << "    ja .large\n";
+        SizeClass();
+        Output << "    mov rdx, 1\n";
+        Output << "    shl rdx, cl ; block size\n";
+        Output << "    mov rax, [r8]\n";
+        Output << "    test rax, rax\n";
+        Output << "    jz .bump\n";
+        Output << "    mov rdi, [rax] ; next free block\n";
+        Output << "    mov [r8], rdi\n";
+        Output << "    mov rdi, rax ; recycled blocks are zeroed like fresh pages\n";
+        Output << "    mov rcx, rdx\n";
+        Output << "    shr rcx, 3\n";
+        Output << "    mov rdx, rax\n";
+        Output << "    xor eax, eax\n";
+        Output << "    rep stosq\n";
+        Output << "    mov rax, rdx\n";
+        Return();
+        Output << ".bump:\n";
+        Output << "    mov rax, [_heap_bump]\n";
+        Output << "    lea rdi, [rax + rdx]\n";
+        Output << "    cmp rdi, [_heap_end]\n";
+        Output << "    ja .refill\n";
+        Output << "    mov [_heap_bump], rdi\n";
+        Return();
+        Output << ".refill:\n";
+        Output << "    push rdx\n";
+        Map(std::to_string(ChunkSize));
+        Output << "    pop rdx\n";
+        Output << "    lea rdi, [rax + " << ChunkSize << "]\n";
+        Output << "    mov [_heap_end], rdi\n";
+        Output << "    lea rdi, [rax + rdx]\n";
+        Output << "    mov [_heap_bump], rdi\n";
+        Return();
+        Output << ".large:\n";
+        Map("rsi");
+        Return();
+        Output << "; end function " << Allocate << "\n";
+
+        Output << Free << ": ; begin function\n";
+        Save();
+        Output << "    cmp rsi, " << LargestSmallBlock << "\n";
+        Output << "    ja .large\n";
+        SizeClass();
+        Output << "    mov rax, [r8]\n";
+        Output << "    mov [rdi], rax\n";
+        Output << "    mov QWORD [rdi + 8], 0 ; pages not given back yet\n";
+        Output << "    mov [r8], rdi\n";
+        Output << "    cmp rcx, 13 ; only blocks of two pages or more have pages to give back\n";
+        Output << "    jb .done\n";
+        Output << "    mov rdx, 1\n";
+        Output << "    shl rdx, cl\n";
+        Output << "    add [_heap_unadvised], rdx\n";
+        Output << "    cmp QWORD [_heap_unadvised], " << AdviseBatch << "\n";
+        Output << "    jb .done\n";
+        Output << "    mov QWORD [_heap_unadvised], 0\n";
+        Output << "    push rbx\n";
+        Output << "    mov rbx, 13\n";
+        Output << ".list:\n";
+        Output << "    mov r9, [_heap_free + rbx * 8 - 32]\n";
+        Output << ".block:\n";
+        Output << "    test r9, r9\n";
+        Output << "    jz .next\n";
+        Output << "    cmp QWORD [r9 + 8], 0\n";
+        Output << "    jne .skip\n";
+        Output << "    mov QWORD [r9 + 8], 1\n";
+        Output << "    lea rdi, [r9 + 4096] ; the first page holds the links\n";
+        Output << "    mov rcx, rbx\n";
+        Output << "    mov rsi, 1\n";
+        Output << "    shl rsi, cl\n";
+        Output << "    sub rsi, 4096\n";
+        Output << "    mov rdx, 8 ; MADV_FREE\n";
+        Output << "    mov rax, 28 ; madvise\n";
+        Output << "    syscall\n";
+        Output << ".skip:\n";
+        Output << "    mov r9, [r9]\n";
+        Output << "    jmp .block\n";
+        Output << ".next:\n";
+        Output << "    inc rbx\n";
+        Output << "    cmp rbx, 15\n";
+        Output << "    jbe .list\n";
+        Output << "    pop rbx\n";
+        Output << ".done:\n";
+        Return();
+        Output << ".large:\n";
+        Output << "    mov rax, 11 ; munmap syscall number\n";
+        Output << "    syscall\n";
+        Return();
+        Output << "; end function " << Free << "\n";
+
+        // a fresh block keeps the count at zero, only the length and the bytes are copied
+        Output << Copy << ": ; begin function\n";
+        Output << "    push rdi ; the literal\n";
+        Output << "    mov rsi, [rdi - 8] ; length\n";
+        Output << "    add rsi, 16\n";
+        Output << "    call " << Allocate << "\n";
+        Output << "    pop rsi\n";
+        Output << "    mov rcx, [rsi - 8]\n";
+        Output << "    mov [rax + 8], rcx\n";
+        Output << "    add rax, 16\n";
+        Output << "    mov rdi, rax\n";
+        Output << "    rep movsb\n";
+        Output << "    ret\n";
+        Output << "; end function " << Copy << "\n";
+
+        return Output.str();
+    }
+};
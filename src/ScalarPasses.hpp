@@ -0,0 +1,300 @@
+#pragma once
+
+#include "Common.hpp"
+#include "IR.hpp"
+
+/*
+ * the basic SSA cleanups every optimization level above -O0 runs,
+ * each returns true if it changed the function and leaves the CFG
+ * and dominance information up to date
+ */
+
+// arithmetic and compares on constants, and the identities x + 0, x - 0, x * 1 and x * 0
+inline bool FoldConstants(IRFunction &Function)
+{
+    bool Changed = false;
+    std::unordered_map<uint32_t, int64_t> Constants;
+
+    for (IRBlock &Block : Function.Blocks)
+    {
+        for (const IRInstruction &Instruction : Block.Instructions)
+        {
+            if (Instruction.Op == IROpcode::Const)
+                Constants[Instruction.Id] = Instruction.Imm;
+        }
+    }
+
+    auto MakeConstant = [&](IRInstruction &Instruction, int64_t Value)
+    {
+        Instruction.Op = IROpcode::Const;
+        Instruction.Operands.clear();
+        Instruction.Imm = Value;
+        Constants[Instruction.Id] = Value;
+        Changed = true;
+    };
+
+    for (uint32_t Id : Function.ReversePostOrder)
+    {
+        IRBlock &Block = Function.Block(Id);
+        for (size_t i = 0; i < Block.Instructions.size(); i++)
+        {
+            IRInstruction &Instruction = Block.Instructions.at(i);
+            const std::vector<uint32_t> &Operands = Instruction.Operands;
+
+            if (Instruction.Op == IROpcode::Neg && Constants.count(Operands.at(0)))
+            {
+                MakeConstant(Instruction, int64_t(0 - uint64_t(Constants.at(Operands.at(0)))));
+                continue;
+            }
+
+            if (Instruction.Op < IROpcode::Add || Instruction.Op > IROpcode::CmpLE || Instruction.Op == IROpcode::Neg)
+                continue;
+
+            std::optional<int64_t> A;
+            std::optional<int64_t> B;
+            if (auto It = Constants.find(Operands.at(0)); It != Constants.end())
+                A = It->second;
+            if (auto It = Constants.find(Operands.at(1)); It != Constants.end())
+                B = It->second;
+
+            if (A && B)
+            {
+                // wraps like the machine does
+                const uint64_t a = *A, b = *B;
+                switch (Instruction.Op)
+                {
+                case IROpcode::Add:
+                    MakeConstant(Instruction, int64_t(a + b));
+                    break;
+                case IROpcode::Sub:
+                    MakeConstant(Instruction, int64_t(a - b));
+                    break;
+                case IROpcode::Mul:
+                    MakeConstant(Instruction, int64_t(a * b));
+                    break;
+                case IROpcode::CmpGT:
+                    MakeConstant(Instruction, *A > *B);
+                    break;
+                case IROpcode::CmpLT:
+                    MakeConstant(Instruction, *A < *B);
+                    break;
+                case IROpcode::CmpGE:
+                    MakeConstant(Instruction, *A >= *B);
+                    break;
+                default:
+                    MakeConstant(Instruction, *A <= *B);
+                    break;
+                }
+                continue;
+            }
+
+            std::optional<uint32_t> Same;
+            if (Instruction.Op == IROpcode::Add && A == 0)
+                Same = Operands.at(1);
+            else if ((Instruction.Op == IROpcode::Add || Instruction.Op == IROpcode::Sub) && B == 0)
+                Same = Operands.at(0);
+            else if (Instruction.Op == IROpcode::Mul && A == 1)
+                Same = Operands.at(1);
+            else if (Instruction.Op == IROpcode::Mul && B == 1)
+                Same = Operands.at(0);
+            else if (Instruction.Op == IROpcode::Mul && (A == 0 || B == 0))
+            {
+                MakeConstant(Instruction, 0);
+                continue;
+            }
+
+            if (Same)
+            {
+                Function.ReplaceAllUses(Instruction.Id, *Same);
+                Block.Instructions.erase(Block.Instructions.begin() + i--);
+                Changed = true;
+            }
+        }
+    }
+
+    return Changed;
+}
+
+// values that are computed again where an identical one already dominates them
+inline bool EliminateCommonSubexpressions(IRFunction &Function)
+{
+    using Key = std::tuple<IROpcode, IRType, std::vector<uint32_t>, int64_t, std::string>;
+
+    bool Changed = false;
+    std::map<Key, uint32_t> Available;
+
+    std::function<void(uint32_t)> Visit = [&](uint32_t Id)
+    {
+        std::vector<Key> Added;
+        IRBlock &Block = Function.Block(Id);
+
+        for (size_t i = 0; i < Block.Instructions.size(); i++)
+        {
+            IRInstruction &Instruction = Block.Instructions.at(i);
+
+            // loads can see stores and calls in between, phis and params are unique by position
+            if (!Instruction.IsPure() || Instruction.Op == IROpcode::Phi || Instruction.Op == IROpcode::Param || Instruction.Op == IROpcode::Load)
+                continue;
+
+            std::vector<uint32_t> Operands = Instruction.Operands;
+            if (Instruction.Op == IROpcode::Add || Instruction.Op == IROpcode::Mul)
+                std::sort(Operands.begin(), Operands.end());
+
+            Key Value{Instruction.Op, Instruction.Type, Operands, Instruction.Imm, Instruction.Text};
+            if (Available.count(Value))
+            {
+                Function.ReplaceAllUses(Instruction.Id, Available.at(Value));
+                Block.Instructions.erase(Block.Instructions.begin() + i--);
+                Changed = true;
+                continue;
+            }
+
+            Available[Value] = Instruction.Id;
+            Added.push_back(Value);
+        }
+
+        if (Function.DominatorTree.count(Id))
+        {
+            for (uint32_t Child : Function.DominatorTree.at(Id))
+                Visit(Child);
+        }
+
+        for (const Key &Value : Added)
+            Available.erase(Value);
+    };
+
+    Visit(Function.Blocks.front().Id);
+    return Changed;
+}
+
+// pure instructions nothing reads
+inline bool EliminateDeadCode(IRFunction &Function)
+{
+    bool Changed = false;
+    bool Removed = true;
+
+    while (Removed)
+    {
+        Removed = false;
+
+        std::unordered_map<uint32_t, size_t> Uses;
+        for (const IRBlock &Block : Function.Blocks)
+        {
+            for (const IRInstruction &Instruction : Block.Instructions)
+            {
+                for (uint32_t Operand : Instruction.Operands)
+                {
+                    if (Operand != Instruction.Id)
+                        Uses[Operand]++;
+                }
+            }
+        }
+
+        for (IRBlock &Block : Function.Blocks)
+        {
+            const size_t Before = Block.Instructions.size();
+            Block.Instructions.erase(std::remove_if(Block.Instructions.begin(), Block.Instructions.end(),
+                                                    [&](const IRInstruction &Instruction)
+                                                    { return Instruction.Id && Instruction.IsPure() && Instruction.Op != IROpcode::Param && !Uses.count(Instruction.Id); }),
+                                     Block.Instructions.end());
+            Removed |= Block.Instructions.size() != Before;
+        }
+
+        Changed |= Removed;
+    }
+
+    return Changed;
+}
+
+// folds constant branches, drops unreachable blocks and merges straight line chains
+inline bool SimplifyCFG(IRFunction &Function)
+{
+    bool Changed = false;
+
+    std::unordered_map<uint32_t, int64_t> Constants;
+    for (const IRBlock &Block : Function.Blocks)
+    {
+        for (const IRInstruction &Instruction : Block.Instructions)
+        {
+            if (Instruction.Op == IROpcode::Const)
+                Constants[Instruction.Id] = Instruction.Imm;
+        }
+    }
+
+    for (IRBlock &Block : Function.Blocks)
+    {
+        if (!Block.Terminated() || Block.Instructions.back().Op != IROpcode::CondBr)
+            continue;
+
+        IRInstruction &Branch = Block.Instructions.back();
+        std::optional<uint32_t> Target;
+        if (Branch.Targets.at(0) == Branch.Targets.at(1))
+            Target = Branch.Targets.at(0);
+        else if (Constants.count(Branch.Operands.at(0)))
+            Target = Branch.Targets.at(Constants.at(Branch.Operands.at(0)) ? 0 : 1);
+
+        if (Target)
+        {
+            Branch = IRInstruction{.Op = IROpcode::Br, .Targets = {*Target}};
+            Changed = true;
+        }
+    }
+
+    Function.ComputeCFG();
+
+    bool Merged = true;
+    while (Merged)
+    {
+        Merged = false;
+
+        for (IRBlock &Block : Function.Blocks)
+        {
+            if (!Block.Terminated() || Block.Instructions.back().Op != IROpcode::Br)
+                continue;
+
+            const uint32_t Next = Block.Instructions.back().Targets.at(0);
+            const IRBlock &Successor = Function.Block(Next);
+            if (Next == Block.Id || Next == Function.Blocks.front().Id || Successor.Predecessors.size() != 1)
+                continue;
+
+            const uint32_t Into = Block.Id;
+            const std::vector<uint32_t> Successors = Successor.Successors;
+
+            // a block with one predecessor only has phis with one value
+            for (const IRInstruction &Instruction : Successor.Instructions)
+            {
+                if (Instruction.Op == IROpcode::Phi)
+                    Function.ReplaceAllUses(Instruction.Id, Instruction.Operands.at(0));
+            }
+
+            Block.Instructions.pop_back();
+            for (const IRInstruction &Instruction : Function.Block(Next).Instructions)
+            {
+                if (Instruction.Op != IROpcode::Phi)
+                    Block.Instructions.push_back(Instruction);
+            }
+
+            for (uint32_t Id : Successors)
+            {
+                for (IRInstruction &Instruction : Function.Block(Id).Instructions)
+                {
+                    if (Instruction.Op == IROpcode::Phi)
+                        std::replace(Instruction.Targets.begin(), Instruction.Targets.end(), Next, Into);
+                }
+            }
+
+            Function.Blocks.erase(std::remove_if(Function.Blocks.begin(), Function.Blocks.end(),
+                                                 [&](const IRBlock &Block)
+                                                 { return Block.Id == Next; }),
+                                  Function.Blocks.end());
+            Function.ComputeCFG();
+            Merged = Changed = true;
+            break;
+        }
+    }
+
+    Function.RemoveRedundantPhis();
+    Function.ComputeCFG();
+    Function.ComputeDominance();
+    return Changed;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "Common.hpp"
+
+/*
+ * moves scalars of 1, 2, 4 or 8 bytes between memory and the 64 bit
+ * registers every value is kept in, narrower loads sign or zero extend
+ * to the whole register and narrower stores keep the low bytes, a float
+ * is widened to the double it is kept as in a register and narrowed back
+ * through xmm0
+ */
+class ScalarAccess
+{
+public:
+    // the low Size bytes of a 64 bit register, rax and 1 give al
+    static std::string Register(const std::string &Register, int64_t Size)
+    {
+        for (const std::vector<std::string> &Names : Registers)
+        {
+            if (Names.at(0) == Register)
+                return Names.at(Size == 1 ? 3 : Size == 2 ? 2 : Size == 4 ? 1 : 0);
+        }
+        return Register;
+    }
+
+    // To is a 64 bit register
+    static std::string Load(const std::string &To, const std::string &Address, int64_t Size, bool Signed, bool Floating = false)
+    {
+        if (Floating && Size == 4)
+            return "cvtss2sd xmm0, DWORD " + Address + "\n    movq " + To + ", xmm0";
+
+        switch (Size)
+        {
+        case 1:
+            return (Signed ? "movsx " : "movzx ") + To + ", BYTE " + Address;
+        case 2:
+            return (Signed ? "movsx " : "movzx ") + To + ", WORD " + Address;
+        case 4:
+            if (Signed)
+                return "movsxd " + To + ", DWORD " + Address;
+            return "mov " + Register(To, 4) + ", DWORD " + Address; // writing the low half clears the rest
+        default:
+            return "mov " + To + ", QWORD " + Address;
+        }
+    }
+
+    // From is a 64 bit register or an immediate, only a register for a float
+    static std::string Store(const std::string &Address, const std::string &From, int64_t Size, bool Floating = false)
+    {
+        if (Floating && Size == 4)
+            return "movq xmm0, " + From + "\n    cvtsd2ss xmm0, xmm0\n    movd DWORD " + Address + ", xmm0";
+
+        const char *Width = Size == 1 ? "BYTE " : Size == 2 ? "WORD " : Size == 4 ? "DWORD " : "QWORD ";
+        if (!From.empty() && (std::isdigit((unsigned char)From.front()) || From.front() == '-'))
+            return std::string("mov ") + Width + Address + ", " + std::to_string(Truncate(std::stoll(From), Size));
+        return std::string("mov ") + Width + Address + ", " + Register(From, Size);
+    }
+
+    // puts in the 64 bit To what storing Size bytes of From and loading them back would, From is left as it was
+    static std::string Narrow(const std::string &To, const std::string &From, int64_t Size, bool Signed, bool Floating = false)
+    {
+        if (Floating && Size == 4)
+            return "movq xmm0, " + From + "\n    cvtsd2ss xmm0, xmm0\n    cvtss2sd xmm0, xmm0\n    movq " + To + ", xmm0";
+
+        switch (Size)
+        {
+        case 1:
+        case 2:
+            return (Signed ? "movsx " : "movzx ") + To + ", " + Register(From, Size);
+        case 4:
+            if (Signed)
+                return "movsxd " + To + ", " + Register(From, 4);
+            return "mov " + Register(To, 4) + ", " + Register(From, 4);
+        default:
+            return "mov " + To + ", " + From;
+        }
+    }
+
+    // the value a store of Size bytes leaves in memory, read back signed
+    static int64_t Truncate(int64_t Value, int64_t Size)
+    {
+        switch (Size)
+        {
+        case 1:
+            return int8_t(Value);
+        case 2:
+            return int16_t(Value);
+        case 4:
+            return int32_t(Value);
+        default:
+            return Value;
+        }
+    }
+
+private:
+    inline static const std::vector<std::vector<std::string>> Registers = {
+        {"rax", "eax", "ax", "al"},
+        {"rbx", "ebx", "bx", "bl"},
+        {"rcx", "ecx", "cx", "cl"},
+        {"rdx", "edx", "dx", "dl"},
+        {"rsi", "esi", "si", "sil"},
+        {"rdi", "edi", "di", "dil"},
+        {"rbp", "ebp", "bp", "bpl"},
+        {"rsp", "esp", "sp", "spl"},
+        {"r8", "r8d", "r8w", "r8b"},
+        {"r9", "r9d", "r9w", "r9b"},
+        {"r10", "r10d", "r10w", "r10b"},
+        {"r11", "r11d", "r11w", "r11b"},
+        {"r12", "r12d", "r12w", "r12b"},
+        {"r13", "r13d", "r13w", "r13b"},
+        {"r14", "r14d", "r14w", "r14b"},
+        {"r15", "r15d", "r15w", "r15b"},
+    };
+};
@@ -0,0 +1,522 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Ast.hpp"
+#include "CompileFlags.hpp"
+#include "SymbolResolver.hpp"
+
+/*
+ * type checks the program without emitting any code,
+ * every expression is annotated with its resolved type
+ * and every call with the overload it ends up calling
+ */
+class SemanticAnalyzer : public SymbolResolver
+{
+public:
+    SemanticAnalyzer(std::vector<StatementPtr> ast, const CompileFlags &flags)
+        : SymbolResolver(std::move(ast), flags)
+    {
+    }
+
+    void AnalyzeProgram()
+    {
+        for (const StatementPtr &Stmt : Ast)
+        {
+            AnalyzeStatement(Stmt);
+        }
+
+        bool Found = false;
+        for (auto &&Var : Variables)
+        {
+            if (Var.Address != 1)
+                continue;
+
+            Found = true;
+            break;
+        }
+
+        if (!Found)
+        {
+            Throw(CompileError("main() function could not be found", Warning));
+        }
+    }
+
+private:
+    std::shared_ptr<ExpressionStatement> EvalExpr = std::make_shared<ExpressionStatement>(nullptr);
+
+    void DeclareNamespaceMember(const StatementPtr &Stmt) override
+    {
+        AnalyzeStatement(Stmt);
+    }
+
+    void OpenScope()
+    {
+        CurrentScope++;
+    }
+
+    void CloseScope()
+    {
+        const int64_t ScopeLoc = CurrentScope--;
+
+        for (int i = Variables.size() - 1; i >= 0; i--)
+        {
+            const Variable &Var = Variables.at(i);
+
+            if (Var.Funcs || Var.Class || Var.Namespace)
+                continue;
+
+            if (int64_t(Var.ScopeI) < ScopeLoc)
+                continue;
+
+            DiscardVariable(i);
+        }
+    }
+
+    void AnalyzeFunction(const std::shared_ptr<VarDeclaration> &Decl, const std::shared_ptr<FunctionDefinition> &Func)
+    {
+        const bool IsMain = Decl->Address == 1;
+
+        // reserve the label so overloads mangle the same way as in codegen
+        MangleFunctionSignature(*Func, Decl->Name);
+
+        if (IsMain && CmplFlags.StrictMode && !Func->Global)
+        {
+            Throw(CompileError("the main function was not exported (add `export` keyword)", Warning));
+        }
+
+        for (int j = Func->Arguments.size() - 1; j >= 0; j--)
+        {
+            VarDeclaration &ParamDecl = Func->Arguments.at(j);
+
+            std::shared_ptr<std::unordered_map<std::string, MemberInfo>> ParamClass = nullptr;
+            if (ParamDecl.Type.CustomTypeName)
+                ParamClass = ResolveSymbol(ParamDecl.Type.CustomTypeName).Class;
+
+            DeclareVariable(Variable{.TypeDesc = ParamDecl.Type, .Class = ParamClass, .Address = ParamDecl.Address, .Name = ParamDecl.Name});
+        }
+
+        OpenScope();
+
+        for (const StatementPtr &Stmt : Func->Body)
+        {
+            AnalyzeStatement(Stmt);
+        }
+
+        CloseScope();
+
+        for (size_t i = 0; i < Func->Arguments.size(); i++)
+        {
+            DiscardVariable(Variables.size() - 1);
+        }
+    }
+
+    void AnalyzeStatement(const StatementPtr &Stmt)
+    {
+        CurrentEval = Stmt;
+
+        if (std::dynamic_pointer_cast<AssemblyInstructions>(Stmt))
+        {
+            // opaque to the type checker
+        }
+        else if (auto ExprStmt = std::dynamic_pointer_cast<ExpressionStatement>(Stmt))
+        {
+            AnalyzeExpression(ExprStmt->Expr);
+        }
+        else if (auto Multi = std::dynamic_pointer_cast<MultiStatement>(Stmt))
+        {
+            for (auto &&Stmt : Multi->Statements)
+            {
+                AnalyzeStatement(Stmt);
+            }
+        }
+        else if (auto Decl = std::dynamic_pointer_cast<VarDeclaration>(Stmt))
+        {
+            CmplSymbol Symbol = ResolveSymbol(Decl->Initializer);
+
+            if (Symbol.Funcs)
+            {
+                for (auto &&Func : *Symbol.Funcs)
+                {
+                    if (Func->ReturnType.Type == ValueType::Unknown && !Func->Body.empty())
+                    {
+                        if (auto Return = std::dynamic_pointer_cast<ReturnStatement>(Func->Body.at(0)))
+                        {
+                            Func->ReturnType = ResolveSymbol(Return->Expr).TypeDesc;
+                        }
+                    }
+
+                    bool Found = false;
+                    for (auto &&Var : Variables)
+                    {
+                        if (Var.Address != Decl->Address)
+                            continue;
+
+                        Var.Funcs->push_back(Func);
+
+                        Found = true;
+                        break;
+                    }
+
+                    if (!Found)
+                    {
+                        DeclareVariable(Variable{.TypeDesc = Decl->Type, .Funcs = Symbol.Funcs, .Address = Decl->Address, .Name = Decl->Name});
+                    }
+
+                    // imported bodies are parsed and checked once a call selects them
+                    if (Func->ParseBody)
+                    {
+                        MangleFunctionSignature(*Func, Decl->Name);
+                        DeferredFunctions[Func->UniqueId] = Decl;
+                        continue;
+                    }
+
+                    AnalyzeFunction(Decl, Func);
+                    CurrentEval = Stmt;
+                }
+            }
+            else if (Symbol.Namespace)
+            {
+                DeclareVariable(Variable{.StackLoc = -1, .TypeDesc = Decl->Type, .Namespace = Symbol.Namespace, .Address = Decl->Address, .Name = Decl->Name});
+            }
+            else if (Symbol.Class && !Symbol.TypeDesc.CustomTypeName)
+            {
+                DeclareVariable(Variable{.StackLoc = -1, .TypeDesc = Decl->Type, .Class = Symbol.Class, .Address = Decl->Address, .Name = Decl->Name});
+            }
+            else
+            {
+                if (Decl->Type.Type == ValueType::Unknown)
+                {
+                    TypeDescriptor OldType = Decl->Type;
+                    Decl->Type = Symbol.TypeDesc;
+                    Decl->Type.Constant = OldType.Constant;
+                }
+                else if (!CompileTypeMatch(Symbol.TypeDesc, Decl->Type))
+                {
+                    Throw(CompileError("initializer type mismatch", Error));
+                }
+
+                std::shared_ptr<std::unordered_map<std::string, MemberInfo>> ClassMembers = nullptr;
+                if (Decl->Type.CustomTypeName)
+                    ClassMembers = ResolveSymbol(Decl->Type.CustomTypeName).Class;
+
+                DeclareVariable(Variable{.TypeDesc = Decl->Type, .Class = ClassMembers, .Address = Decl->Address, .Name = Decl->Name});
+                AnalyzeExpression(Decl->Initializer);
+            }
+        }
+        else if (auto Using = std::dynamic_pointer_cast<UseStatement>(Stmt))
+        {
+            CmplSymbol Object = ResolveSymbol(Using->Expr);
+            DeclareVariable(Variable{.StackLoc = Object.Var ? Object.Var->StackLoc : -1, .TypeDesc = Object.TypeDesc, .Funcs = Object.Funcs, .Namespace = Object.Namespace, .Address = Using->Address});
+        }
+        else if (auto If = std::dynamic_pointer_cast<IfStatement>(Stmt))
+        {
+            for (size_t i = 0; i < If->Then.size(); i++)
+            {
+                AnalyzeExpression(If->Conditions.at(i));
+
+                OpenScope();
+                for (const StatementPtr &Stmt : If->Then.at(i))
+                {
+                    AnalyzeStatement(Stmt);
+                }
+                CloseScope();
+            }
+        }
+        else if (auto While = std::dynamic_pointer_cast<WhileStatement>(Stmt))
+        {
+            AnalyzeExpression(While->Condition);
+
+            for (const StatementPtr &Stmt : While->Body)
+            {
+                AnalyzeStatement(Stmt);
+            }
+        }
+        else if (auto Return = std::dynamic_pointer_cast<ReturnStatement>(Stmt))
+        {
+            AnalyzeExpression(Return->Expr);
+        }
+        else if (Stmt)
+        {
+            Throw(CompileError("AnalyzeStatement(): unhandled statement " + std::string(typeid(*Stmt).name()) + " (not implemented)", Error));
+        }
+    }
+
+    void AnalyzeExpression(const ExpressionPtr &Expr)
+    {
+        if (!Expr)
+            return;
+
+        EvalExpr->Expr = Expr;
+        CurrentEval = EvalExpr;
+
+        Expr->ResolvedType = ResolveSymbol(Expr).TypeDesc;
+
+        if (auto VarExpr = std::dynamic_pointer_cast<VariableExpression>(Expr))
+        {
+            if (VarExpr->Name.empty())
+            {
+                Throw(CompileError("Awaiting identifier...", SyntaxError));
+                return;
+            }
+
+            CmplSymbol Symbol = ResolveSymbol(VarExpr);
+
+            if (Symbol.Funcs)
+            {
+                auto Call = std::make_shared<CallExpression>(VarExpr, std::vector<ExpressionPtr>());
+                Call->Location = VarExpr->Location;
+                AnalyzeExpression(Call);
+                VarExpr->ResolvedType = Call->ResolvedType;
+            }
+            else if (!Symbol.Var)
+            {
+                Throw(CompileError(VarExpr->Name + " is not a valid variable", Error));
+            }
+        }
+        else if (auto Access = std::dynamic_pointer_cast<MemberExpression>(Expr))
+        {
+            CmplSymbol ObjectSymbol = ResolveSymbol(Access->Object);
+            CmplSymbol Symbol = ResolveSymbol(Access);
+
+            if (ObjectSymbol.TypeDesc.Nullable)
+            {
+                Throw(CompileError("object was not unwrapped in member access expression (add object!.member)", Error));
+            }
+
+            if (ObjectSymbol.Namespace)
+            {
+                if (!ObjectSymbol.Namespace->count(Access->Member))
+                {
+                    Throw(CompileError(Access->Member + " is not a member of the namespace, was it exported?", Error));
+                    return;
+                }
+            }
+            else if (ObjectSymbol.Class)
+            {
+                if (!ObjectSymbol.Class->count(Access->Member))
+                {
+                    Throw(CompileError(Access->Member + " is not a member of the object, is it public?", Error));
+                    return;
+                }
+                AnalyzeExpression(Access->Object);
+            }
+            else
+            {
+                Throw(CompileError("not a valid namespace to access", Error));
+                return;
+            }
+
+            if (Symbol.Funcs)
+            {
+                auto Call = std::make_shared<CallExpression>(Access, std::vector<ExpressionPtr>());
+                Call->Location = Access->Location;
+                AnalyzeExpression(Call);
+                Access->ResolvedType = Call->ResolvedType;
+            }
+        }
+        else if (auto Index = std::dynamic_pointer_cast<IndexExpression>(Expr))
+        {
+            CmplSymbol ObjectSymbol = ResolveSymbol(Index->Object);
+
+            if (!CompileTypeMatch(ResolveSymbol(Index->Index).TypeDesc, ValueType::Long))
+            {
+                Throw(CompileError("[] operator offset expects a number", Error));
+            }
+
+            if (ObjectSymbol.TypeDesc.Nullable)
+            {
+                Throw(CompileError("pointer was not unwrapped in index expression (add pointer![0])", Error));
+            }
+
+            if (!ObjectSymbol.TypeDesc.PointerDepth)
+            {
+                Throw(CompileError("[] operator expects a pointer type", Error));
+            }
+
+            AnalyzeExpression(Index->Object);
+            AnalyzeExpression(Index->Index);
+        }
+        else if (auto Assign = std::dynamic_pointer_cast<AssignmentExpression>(Expr))
+        {
+            CmplSymbol NameSymbol = ResolveSymbol(Assign->Name);
+            CmplSymbol ValSymbol = ResolveSymbol(Assign->Value);
+
+            if (NameSymbol.TypeDesc.Constant)
+            {
+                Throw(CompileError("immutable, cannot reassign", Error));
+                return;
+            }
+
+            if (auto AccessExpr = std::dynamic_pointer_cast<MemberExpression>(Assign->Name))
+            {
+                CmplSymbol ObjectSymbol = ResolveSymbol(AccessExpr->Object);
+                if (!ObjectSymbol.Class || !ObjectSymbol.Class->count(AccessExpr->Member))
+                    return;
+
+                AnalyzeExpression(AccessExpr->Object);
+            }
+            else if (auto IndexExpr = std::dynamic_pointer_cast<IndexExpression>(Assign->Name))
+            {
+                AnalyzeExpression(IndexExpr->Object);
+                AnalyzeExpression(IndexExpr->Index);
+            }
+            else if (std::dynamic_pointer_cast<UnaryExpression>(Assign->Name))
+            {
+                Throw(CompileError("invalid unary assignment", Fatal));
+                return;
+            }
+            else if (!NameSymbol.Var)
+            {
+                Throw(CompileError("invalid variable to assign to (if you forced unwrapped change it to `x = x! + 1`)", Fatal));
+                return;
+            }
+
+            AnalyzeExpression(Assign->Value);
+
+            EvalExpr->Expr = Expr;
+            CurrentEval = EvalExpr;
+            if (!CompileTypeMatch(ValSymbol.TypeDesc, NameSymbol.TypeDesc))
+            {
+                Throw(CompileError("assignment type mismatch", Error));
+            }
+        }
+        else if (auto Call = std::dynamic_pointer_cast<CallExpression>(Expr))
+        {
+            CmplSymbol Symbol = ResolveSymbol(Call->Callee);
+
+            if (!Symbol.Funcs)
+            {
+                Throw(CompileError("not a valid function to call", Error));
+                return;
+            }
+
+            Call->ResolvedCallee = CalculateBestOverload(Symbol.Funcs, Call, true);
+
+            if (Call->ResolvedCallee)
+            {
+                if (std::shared_ptr<VarDeclaration> Decl = TakeDeferredFunction(Call->ResolvedCallee))
+                {
+                    AnalyzeFunction(Decl, Call->ResolvedCallee);
+                    EvalExpr->Expr = Expr;
+                    CurrentEval = EvalExpr;
+                }
+            }
+
+            for (const ExpressionPtr &Arg : Call->Arguments)
+            {
+                AnalyzeExpression(Arg);
+            }
+        }
+        else if (auto NewExpr = std::dynamic_pointer_cast<UseExpression>(Expr))
+        {
+            if (NewExpr->Type.PointerDepth)
+            {
+                if (!CompileTypeMatch(ResolveSymbol(NewExpr->Arguments.at(0)).TypeDesc, ValueType::Long))
+                {
+                    Throw(CompileError("new[] operator size expects a number", Error));
+                }
+
+                AnalyzeExpression(NewExpr->Arguments.at(0));
+            }
+            else if (NewExpr->Type.Type != ValueType::Custom)
+            {
+                // int(x), double(x) and the other conversions
+                const TypeDescriptor &From = ResolveSymbol(NewExpr->Arguments.at(0)).TypeDesc;
+                if (From.PointerDepth || From.Nullable || !(IsFloatingType(From) || CompileTypeMatch(From, ValueType::Long) || From.Type == ValueType::Bool || From.Type == ValueType::Character))
+                {
+                    Throw(CompileError("conversion to " + std::string(magic_enum::enum_name(NewExpr->Type.Type)) + " expects a number", Error));
+                }
+
+                AnalyzeExpression(NewExpr->Arguments.at(0));
+            }
+            else if (!ResolveSymbol(NewExpr).Class)
+            {
+                Throw(CompileError("new operator expects a class type", Error));
+            }
+        }
+        else if (auto SizeOf = std::dynamic_pointer_cast<SizeOfExpression>(Expr))
+        {
+            CmplSymbol ObjectSymbol = ResolveSymbol(SizeOf->Expr);
+
+            if (ObjectSymbol.TypeDesc.Nullable)
+            {
+                Throw(CompileError("pointer was not unwrapped in index expression (add sizeof(pointer!))", Error));
+            }
+
+            if (!ObjectSymbol.TypeDesc.PointerDepth)
+            {
+                Throw(CompileError("sizeof() operator expects a pointer type", Error));
+            }
+
+            AnalyzeExpression(SizeOf->Expr);
+        }
+        else if (auto Cast = std::dynamic_pointer_cast<ClassCastExpression>(Expr))
+        {
+            AnalyzeExpression(Cast->Expr);
+        }
+        else if (auto Bin = std::dynamic_pointer_cast<BinaryExpression>(Expr))
+        {
+            const CmplSymbol &SymbolA = ResolveSymbol(Bin->A);
+            const CmplSymbol &SymbolB = ResolveSymbol(Bin->B);
+
+            AnalyzeExpression(Bin->A);
+            AnalyzeExpression(Bin->B);
+
+            EvalExpr->Expr = Expr;
+            CurrentEval = EvalExpr;
+
+            if (SymbolA.TypeDesc.Nullable || SymbolB.TypeDesc.Nullable)
+            {
+                Throw(CompileError("an operand of the binary expression is nullable", Error));
+            }
+
+            switch (Bin->Operator)
+            {
+            case OperationType::Add:
+            case OperationType::Subtract:
+            case OperationType::Multiply:
+            case OperationType::GreaterThan:
+            case OperationType::LessThan:
+            case OperationType::GreaterThanOrEqualTo:
+            case OperationType::LessThanOrEqualTo:
+                break;
+
+            case OperationType::Divide:
+                if (IsFloatingType(SymbolA.TypeDesc) || IsFloatingType(SymbolB.TypeDesc))
+                    break;
+                Throw(CompileError("TODO: binary op " + std::string(magic_enum::enum_name(Bin->Operator)) + " is not implemented", Error));
+                break;
+
+            default:
+                Throw(CompileError("TODO: binary op " + std::string(magic_enum::enum_name(Bin->Operator)) + " is not implemented", Error));
+                break;
+            }
+        }
+        else if (auto Un = std::dynamic_pointer_cast<UnaryExpression>(Expr))
+        {
+            CmplSymbol Symbol = ResolveSymbol(Un->Expr);
+
+            AnalyzeExpression(Un->Expr);
+
+            EvalExpr->Expr = Expr;
+            CurrentEval = EvalExpr;
+
+            switch (Un->Operator)
+            {
+            case OperationType::Subtract:
+                break;
+            case OperationType::ForceUnwrap:
+                if (!Symbol.TypeDesc.Nullable)
+                    Throw(CompileError("force unwrap operator expects a nullable symbol", Error));
+                break;
+
+            default:
+                Throw(CompileError("TODO: unary operator '" + std::string(magic_enum::enum_name(Un->Operator)) + '\'', Error));
+            }
+        }
+        else if (std::dynamic_pointer_cast<UnownedReferenceExpression>(Expr))
+        {
+            Throw(CompileError("the unowned reference &operator cannot be used here", Error));
+        }
+    }
+};
@@ -0,0 +1,724 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Ast.hpp"
+#include "CompileFlags.hpp"
+#include "CompletionIndex.hpp"
+
+/*
+ * symbol table and type resolution shared by
+ * the semantic analyzer and the code generator
+ */
+class SymbolResolver
+{
+public:
+    std::vector<CompileError> Errors;
+
+    std::unordered_map<MapId, std::pair<std::string, size_t> /* <signature, refcount> */> FunctionSignatureCache;
+
+protected:
+    inline void Throw(CompileError e)
+    {
+        e.Location = CurrentEval->Location;
+        if (auto ExprStmt = std::dynamic_pointer_cast<ExpressionStatement>(CurrentEval))
+            e.Location = ExprStmt->Expr->Location;
+        Errors.push_back(e);
+    }
+
+    std::vector<StatementPtr> Ast;
+    StatementPtr CurrentEval = nullptr;
+    const CompileFlags &CmplFlags;
+    uint64_t CurrentScope = 0;
+
+    struct MemberInfo
+    {
+        TypeDescriptor Type;
+        uint64_t Offset; // byte offset in the instance
+    };
+
+    struct Variable
+    {
+        int64_t StackLoc = 0;
+        TypeDescriptor TypeDesc;
+        std::shared_ptr<std::vector<std::shared_ptr<FunctionDefinition>>> Funcs = nullptr;
+        std::shared_ptr<std::unordered_map<std::string, MapId>> Namespace = nullptr;
+        std::shared_ptr<std::unordered_map<std::string, MemberInfo>> Class = nullptr;
+        MapId Address = 0;
+        uint64_t ScopeI = 0; // set to CurrentScope when declared
+        std::string Name;
+        std::string Register; // empty when the variable lives on the stack, the QWORD [label] of a furn --repl global
+        bool Object = false; // names an object kept in the frame instead of holding a pointer to one
+        int64_t ObjectSize = 0; // bytes of it in the frame, members in registers take none
+    };
+
+    struct CmplSymbol
+    {
+        TypeDescriptor TypeDesc;
+        std::shared_ptr<Variable> Var = nullptr;
+        std::shared_ptr<std::vector<std::shared_ptr<FunctionDefinition>>> Funcs = nullptr;
+        std::shared_ptr<std::unordered_map<std::string, MapId>> Namespace = nullptr;
+        std::shared_ptr<std::unordered_map<std::string, MemberInfo>> Class = nullptr;
+    };
+
+    std::vector<Variable> Variables;
+    CompletionIndex Completions;
+
+    // functions nothing has called yet, by FunctionDefinition::UniqueId,
+    // imported ones have not had their body parsed either
+    std::unordered_map<MapId, std::shared_ptr<VarDeclaration>> DeferredFunctions;
+
+    SymbolResolver(std::vector<StatementPtr> ast, const CompileFlags &flags)
+        : Ast(std::move(ast)), CmplFlags(flags)
+    {
+    }
+
+    virtual ~SymbolResolver() = default;
+
+    // namespace members are declared by whoever walks the tree
+    virtual void DeclareNamespaceMember(const StatementPtr &Stmt) = 0;
+
+    void DeclareVariable(Variable Var)
+    {
+        Var.ScopeI = CurrentScope;
+        Variables.push_back(Var);
+
+        // the index is only needed to answer the editor
+        if (!CmplFlags.CompileInfo || Var.Name.empty() || Var.Name == "main")
+            return;
+
+        if (Var.Funcs)
+            Completions.Insert(Var.Name, CompletionIndex::EntryKind::Function, Var.ScopeI);
+        else if (Var.Namespace)
+            Completions.Insert(Var.Name, CompletionIndex::EntryKind::Namespace, Var.ScopeI);
+        else
+            Completions.Insert(Var.Name, CompletionIndex::EntryKind::Name, Var.ScopeI);
+    }
+
+    void DiscardVariable(const size_t Index)
+    {
+        const Variable &Var = Variables.at(Index);
+
+        if (CmplFlags.CompileInfo && !Var.Name.empty())
+            Completions.Erase(Var.Name, Var.ScopeI);
+
+        Variables.erase(Variables.begin() + Index);
+    }
+
+    // parses the body of a deferred function, returns the declaration
+    // it was deferred from or nullptr if Func is already available
+    std::shared_ptr<VarDeclaration> TakeDeferredFunction(const std::shared_ptr<FunctionDefinition> &Func)
+    {
+        auto It = DeferredFunctions.find(Func->UniqueId);
+        if (It == DeferredFunctions.end())
+            return nullptr;
+
+        std::shared_ptr<VarDeclaration> Decl = It->second;
+        DeferredFunctions.erase(It); // before generating, the body may call itself
+
+        if (Func->ParseBody)
+        {
+            Func->Body = Func->ParseBody(Errors);
+            Func->ParseBody = nullptr;
+        }
+
+        return Decl;
+    }
+
+    bool CompileTypeMatch(const TypeDescriptor &ObjectType, const TypeDescriptor &ExpectedType, const unsigned short Looseness = 1000)
+    {
+#define _CompileTypeMatch_NumbersCheck                                                                                         \
+    if (ExpectedType.Type == ValueType::Long)                                                                                  \
+    {                                                                                                                          \
+        return ObjectType.Type == ValueType::Short || ObjectType.Type == ValueType::Int || ObjectType.Type == ValueType::Long; \
+    }                                                                                                                          \
+    else if (ExpectedType.Type == ValueType::Int)                                                                              \
+    {                                                                                                                          \
+        return ObjectType.Type == ValueType::Short || ObjectType.Type == ValueType::Int;                                       \
+    }                                                                                                                          \
+    else if (ExpectedType.Type == ValueType::Short)                                                                            \
+    {                                                                                                                          \
+        return ObjectType.Type == ValueType::Short || ObjectType.Type == ValueType::Int;                                       \
+    }                                                                                                                          \
+    else if ((ExpectedType.Type == ValueType::Float || ExpectedType.Type == ValueType::Double) && !ExpectedType.PointerDepth)  \
+    {                                                                                                                          \
+        return ObjectType.Type == ValueType::Float || ObjectType.Type == ValueType::Double;                                    \
+    }
+
+        if (ObjectType.PointerDepth != ExpectedType.PointerDepth)
+            return false;
+
+        if (ObjectType.PointerDepth)
+        {
+            if (ObjectType.Constant && !ExpectedType.Constant)
+                return false;
+        }
+
+        if (ObjectType.Type == ValueType::Custom || ExpectedType.Type == ValueType::Custom)
+        {
+            if (ObjectType.Type != ExpectedType.Type)
+                return false;
+
+            if (ObjectType.Constant && !ExpectedType.Constant)
+                return false;
+
+            return (*ResolveSymbol(ObjectType.CustomTypeName).Class).at("*ClassId").Offset == (*ResolveSymbol(ExpectedType.CustomTypeName).Class).at("*ClassId").Offset;
+        }
+
+        if (Looseness <= 0)
+        {
+            if (ObjectType.Type != ExpectedType.Type)
+                return false;
+
+            if (ObjectType.Nullable != ExpectedType.Nullable)
+                return false;
+
+            if (ObjectType.Constant != ExpectedType.Constant)
+                return false;
+
+            return true;
+        }
+        else if (Looseness <= 1)
+        {
+            if (ObjectType.Type != ExpectedType.Type)
+                return false;
+
+            if (ObjectType.Nullable && !ExpectedType.Nullable)
+                return false;
+
+            return true;
+        }
+        else if (Looseness <= 2)
+        {
+            if (ObjectType.Type != ExpectedType.Type)
+                return false;
+
+            if (ObjectType.Nullable && !ExpectedType.Nullable)
+                return false;
+
+            _CompileTypeMatch_NumbersCheck;
+
+            return true;
+        }
+        else if (Looseness <= 3)
+        {
+            if (ObjectType.Type != ExpectedType.Type)
+                return false;
+
+            if (ObjectType.Nullable && !ExpectedType.Nullable)
+                return false;
+
+            if (ExpectedType.Type == ValueType::Dynamic)
+                return true;
+
+            _CompileTypeMatch_NumbersCheck;
+
+            return true;
+        }
+        else
+        {
+            if (ObjectType.Type == ValueType::Null && ExpectedType.Nullable)
+                return true;
+
+            if (ObjectType.Nullable && !ExpectedType.Nullable)
+                return false;
+
+            if (ExpectedType.Type == ValueType::Dynamic)
+                return true;
+
+            _CompileTypeMatch_NumbersCheck;
+
+            return ObjectType.Type == ExpectedType.Type;
+        }
+    }
+
+    // bytes a value takes in an array element or class member, locals and
+    // parameters still take a whole 8 byte register or stack slot
+    int64_t SizeOfType(const TypeDescriptor &Type)
+    {
+        if (Type.PointerDepth)
+        {
+            return 8;
+        }
+
+        if (Type.Type == ValueType::Custom && Type.CustomTypeName)
+        {
+            // return the size of the REFERENCE address
+            return 8;
+            // NOT the following
+            // const CmplSymbol &TypeSymbol = ResolveSymbol(Type.CustomTypeName);
+            // if (TypeSymbol.Class)
+            // {
+            //     return TypeSymbol.Class->at("*ClassSize").Offset;
+            // }
+        }
+
+        switch (Type.Type)
+        {
+        case ValueType::Bool:
+            return 1;
+
+        case ValueType::Character:
+            return 1;
+
+        case ValueType::Int:
+            return 4;
+
+        case ValueType::Short:
+            return 2;
+
+        case ValueType::Long:
+            return 8;
+
+        case ValueType::Float:
+            return 4;
+
+        case ValueType::Double:
+            return 8;
+
+        default:
+            break;
+        }
+
+        return 8;
+    }
+
+    // whether loading a narrower value sign extends it, bool and char zero extend
+    bool IsSignedType(const TypeDescriptor &Type)
+    {
+        if (Type.PointerDepth)
+            return false;
+        return Type.Type == ValueType::Short || Type.Type == ValueType::Int || Type.Type == ValueType::Long;
+    }
+
+    // float and double values are kept as the bits of a double, float is only narrowed in memory
+    bool IsFloatingType(const TypeDescriptor &Type)
+    {
+        if (Type.PointerDepth)
+            return false;
+        return Type.Type == ValueType::Float || Type.Type == ValueType::Double;
+    }
+
+    // a C function or one C calls that takes or returns a float or double, C has
+    // those in the xmm registers where every other function has them in the integer ones
+    bool PassesFloatsToC(const FunctionDefinition &Func)
+    {
+        if (!Func.External && !Func.CLinkage)
+            return false;
+        return IsFloatingType(Func.ReturnType) || std::any_of(Func.Arguments.begin(), Func.Arguments.end(), [&](const VarDeclaration &Argument)
+                                                              { return IsFloatingType(Argument.Type); });
+    }
+
+    CmplSymbol GarbageCmplSymbol = CmplSymbol{.TypeDesc = ValueType::Unknown};
+
+    CmplSymbol ResolveSymbol(const ExpressionPtr &Expr)
+    {
+        if (auto VarExpr = std::dynamic_pointer_cast<VariableExpression>(Expr))
+        {
+            if (VarExpr->Name.empty())
+            {
+                return GarbageCmplSymbol;
+            }
+
+            bool Found = false;
+            for (auto &&Var : Variables)
+            {
+                if (Var.Address != VarExpr->Address)
+                    continue;
+
+                Found = true;
+                break;
+            }
+
+            if (!Found)
+            {
+                // look for identifier in namespaces
+                for (auto &&Var : Variables)
+                {
+                    if (!Var.Namespace)
+                        continue;
+                    if (!Var.Namespace->count(VarExpr->Name))
+                        continue;
+
+                    for (auto &&MemberVar : Variables)
+                    {
+                        if (MemberVar.Address != Var.Namespace->at(VarExpr->Name))
+                            continue;
+
+                        // only look for a function
+                        if (MemberVar.Funcs)
+                            return CmplSymbol{.TypeDesc = MemberVar.TypeDesc, .Funcs = MemberVar.Funcs};
+
+                        break;
+                    }
+                }
+
+                return GarbageCmplSymbol;
+            }
+
+            for (auto &&Var : Variables)
+            {
+                if (Var.Address != VarExpr->Address)
+                    continue;
+
+                if (Var.Funcs)
+                    return CmplSymbol{.TypeDesc = Var.TypeDesc, .Funcs = Var.Funcs};
+                else if (Var.Namespace)
+                    return CmplSymbol{.TypeDesc = Var.TypeDesc, .Namespace = Var.Namespace};
+                else if (Var.Class && Var.StackLoc == -1)
+                    return CmplSymbol{.TypeDesc = Var.TypeDesc, .Class = Var.Class};
+                else
+                    return CmplSymbol{.TypeDesc = Var.TypeDesc, .Var = std::make_shared<Variable>(Var), .Class = Var.Class};
+            }
+        }
+        else if (auto Assign = std::dynamic_pointer_cast<AssignmentExpression>(Expr))
+        {
+            return ResolveSymbol(Assign->Value);
+        }
+        else if (auto Literal = std::dynamic_pointer_cast<ValueExpression>(Expr))
+        {
+            if (Literal->Val.type() == typeid(rt_Int))
+                return CmplSymbol{.TypeDesc = TypeDescriptor(ValueType::Int).AsConstant()};
+            else if (Literal->Val.type() == typeid(rt_Float))
+                return CmplSymbol{.TypeDesc = TypeDescriptor(ValueType::Double).AsConstant()};
+            else if (Literal->Val.type() == typeid(bool))
+                return CmplSymbol{.TypeDesc = TypeDescriptor(ValueType::Bool).AsConstant()};
+            else if (Literal->Val.type() == typeid(std::nullptr_t))
+                return CmplSymbol{.TypeDesc = TypeDescriptor(ValueType::Null, {}, nullptr, 2).AsConstant()};
+            else if (Literal->Val.type() == typeid(char))
+                return CmplSymbol{.TypeDesc = TypeDescriptor(ValueType::Character).AsConstant()};
+            else if (Literal->Val.type() == typeid(std::string))
+            {
+                if (ToString(Literal->Val).length() == 1)
+                    return CmplSymbol{.TypeDesc = TypeDescriptor(ValueType::Character).AsConstant()};
+                else
+                    return CmplSymbol{.TypeDesc = TypeDescriptor(ValueType::Character).AsPointer()};
+            }
+
+            return GarbageCmplSymbol;
+        }
+        else if (auto Func = std::dynamic_pointer_cast<FunctionDefinition>(Expr))
+        {
+            std::vector<TypeDescriptor> FuncSubtypes;
+            FuncSubtypes.push_back(Func->ReturnType);
+            for (auto &&Param : Func->Arguments)
+            {
+                FuncSubtypes.push_back(Param.Type);
+            }
+
+            auto Funcs = std::make_shared<std::vector<std::shared_ptr<FunctionDefinition>>>();
+            Funcs->push_back(Func);
+
+            return CmplSymbol{.TypeDesc = TypeDescriptor(ValueType::Function, FuncSubtypes), .Funcs = Funcs};
+        }
+        else if (auto Namespace = std::dynamic_pointer_cast<NamespaceDefinition>(Expr))
+        {
+            auto Members = std::make_shared<std::unordered_map<std::string, MapId>>();
+            for (auto &&[Name, Address] : Namespace->Definition)
+            {
+                (*Members)[Name] = Address;
+            }
+
+            for (auto &&Member : Namespace->Statements)
+            {
+                if (auto &&Decl = std::dynamic_pointer_cast<VarDeclaration>(Member))
+                {
+                    if (Decl->Address == 1) // is main()
+                        continue;
+                }
+                DeclareNamespaceMember(Member);
+            }
+
+            return CmplSymbol{.TypeDesc = ValueType::Namespace, .Namespace = Members};
+        }
+        else if (auto Access = std::dynamic_pointer_cast<MemberExpression>(Expr))
+        {
+            CmplSymbol ObjectSymbol = ResolveSymbol(Access->Object);
+
+            if (ObjectSymbol.Namespace)
+            {
+                if (!ObjectSymbol.Namespace->count(Access->Member))
+                {
+                    return GarbageCmplSymbol;
+                }
+                for (auto &&Var : Variables)
+                {
+                    if (Var.Address != ObjectSymbol.Namespace->at(Access->Member))
+                        continue;
+
+                    if (Var.Funcs)
+                        return CmplSymbol{.TypeDesc = Var.TypeDesc, .Funcs = Var.Funcs};
+                    else if (Var.Namespace)
+                        return CmplSymbol{.TypeDesc = Var.TypeDesc, .Namespace = Var.Namespace};
+                    else
+                        return CmplSymbol{.TypeDesc = Var.TypeDesc, .Var = std::make_shared<Variable>(Var)};
+                }
+
+                return GarbageCmplSymbol;
+            }
+            else if (ObjectSymbol.Class)
+            {
+                if (!ObjectSymbol.Class->count(Access->Member))
+                {
+                    return GarbageCmplSymbol;
+                }
+                TypeDescriptor MemberType = ObjectSymbol.Class->at(Access->Member).Type;
+                if (ObjectSymbol.TypeDesc.Constant)
+                {
+                    // if the object is constant, all of its members should be too
+                    MemberType.Constant = true;
+                }
+
+                std::shared_ptr<std::unordered_map<std::string, SymbolResolver::MemberInfo>> MemberClass = nullptr;
+                if (MemberType.CustomTypeName)
+                {
+                    MemberClass = ResolveSymbol(MemberType.CustomTypeName).Class;
+                }
+
+                return CmplSymbol{.TypeDesc = MemberType, .Class = MemberClass};
+            }
+
+            return GarbageCmplSymbol;
+        }
+        else if (auto Index = std::dynamic_pointer_cast<IndexExpression>(Expr))
+        {
+            CmplSymbol ObjectSymbol = ResolveSymbol(Index->Object);
+            ObjectSymbol.TypeDesc.PointerDepth -= 1;
+            return ObjectSymbol;
+        }
+        else if (auto Class = std::dynamic_pointer_cast<ClassBlueprint>(Expr))
+        {
+            auto Members = std::make_shared<std::unordered_map<std::string, MemberInfo>>();
+            (*Members)["*ClassId"] = MemberInfo{.Type = ValueType::Unknown, .Offset = Class->UniqueId};
+
+            // widest members first so every member lands aligned without padding between them
+            std::vector<const MemberDeclaration *> Order;
+            for (auto &&MemberDecl : Class->Members)
+                Order.push_back(&MemberDecl);
+            std::stable_sort(Order.begin(), Order.end(), [&](const MemberDeclaration *A, const MemberDeclaration *B)
+                             { return SizeOfType(A->Type) > SizeOfType(B->Type); });
+
+            uint64_t Size = 0;
+            uint64_t Alignment = 1;
+            for (const MemberDeclaration *MemberDecl : Order)
+            {
+                const uint64_t MemberSize = SizeOfType(MemberDecl->Type);
+                Size = (Size + MemberSize - 1) / MemberSize * MemberSize;
+                (*Members)[MemberDecl->Name] = MemberInfo{.Type = MemberDecl->Type, .Offset = Size};
+                Size += MemberSize;
+                Alignment = std::max(Alignment, MemberSize);
+            }
+            Size = (Size + Alignment - 1) / Alignment * Alignment;
+
+            (*Members)["*ClassSize"] = MemberInfo{.Type = ValueType::Unknown, .Offset = Size};
+
+            return CmplSymbol{.TypeDesc = TypeDescriptor(ValueType::Custom, {}, nullptr), .Class = Members};
+        }
+        else if (auto NewExpr = std::dynamic_pointer_cast<UseExpression>(Expr))
+        {
+            CmplSymbol Type = ResolveSymbol(NewExpr->Type.CustomTypeName);
+            auto Members = Type.Class;
+
+            return CmplSymbol{.TypeDesc = NewExpr->Type, .Class = Members};
+        }
+        else if (auto Cast = std::dynamic_pointer_cast<ClassCastExpression>(Expr))
+        {
+            std::shared_ptr<std::unordered_map<std::string, SymbolResolver::MemberInfo>> Members = nullptr;
+
+            if (Cast->Type.CustomTypeName)
+            {
+                CmplSymbol Type = ResolveSymbol(Cast->Type.CustomTypeName);
+                Members = Type.Class;
+            }
+
+            return CmplSymbol{.TypeDesc = Cast->Type, .Class = Members};
+        }
+        else if (auto SizeOfType = std::dynamic_pointer_cast<SizeOfTypeExpression>(Expr))
+        {
+            return CmplSymbol{.TypeDesc = ValueType::Int};
+        }
+        else if (auto SizeOf = std::dynamic_pointer_cast<SizeOfExpression>(Expr))
+        {
+            return CmplSymbol{.TypeDesc = ValueType::Int};
+        }
+        else if (auto Bin = std::dynamic_pointer_cast<BinaryExpression>(Expr))
+        {
+            CmplSymbol SymbolA = ResolveSymbol(Bin->A);
+            CmplSymbol SymbolB = ResolveSymbol(Bin->B);
+
+            switch (Bin->Operator)
+            {
+            case OperationType::Add:
+            case OperationType::Subtract:
+            case OperationType::Multiply:
+            case OperationType::Divide:
+                if (IsFloatingType(SymbolA.TypeDesc) || IsFloatingType(SymbolB.TypeDesc))
+                    return CmplSymbol{.TypeDesc = (SymbolA.TypeDesc.Type == ValueType::Double || SymbolB.TypeDesc.Type == ValueType::Double) ? ValueType::Double : ValueType::Float};
+                return CmplSymbol{.TypeDesc = ValueType::Int};
+            case OperationType::LessThan:
+            case OperationType::GreaterThan:
+            case OperationType::LessThanOrEqualTo:
+            case OperationType::GreaterThanOrEqualTo:
+                return CmplSymbol{.TypeDesc = ValueType::Bool};
+            default:
+                break;
+            }
+
+            return GarbageCmplSymbol;
+        }
+
+        else if (auto Un = std::dynamic_pointer_cast<UnaryExpression>(Expr))
+        {
+            CmplSymbol Symbol = ResolveSymbol(Un->Expr);
+
+            switch (Un->Operator)
+            {
+            case OperationType::Add:
+            case OperationType::Subtract:
+                return CmplSymbol{.TypeDesc = IsFloatingType(Symbol.TypeDesc) ? Symbol.TypeDesc.Type : ValueType::Int};
+            case OperationType::ForceUnwrap:
+            {
+                Symbol.TypeDesc.Nullable = false;
+                return Symbol;
+            }
+
+            default:
+                break;
+            }
+
+            return GarbageCmplSymbol;
+        }
+        else if (auto Call = std::dynamic_pointer_cast<CallExpression>(Expr))
+        {
+            CmplSymbol Symbol = ResolveSymbol(Call->Callee);
+
+            if (Symbol.Funcs)
+            {
+                auto Func = CalculateBestOverload(Symbol.Funcs, Call, false);
+                if (!Func)
+                    return GarbageCmplSymbol;
+
+                if (Func->ReturnType.CustomTypeName)
+                {
+                    return CmplSymbol{.TypeDesc = Func->ReturnType, .Class = ResolveSymbol(Func->ReturnType.CustomTypeName).Class};
+                }
+                return CmplSymbol{.TypeDesc = Func->ReturnType};
+            }
+
+            return GarbageCmplSymbol;
+        }
+        else if (auto UnownedReference = std::dynamic_pointer_cast<UnownedReferenceExpression>(Expr))
+        {
+            return ResolveSymbol(UnownedReference->Expr);
+        }
+
+        // if (Expr)
+        //     Throw(CompileError("resolve symbol: failed (not implemented)", Error));
+        return GarbageCmplSymbol;
+    }
+
+
+    /*
+     * function signature generator
+     * with mangled names that are
+     * easier to understand when debugging
+     */
+    std::string MangleFunctionSignature(const FunctionDefinition &Func, std::string OptionalFuncName = "function")
+    {
+        if (FunctionSignatureCache.count(Func.UniqueId))
+        {
+            FunctionSignatureCache.at(Func.UniqueId).second++;
+            return FunctionSignatureCache.at(Func.UniqueId).first;
+        }
+
+        std::replace(OptionalFuncName.begin(), OptionalFuncName.end(), '-', '_');
+
+        // C knows it by its plain name
+        if (Func.CLinkage)
+        {
+            FunctionSignatureCache[Func.UniqueId] = std::make_pair(OptionalFuncName, 0);
+            return OptionalFuncName;
+        }
+
+        std::string Result = "f" + (std::to_string(Func.UniqueId)).substr(0, 5) + "_" + OptionalFuncName + "_" + std::string(magic_enum::enum_name(Func.ReturnType.Type));
+
+        if (Func.ReturnType.Nullable && Func.ReturnType.Type != ValueType::Null)
+            Result += "N";
+        if (!Func.ReturnType.Constant)
+            Result += "M";
+        for (size_t i = 0; i < Func.ReturnType.PointerDepth; i++)
+            Result += "P";
+
+        for (auto &&Param : Func.Arguments)
+        {
+            Result += std::string(magic_enum::enum_name(Param.Type.Type));
+
+            if (Param.Type.Nullable && Func.ReturnType.Type != ValueType::Null)
+                Result += "N";
+            if (!Param.Type.Constant)
+                Result += "M";
+            for (size_t i = 0; i < Func.ReturnType.PointerDepth; i++)
+                Result += "P";
+        }
+
+        FunctionSignatureCache[Func.UniqueId] = std::make_pair(Result, 0);
+
+        return Result;
+    }
+
+    std::shared_ptr<FunctionDefinition> CalculateBestOverload(std::shared_ptr<std::vector<std::shared_ptr<FunctionDefinition>>> Funcs, std::shared_ptr<CallExpression> Call, const bool Throws = false)
+    {
+        std::shared_ptr<FunctionDefinition> Best = nullptr;
+
+        // Try strictest → loosest
+        for (int Looseness = 0; Looseness <= 4; Looseness++)
+        {
+            std::shared_ptr<FunctionDefinition> Match = nullptr;
+
+            for (auto &Func : *Funcs)
+            {
+                // Arg count mismatch → skip early
+                if (Func->Arguments.size() != Call->Arguments.size())
+                    continue;
+
+                bool AllParamsMatch = true;
+
+                for (size_t i = 0; i < Func->Arguments.size(); ++i)
+                {
+                    auto CallType = ResolveSymbol(Call->Arguments[i]).TypeDesc;
+                    auto ParamType = Func->Arguments[i].Type;
+
+                    if (!CompileTypeMatch(CallType, ParamType, Looseness))
+                    {
+                        AllParamsMatch = false;
+                        break;
+                    }
+                }
+
+                if (!AllParamsMatch)
+                    continue;
+
+                // First match at this looseness
+                if (!Match)
+                {
+                    Match = Func;
+                }
+                else
+                {
+                    // Second match → ambiguous
+                    if (Throws)
+                        Throw(CompileError("ambiguous call of overloaded function " + MangleFunctionSignature(*Match), Fatal));
+                    return nullptr;
+                }
+            }
+
+            // If we found a valid match at this looseness → return it
+            if (Match)
+                return Match;
+        }
+
+        // No overloads matched at any looseness
+        if (Throws)
+            Throw(CompileError("no overload of the function matches", Error));
+        return nullptr;
+    }
+};
@@ -128,7 +128,7 @@ struct Token
         : Type(type), Text(std::move(text)), Location(location) {}
 };
 
-bool operator!(Token Tok)
+inline bool operator!(Token Tok)
 {
     return Tok.Type == TT_NULL;
 }